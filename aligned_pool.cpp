@@ -0,0 +1,103 @@
+// ==========================================================================
+// $Id: aligned_pool.cpp $
+// Pool of 64-byte aligned blocks for instance arrays
+// ==========================================================================
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "aligned_pool.h"
+
+namespace CSI4130 {
+
+namespace {
+void* systemAllocate( size_t _bytes ) {
+#ifdef _WIN32
+  void* block = _aligned_malloc(_bytes, AlignedPool::ALIGNMENT);
+#else
+  void* block = 0;
+  if ( posix_memalign(&block, AlignedPool::ALIGNMENT, _bytes) != 0 ) block = 0;
+#endif
+  if ( !block ) throw std::bad_alloc();
+  return block;
+}
+
+void systemRelease( void* _block ) {
+#ifdef _WIN32
+  _aligned_free(_block);
+#else
+  free(_block);
+#endif
+  return;
+}
+}
+
+
+AlignedPool::AlignedPool() : d_systemBytes(0), d_nSystem(0), d_nReused(0) {}
+
+
+AlignedPool::~AlignedPool() {
+  trim();
+}
+
+
+AlignedPool& AlignedPool::global() {
+  static AlignedPool s_pool;
+  return s_pool;
+}
+
+
+int AlignedPool::sizeClass( size_t _bytes ) {
+  int c = 0;
+  while ( (ALIGNMENT << c) < _bytes ) ++c;
+  return c;
+}
+
+
+void* AlignedPool::allocate( size_t _bytes, size_t& _capacity ) {
+  int c = sizeClass(_bytes);
+  _capacity = ALIGNMENT << c;
+  {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    if ( c < NUM_CLASSES && !d_free[c].empty() ) {
+      void* block = d_free[c].back();
+      d_free[c].pop_back();
+      ++d_nReused;
+      return block;
+    }
+    ++d_nSystem;
+    d_systemBytes += _capacity;
+  }
+  return systemAllocate(_capacity);
+}
+
+
+void AlignedPool::release( void* _block, size_t _capacity ) {
+  if ( !_block ) return;
+  int c = sizeClass(_capacity);
+  std::lock_guard<std::mutex> lock(d_mutex);
+  if ( c < NUM_CLASSES ) {
+    d_free[c].push_back(_block);
+  } else {
+    d_systemBytes -= _capacity;
+    systemRelease(_block);
+  }
+  return;
+}
+
+
+void AlignedPool::trim() {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  for ( int c=0; c<NUM_CLASSES; ++c ) {
+    for ( size_t b=0; b<d_free[c].size(); ++b ) {
+      systemRelease(d_free[c][b]);
+      d_systemBytes -= ALIGNMENT << c;
+    }
+    d_free[c].clear();
+  }
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,74 @@
+// ==========================================================================
+// $Id: aligned_pool.h $
+// Pool of 64-byte aligned blocks for instance arrays
+// ==========================================================================
+// Blocks come in power-of-two sizes from 64 bytes up and start on a cache
+// line, so SIMD loads and the jobs splitting an array never share a line
+// at the start. A released block goes onto the free list of its size and
+// is handed out again before new memory is taken from the system; arrays
+// which grow and shrink interactively therefore settle on a few blocks.
+// ==========================================================================
+#ifndef CSI4130_ALIGNED_POOL_H_
+#define CSI4130_ALIGNED_POOL_H_
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace CSI4130 {
+
+class AlignedPool {
+ public:
+  static const size_t ALIGNMENT = 64;
+
+ private:
+  // free blocks of 64 << c bytes
+  static const int NUM_CLASSES = 40;
+  std::vector<void*> d_free[NUM_CLASSES];
+  std::mutex d_mutex;
+  // statistics
+  size_t d_systemBytes;
+  long long d_nSystem;
+  long long d_nReused;
+
+ public:
+  AlignedPool();
+  ~AlignedPool();
+
+  static AlignedPool& global();
+
+  // At least _bytes; the usable size, a power of two, is returned in
+  // _capacity
+  void* allocate( size_t _bytes, size_t& _capacity );
+  // _capacity as returned by allocate()
+  void release( void* _block, size_t _capacity );
+  // Return all free blocks to the system
+  void trim();
+
+  inline size_t getSystemBytes() const;
+  inline long long getNSystem() const;
+  inline long long getNReused() const;
+
+ private:
+  static int sizeClass( size_t _bytes );
+
+  // no copy or assignment
+  AlignedPool(const AlignedPool& _oPool );
+  AlignedPool& operator=( const AlignedPool& _oPool );
+};
+
+
+size_t AlignedPool::getSystemBytes() const {
+  return d_systemBytes;
+}
+
+long long AlignedPool::getNSystem() const {
+  return d_nSystem;
+}
+
+long long AlignedPool::getNReused() const {
+  return d_nReused;
+}
+
+} // end namespace
+#endif
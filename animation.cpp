@@ -0,0 +1,262 @@
+// ==========================================================================
+// $Id: animation.cpp $
+// Per-frame animation of the instance transforms
+// ==========================================================================
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GLM_ENABLE_EXPERIMENTAL
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "animation.h"
+
+namespace CSI4130 {
+
+namespace {
+
+const float c_pi = 3.14159265f;
+const float c_twoPi = 6.28318531f;
+// instances per job, a multiple of 4
+const int c_grain = 4096;
+
+// x - 2 pi k with the result in [-pi,pi]
+inline float wrapAngle( float _x ) {
+  return _x - c_twoPi * std::nearbyint(_x * (1.0f / c_twoPi));
+}
+
+// sin for _x in [-pi,pi]: sin(pi-x) = sin(x) folds onto [-pi/2,pi/2]
+// where a Taylor polynomial of degree 11 is good to 1e-7
+inline float sinFolded( float _x ) {
+  _x = std::min(_x, c_pi - _x);
+  _x = std::max(_x, -c_pi - _x);
+  float x2 = _x * _x;
+  return _x * (1.0f + x2 * (-1.0f/6.0f + x2 * (1.0f/120.0f +
+    x2 * (-1.0f/5040.0f + x2 * (1.0f/362880.0f + x2 * (-1.0f/39916800.0f))))));
+}
+
+#ifdef __SSE2__
+// Same as above for 4 angles
+inline __m128 wrapAngle4( __m128 _x ) {
+  __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(
+    _mm_mul_ps(_x, _mm_set1_ps(1.0f / c_twoPi))));
+  return _mm_sub_ps(_x, _mm_mul_ps(k, _mm_set1_ps(c_twoPi)));
+}
+
+inline __m128 sinFolded4( __m128 _x ) {
+  const __m128 pi = _mm_set1_ps(c_pi);
+  _x = _mm_min_ps(_x, _mm_sub_ps(pi, _x));
+  _x = _mm_max_ps(_x, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(pi, _x)));
+  __m128 x2 = _mm_mul_ps(_x, _x);
+  __m128 p = _mm_set1_ps(-1.0f/39916800.0f);
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f/362880.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.0f/5040.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f/120.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.0f/6.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+  return _mm_mul_ps(_x, p);
+}
+
+// Store column _col of the matrices of 4 consecutive instances; lane k
+// of _x, _y, _z, _w belongs to instance k
+inline void storeColumn4( float* _m, int _col, __m128 _x, __m128 _y,
+			  __m128 _z, __m128 _w ) {
+  _MM_TRANSPOSE4_PS(_x, _y, _z, _w);
+  _mm_storeu_ps(_m + _col * 4, _x);
+  _mm_storeu_ps(_m + 16 + _col * 4, _y);
+  _mm_storeu_ps(_m + 32 + _col * 4, _z);
+  _mm_storeu_ps(_m + 48 + _col * 4, _w);
+  return;
+}
+#endif
+
+}
+
+
+const char* animationName( AnimationMode _mode ) {
+  switch (_mode) {
+  case ANIMATION_OFF: return "off";
+  case ANIMATION_SPIN: return "spin";
+  case ANIMATION_ORBIT: return "orbit";
+  default: return "unknown";
+  }
+}
+
+
+InstanceAnimation::InstanceAnimation() : d_mode(ANIMATION_OFF),
+					 d_nInstances(0), d_front(0),
+					 d_jobs(0) {
+}
+
+
+InstanceAnimation::~InstanceAnimation() {
+  // the job system may already be destroyed, e.g., for a global at exit;
+  // the owner ends the update
+  assert( !d_jobs );
+}
+
+
+void InstanceAnimation::init( const Attributes& _attrib, int _first ) {
+  endUpdate();
+  int n = _attrib.getAttribNTransforms();
+  int first = std::min(_first, std::min(d_nInstances, n));
+  d_nInstances = n;
+  d_axisX.resize(n); d_axisY.resize(n); d_axisZ.resize(n);
+  d_angle.resize(n);
+  d_omega.resize(n);
+  d_offsetX.resize(n); d_offsetY.resize(n); d_offsetZ.resize(n);
+  d_posX.resize(n); d_posY.resize(n); d_posZ.resize(n);
+  d_tfms[0].resize(n);
+  d_tfms[1].resize(n);
+  if ( first == 0 ) d_front = 0;
+  glm::mat4* front = d_tfms[d_front].data();
+  unsigned seed = _attrib.getSeed();
+  const glm::mat4* tfms = _attrib.d_tfms;
+  JobSystem::global().parallelFor(first, n, c_grain, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	// rigid transforms from any source, e.g., a scene file: the
+	// rotation R and the position p = R offset
+	glm::mat3 rot(tfms[i]);
+	glm::vec3 axis;
+	float angle;
+	Attributes::rotationAxisAngle(rot, axis, angle);
+	glm::vec3 pos(tfms[i][3]);
+	glm::vec3 offset = glm::transpose(rot) * pos;
+	d_axisX[i] = axis.x; d_axisY[i] = axis.y; d_axisZ[i] = axis.z;
+	d_angle[i] = angle;
+	d_offsetX[i] = offset.x; d_offsetY[i] = offset.y; d_offsetZ[i] = offset.z;
+	// separate stream of the same seed: 0.2 .. 1 half turns per second
+	// in either direction
+	float speed = c_pi * (0.2f + 0.8f *
+			      Attributes::randomUnit(seed ^ 0x9e3779b9U, i, 0));
+	d_omega[i] = Attributes::randomUnit(seed ^ 0x9e3779b9U, i, 1) < 0.5f ?
+	  -speed : speed;
+	// a spinning instance stays where it was placed
+	d_posX[i] = pos.x; d_posY[i] = pos.y; d_posZ[i] = pos.z;
+      }
+      updateRange(_begin, _end, 0.0f, front);
+    });
+  // the back buffer is rewritten by the next update
+  std::copy(d_tfms[d_front].begin() + first, d_tfms[d_front].end(),
+	    d_tfms[1 - d_front].begin() + first);
+  return;
+}
+
+
+void InstanceAnimation::beginUpdate( float _dt, JobSystem& _jobs ) {
+  endUpdate();
+  d_jobs = &_jobs;
+  glm::mat4* back = d_tfms[1 - d_front].data();
+  for ( int b=0; b<d_nInstances; b+=c_grain ) {
+    int e = std::min(b + c_grain, d_nInstances);
+    _jobs.run([this, b, e, _dt, back]() { updateRange(b, e, _dt, back); },
+	      &d_pending);
+  }
+  return;
+}
+
+
+void InstanceAnimation::endUpdate() {
+  if ( !d_jobs ) return;
+  d_jobs->wait(d_pending);
+  d_jobs = 0;
+  d_front = 1 - d_front;
+  return;
+}
+
+
+void InstanceAnimation::update( float _dt, JobSystem& _jobs ) {
+  beginUpdate(_dt, _jobs);
+  endUpdate();
+  return;
+}
+
+
+// Integrate the angles and build the rotation with Rodrigues' formula
+//   R = cos I + sin [a]x + (1 - cos) a a^T
+// followed by the translation of the mode
+void InstanceAnimation::updateRange( int _begin, int _end, float _dt,
+				     glm::mat4* _tfms ) {
+  bool orbit = d_mode == ANIMATION_ORBIT;
+  int i = _begin;
+#ifdef __SSE2__
+  const __m128 dt = _mm_set1_ps(_dt);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  for ( ; i+4 <= _end; i+=4 ) {
+    __m128 angle = _mm_add_ps(_mm_loadu_ps(&d_angle[i]),
+			      _mm_mul_ps(_mm_loadu_ps(&d_omega[i]), dt));
+    angle = wrapAngle4(angle);
+    _mm_storeu_ps(&d_angle[i], angle);
+    __m128 s = sinFolded4(angle);
+    __m128 c = sinFolded4(wrapAngle4(_mm_add_ps(angle,
+						_mm_set1_ps(0.5f * c_pi))));
+    __m128 t = _mm_sub_ps(one, c);
+    __m128 ax = _mm_loadu_ps(&d_axisX[i]);
+    __m128 ay = _mm_loadu_ps(&d_axisY[i]);
+    __m128 az = _mm_loadu_ps(&d_axisZ[i]);
+    __m128 txy = _mm_mul_ps(_mm_mul_ps(t, ax), ay);
+    __m128 txz = _mm_mul_ps(_mm_mul_ps(t, ax), az);
+    __m128 tyz = _mm_mul_ps(_mm_mul_ps(t, ay), az);
+    __m128 sx = _mm_mul_ps(s, ax);
+    __m128 sy = _mm_mul_ps(s, ay);
+    __m128 sz = _mm_mul_ps(s, az);
+    __m128 r00 = _mm_add_ps(c, _mm_mul_ps(_mm_mul_ps(t, ax), ax));
+    __m128 r10 = _mm_add_ps(txy, sz);
+    __m128 r20 = _mm_sub_ps(txz, sy);
+    __m128 r01 = _mm_sub_ps(txy, sz);
+    __m128 r11 = _mm_add_ps(c, _mm_mul_ps(_mm_mul_ps(t, ay), ay));
+    __m128 r21 = _mm_add_ps(tyz, sx);
+    __m128 r02 = _mm_add_ps(txz, sy);
+    __m128 r12 = _mm_sub_ps(tyz, sx);
+    __m128 r22 = _mm_add_ps(c, _mm_mul_ps(_mm_mul_ps(t, az), az));
+    __m128 px, py, pz;
+    if ( orbit ) {
+      __m128 ox = _mm_loadu_ps(&d_offsetX[i]);
+      __m128 oy = _mm_loadu_ps(&d_offsetY[i]);
+      __m128 oz = _mm_loadu_ps(&d_offsetZ[i]);
+      px = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r00, ox), _mm_mul_ps(r01, oy)),
+		      _mm_mul_ps(r02, oz));
+      py = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r10, ox), _mm_mul_ps(r11, oy)),
+		      _mm_mul_ps(r12, oz));
+      pz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r20, ox), _mm_mul_ps(r21, oy)),
+		      _mm_mul_ps(r22, oz));
+    } else {
+      px = _mm_loadu_ps(&d_posX[i]);
+      py = _mm_loadu_ps(&d_posY[i]);
+      pz = _mm_loadu_ps(&d_posZ[i]);
+    }
+    float* m = &_tfms[i][0][0];
+    storeColumn4(m, 0, r00, r10, r20, zero);
+    storeColumn4(m, 1, r01, r11, r21, zero);
+    storeColumn4(m, 2, r02, r12, r22, zero);
+    storeColumn4(m, 3, px, py, pz, one);
+  }
+#endif
+  for ( ; i<_end; ++i ) {
+    float angle = wrapAngle(d_angle[i] + d_omega[i] * _dt);
+    d_angle[i] = angle;
+    float s = sinFolded(angle);
+    float c = sinFolded(wrapAngle(angle + 0.5f * c_pi));
+    float t = 1.0f - c;
+    float ax = d_axisX[i], ay = d_axisY[i], az = d_axisZ[i];
+    glm::mat4& m = _tfms[i];
+    m[0] = glm::vec4(c + t*ax*ax, t*ax*ay + s*az, t*ax*az - s*ay, 0.0f);
+    m[1] = glm::vec4(t*ax*ay - s*az, c + t*ay*ay, t*ay*az + s*ax, 0.0f);
+    m[2] = glm::vec4(t*ax*az + s*ay, t*ay*az - s*ax, c + t*az*az, 0.0f);
+    if ( orbit ) {
+      glm::vec3 offset(d_offsetX[i], d_offsetY[i], d_offsetZ[i]);
+      m[3] = glm::vec4(glm::mat3(m) * offset, 1.0f);
+    } else {
+      m[3] = glm::vec4(d_posX[i], d_posY[i], d_posZ[i], 1.0f);
+    }
+  }
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,102 @@
+// ==========================================================================
+// $Id: animation.h $
+// Per-frame animation of the instance transforms
+// ==========================================================================
+// Every instance keeps its rotation axis, angle, angular velocity and
+// offset in separate arrays (structure of arrays). An update integrates
+// the angles and rebuilds all model matrices, four instances at a time
+// with SSE2, in parallel jobs which write into the back buffer. The
+// buffers are swapped once the jobs are done, so the front buffer can be
+// uploaded while the next update is running.
+//
+// The state is taken from the rigid transforms of Attributes, so at time
+// 0 the matrices equal the static ones.
+// ==========================================================================
+#ifndef CSI4130_ANIMATION_H_
+#define CSI4130_ANIMATION_H_
+
+#include <vector>
+
+// glm types
+#include <glm/glm.hpp>
+
+#include "attributes.h"
+#include "job_system.h"
+
+namespace CSI4130 {
+
+enum AnimationMode {
+  ANIMATION_OFF = 0,
+  ANIMATION_SPIN, // rotate about the own axis in place
+  ANIMATION_ORBIT, // rotate the offset about the axis through the origin
+  ANIMATION_NUM_MODES
+};
+
+const char* animationName( AnimationMode _mode );
+
+
+class InstanceAnimation {
+  AnimationMode d_mode;
+  int d_nInstances;
+  // state, one entry per instance
+  std::vector<float> d_axisX, d_axisY, d_axisZ;
+  std::vector<float> d_angle; // kept in [-pi,pi]
+  std::vector<float> d_omega; // radians per second
+  std::vector<float> d_offsetX, d_offsetY, d_offsetZ;
+  std::vector<float> d_posX, d_posY, d_posZ; // placed position
+  // model matrices
+  std::vector<glm::mat4> d_tfms[2];
+  int d_front;
+  JobCounter d_pending;
+  JobSystem* d_jobs;
+
+ public:
+  InstanceAnimation();
+  // an update must be ended before
+  ~InstanceAnimation();
+
+  // Take the placement of the transforms of _attrib; instances below
+  // _first keep their state, e.g., after the count grew
+  void init( const Attributes& _attrib, int _first = 0 );
+  inline void setMode( AnimationMode _mode );
+  inline AnimationMode getMode() const;
+  inline int getNInstances() const;
+
+  // Advance by _dt seconds. The matrices are rebuilt by jobs of _jobs
+  // which write to the back buffer; endUpdate() waits for them and swaps.
+  void beginUpdate( float _dt, JobSystem& _jobs = JobSystem::global() );
+  void endUpdate();
+  // Same as beginUpdate() followed by endUpdate()
+  void update( float _dt, JobSystem& _jobs = JobSystem::global() );
+
+  // Front buffer, valid until the next endUpdate()
+  inline const glm::mat4* getTransforms() const;
+
+ private:
+  void updateRange( int _begin, int _end, float _dt, glm::mat4* _tfms );
+
+  // no copy or assignment
+  InstanceAnimation(const InstanceAnimation& _oAnimation );
+  InstanceAnimation& operator=( const InstanceAnimation& _oAnimation );
+};
+
+
+void InstanceAnimation::setMode( AnimationMode _mode ) {
+  d_mode = _mode;
+  return;
+}
+
+AnimationMode InstanceAnimation::getMode() const {
+  return d_mode;
+}
+
+int InstanceAnimation::getNInstances() const {
+  return d_nInstances;
+}
+
+const glm::mat4* InstanceAnimation::getTransforms() const {
+  return d_tfms[d_front].data();
+}
+
+} // end namespace
+#endif
@@ -20,6 +20,8 @@
 //
 //
 // ==========================================================================
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #define _USE_MATH_DEFINES
@@ -29,47 +31,94 @@
 #include<math.h>
 
 #include "attributes.h"
+#include "job_system.h"
 // matrix manipulation
 #define GLM_FORCE_RADIANS
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 
-void Attributes::createColors() {
-  // create a jet color map
+void Attributes::reserveColors( int _n ) {
+  size_t bytes = sizeof(glm::vec4) * _n;
+  if ( bytes <= d_colorBytes ) return;
+  // colors are regenerated, nothing to copy
+  CSI4130::AlignedPool& pool = CSI4130::AlignedPool::global();
+  pool.release(d_colors, d_colorBytes);
+  d_colors = static_cast<glm::vec4*>
+    (pool.allocate(std::max(bytes, d_colorBytes + d_colorBytes / 2),
+		   d_colorBytes));
+  return;
+}
 
-  int step = d_nColors/4;
-  int step2 = step/2;
 
-  for (int i = 0; i < step2; ++i ) {
-    d_colors[i].r = 0.0f;
-    d_colors[i].g = 0.0f;
-    d_colors[i].b = 0.5f + (i*0.5f)/step2;
-    d_colors[i].a = 1.0f;
-  }
-  for (int i = step2; i < step+step2; ++i ) {
-    d_colors[i].r = 0.0f;
-    d_colors[i].g = static_cast<float>(i-step2)/step;
-    d_colors[i].b = 1.0f;
-    d_colors[i].a = 1.0f;
-  }
-  for (int i = step+step2; i<2*step+step2; ++i ) {
-    d_colors[i].r = static_cast<float>(i-step-step2)/step;
-    d_colors[i].g = 1.0f;
-    d_colors[i].b = static_cast<float>(2*step+step2-i)/step;
-    d_colors[i].a = 1.0f;
-  }
-  for (int i = 2*step+step2; i<3*step+step2; ++i ) {
-    d_colors[i].r = 1.0f;
-    d_colors[i].g = static_cast<float>(3*step+step2-i)/step;
-    d_colors[i].b = 0.0f;
-    d_colors[i].a = 1.0f;
+void Attributes::reserveTransforms( int _n, int _keep ) {
+  size_t bytes = sizeof(glm::mat4) * _n;
+  if ( bytes <= d_tfmBytes ) return;
+  CSI4130::AlignedPool& pool = CSI4130::AlignedPool::global();
+  size_t capacity;
+  glm::mat4* tfms = static_cast<glm::mat4*>
+    (pool.allocate(std::max(bytes, d_tfmBytes + d_tfmBytes / 2), capacity));
+  if ( _keep > 0 ) memcpy(tfms, d_tfms, sizeof(glm::mat4) * _keep);
+  pool.release(d_tfms, d_tfmBytes);
+  d_tfms = tfms;
+  d_tfmBytes = capacity;
+  return;
+}
+
+
+void Attributes::updateTransforms( int _nTfms, glm::vec3 _minP,
+				   glm::vec3 _maxP ) {
+  glm::vec3 volume = _maxP - _minP;
+  if ( volume != d_volume ) {
+    d_volume = volume;
+    d_nGenerated = 0;
   }
-  for (int i = 3*step+step2; i<d_nColors; ++i ) {
-    d_colors[i].r = static_cast<float>(d_nColors-i)/step + 0.5f;
-    d_colors[i].g = 0.0f;
-    d_colors[i].b = 0.0f;
-    d_colors[i].a = 1.0f;
+  // generated transforms survive shrinking
+  int keep = std::min(d_nGenerated, _nTfms);
+  reserveTransforms(_nTfms, keep);
+  d_nTfms = _nTfms;
+  createTransforms(keep, d_nTfms);
+  d_nGenerated = std::max(d_nGenerated, d_nTfms);
+  return;
+}
+
+
+void Attributes::resizeTransforms( int _nTfms ) {
+  int keep = std::min(d_nTfms, _nTfms);
+  glm::mat4* old = d_tfms;
+  reserveTransforms(_nTfms, keep);
+  // generated ones beyond keep may still be there unless moved
+  if ( d_tfms != old ) d_nGenerated = std::min(d_nGenerated, keep);
+  int first = std::max(keep, std::min(d_nGenerated, _nTfms));
+  createTransforms(first, _nTfms);
+  if ( d_nGenerated >= keep ) {
+    d_nGenerated = std::max(d_nGenerated, _nTfms);
   }
+  d_nTfms = _nTfms;
+  return;
+}
+
+
+glm::mat4* Attributes::allocateTransforms( int _nTfms ) {
+  reserveTransforms(_nTfms, 0);
+  d_nTfms = _nTfms;
+  d_nGenerated = 0;
+  return d_tfms;
+}
+
+
+void Attributes::updateColors( int _nColors ) {
+  if ( _nColors == d_nColors && d_colors ) return;
+  reserveColors(_nColors);
+  d_nColors = _nColors;
+  createColors();
+  return;
+}
+
+
+void Attributes::createColors() {
+  // every color only depends on its index
+  CSI4130::JobSystem::global().parallelFor(0, d_nColors, 1 << 16,
+    [this](int _begin, int _end) { createColorRange(_begin, _end); });
   /*
   for (int i = 0; i < d_nColors; ++i ) {
     std::cerr << i << " [" << d_colors[i].r
@@ -80,28 +129,118 @@ void Attributes::createColors() {
   return;
 }
 
-void Attributes::createTransforms(glm::vec3 _minP, glm::vec3 _maxP) {
-  glm::vec3 volume = _maxP - _minP;
-  for (int i=0; i<d_nTfms; ++i) {
-    glm::vec3 randVec;
-    float len2;
-    // make a unit vector
-    do {
-      randVec = glm::vec3(2.0f*randomUnit()-1.0f,
-			  2.0f*randomUnit()-1.0f,
-			  2.0f*randomUnit()-1.0f);
-      len2 = glm::dot(randVec,randVec); 
-    } while ( len2 > 1.0f );
-    // Now normalize
-    randVec *= 1.0f/sqrt(len2);
-    // random angle -pi .. pi
-    float angle = static_cast<float>(M_PI * ( 2.0 * randomUnit() -  1.0 ));
-    d_tfms[i] = glm::rotate( angle, randVec );
-    // Add a random vector scaled upto the viewing volume
-    randVec.x = (randomUnit()-0.5f) * volume.x;
-    randVec.y = (randomUnit()-0.5f) * volume.y;
-    randVec.z = (randomUnit()-0.5f) * volume.z;
-    d_tfms[i] = glm::translate( d_tfms[i], randVec );
+void Attributes::createColorRange(int _begin, int _end) {
+  // create a jet color map
+
+  int step = d_nColors/4;
+  int step2 = step/2;
+
+  for (int i = _begin; i < _end; ++i ) {
+    if ( i < step2 ) {
+      d_colors[i].r = 0.0f;
+      d_colors[i].g = 0.0f;
+      d_colors[i].b = 0.5f + (i*0.5f)/step2;
+    } else if ( i < step+step2 ) {
+      d_colors[i].r = 0.0f;
+      d_colors[i].g = static_cast<float>(i-step2)/step;
+      d_colors[i].b = 1.0f;
+    } else if ( i < 2*step+step2 ) {
+      d_colors[i].r = static_cast<float>(i-step-step2)/step;
+      d_colors[i].g = 1.0f;
+      d_colors[i].b = static_cast<float>(2*step+step2-i)/step;
+    } else if ( i < 3*step+step2 ) {
+      d_colors[i].r = 1.0f;
+      d_colors[i].g = static_cast<float>(3*step+step2-i)/step;
+      d_colors[i].b = 0.0f;
+    } else {
+      d_colors[i].r = static_cast<float>(d_nColors-i)/step + 0.5f;
+      d_colors[i].g = 0.0f;
+      d_colors[i].b = 0.0f;
+    }
+    d_colors[i].a = 1.0f;
+  }
+  return;
+}
+
+void Attributes::createTransforms( int _begin, int _end ) {
+  glm::vec3 volume = d_volume;
+  CSI4130::JobSystem::global().parallelFor(_begin, _end, 1 << 14,
+    [this, volume](int _begin, int _end) {
+      createTransformRange(_begin, _end, volume); });
+  return;
+}
+
+void Attributes::createTransformRange(int _begin, int _end,
+				      glm::vec3 _volume) {
+  for (int i=_begin; i<_end; ++i) {
+    glm::vec3 axis, offset;
+    float angle;
+    randomPlacement(d_seed, i, _volume, axis, angle, offset);
+    d_tfms[i] = glm::rotate( angle, axis );
+    d_tfms[i] = glm::translate( d_tfms[i], offset );
+  }
+  return;
+}
+
+void Attributes::randomPlacement( unsigned _seed, int _instance,
+				  glm::vec3 _volume, glm::vec3& _axis,
+				  float& _angle, glm::vec3& _offset ) {
+  glm::vec3 randVec;
+  float len2;
+  unsigned draw = 0;
+  // make a unit vector
+  do {
+    randVec = glm::vec3(2.0f*randomUnit(_seed, _instance, draw)-1.0f,
+			2.0f*randomUnit(_seed, _instance, draw+1)-1.0f,
+			2.0f*randomUnit(_seed, _instance, draw+2)-1.0f);
+    draw += 3;
+    len2 = glm::dot(randVec,randVec); 
+  } while (( len2 > 1.0f || len2 == 0.0f ) && draw < 60 );
+  // Now normalize
+  _axis = randVec * (1.0f/sqrt(len2));
+  // random angle -pi .. pi
+  _angle = static_cast<float>(M_PI * ( 2.0 * randomUnit(_seed, _instance, 60) -  1.0 ));
+  // Add a random vector scaled upto the viewing volume
+  _offset.x = (randomUnit(_seed, _instance, 61)-0.5f) * _volume.x;
+  _offset.y = (randomUnit(_seed, _instance, 62)-0.5f) * _volume.y;
+  _offset.z = (randomUnit(_seed, _instance, 63)-0.5f) * _volume.z;
+  return;
+}
+
+
+void Attributes::rotationAxisAngle( const glm::mat3& _rot, glm::vec3& _axis,
+				    float& _angle ) {
+  float c = 0.5f * (_rot[0][0] + _rot[1][1] + _rot[2][2] - 1.0f);
+  c = std::max(-1.0f, std::min(1.0f, c));
+  // 2 sin(angle) axis from the antisymmetric part (column major)
+  glm::vec3 v(_rot[1][2] - _rot[2][1], _rot[2][0] - _rot[0][2],
+	      _rot[0][1] - _rot[1][0]);
+  float len = glm::length(v);
+  // acos alone is inaccurate close to a half turn
+  _angle = std::atan2(0.5f * len, c);
+  if ( c >= 0.0f ) {
+    if ( len > 0.0f ) {
+      _axis = v * (1.0f / len);
+    } else {
+      // no rotation, any axis
+      _axis = glm::vec3(1.0f, 0.0f, 0.0f);
+      _angle = 0.0f;
+    }
+    return;
+  }
+  // beyond a quarter turn sin gets small but the symmetric part
+  // (R + R^T)/2 = c I + (1 - c) a a^T is well conditioned; the largest
+  // diagonal entry gives the most accurate component
+  int k = 0;
+  if ( _rot[1][1] > _rot[k][k] ) k = 1;
+  if ( _rot[2][2] > _rot[k][k] ) k = 2;
+  float t = 1.0f - c;
+  float ak = std::sqrt(std::max(0.0f, (_rot[k][k] - c) / t));
+  for ( int j=0; j<3; ++j ) {
+    _axis[j] = j == k ? ak : 0.5f * (_rot[k][j] + _rot[j][k]) / (t * ak);
   }
+  // the antisymmetric part has the sign of the axis
+  if ( glm::dot(_axis, v) < 0.0f ) _axis = -_axis;
+  _axis = glm::normalize(_axis);
   return;
 }
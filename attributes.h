@@ -23,6 +23,7 @@
 #define CSI4130_ATTRIBUTES_H_
 
 #include <cassert>
+#include <cstdint>
 #include <cstdlib> // Needed in windows for rand
 
 // gl types
@@ -36,11 +37,28 @@
 // glm types
 #include <glm/glm.hpp>
 
+#include "aligned_pool.h"
 
+
+// The arrays live in 64-byte aligned blocks of the AlignedPool. A grow
+// asks for half as much again, which the pool rounds up to its next
+// power-of-two size class, so the capacity doubles; shrinking keeps the
+// storage. Transforms only
+// depend on the seed, the volume and their number, so changing the count
+// generates just the transforms which were never generated.
 class Attributes {
  protected:
   int d_nColors;
   int d_nTfms;
+  // allocated bytes of the arrays
+  size_t d_colorBytes;
+  size_t d_tfmBytes;
+  // transforms [0,d_nGenerated) are generated for d_seed and d_volume
+  int d_nGenerated;
+  // seed of the random transforms
+  unsigned d_seed;
+  // extent of the volume the transforms were placed in
+  glm::vec3 d_volume;
 
  public:
   // vertex attributes
@@ -58,17 +76,54 @@ class Attributes {
   inline int getAttribNColors() const;
 
   // Call to change viewing volume
-  inline void updateTransforms( int _nTfms, 
-				glm::vec3 _minP = glm::vec3(-1.0f,-1.0f,-1.0f),
-				glm::vec3 _maxP = glm::vec3( 1.0f, 1.0f, 1.0f));
+  void updateTransforms( int _nTfms, 
+			 glm::vec3 _minP = glm::vec3(-1.0f,-1.0f,-1.0f),
+			 glm::vec3 _maxP = glm::vec3( 1.0f, 1.0f, 1.0f));
+  // Change the number of transforms keeping the first ones, whatever
+  // their source; new ones are generated in the current volume
+  void resizeTransforms( int _nTfms );
   
-  inline void updateColors( int _nColors );
+  // The color map depends on the count; same count, same colors
+  void updateColors( int _nColors );
+
+  // Room for _nTfms transforms which the caller fills, e.g., a scene
+  // loader; the contents are undefined
+  glm::mat4* allocateTransforms( int _nTfms );
+  // Extent of a volume about the origin which holds all transforms
+  inline void setVolume( glm::vec3 _volume );
+
+  // Transforms only depend on the seed and the instance number, not on
+  // the number of threads generating them
+  inline void setSeed( unsigned _seed );
+  inline unsigned getSeed() const;
+  inline glm::vec3 getVolume() const;
+
+  // Uniform random number in [0,1) for draw _draw of instance _instance
+  static inline float randomUnit( unsigned _seed, unsigned _instance,
+				  unsigned _draw );
+
+  // Random placement of instance _instance: the transform is
+  // rotate(_angle, _axis) * translate(_offset)
+  static void randomPlacement( unsigned _seed, int _instance,
+			       glm::vec3 _volume, glm::vec3& _axis,
+			       float& _angle, glm::vec3& _offset );
+
+  // Axis and angle in [0,pi] of the rotation _rot
+  static void rotationAxisAngle( const glm::mat3& _rot, glm::vec3& _axis,
+				 float& _angle );
 
  private:
+  // room for _n elements, the first _keep are copied on growth
+  void reserveColors( int _n );
+  void reserveTransforms( int _n, int _keep );
   void createColors();
-  void createTransforms(glm::vec3 _minP, glm::vec3 _maxP);
+  // transforms [_begin,_end)
+  void createTransforms( int _begin, int _end );
+  // work of one job
+  void createColorRange(int _begin, int _end);
+  void createTransformRange(int _begin, int _end, glm::vec3 _volume);
 
-  static inline float randomUnit();
+  static inline unsigned hash( unsigned _x );
 	
   // no copy or assignment
   Attributes(const Attributes& _oAttributes );
@@ -77,17 +132,16 @@ class Attributes {
 
 Attributes::Attributes( int _nColors, int _nTfms,
 		    glm::vec3 _minP, glm::vec3 _maxP ) : 
-d_nColors(_nColors), d_nTfms(_nTfms) {
-  d_colors = new glm::vec4[d_nColors];
-  createColors();
-  d_tfms = new glm::mat4[d_nTfms];
-  createTransforms(_minP,_maxP);
+d_nColors(0), d_nTfms(0), d_colorBytes(0), d_tfmBytes(0), d_nGenerated(0),
+d_seed(1), d_volume(_maxP - _minP), d_colors(0), d_tfms(0) {
+  updateColors(_nColors);
+  updateTransforms(_nTfms, _minP, _maxP);
 }
 
 
 Attributes::~Attributes() {
-  delete[] d_colors;
-  delete[] d_tfms;
+  CSI4130::AlignedPool::global().release(d_colors, d_colorBytes);
+  CSI4130::AlignedPool::global().release(d_tfms, d_tfmBytes);
 }
 
 int Attributes::getAttribNColors() const {
@@ -98,27 +152,44 @@ int Attributes::getAttribNTransforms() const {
   return d_nTfms;
 }
 
-inline void Attributes::updateTransforms( int _nTfms, 
-	  glm::vec3 _minP, glm::vec3 _maxP ) { 
-	if ( d_nTfms != _nTfms ) {
-		delete[] d_tfms;
-		d_nTfms = _nTfms;
-	  d_tfms = new glm::mat4[d_nTfms];	
-	}
-  createTransforms(_minP,_maxP);
+inline void Attributes::setVolume( glm::vec3 _volume ) {
+  d_volume = _volume;
+  d_nGenerated = 0;
+}
+
+inline void Attributes::setSeed( unsigned _seed ) {
+  d_seed = _seed;
+  d_nGenerated = 0;
+}
+
+inline unsigned Attributes::getSeed() const {
+  return d_seed;
+}
+
+inline glm::vec3 Attributes::getVolume() const {
+  return d_volume;
 }
 
-inline void Attributes::updateColors( int _nColors ) {
-	if ( d_nColors != _nColors ) { 
-		delete[] d_colors;
-		d_nColors = _nColors; 
-	  d_colors = new glm::vec4[d_nColors];
-	}  
-	createColors();
+// Integer hash (lowbias32 by C. Wellons)
+inline unsigned Attributes::hash( unsigned _x ) {
+  _x ^= _x >> 16;
+  _x *= 0x7feb352dU;
+  _x ^= _x >> 15;
+  _x *= 0x846ca68bU;
+  _x ^= _x >> 16;
+  return _x;
 }
 
-inline float Attributes::randomUnit() {
-  return static_cast<float>(rand())/RAND_MAX; 
+inline float Attributes::randomUnit( unsigned _seed, unsigned _instance,
+				     unsigned _draw ) {
+  // 64 bit key, the high word only enters beyond 2^26 instances so the
+  // draws of smaller instance numbers are unchanged
+  uint64_t key = static_cast<uint64_t>(_instance) * 64U + _draw;
+  unsigned inner = hash( static_cast<unsigned>(key) );
+  if ( key >> 32 ) inner = hash( inner ^ static_cast<unsigned>(key >> 32) );
+  unsigned h = hash( _seed ^ inner );
+  // 24 bits are exactly representable in a float
+  return static_cast<float>(h >> 8) * (1.0f / 16777216.0f);
 }
 
 
@@ -0,0 +1,32 @@
+// ==========================================================================
+// $Id: bench_animation.cpp $
+// Per-frame update of animated instance transforms on 1..N threads
+// ==========================================================================
+#include "animation.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchAnimation() {
+  const int nInstances = 1000000;
+  Attributes attrib(12, nInstances, glm::vec3(-10.0f), glm::vec3(10.0f));
+  InstanceAnimation anim;
+  anim.init(attrib);
+  const AnimationMode modes[] = { ANIMATION_SPIN, ANIMATION_ORBIT };
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    for ( int m=0; m<2; ++m ) {
+      anim.setMode(modes[m]);
+      double update = measure([&]() { anim.update(1.0f / 60.0f, jobs); });
+      report("animation", std::string("update ") + animationName(modes[m]),
+	     nInstances, nThreads, update, nInstances);
+    }
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
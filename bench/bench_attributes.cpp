@@ -0,0 +1,40 @@
+// ==========================================================================
+// $Id: bench_attributes.cpp $
+// Generation of instance transforms and colors for 10 to 10M instances
+// ==========================================================================
+#include <glm/glm.hpp>
+
+#include "attributes.h"
+#include "job_system.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchAttributes() {
+  // Attributes generates with the global job system
+  int nThreads = JobSystem::global().getNumThreads();
+  std::vector<long long> counts = sweepCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int n = static_cast<int>(counts[c]);
+    glm::vec3 minP(-10.0f), maxP(10.0f);
+    // the arrays are allocated once, only generation is timed
+    Attributes attrib(n, n, minP, maxP);
+    double tfms = measure([&]() {
+	// a new seed invalidates all transforms
+	attrib.setSeed(attrib.getSeed());
+	attrib.updateTransforms(n, minP, maxP);
+      });
+    report("attributes", "createTransforms", n, nThreads, tfms, n);
+    double colors = measure([&]() {
+	// the colors are only regenerated for a new count
+	attrib.updateColors(0);
+	attrib.updateColors(n);
+      });
+    report("attributes", "createColors", n, nThreads, colors, n);
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
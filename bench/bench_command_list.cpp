@@ -0,0 +1,68 @@
+// ==========================================================================
+// $Id: bench_command_list.cpp $
+// Frame preparation with command lists recorded on 1..N threads
+// ==========================================================================
+#define GLM_ENABLE_EXPERIMENTAL
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "command_list.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+namespace {
+
+// One draw item per object: a model view matrix and an instanced draw,
+// spread over 2 shapes and 8 materials
+void recordItems( CommandList& _list, int _begin, int _end,
+		  const glm::mat4& _view ) {
+  for ( int i=_begin; i<_end; ++i ) {
+    uint64_t key = commandKey(1, 1, 1 + i % 2, i % 8);
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), 0.001f * i,
+				  glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::translate(model, glm::vec3(i % 100, i / 100, 0.0f));
+    glm::mat4 mv = _view * model;
+    _list.uniform(key, 1, 0, glm::value_ptr(mv), 16);
+    _list.drawElementsInstanced(key, GL_TRIANGLE_STRIP, 29,
+				GL_UNSIGNED_SHORT, 0, 1);
+  }
+  return;
+}
+
+}
+
+
+void benchCommandList() {
+  const int nItems = 100000;
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, -10.0f),
+			       glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    std::vector<CommandList> lists(nThreads);
+    CommandQueue queue;
+    double record = measure([&]() {
+	recordParallel(lists, [&](CommandList& _list, int _t) {
+	    _list.clear();
+	    recordItems(_list, nItems * _t / nThreads,
+			nItems * (_t + 1) / nThreads, view);
+	  }, jobs);
+      });
+    double sort = measure([&]() {
+	queue.clear();
+	for ( int t=0; t<nThreads; ++t ) queue.add(lists[t]);
+	queue.sort();
+      });
+    report("commands", "record", nItems, nThreads, record, nItems);
+    report("commands", "merge+sort", nItems, nThreads, sort, 2 * nItems);
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
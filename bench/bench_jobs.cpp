@@ -0,0 +1,51 @@
+// ==========================================================================
+// $Id: bench_jobs.cpp $
+// Job system overhead and parallel_for scaling
+// ==========================================================================
+#include <cmath>
+#include <vector>
+
+#include "job_system.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchJobs() {
+  const int nJobs = 100000;
+  const int nElements = 1 << 22;
+  std::vector<float> data(nElements, 1.0f);
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    // cost of run + execute + wait for an empty job
+    double empty = measure([&]() {
+	JobCounter counter;
+	for ( int j=0; j<nJobs; ++j ) jobs.run([]() {}, &counter);
+	jobs.wait(counter);
+      });
+    report("jobs", "empty job", nJobs, nThreads, empty, nJobs);
+    // jobs released by a dependency
+    double dependent = measure([&]() {
+	JobCounter first, second;
+	for ( int j=0; j<nJobs/2; ++j ) jobs.run([]() {}, &first);
+	for ( int j=0; j<nJobs/2; ++j ) jobs.run([]() {}, &second, &first);
+	jobs.wait(second);
+      });
+    report("jobs", "dependent job", nJobs, nThreads, dependent, nJobs);
+    // compute bound loop
+    double loop = measure([&]() {
+	jobs.parallelFor(0, nElements, 1 << 14, [&](int _begin, int _end) {
+	    for ( int i=_begin; i<_end; ++i ) {
+	      data[i] = std::sqrt(data[i] * 1.0001f + std::sin(0.001f * i));
+	    }
+	  });
+      });
+    report("jobs", "parallel_for", nElements, nThreads, loop, nElements);
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
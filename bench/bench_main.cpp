@@ -0,0 +1,61 @@
+// ==========================================================================
+// $Id: bench_main.cpp $
+// CPU micro-benchmarks of lit_boxes - run without a GL context
+// ==========================================================================
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+
+using namespace CSI4130::bench;
+
+namespace {
+
+struct Suite {
+  const char* d_name;
+  void (*d_run)();
+};
+
+const Suite g_suites[] = {
+  { "commands", benchCommandList },
+  { "jobs", benchJobs },
+  { "animation", benchAnimation },
+  { "sort", benchSort },
+  { "occlusion", benchOcclusion },
+  { "scene", benchScene },
+  { "attributes", benchAttributes },
+  { "shapes", benchShapes },
+  { "materials", benchMaterials },
+  { "simplify", benchSimplify }
+};
+
+}
+
+
+// usage: lit_boxes_bench [--json <file>] [--max-n <n>] [suite ...]
+int main( int argc, char** argv ) {
+  std::string jsonPath;
+  std::vector<std::string> names;
+  for ( int a=1; a<argc; ++a ) {
+    if ( !strcmp(argv[a], "--json") && a+1 < argc ) {
+      jsonPath = argv[++a];
+    } else if ( !strcmp(argv[a], "--max-n") && a+1 < argc ) {
+      setMaxN( atoll(argv[++a]) );
+    } else {
+      names.push_back(argv[a]);
+    }
+  }
+  int nSuites = sizeof(g_suites) / sizeof(Suite);
+  for ( int s=0; s<nSuites; ++s ) {
+    bool run = names.empty();
+    for ( size_t a=0; a<names.size(); ++a ) {
+      if ( names[a] == g_suites[s].d_name ) run = true;
+    }
+    if ( run ) g_suites[s].d_run();
+  }
+  if ( !jsonPath.empty() && writeJson(jsonPath) != 0 ) return 1;
+  return 0;
+}
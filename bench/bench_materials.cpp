@@ -0,0 +1,54 @@
+// ==========================================================================
+// $Id: bench_materials.cpp $
+// Filling the material and light tables and packing materials for the UBO
+// ==========================================================================
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// errorOut used by material.h
+#include "shader.h"
+#include "light.h"
+#include "material.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchMaterials() {
+  // tables of more than 1000000 entries are of no use
+  std::vector<long long> counts = sweepCounts(1000000);
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int n = static_cast<int>(counts[c]);
+    MaterialArray materials;
+    for ( int m=0; m<n; ++m ) {
+      Material mat;
+      mat.d_shininess = static_cast<GLfloat>(m);
+      materials.append(mat);
+    }
+    std::vector<GLfloat> data;
+    double pack = measure([&]() { materials.packStd140(data); });
+    report("materials", "MaterialArray packStd140", n, 1, pack, n);
+    // lights are set uniform by uniform: the CPU work is the table and
+    // the copies the key handlers make
+    LightArray lights;
+    double fill = measure([&]() {
+	lights.clear();
+	for ( int l=0; l<n; ++l ) lights.append(LightSource());
+      });
+    report("materials", "LightArray append", n, 1, fill, n);
+    double update = measure([&]() {
+	for ( int l=0; l<n; ++l ) {
+	  LightSource light = lights.get(l);
+	  light.d_linear_attenuation += 0.0005f;
+	  lights.set(l, light);
+	}
+      });
+    report("materials", "LightArray get/set", n, 1, update, n);
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
@@ -0,0 +1,49 @@
+// ==========================================================================
+// $Id: bench_occlusion.cpp $
+// Software occlusion culling of instances on 1..N threads
+// ==========================================================================
+#include <sstream>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "attributes.h"
+#include "occlusion.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchOcclusion() {
+  const int nInstances = 1000000;
+  // unit boxes in a 40^3 volume seen from the front
+  const float inner = 0.5f, outer = 0.866f;
+  Attributes attrib(12, nInstances, glm::vec3(-20.0f), glm::vec3(20.0f));
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, -41.0f),
+			       glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj = glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 1.0f, 81.0f);
+  const int occluders[] = { 64, 1024, 16384 };
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    for ( int o=0; o<3; ++o ) {
+      OcclusionCuller culler(256, 256, occluders[o]);
+      int nVisible = 0;
+      double cull = measure([&]() {
+	  nVisible = culler.cull(attrib.d_tfms, nInstances, inner, outer,
+				 view, proj, jobs);
+	});
+      std::ostringstream name;
+      name << occluders[o] << " occl, "
+	   << 100 * (nInstances - nVisible) / nInstances << "% hidden";
+      report("occlusion", name.str(), nInstances, nThreads, cull, nInstances);
+    }
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
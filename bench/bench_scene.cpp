@@ -0,0 +1,57 @@
+// ==========================================================================
+// $Id: bench_scene.cpp $
+// Loading text and binary scene files on 1..N threads
+// ==========================================================================
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "attributes.h"
+#include "scene.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchScene() {
+  const int nInstances = 1000000;
+  const char* paths[] = { "bench_scene.txt", "bench_scene.bin" };
+  // one list set in both forms, written once
+  Scene scene;
+  scene.d_materials.resize(4);
+  scene.d_lights.resize(2);
+  Attributes attrib(12, nInstances, glm::vec3(-20.0f), glm::vec3(20.0f));
+  std::vector<GLuint> materials(nInstances);
+  for ( int i=0; i<nInstances; ++i ) materials[i] = i % 4;
+  for ( int f=0; f<2; ++f ) {
+    if ( writeScene(paths[f], scene, attrib.d_tfms, materials.data(),
+		    nInstances, f == 1) != 0 ) return;
+  }
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    for ( int f=0; f<2; ++f ) {
+      long long bytes = 0;
+      double load = measure([&]() {
+	  Scene loaded;
+	  SceneReader reader;
+	  if ( reader.open(paths[f], loaded) == 0 ) {
+	    reader.readInstances(loaded, attrib.d_tfms, materials.data(), jobs);
+	  }
+	  bytes = reader.getBytes();
+	});
+      std::ostringstream name;
+      name << (f == 0 ? "text, " : "binary, ")
+	   << static_cast<int>(bytes / load / (1024.0 * 1024.0)) << " MB/s";
+      report("scene", name.str(), nInstances, nThreads, load, nInstances);
+    }
+  }
+  for ( int f=0; f<2; ++f ) remove(paths[f]);
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
@@ -0,0 +1,136 @@
+// ==========================================================================
+// $Id: bench_shapes.cpp $
+// Shape construction and the indexed accessors of RenderShape
+// ==========================================================================
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include "box_shape.h"
+#include "sphere.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+namespace {
+
+// results of the accessor loops, so they are not optimized away
+volatile float s_sink;
+
+// Sum of _n vertices and indices read through the accessors, cycling
+// through the shape
+template <class S>
+void benchAccessors( const char* _shape ) {
+  S shape;
+  int nVertices = shape.getNPoints() / 3;
+  int nIndices = shape.getNIndices();
+  std::vector<long long> counts = sweepCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    long long n = counts[c];
+    glm::vec3 sum(0.0f);
+    double vertices = measure([&]() {
+	for ( long long i=0, v=0; i<n; ++i ) {
+	  sum += shape.getVertex(v);
+	  if ( ++v == nVertices ) v = 0;
+	}
+      });
+    report("shapes", std::string(_shape) + " getVertex", n, 1, vertices, n);
+    long long indices = 0;
+    double index = measure([&]() {
+	for ( long long i=0, v=0; i<n; ++i ) {
+	  indices += shape.getIndex(v);
+	  if ( ++v == nIndices ) v = 0;
+	}
+      });
+    report("shapes", std::string(_shape) + " getIndex", n, 1, index, n);
+    s_sink = sum.x + sum.y + sum.z + indices;
+  }
+  return;
+}
+
+
+// A soup of _n unit boxes side by side, welded back into vertices
+void benchWeld( int _n ) {
+  BoxShape box;
+  std::vector<GLfloat> direct;
+  box.getVertexDirect(direct);
+  std::vector<GLuint> corners;
+  box.getTriangles(corners);
+  std::vector<GLfloat> vertex, normal;
+  for ( int b=0; b<_n; ++b ) {
+    for ( size_t c=0; c<corners.size(); ++c ) {
+      glm::vec3 n = box.getNormal(corners[c]);
+      vertex.insert(vertex.end(), { direct[3*c] + b, direct[3*c+1],
+				    direct[3*c+2] });
+      normal.insert(normal.end(), { n.x, n.y, n.z });
+    }
+  }
+  std::vector<GLfloat> outVertex, outNormal;
+  std::vector<GLuint> outCorners;
+  int nVertices = 0;
+  double weld = measure([&]() {
+      nVertices = weldVertices(vertex, normal, 1.0e-5f, outVertex, outNormal,
+			       outCorners, 1 << 30);
+    });
+  int nCorners = static_cast<int>(vertex.size()) / 3;
+  std::ostringstream name;
+  name << "weld " << nCorners << " corners to " << nVertices << " vertices";
+  report("shapes", name.str(), _n, 1, weld, nCorners);
+  return;
+}
+
+
+// Strips of an _n by _n grid of quads, two triangles each
+void benchStripify( int _n ) {
+  std::vector<GLuint> corners;
+  for ( int y=0; y<_n; ++y ) {
+    for ( int x=0; x<_n; ++x ) {
+      GLuint v = y * (_n + 1) + x;
+      corners.insert(corners.end(), { v, v + 1, v + _n + 2,
+				      v, v + _n + 2, v + _n + 1 });
+    }
+  }
+  std::vector<GLuint> strips;
+  int nStrips = 0;
+  double stripify = measure([&]() {
+      nStrips = CSI4130::stripify(corners, 0xFFFF, strips);
+    });
+  int nTriangles = static_cast<int>(corners.size()) / 3;
+  std::ostringstream name;
+  name << "stripify " << nTriangles << " triangles to " << nStrips
+       << " strips, " << strips.size() << " of " << corners.size()
+       << " indices";
+  report("shapes", name.str(), 1, 1, stripify, nTriangles);
+  return;
+}
+
+}
+
+
+void benchShapes() {
+  // construction includes the default instance attributes
+  const int nShapes = 1000;
+  double box = measure([&]() {
+      for ( int s=0; s<nShapes; ++s ) {
+	BoxShape shape;
+      }
+    });
+  report("shapes", "BoxShape()", nShapes, 1, box, nShapes);
+  double sphere = measure([&]() {
+      for ( int s=0; s<nShapes; ++s ) {
+	Sphere shape;
+      }
+    });
+  report("shapes", "Sphere()", nShapes, 1, sphere, nShapes);
+  benchAccessors<BoxShape>("box");
+  benchAccessors<Sphere>("sphere");
+  benchWeld(1000);
+  benchWeld(10000);
+  benchStripify(100);
+  benchStripify(300);
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
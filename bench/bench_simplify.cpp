@@ -0,0 +1,81 @@
+// ==========================================================================
+// $Id: bench_simplify.cpp $
+// Quadric error simplification of a mesh into four levels of detail
+// ==========================================================================
+#include <cmath>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include "simplifier.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+namespace {
+
+// Bumpy height field of _n x _n quads over [-1,1]^2 with its normals;
+// the built-in shapes have too few triangles to simplify
+void heightField( int _n, std::vector<GLfloat>& _vertex,
+		  std::vector<GLfloat>& _normal, std::vector<GLuint>& _tris ) {
+  for ( int j=0; j<=_n; ++j ) {
+    for ( int i=0; i<=_n; ++i ) {
+      float x = 2.0f * i / _n - 1.0f, y = 2.0f * j / _n - 1.0f;
+      float z = 0.1f * std::sin(6.0f * x) * std::cos(4.0f * y);
+      glm::vec3 n = glm::normalize
+	(glm::vec3(-0.6f * std::cos(6.0f * x) * std::cos(4.0f * y),
+		   0.4f * std::sin(6.0f * x) * std::sin(4.0f * y), 1.0f));
+      _vertex.insert(_vertex.end(), { x, y, z });
+      _normal.insert(_normal.end(), { n.x, n.y, n.z });
+    }
+  }
+  for ( int j=0; j<_n; ++j ) {
+    for ( int i=0; i<_n; ++i ) {
+      GLuint v = j * (_n + 1) + i;
+      _tris.insert(_tris.end(), { v, v + 1, v + _n + 1,
+				  v + 1, v + _n + 2, v + _n + 1 });
+    }
+  }
+  return;
+}
+
+}
+
+
+void benchSimplify() {
+  // 80000 triangles
+  std::vector<GLfloat> vertex, normal;
+  std::vector<GLuint> tris;
+  heightField(200, vertex, normal, tris);
+  Simplifier simplifier;
+  if ( simplifier.setMesh(vertex.data(), normal.data(),
+			  static_cast<int>(vertex.size()) / 3, tris) != 0 ) {
+    return;
+  }
+  int nTris = simplifier.getNTriangles();
+  std::vector<float> ratios = { 0.5f, 0.25f, 0.125f, 0.0625f };
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    std::vector<LodMesh> lods;
+    double all = measure([&]() {
+	simplifier.simplifyLevels(ratios, lods, jobs);
+      });
+    // the levels of the last repetition
+    for ( size_t l=0; l<lods.size(); ++l ) {
+      std::ostringstream name;
+      name << "ratio " << lods[l].d_ratio << ", " << lods[l].getNTriangles()
+	   << " triangles, error " << lods[l].d_error;
+      report("simplify", name.str(), nTris, nThreads, lods[l].d_ms * 1.0e-3,
+	     nTris);
+    }
+    report("simplify", "all levels", nTris, nThreads, all,
+	   nTris * static_cast<double>(ratios.size()));
+  }
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
@@ -0,0 +1,63 @@
+// ==========================================================================
+// $Id: bench_sort.cpp $
+// Depth ordering of instances: parallel radix sort against std::sort
+// ==========================================================================
+#include <algorithm>
+#include <utility>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "attributes.h"
+#include "instance_sort.h"
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+void benchSort() {
+  const int nInstances = 1000000;
+  Attributes attrib(12, nInstances, glm::vec3(-10.0f), glm::vec3(10.0f));
+  glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 3.0f, -20.0f),
+			       glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  InstanceSorter sorter;
+  sorter.sort(attrib.d_tfms, nInstances, view, SORT_FRONT_TO_BACK);
+  // depth keys in instance order
+  std::vector<uint32_t> keys(nInstances);
+  for ( int i=0; i<nInstances; ++i ) {
+    keys[sorter.getOrder()[i]] = sorter.getKeys()[i];
+  }
+  std::vector<int> counts = threadCounts();
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    int nThreads = counts[c];
+    JobSystem jobs(nThreads);
+    double sort = measure([&]() {
+	sorter.sort(attrib.d_tfms, nInstances, view, SORT_FRONT_TO_BACK, jobs);
+      });
+    report("sort", "depth keys+radix", nInstances, nThreads, sort, nInstances);
+    double radix = measure([&]() {
+	sorter.radixSort(keys.data(), nInstances, 16, jobs);
+      });
+    report("sort", "radix keys", nInstances, nThreads, radix, nInstances);
+    std::vector<glm::mat4> sorted(nInstances);
+    double gather = measure([&]() {
+	sorter.gather(attrib.d_tfms, sorted.data(), jobs);
+      });
+    report("sort", "gather matrices", nInstances, nThreads, gather, nInstances);
+  }
+  // reference: comparison sort of the same keys on one thread
+  std::vector<std::pair<uint32_t, uint32_t> > pairs(nInstances);
+  double reference = measure([&]() {
+      for ( int i=0; i<nInstances; ++i ) {
+	pairs[i] = std::make_pair(keys[i], static_cast<uint32_t>(i));
+      }
+      std::sort(pairs.begin(), pairs.end());
+    });
+  report("sort", "std::sort keys", nInstances, 1, reference, nInstances);
+  return;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
@@ -0,0 +1,111 @@
+// ==========================================================================
+// $Id: benchmark.cpp $
+// Minimal timing harness for the CPU micro-benchmarks (no GL context)
+// ==========================================================================
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "benchmark.h"
+
+namespace CSI4130 {
+namespace bench {
+
+namespace {
+std::vector<Result> s_results;
+long long s_maxN = 10000000;
+
+std::string jsonString( const std::string& _str ) {
+  std::string out("\"");
+  for ( size_t c=0; c<_str.size(); ++c ) {
+    if ( _str[c] == '"' || _str[c] == '\\' ) out += '\\';
+    out += _str[c];
+  }
+  return out + "\"";
+}
+}
+
+
+double measure( const std::function<void()>& _fn, double _minSeconds ) {
+  typedef std::chrono::steady_clock Clock;
+  double best = 1.0e30;
+  double total = 0.0;
+  int reps = 0;
+  while ( reps < 2 || total < _minSeconds ) {
+    Clock::time_point start = Clock::now();
+    _fn();
+    double sec = std::chrono::duration<double>(Clock::now() - start).count();
+    best = std::min(best, sec);
+    total += sec;
+    ++reps;
+  }
+  return best;
+}
+
+
+void report( const std::string& _suite, const std::string& _name,
+	     long long _n, int _threads, double _seconds, double _items ) {
+  Result res = { _suite, _name, _n, _threads, _seconds,
+		 _seconds > 0.0 ? _items / _seconds : 0.0 };
+  s_results.push_back(res);
+  std::cerr << std::left << std::setw(14) << _suite << std::setw(28) << _name
+	    << std::right << std::setw(10) << _n << std::setw(4) << _threads
+	    << std::setw(12) << std::fixed << std::setprecision(3)
+	    << _seconds * 1000.0 << " ms" << std::setw(14)
+	    << std::setprecision(0) << res.d_itemsPerSecond << " /s"
+	    << std::endl;
+  return;
+}
+
+
+const std::vector<Result>& results() {
+  return s_results;
+}
+
+
+std::vector<int> threadCounts() {
+  int hw = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> counts;
+  for ( int t=1; t<hw; t*=2 ) counts.push_back(t);
+  counts.push_back(hw);
+  return counts;
+}
+
+
+std::vector<long long> sweepCounts( long long _max ) {
+  std::vector<long long> counts;
+  for ( long long n=10; n<=std::min(_max, s_maxN); n*=10 ) counts.push_back(n);
+  return counts;
+}
+
+
+void setMaxN( long long _maxN ) {
+  s_maxN = _maxN;
+  return;
+}
+
+
+int writeJson( const std::string& _path ) {
+  std::ofstream out(_path.c_str());
+  if ( !out ) {
+    std::cerr << "Cannot write " << _path << std::endl;
+    return -1;
+  }
+  out << "{\n  \"results\": [";
+  for ( size_t r=0; r<s_results.size(); ++r ) {
+    const Result& res = s_results[r];
+    out << (r ? ",\n" : "\n")
+	<< "    { \"suite\": " << jsonString(res.d_suite)
+	<< ", \"name\": " << jsonString(res.d_name)
+	<< ", \"n\": " << res.d_n << ", \"threads\": " << res.d_threads
+	<< std::setprecision(9) << ", \"seconds\": " << res.d_seconds
+	<< ", \"items_per_second\": " << res.d_itemsPerSecond << " }";
+  }
+  out << "\n  ]\n}\n";
+  return out ? 0 : -1;
+}
+
+} // end namespace bench
+} // end namespace CSI4130
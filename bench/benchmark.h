@@ -0,0 +1,60 @@
+// ==========================================================================
+// $Id: benchmark.h $
+// Minimal timing harness for the CPU micro-benchmarks (no GL context)
+// ==========================================================================
+#ifndef CSI4130_BENCHMARK_H_
+#define CSI4130_BENCHMARK_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace CSI4130 {
+namespace bench {
+
+struct Result {
+  std::string d_suite;
+  std::string d_name;
+  long long d_n; // problem size, e.g., number of instances
+  int d_threads;
+  double d_seconds; // best time of one repetition
+  double d_itemsPerSecond;
+};
+
+// Time _fn. It is repeated until at least _minSeconds have passed (and at
+// least twice); the best repetition is returned in seconds.
+double measure( const std::function<void()>& _fn, double _minSeconds = 0.2 );
+
+// Record and print a result
+void report( const std::string& _suite, const std::string& _name,
+	     long long _n, int _threads, double _seconds, double _items );
+
+const std::vector<Result>& results();
+
+// Thread counts 1, 2, 4, ... up to the hardware concurrency
+std::vector<int> threadCounts();
+
+// Problem sizes 10, 100, 1000, ... up to _max and the limit set with
+// setMaxN() (10000000 by default)
+std::vector<long long> sweepCounts( long long _max = 10000000 );
+void setMaxN( long long _maxN );
+
+// All results so far as JSON to _path; returns 0 on success
+int writeJson( const std::string& _path );
+
+// Suites
+void benchCommandList();
+void benchJobs();
+void benchAnimation();
+void benchSort();
+void benchOcclusion();
+void benchScene();
+void benchAttributes();
+void benchShapes();
+void benchMaterials();
+void benchSimplify();
+
+} // end namespace bench
+} // end namespace CSI4130
+#endif
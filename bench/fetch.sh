@@ -0,0 +1,27 @@
+#!/bin/sh
+# Frame times of the instance fetch paths for growing instance counts on
+# the GPU of the display (LIBGL_ALWAYS_SOFTWARE=1 for llvmpipe). Run from
+# anywhere; LIT_BOXES is the executable (default build/lit_boxes), FRAMES
+# the timed frames, extra arguments go to lit_boxes, e.g., --gpu-cull.
+cd "$(dirname "$0")/.." || exit 1
+LIT_BOXES=${LIT_BOXES:-build/lit_boxes}
+FRAMES=${FRAMES:-20}
+
+# GLUT needs a display for its context
+run() {
+  if [ -z "$DISPLAY" ]; then
+    xvfb-run -a -s "-screen 0 640x480x24" "$@"
+  else
+    "$@"
+  fi
+}
+
+status=0
+for n in 1000 100000 1000000; do
+  for fetch in attrib tbo ssbo; do
+    run "$LIT_BOXES" --scene regress/boxes.scene --instance-fetch $fetch \
+      --no-shadows --instances $n --bench-frames "$FRAMES" "$@" 2>&1 |
+      grep "^Benchmark" || status=1
+  done
+done
+exit $status
@@ -138,55 +138,4 @@ BoxShape::BoxShape() : RenderShape() {
 				d_restart,
 				20,21,22,23  // +z
 				});
-
-  // direct specification
-    d_vertex_direct.insert(d_vertex_direct.end(), {
-	-0.5f, -0.5f, -0.5f, // 0
-	  -0.5f, -0.5f,  0.5f, // 1
-	  -0.5f,  0.5f, -0.5f, // 2
-	  
-	  -0.5f, -0.5f,  0.5f, // 1
-	  -0.5f,  0.5f, -0.5f, // 2
-	  -0.5f,  0.5f,  0.5f, // 3
-	  
-	  -0.5f,  0.5f, -0.5f, // 2
-	  -0.5f,  0.5f,  0.5f, // 3
-	  0.5f,  0.5f, -0.5f, // 6
- 
-	  -0.5f,  0.5f,  0.5f, // 3
-	  0.5f,  0.5f, -0.5f, // 6
-	  0.5f,  0.5f,  0.5f, // 7
-	  
-	  0.5f,  0.5f, -0.5f, // 6
-	  0.5f,  0.5f,  0.5f, // 7
-	  0.5f, -0.5f, -0.5f, // 4
-	  
-	  0.5f,  0.5f,  0.5f, // 7
-	  0.5f, -0.5f, -0.5f, // 4
-	  0.5f, -0.5f,  0.5f, // 5
-	  //---------------------------
-	  -0.5f,  0.5f, -0.5f, // 2
-	  0.5f,  0.5f, -0.5f, // 6
-	  -0.5f, -0.5f, -0.5f, // 0
-  
-	  0.5f,  0.5f, -0.5f, // 6
-	  -0.5f, -0.5f, -0.5f, // 0
-	  0.5f, -0.5f, -0.5f, // 4
-  
-	  -0.5f, -0.5f, -0.5f, // 0
-	  0.5f, -0.5f, -0.5f, // 4
-	  -0.5f, -0.5f,  0.5f, // 1
-
-	  0.5f, -0.5f, -0.5f, // 4
-	  -0.5f, -0.5f,  0.5f, // 1
-	  0.5f, -0.5f,  0.5f, // 5
-
-	  -0.5f, -0.5f,  0.5f, // 1
-	  0.5f, -0.5f,  0.5f, // 5
-	  -0.5f,  0.5f,  0.5f, // 3
-
-	  0.5f, -0.5f,  0.5f, // 5
-	  -0.5f,  0.5f,  0.5f, // 3
-	  0.5f,  0.5f,  0.5f // 7
-	  });
 }
@@ -0,0 +1,146 @@
+// ==========================================================================
+// $Id: bvh.cpp $
+// Bounding volume hierarchy over axis aligned boxes
+// ==========================================================================
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+
+#include "bvh.h"
+
+namespace CSI4130 {
+
+namespace {
+// split candidates per node are the boundaries between the bins
+const int c_bins = 16;
+
+// half the surface area of the box
+inline float halfArea( const glm::vec3& _min, const glm::vec3& _max ) {
+  glm::vec3 e = glm::max(_max - _min, glm::vec3(0.0f));
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// primitives [d_begin,d_end) of node d_node, still to be split
+struct BuildRange {
+  int d_node;
+  int d_begin;
+  int d_end;
+  int d_depth;
+};
+}
+
+
+Bvh::Bvh() : d_depth(0) {
+}
+
+
+void Bvh::build( const std::vector<glm::vec3>& _min,
+		 const std::vector<glm::vec3>& _max, int _maxLeaf ) {
+  int n = static_cast<int>(_min.size());
+  _maxLeaf = std::max(_maxLeaf, 1);
+  d_nodes.clear();
+  d_prims.resize(n);
+  std::iota(d_prims.begin(), d_prims.end(), 0);
+  d_depth = 0;
+  if ( n == 0 ) return;
+  std::vector<glm::vec3> centroid(n);
+  for ( int i=0; i<n; ++i ) {
+    centroid[i] = 0.5f * (_min[i] + _max[i]);
+  }
+  d_nodes.reserve(2 * (n / _maxLeaf) + 1);
+  d_nodes.push_back(BvhNode());
+  std::vector<BuildRange> stack;
+  BuildRange root = { 0, 0, n, 1 };
+  stack.push_back(root);
+  while ( !stack.empty() ) {
+    BuildRange range = stack.back();
+    stack.pop_back();
+    d_depth = std::max(d_depth, range.d_depth);
+    glm::vec3 bMin(FLT_MAX), bMax(-FLT_MAX), cMin(FLT_MAX), cMax(-FLT_MAX);
+    for ( int i=range.d_begin; i<range.d_end; ++i ) {
+      int p = d_prims[i];
+      bMin = glm::min(bMin, _min[p]);
+      bMax = glm::max(bMax, _max[p]);
+      cMin = glm::min(cMin, centroid[p]);
+      cMax = glm::max(cMax, centroid[p]);
+    }
+    BvhNode& node = d_nodes[range.d_node];
+    node.d_min = bMin;
+    node.d_max = bMax;
+    node.d_first = range.d_begin;
+    node.d_count = range.d_end - range.d_begin;
+    if ( node.d_count <= _maxLeaf || range.d_depth >= MAX_DEPTH ) continue;
+    glm::vec3 extent = cMax - cMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) :
+      (extent.y > extent.z ? 1 : 2);
+    int mid = range.d_begin;
+    if ( extent[axis] > 0.0f ) {
+      // bin the centroids and sweep the split planes from both sides
+      float scale = c_bins / extent[axis];
+      int binCount[c_bins] = { 0 };
+      glm::vec3 binMin[c_bins], binMax[c_bins];
+      std::fill(binMin, binMin + c_bins, glm::vec3(FLT_MAX));
+      std::fill(binMax, binMax + c_bins, glm::vec3(-FLT_MAX));
+      for ( int i=range.d_begin; i<range.d_end; ++i ) {
+	int p = d_prims[i];
+	int b = std::min(static_cast<int>((centroid[p][axis] - cMin[axis]) *
+					  scale), c_bins - 1);
+	++binCount[b];
+	binMin[b] = glm::min(binMin[b], _min[p]);
+	binMax[b] = glm::max(binMax[b], _max[p]);
+      }
+      float rightCost[c_bins];
+      glm::vec3 sMin(FLT_MAX), sMax(-FLT_MAX);
+      int count = 0;
+      for ( int b=c_bins-1; b>0; --b ) {
+	count += binCount[b];
+	sMin = glm::min(sMin, binMin[b]);
+	sMax = glm::max(sMax, binMax[b]);
+	rightCost[b] = count * halfArea(sMin, sMax);
+      }
+      float bestCost = FLT_MAX;
+      int bestSplit = 0;
+      sMin = glm::vec3(FLT_MAX), sMax = glm::vec3(-FLT_MAX);
+      count = 0;
+      for ( int b=0; b<c_bins-1; ++b ) {
+	count += binCount[b];
+	sMin = glm::min(sMin, binMin[b]);
+	sMax = glm::max(sMax, binMax[b]);
+	float cost = count * halfArea(sMin, sMax) + rightCost[b + 1];
+	if ( count > 0 && count < node.d_count && cost < bestCost ) {
+	  bestCost = cost;
+	  bestSplit = b;
+	}
+      }
+      mid = static_cast<int>
+	(std::partition(d_prims.begin() + range.d_begin,
+			d_prims.begin() + range.d_end, [&](int _p) {
+			  int b = std::min(static_cast<int>
+					   ((centroid[_p][axis] - cMin[axis]) *
+					    scale), c_bins - 1);
+			  return b <= bestSplit;
+			}) - d_prims.begin());
+    }
+    // equal centroids: halve by count
+    if ( mid == range.d_begin || mid == range.d_end ) {
+      mid = (range.d_begin + range.d_end) / 2;
+      std::nth_element(d_prims.begin() + range.d_begin, d_prims.begin() + mid,
+		       d_prims.begin() + range.d_end, [&](int _a, int _b) {
+			 return centroid[_a][axis] < centroid[_b][axis];
+		       });
+    }
+    int left = static_cast<int>(d_nodes.size());
+    // node is invalid once the nodes grow
+    node.d_first = left;
+    node.d_count = 0;
+    d_nodes.push_back(BvhNode());
+    d_nodes.push_back(BvhNode());
+    BuildRange right = { left + 1, mid, range.d_end, range.d_depth + 1 };
+    stack.push_back(right);
+    BuildRange leftRange = { left, range.d_begin, mid, range.d_depth + 1 };
+    stack.push_back(leftRange);
+  }
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,81 @@
+// ==========================================================================
+// $Id: bvh.h $
+// Bounding volume hierarchy over axis aligned boxes
+// ==========================================================================
+// The hierarchy is built top-down. Every node with more primitives than
+// fit into a leaf splits them by the plane of least surface area cost.
+// The cost is evaluated at 16 bins of the centroids along the longest
+// axis of the centroid bounds. The nodes are stored in one array, and
+// the two children of a node are next to each other. The primitive
+// numbers are reordered so that every leaf refers to a contiguous range.
+// The ray tracer builds one hierarchy over the triangles of every shape
+// and one over the instances.
+// ==========================================================================
+#ifndef CSI4130_BVH_H_
+#define CSI4130_BVH_H_
+
+#include <vector>
+
+// glm types
+#include <glm/glm.hpp>
+
+namespace CSI4130 {
+
+// 32 bytes, two nodes share a cache line
+struct BvhNode {
+  glm::vec3 d_min;
+  int d_first; // first primitive of a leaf, left child otherwise
+  glm::vec3 d_max;
+  int d_count; // primitives of a leaf, 0 otherwise
+
+  inline bool isLeaf() const;
+};
+
+
+class Bvh {
+  std::vector<BvhNode> d_nodes;
+  std::vector<int> d_prims;
+  int d_depth;
+
+ public:
+  // deeper nodes stay leaves, traversal stacks hold MAX_DEPTH+1 nodes
+  static const int MAX_DEPTH = 64;
+
+  Bvh();
+
+  // Build over the boxes [_min[i],_max[i]] of the primitives; leaves hold
+  // at most _maxLeaf primitives
+  void build( const std::vector<glm::vec3>& _min,
+	      const std::vector<glm::vec3>& _max, int _maxLeaf = 4 );
+
+  // node 0 is the root; empty without primitives
+  inline const std::vector<BvhNode>& getNodes() const;
+  // primitive numbers in leaf order
+  inline const std::vector<int>& getPrims() const;
+  inline int getDepth() const;
+
+ private:
+  // no copy or assignment
+  Bvh(const Bvh& _oBvh );
+  Bvh& operator=( const Bvh& _oBvh );
+};
+
+
+bool BvhNode::isLeaf() const {
+  return d_count > 0;
+}
+
+const std::vector<BvhNode>& Bvh::getNodes() const {
+  return d_nodes;
+}
+
+const std::vector<int>& Bvh::getPrims() const {
+  return d_prims;
+}
+
+int Bvh::getDepth() const {
+  return d_depth;
+}
+
+} // end namespace
+#endif
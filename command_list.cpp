@@ -0,0 +1,375 @@
+// ==========================================================================
+// $Id: command_list.cpp $
+// Recorded draw command lists: recorded on any thread, submitted on the GL
+// thread
+// ==========================================================================
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "command_list.h"
+
+namespace CSI4130 {
+
+namespace {
+
+// Payloads following each entry in the data buffer
+struct BindBufferCmd {
+  GLenum d_target;
+  GLuint d_buffer;
+};
+
+struct BindBufferRangeCmd {
+  GLenum d_target;
+  GLuint d_index;
+  GLuint d_buffer;
+  GLintptr d_offset;
+  GLsizeiptr d_size;
+};
+
+struct UniformCmd {
+  GLuint d_program;
+  GLint d_loc;
+  GLint d_size;
+  GLfloat d_value[16];
+};
+
+struct UniformIntCmd {
+  GLuint d_program;
+  GLint d_loc;
+  GLint d_value;
+};
+
+struct DrawCmd {
+  GLenum d_mode;
+  GLsizei d_count;
+  GLenum d_type;
+  GLsizei d_instances;
+  GLuint d_baseInstance;
+  size_t d_offset;
+};
+
+struct DrawIndirectCmd {
+  GLenum d_mode;
+  GLenum d_type;
+  GLuint d_buffer;
+  size_t d_offset;
+};
+
+}
+
+
+void* CommandList::allocate( uint64_t _key, CommandType _type,
+			     size_t _size ) {
+  // keep payloads 8-byte aligned
+  size_t offset = (d_data.size() + 7) & ~static_cast<size_t>(7);
+  d_data.resize(offset + _size);
+  Entry entry = { _key, static_cast<GLuint>(_type),
+		  static_cast<GLuint>(offset) };
+  d_entries.push_back(entry);
+  return d_data.data() + offset;
+}
+
+
+void CommandList::useProgram( uint64_t _key, GLuint _program ) {
+  *static_cast<GLuint*>(allocate(_key, CMD_USE_PROGRAM, sizeof(GLuint)))
+    = _program;
+  return;
+}
+
+
+void CommandList::bindVertexArray( uint64_t _key, GLuint _vao ) {
+  *static_cast<GLuint*>(allocate(_key, CMD_BIND_VAO, sizeof(GLuint)))
+    = _vao;
+  return;
+}
+
+
+void CommandList::bindBuffer( uint64_t _key, GLenum _target,
+			      GLuint _buffer ) {
+  BindBufferCmd* cmd = static_cast<BindBufferCmd*>
+    (allocate(_key, CMD_BIND_BUFFER, sizeof(BindBufferCmd)));
+  cmd->d_target = _target;
+  cmd->d_buffer = _buffer;
+  return;
+}
+
+
+void CommandList::bindBufferRange( uint64_t _key, GLenum _target,
+				   GLuint _index, GLuint _buffer,
+				   GLintptr _offset, GLsizeiptr _size ) {
+  BindBufferRangeCmd* cmd = static_cast<BindBufferRangeCmd*>
+    (allocate(_key, CMD_BIND_BUFFER_RANGE, sizeof(BindBufferRangeCmd)));
+  cmd->d_target = _target;
+  cmd->d_index = _index;
+  cmd->d_buffer = _buffer;
+  cmd->d_offset = _offset;
+  cmd->d_size = _size;
+  return;
+}
+
+
+void CommandList::enable( uint64_t _key, GLenum _cap ) {
+  *static_cast<GLenum*>(allocate(_key, CMD_ENABLE, sizeof(GLenum))) = _cap;
+  return;
+}
+
+
+void CommandList::disable( uint64_t _key, GLenum _cap ) {
+  *static_cast<GLenum*>(allocate(_key, CMD_DISABLE, sizeof(GLenum))) = _cap;
+  return;
+}
+
+
+void CommandList::primitiveRestartIndex( uint64_t _key, GLuint _index ) {
+  *static_cast<GLuint*>(allocate(_key, CMD_RESTART_INDEX, sizeof(GLuint)))
+    = _index;
+  return;
+}
+
+
+void CommandList::depthFunc( uint64_t _key, GLenum _func ) {
+  *static_cast<GLenum*>(allocate(_key, CMD_DEPTH_FUNC, sizeof(GLenum)))
+    = _func;
+  return;
+}
+
+
+void CommandList::depthMask( uint64_t _key, GLboolean _write ) {
+  *static_cast<GLboolean*>(allocate(_key, CMD_DEPTH_MASK, sizeof(GLboolean)))
+    = _write;
+  return;
+}
+
+
+void CommandList::colorMask( uint64_t _key, GLboolean _write ) {
+  *static_cast<GLboolean*>(allocate(_key, CMD_COLOR_MASK, sizeof(GLboolean)))
+    = _write;
+  return;
+}
+
+
+void CommandList::uniform( uint64_t _key, GLuint _program, GLint _loc,
+			   const GLfloat* _v, int _size ) {
+  assert( _size == 1 || _size == 3 || _size == 4 || _size == 16 );
+  // only store the floats actually used
+  UniformCmd* cmd = static_cast<UniformCmd*>
+    (allocate(_key, CMD_UNIFORM,
+	      sizeof(UniformCmd) - sizeof(GLfloat) * (16 - _size)));
+  cmd->d_program = _program;
+  cmd->d_loc = _loc;
+  cmd->d_size = _size;
+  memcpy(cmd->d_value, _v, sizeof(GLfloat) * _size);
+  return;
+}
+
+
+void CommandList::uniform( uint64_t _key, GLuint _program, GLint _loc,
+			   GLint _v ) {
+  UniformIntCmd* cmd = static_cast<UniformIntCmd*>
+    (allocate(_key, CMD_UNIFORM_INT, sizeof(UniformIntCmd)));
+  cmd->d_program = _program;
+  cmd->d_loc = _loc;
+  cmd->d_value = _v;
+  return;
+}
+
+
+void CommandList::drawElementsInstanced( uint64_t _key, GLenum _mode,
+					 GLsizei _count, GLenum _type,
+					 size_t _offset, GLsizei _instances,
+					 GLuint _baseInstance ) {
+  DrawCmd* cmd = static_cast<DrawCmd*>
+    (allocate(_key, CMD_DRAW_ELEMENTS_INSTANCED, sizeof(DrawCmd)));
+  cmd->d_mode = _mode;
+  cmd->d_count = _count;
+  cmd->d_type = _type;
+  cmd->d_instances = _instances;
+  cmd->d_baseInstance = _baseInstance;
+  cmd->d_offset = _offset;
+  return;
+}
+
+
+void CommandList::drawElementsIndirect( uint64_t _key, GLenum _mode,
+					GLenum _type, GLuint _buffer,
+					size_t _offset ) {
+  DrawIndirectCmd* cmd = static_cast<DrawIndirectCmd*>
+    (allocate(_key, CMD_DRAW_ELEMENTS_INDIRECT, sizeof(DrawIndirectCmd)));
+  cmd->d_mode = _mode;
+  cmd->d_type = _type;
+  cmd->d_buffer = _buffer;
+  cmd->d_offset = _offset;
+  return;
+}
+
+
+CommandQueue::CommandQueue() : d_lastSubmitted(0) {
+}
+
+
+void CommandQueue::clear() {
+  d_lists.clear();
+  d_refs.clear();
+  return;
+}
+
+
+void CommandQueue::add( const CommandList& _list ) {
+  d_lists.push_back(&_list);
+  return;
+}
+
+
+void CommandQueue::sort() {
+  d_refs.clear();
+  for ( std::vector<const CommandList*>::const_iterator iter = d_lists.begin();
+	iter != d_lists.end(); ++iter ) {
+    const std::vector<CommandList::Entry>& entries = (*iter)->getEntries();
+    for ( GLuint e=0; e<entries.size(); ++e ) {
+      Ref ref = { entries[e].d_key, *iter, e };
+      d_refs.push_back(ref);
+    }
+  }
+  // stable: equal keys stay in list order and recording order
+  std::stable_sort(d_refs.begin(), d_refs.end(),
+		   [](const Ref& _a, const Ref& _b) {
+		     return _a.d_key < _b.d_key; });
+  return;
+}
+
+
+void CommandQueue::execute( GLStateCache& _state ) {
+  execute( _state, d_refs.begin(), d_refs.end() );
+  d_lastSubmitted = d_refs.size();
+  return;
+}
+
+
+void CommandQueue::executePass( GLStateCache& _state, unsigned _pass ) {
+  // refs are sorted by key and the pass is the top byte
+  std::vector<Ref>::const_iterator begin = d_refs.begin();
+  while ( begin != d_refs.end() && (begin->d_key >> 56) < _pass ) ++begin;
+  std::vector<Ref>::const_iterator end = begin;
+  while ( end != d_refs.end() && (end->d_key >> 56) == _pass ) ++end;
+  execute( _state, begin, end );
+  // the passes of a frame add up
+  if ( begin == d_refs.begin() ) d_lastSubmitted = 0;
+  d_lastSubmitted += end - begin;
+  return;
+}
+
+
+void CommandQueue::execute( GLStateCache& _state,
+			    std::vector<Ref>::const_iterator _begin,
+			    std::vector<Ref>::const_iterator _end ) {
+  for ( std::vector<Ref>::const_iterator iter = _begin;
+	iter != _end; ++iter ) {
+    const CommandList::Entry& entry = iter->d_list->getEntries()[iter->d_index];
+    const unsigned char* data = iter->d_list->getData(entry.d_offset);
+    switch (entry.d_type) {
+    case CMD_USE_PROGRAM:
+      _state.useProgram(*reinterpret_cast<const GLuint*>(data));
+      break;
+    case CMD_BIND_VAO:
+      _state.bindVertexArray(*reinterpret_cast<const GLuint*>(data));
+      break;
+    case CMD_BIND_BUFFER: {
+      const BindBufferCmd* cmd = reinterpret_cast<const BindBufferCmd*>(data);
+      _state.bindBuffer(cmd->d_target, cmd->d_buffer);
+      break;
+    }
+    case CMD_BIND_BUFFER_RANGE: {
+      const BindBufferRangeCmd* cmd =
+	reinterpret_cast<const BindBufferRangeCmd*>(data);
+      _state.bindBufferRange(cmd->d_target, cmd->d_index, cmd->d_buffer,
+			     cmd->d_offset, cmd->d_size);
+      break;
+    }
+    case CMD_ENABLE:
+      _state.enable(*reinterpret_cast<const GLenum*>(data));
+      break;
+    case CMD_DISABLE:
+      _state.disable(*reinterpret_cast<const GLenum*>(data));
+      break;
+    case CMD_RESTART_INDEX:
+      _state.primitiveRestartIndex(*reinterpret_cast<const GLuint*>(data));
+      break;
+    case CMD_DEPTH_FUNC:
+      _state.depthFunc(*reinterpret_cast<const GLenum*>(data));
+      break;
+    case CMD_DEPTH_MASK:
+      _state.depthMask(*reinterpret_cast<const GLboolean*>(data));
+      break;
+    case CMD_COLOR_MASK:
+      _state.colorMask(*reinterpret_cast<const GLboolean*>(data));
+      break;
+    case CMD_UNIFORM: {
+      const UniformCmd* cmd = reinterpret_cast<const UniformCmd*>(data);
+      switch (cmd->d_size) {
+      case 1:
+	_state.programUniform1f(cmd->d_program, cmd->d_loc, cmd->d_value[0]);
+	break;
+      case 3:
+	_state.programUniform3fv(cmd->d_program, cmd->d_loc, cmd->d_value);
+	break;
+      case 4:
+	_state.programUniform4fv(cmd->d_program, cmd->d_loc, cmd->d_value);
+	break;
+      default:
+	_state.programUniformMatrix4fv(cmd->d_program, cmd->d_loc, cmd->d_value);
+	break;
+      }
+      break;
+    }
+    case CMD_UNIFORM_INT: {
+      const UniformIntCmd* cmd = reinterpret_cast<const UniformIntCmd*>(data);
+      _state.programUniform1i(cmd->d_program, cmd->d_loc, cmd->d_value);
+      break;
+    }
+    case CMD_DRAW_ELEMENTS_INSTANCED: {
+      const DrawCmd* cmd = reinterpret_cast<const DrawCmd*>(data);
+      if ( cmd->d_baseInstance > 0 ) {
+	glDrawElementsInstancedBaseInstance(cmd->d_mode, cmd->d_count,
+					    cmd->d_type,
+					    reinterpret_cast<const void*>(cmd->d_offset),
+					    cmd->d_instances,
+					    cmd->d_baseInstance);
+      } else {
+	glDrawElementsInstanced(cmd->d_mode, cmd->d_count, cmd->d_type,
+				reinterpret_cast<const void*>(cmd->d_offset),
+				cmd->d_instances);
+      }
+      break;
+    }
+    case CMD_DRAW_ELEMENTS_INDIRECT: {
+      const DrawIndirectCmd* cmd =
+	reinterpret_cast<const DrawIndirectCmd*>(data);
+      _state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, cmd->d_buffer);
+      glDrawElementsIndirect(cmd->d_mode, cmd->d_type,
+			     reinterpret_cast<const void*>(cmd->d_offset));
+      break;
+    }
+    default:
+      assert( false );
+    }
+  }
+  return;
+}
+
+
+int CommandQueue::getLastSubmitted() const {
+  return d_lastSubmitted;
+}
+
+
+void recordParallel( std::vector<CommandList>& _lists,
+		     const std::function<void(CommandList&, int)>& _record,
+		     JobSystem& _jobs ) {
+  _jobs.parallelFor(0, _lists.size(), 1, [&](int _begin, int _end) {
+      for ( int l=_begin; l<_end; ++l ) _record(_lists[l], l);
+    });
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,156 @@
+// ==========================================================================
+// $Id: command_list.h $
+// Recorded draw command lists: recorded on any thread, submitted on the GL
+// thread
+// ==========================================================================
+// A CommandList is a linear buffer of compact commands. Recording does
+// not touch GL, so every worker thread can fill its own list. The
+// CommandQueue merges the lists, orders them by sort key (pass, program,
+// shape, material) and executes them through the GLStateCache on the GL
+// thread. Commands with equal keys keep their recording order.
+// ==========================================================================
+#ifndef CSI4130_COMMAND_LIST_H_
+#define CSI4130_COMMAND_LIST_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+
+#include "gl_state.h"
+#include "job_system.h"
+
+namespace CSI4130 {
+
+enum CommandType {
+  CMD_USE_PROGRAM,
+  CMD_BIND_VAO,
+  CMD_BIND_BUFFER,
+  CMD_BIND_BUFFER_RANGE,
+  CMD_ENABLE,
+  CMD_DISABLE,
+  CMD_RESTART_INDEX,
+  CMD_DEPTH_FUNC,
+  CMD_DEPTH_MASK,
+  CMD_COLOR_MASK,
+  CMD_UNIFORM,
+  CMD_UNIFORM_INT,
+  CMD_DRAW_ELEMENTS_INSTANCED,
+  CMD_DRAW_ELEMENTS_INDIRECT
+};
+
+// Sort key - higher fields take precedence
+inline uint64_t commandKey( unsigned _pass, unsigned _program,
+			    unsigned _shape = 0, unsigned _material = 0 ) {
+  return (static_cast<uint64_t>(_pass & 0xFF) << 56) |
+    (static_cast<uint64_t>(_program & 0xFFFF) << 40) |
+    (static_cast<uint64_t>(_shape & 0xFFFF) << 24) |
+    (static_cast<uint64_t>(_material & 0xFFFF) << 8);
+}
+
+
+class CommandList {
+ public:
+  struct Entry {
+    uint64_t d_key;
+    GLuint d_type;
+    GLuint d_offset; // into d_data
+  };
+
+ private:
+  std::vector<unsigned char> d_data;
+  std::vector<Entry> d_entries;
+
+ public:
+  // Memory is kept when cleared; a list reaches its steady size after a
+  // few frames and recording does no more allocations.
+  inline void clear();
+  inline int size() const;
+  inline const std::vector<Entry>& getEntries() const;
+  inline const unsigned char* getData( GLuint _offset ) const;
+
+  void useProgram( uint64_t _key, GLuint _program );
+  void bindVertexArray( uint64_t _key, GLuint _vao );
+  void bindBuffer( uint64_t _key, GLenum _target, GLuint _buffer );
+  void bindBufferRange( uint64_t _key, GLenum _target, GLuint _index,
+			GLuint _buffer, GLintptr _offset, GLsizeiptr _size );
+  void enable( uint64_t _key, GLenum _cap );
+  void disable( uint64_t _key, GLenum _cap );
+  void primitiveRestartIndex( uint64_t _key, GLuint _index );
+  void depthFunc( uint64_t _key, GLenum _func );
+  void depthMask( uint64_t _key, GLboolean _write );
+  void colorMask( uint64_t _key, GLboolean _write );
+  // _size is 1, 3, 4 or 16 floats
+  void uniform( uint64_t _key, GLuint _program, GLint _loc,
+		const GLfloat* _v, int _size );
+  void uniform( uint64_t _key, GLuint _program, GLint _loc, GLint _v );
+  // _baseInstance > 0 needs GL 4.2
+  void drawElementsInstanced( uint64_t _key, GLenum _mode, GLsizei _count,
+			      GLenum _type, size_t _offset,
+			      GLsizei _instances, GLuint _baseInstance = 0 );
+  // The DrawElementsIndirectCommand at _offset of _buffer, which may be
+  // written on the GPU; needs GL 4.0
+  void drawElementsIndirect( uint64_t _key, GLenum _mode, GLenum _type,
+			     GLuint _buffer, size_t _offset );
+
+ private:
+  void* allocate( uint64_t _key, CommandType _type, size_t _size );
+};
+
+
+class CommandQueue {
+  struct Ref {
+    uint64_t d_key;
+    const CommandList* d_list;
+    GLuint d_index;
+  };
+  std::vector<const CommandList*> d_lists;
+  std::vector<Ref> d_refs;
+  int d_lastSubmitted;
+
+  void execute( GLStateCache& _state, std::vector<Ref>::const_iterator _begin,
+		std::vector<Ref>::const_iterator _end );
+
+ public:
+  CommandQueue();
+
+  void clear();
+  void add( const CommandList& _list );
+  // merge and order all added lists
+  void sort();
+  // GL thread only
+  void execute( GLStateCache& _state );
+  // only the commands of one pass, e.g., to time passes separately
+  void executePass( GLStateCache& _state, unsigned _pass );
+  int getLastSubmitted() const;
+};
+
+
+// Record into _lists[i] for all i by calling _record(_lists[i], i) as jobs
+void recordParallel( std::vector<CommandList>& _lists,
+		     const std::function<void(CommandList&, int)>& _record,
+		     JobSystem& _jobs = JobSystem::global() );
+
+
+void CommandList::clear() {
+  d_data.clear();
+  d_entries.clear();
+  return;
+}
+
+int CommandList::size() const {
+  return d_entries.size();
+}
+
+const std::vector<CommandList::Entry>& CommandList::getEntries() const {
+  return d_entries;
+}
+
+const unsigned char* CommandList::getData( GLuint _offset ) const {
+  return d_data.data() + _offset;
+}
+
+} // end namespace
+#endif
@@ -27,12 +27,16 @@
 //
 // ==========================================================================
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include "shader.h"
 
 
 namespace CSI4130 {
 
+unsigned long long g_errorChecks = 0;
+
 void getGlVersion( int& major, int& minor )
 {
   char dot;
@@ -49,6 +53,101 @@ void getGlVersion( int& major, int& minor )
 }
 
 
+namespace {
+
+const char* debugSourceName( GLenum _source ) {
+  switch (_source) {
+  case GL_DEBUG_SOURCE_API: return "api";
+  case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+  case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+  case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+  case GL_DEBUG_SOURCE_APPLICATION: return "application";
+  default: return "other";
+  }
+}
+
+const char* debugTypeName( GLenum _type ) {
+  switch (_type) {
+  case GL_DEBUG_TYPE_ERROR: return "error";
+  case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+  case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+  case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+  case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+  default: return "other";
+  }
+}
+
+const char* debugSeverityName( GLenum _severity ) {
+  switch (_severity) {
+  case GL_DEBUG_SEVERITY_HIGH: return "high";
+  case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+  case GL_DEBUG_SEVERITY_LOW: return "low";
+  default: return "notification";
+  }
+}
+
+// Print a message the first time and then only at 10, 100, ... repeats.
+// Asynchronous output may call from driver threads.
+void GLAPIENTRY debugCallback( GLenum _source, GLenum _type, GLuint _id,
+			       GLenum _severity, GLsizei _length,
+			       const GLchar* _message, const void* ) {
+  // drivers do not reliably give distinct ids - key on the text
+  static std::mutex s_mutex;
+  static std::map<std::string, unsigned> s_seen;
+  std::string key = _length < 0 ? std::string(_message) :
+    std::string(_message, _length);
+  std::lock_guard<std::mutex> lock(s_mutex);
+  unsigned count = ++s_seen[key];
+  if ( count != 1 && count != 10 && count != 100 && count != 1000 &&
+       count % 10000 != 0 ) {
+    return;
+  }
+  cerr << "GL " << debugSeverityName(_severity) << " "
+       << debugTypeName(_type) << " (" << debugSourceName(_source)
+       << ", " << _id << "): " << _message;
+  if ( count > 1 ) {
+    cerr << " [repeated " << count << " times]";
+  }
+  cerr << endl;
+  return;
+}
+
+}
+
+
+int installDebugOutput( GLenum _minSeverity, bool _synchronous ) {
+  int major, minor;
+  getGlVersion( major, minor );
+  if (( major < 4 || (major == 4 && minor < 3)) && !GLEW_KHR_debug ) {
+    cerr << "No KHR_debug: GL errors will not be reported" << endl;
+    return -1;
+  }
+  glEnable(GL_DEBUG_OUTPUT);
+  if ( _synchronous ) {
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  } else {
+    glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  }
+  glDebugMessageCallback(debugCallback, NULL);
+  // Filter by severity: everything off, then enable what is wanted
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE,
+			0, NULL, GL_FALSE);
+  const GLenum severities[] = { GL_DEBUG_SEVERITY_HIGH,
+				GL_DEBUG_SEVERITY_MEDIUM,
+				GL_DEBUG_SEVERITY_LOW,
+				GL_DEBUG_SEVERITY_NOTIFICATION };
+  for ( int s=0; s<4; ++s ) {
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severities[s],
+			  0, NULL, GL_TRUE);
+    if ( severities[s] == _minSeverity ) break;
+  }
+  // Errors are always reported regardless of their severity
+  glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE,
+			0, NULL, GL_TRUE);
+  return 0;
+}
+
+
 int Shader::load( std::string filename, GLuint shaderType ) {
   std::ostringstream os;
   std::string line;
@@ -76,6 +175,10 @@ int Shader::load( std::string filename, GLuint shaderType ) {
     d_fragShaderTxt=os.str();
     d_fragShaderRead=true;
     break;
+  case GL_COMPUTE_SHADER:
+    d_compShaderTxt=os.str();
+    d_compShaderRead=true;
+    break;
   default:
     cerr << "Invalid shader type: " <<  shaderType << endl;
     return -2;
@@ -84,6 +187,34 @@ int Shader::load( std::string filename, GLuint shaderType ) {
 }
   
 
+int Shader::define( const std::string& _macro, GLuint shaderType ) {
+  std::string* txt;
+  switch (shaderType) {
+  case GL_VERTEX_SHADER:
+    if ( !d_vertShaderRead ) return -2;
+    txt = &d_vertShaderTxt;
+    break;
+  case GL_FRAGMENT_SHADER:
+    if ( !d_fragShaderRead ) return -2;
+    txt = &d_fragShaderTxt;
+    break;
+  case GL_COMPUTE_SHADER:
+    if ( !d_compShaderRead ) return -2;
+    txt = &d_compShaderTxt;
+    break;
+  default:
+    cerr << "Invalid shader type: " <<  shaderType << endl;
+    return -2;
+  }
+  // nothing but comments may precede #version
+  size_t pos = txt->find("#version");
+  pos = pos == std::string::npos ? 0 : txt->find('\n', pos);
+  pos = pos == std::string::npos ? txt->size() : pos + 1;
+  txt->insert(pos, "#define " + _macro + "\n");
+  return 0;
+}
+
+
 int Shader::installShader( GLuint& handle, GLuint shaderType ) {
   handle = glCreateShader( shaderType );
   if ( handle == GL_INVALID_OPERATION ) {
@@ -111,6 +242,13 @@ int Shader::installShader( GLuint& handle, GLuint shaderType ) {
       return -2;
     }
     break;
+  case GL_COMPUTE_SHADER:
+    if ( d_compShaderRead ) {
+      shaderTxt = static_cast<const GLchar*>(d_compShaderTxt.c_str());
+    } else { 
+      return -2;
+    }
+    break;
   default:
     cerr << "Invalid shader type: " <<  shaderType << endl;
     return -2;
@@ -60,10 +60,22 @@ namespace CSI4130 {
 
 void getGlVersion( int& major, int& minor );
 
+// Install a KHR_debug message callback reporting messages of at least
+// _minSeverity. Repeated messages are only counted. With _synchronous the
+// callback runs in the offending GL call (useful in a debugger) at the
+// cost of serializing the driver. Returns 0 on success.
+int installDebugOutput( GLenum _minSeverity = GL_DEBUG_SEVERITY_LOW,
+			bool _synchronous = false );
+
+
+// Number of glGetError checks by _printOpenGLerrors, e.g., to estimate
+// what the errorOut() checks of a frame cost
+extern unsigned long long g_errorChecks;
 
 inline int _printOpenGLerrors(const char *file, int line) {
   GLenum glErrCode;
   int res=0;
+  ++g_errorChecks;
   while (GL_NO_ERROR != (glErrCode = glGetError())) {
     cerr <<"glError in file: " << file << " line: " << line 
     << " -- " << gluErrorString(glErrCode) << endl;
@@ -76,19 +88,31 @@ inline int _printOpenGLerrors(const char *file, int line) {
 /* inline int errorOut() { */
 /*   return _printOpenGLerrors(__FILE__, __LINE__); */
 /* } */
+// glGetError is a round trip into the driver. Release builds and builds
+// relying on the debug output callback do not check after every call.
+#if defined(NDEBUG) || defined(CSI4130_GL_DEBUG_OUTPUT)
+#define errorOut() ((void)0)
+#else
 #define errorOut() _printOpenGLerrors(__FILE__, __LINE__)
+#endif
 
 class Shader {
   std::string d_vertShaderTxt;
   std::string d_fragShaderTxt;
+  std::string d_compShaderTxt;
   bool d_vertShaderRead;
   bool d_fragShaderRead;
+  bool d_compShaderRead;
  public:
-  Shader() : d_vertShaderRead(false), d_fragShaderRead(false) {}
+  Shader() : d_vertShaderRead(false), d_fragShaderRead(false),
+	     d_compShaderRead(false) {}
 
   /** All functions will return 0 on success */
   // Load a shader from file
   int load( std::string filename, GLuint shaderType );
+  // Add "#define _macro" after the #version line of a shader previously
+  // read, e.g., to select a variant of its source
+  int define( const std::string& _macro, GLuint shaderType );
   // Install a shader previously read
   int installShader( GLuint& handle, GLuint shaderType );
 
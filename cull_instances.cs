@@ -0,0 +1,77 @@
+// ==========================================================================
+// $Id: cull_instances.cs $
+// Frustum culling of the instances into indirect draw commands
+// ==========================================================================
+// Every invocation tests the bounding sphere of one instance against the
+// six planes of the view frustum. A visible instance takes the next slot
+// of its material block by an atomic increment of the instance count of
+// the block's DrawElementsIndirectCommand and copies its attributes to
+// that slot, i.e., after the command's base instance. The draws read the
+// counts from the command buffer, nothing goes back to the host.
+// ==========================================================================
+#version 430 core
+
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  uint baseVertex;
+  uint baseInstance;
+};
+
+// one command per block of the material table
+layout (std430, binding = 0) buffer Commands {
+  DrawCommand command[];
+};
+
+// all instances, grouped by material block
+layout (std430, binding = 1) readonly buffer Transforms {
+  mat4 modelMatrix[];
+};
+layout (std430, binding = 2) readonly buffer Materials {
+  uint materialIndex[];
+};
+layout (std430, binding = 3) readonly buffer Colors {
+  vec4 color[];
+};
+
+// the visible instances
+layout (std430, binding = 4) writeonly buffer VisibleTransforms {
+  mat4 visibleModelMatrix[];
+};
+layout (std430, binding = 5) writeonly buffer VisibleMaterials {
+  uint visibleMaterialIndex[];
+};
+layout (std430, binding = 6) writeonly buffer VisibleColors {
+  vec4 visibleColor[];
+};
+
+uniform int First;
+uniform int Count;
+// world space, normalized, inside if dot(xyz, p) + w >= 0
+uniform vec4 Planes[6];
+// bounding sphere of the shape about the instance origin
+uniform float Radius;
+uniform bool HasMaterials;
+uniform bool HasColors;
+
+// entries of the material table bound per draw, MaterialArray::BLOCK_SIZE
+const uint BLOCK_SIZE = 64u;
+
+void main() {
+  uint i = uint(First) + gl_GlobalInvocationID.x;
+  if ( i >= uint(Count) ) return;
+  // the model matrices are rigid, the sphere is centered on the origin
+  vec3 center = modelMatrix[i][3].xyz;
+  for ( int p=0; p<6; ++p ) {
+    if ( dot(Planes[p].xyz, center) + Planes[p].w < -Radius ) return;
+  }
+  uint block = HasMaterials ? materialIndex[i] / BLOCK_SIZE : 0u;
+  uint slot = command[block].baseInstance +
+    atomicAdd(command[block].instanceCount, 1u);
+  visibleModelMatrix[slot] = modelMatrix[i];
+  if ( HasMaterials ) visibleMaterialIndex[slot] = materialIndex[i];
+  if ( HasColors ) visibleColor[slot] = color[i];
+}
@@ -0,0 +1,8 @@
+// ==========================================================================
+// $Id: depth_only.fs $
+// Depth pre-pass: no color output, only the depth is written
+// ==========================================================================
+#version 330 core
+
+void main() {
+}
@@ -0,0 +1,61 @@
+// ==========================================================================
+// $Id: depth_only.vs $
+// Depth pre-pass: position only, same transform as lit_boxes.vs
+// ==========================================================================
+#version 330 core
+// instance fetch variants as in lit_boxes.vs
+#ifdef INSTANCE_FETCH_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+layout (location=0) in vec4 position;
+
+#if defined(INSTANCE_FETCH_TBO)
+uniform samplerBuffer InstanceMatrices;
+#elif defined(INSTANCE_FETCH_SSBO)
+layout (std430) readonly buffer InstanceMatrices {
+  mat4 instanceMatrix[];
+};
+#else
+layout (location = 3) in mat4 ModelMatrix;	
+#endif
+uniform int InstanceBase = 0;
+
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
+// multi-view as in lit_boxes.vs
+uniform float NumViews = 1.0;
+uniform mat4 ViewMatrices[5];
+uniform vec4 ViewTiles[5];
+out float gl_ClipDistance[4];
+
+// the lit pass tests with GL_EQUAL against this depth
+invariant gl_Position;
+
+void main() {
+  // same operations in the same order as lit_boxes.vs
+  int nViews = int(NumViews);
+  int view = gl_InstanceID % nViews;
+  mat4 View = nViews > 1 ? ViewMatrices[view] : ViewMatrix;
+  int instance = InstanceBase + gl_InstanceID / nViews;
+#if defined(INSTANCE_FETCH_TBO)
+  mat4 ModelMatrix = mat4(texelFetch(InstanceMatrices, 4 * instance),
+			  texelFetch(InstanceMatrices, 4 * instance + 1),
+			  texelFetch(InstanceMatrices, 4 * instance + 2),
+			  texelFetch(InstanceMatrices, 4 * instance + 3));
+#elif defined(INSTANCE_FETCH_SSBO)
+  mat4 ModelMatrix = instanceMatrix[instance];
+#endif
+  mat4 ModelViewMatrix = View * ModelMatrix;
+  vec4 posVec = ModelViewMatrix * position;
+  gl_Position = ProjectionMatrix * posVec;
+  gl_ClipDistance[0] = gl_Position.w + gl_Position.x;
+  gl_ClipDistance[1] = gl_Position.w - gl_Position.x;
+  gl_ClipDistance[2] = gl_Position.w + gl_Position.y;
+  gl_ClipDistance[3] = gl_Position.w - gl_Position.y;
+  if ( nViews > 1 ) {
+    gl_Position.xy = ViewTiles[view].xy * gl_Position.w +
+      ViewTiles[view].zw * gl_Position.xy;
+  }
+}
@@ -0,0 +1,188 @@
+// ==========================================================================
+// $Id: frame_timer.cpp $
+// Frame pacing for a continuous render loop and rolling frame statistics
+// ==========================================================================
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <GL/glew.h>
+#if WIN32
+#include <GL/wglew.h>
+#else
+#include <GL/glxew.h>
+#endif
+
+#include "frame_timer.h"
+
+namespace CSI4130 {
+
+const char* pacingName( PacingPolicy _policy ) {
+  switch (_policy) {
+  case PACING_ON_DEMAND: return "on demand";
+  case PACING_UNLOCKED: return "unlocked";
+  case PACING_VSYNC: return "vsync";
+  case PACING_TARGET_FPS: return "target fps";
+  default: return "unknown";
+  }
+}
+
+
+int setSwapInterval( int _interval ) {
+#if WIN32
+  if ( WGLEW_EXT_swap_control ) {
+    return wglSwapIntervalEXT(_interval) ? 0 : -1;
+  }
+#else
+  if ( GLXEW_EXT_swap_control ) {
+    glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(),
+		       _interval);
+    return 0;
+  }
+  if ( GLXEW_MESA_swap_control ) {
+    return glXSwapIntervalMESA(_interval);
+  }
+#endif
+  return -1;
+}
+
+
+FrameStats::FrameStats( int _window ) : d_times(_window, 0.0f),
+					d_next(0), d_count(0) {
+}
+
+
+void FrameStats::addFrame( float _ms ) {
+  d_times[d_next] = _ms;
+  d_next = (d_next + 1) % d_times.size();
+  d_count = std::min(d_count + 1, static_cast<int>(d_times.size()));
+  return;
+}
+
+
+void FrameStats::clear() {
+  d_next = 0;
+  d_count = 0;
+  return;
+}
+
+
+FrameStats::Summary FrameStats::summarize( float _jankMs ) const {
+  Summary sum;
+  if ( d_count == 0 ) return sum;
+  std::vector<float> sorted(d_times.begin(), d_times.begin() + d_count);
+  std::sort(sorted.begin(), sorted.end());
+  double total = 0.0;
+  for ( int i=0; i<d_count; ++i ) total += sorted[i];
+  sum.d_frames = d_count;
+  sum.d_mean = static_cast<float>(total / d_count);
+  sum.d_fps = sum.d_mean > 0.0f ? 1000.0f / sum.d_mean : 0.0f;
+  sum.d_p50 = sorted[(d_count - 1) / 2];
+  sum.d_p95 = sorted[(d_count - 1) * 95 / 100];
+  sum.d_p99 = sorted[(d_count - 1) * 99 / 100];
+  sum.d_max = sorted[d_count - 1];
+  float threshold = _jankMs > 0.0f ? _jankMs : 2.0f * sum.d_p50;
+  sum.d_jank = static_cast<int>
+    (sorted.end() - std::upper_bound(sorted.begin(), sorted.end(), threshold));
+  return sum;
+}
+
+
+FramePacer::FramePacer( double _targetFps, double _reportInterval ) :
+  d_policy(PACING_ON_DEMAND), d_targetFps(_targetFps),
+  d_reportInterval(_reportInterval), d_started(false) {
+}
+
+
+void FramePacer::setPolicy( PacingPolicy _policy ) {
+  d_policy = _policy;
+  setSwapInterval( d_policy == PACING_VSYNC ? 1 : 0 );
+  // statistics of different policies should not be mixed
+  d_stats.clear();
+  d_started = false;
+  return;
+}
+
+
+PacingPolicy FramePacer::getPolicy() const {
+  return d_policy;
+}
+
+
+bool FramePacer::isContinuous() const {
+  return d_policy != PACING_ON_DEMAND;
+}
+
+
+void FramePacer::setTargetFps( double _fps ) {
+  d_targetFps = std::max(_fps, 1.0);
+  return;
+}
+
+
+double FramePacer::getTargetFps() const {
+  return d_targetFps;
+}
+
+
+int FramePacer::msUntilNextFrame() const {
+  if ( d_policy != PACING_TARGET_FPS || !d_started ) return 0;
+  long long ms = std::chrono::duration_cast<std::chrono::milliseconds>
+    (d_next - Clock::now()).count();
+  return ms > 0 ? static_cast<int>(ms) : 0;
+}
+
+
+void FramePacer::frameDone() {
+  Clock::time_point now = Clock::now();
+  if ( d_started ) {
+    d_stats.addFrame( std::chrono::duration<float, std::milli>
+		      (now - d_last).count());
+  } else {
+    d_lastReport = now;
+    d_next = now;
+    d_started = true;
+  }
+  d_last = now;
+  // schedule relative to the previous deadline to avoid drift, but do not
+  // try to catch up after a long frame
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>
+    (std::chrono::duration<double>(1.0 / d_targetFps));
+  d_next += period;
+  if ( d_next < now ) d_next = now;
+  return;
+}
+
+
+bool FramePacer::reportDue() {
+  if ( !d_started || !isContinuous() ) return false;
+  Clock::time_point now = Clock::now();
+  if ( std::chrono::duration<double>(now - d_lastReport).count()
+       < d_reportInterval ) {
+    return false;
+  }
+  d_lastReport = now;
+  return true;
+}
+
+
+FrameStats::Summary FramePacer::summarize() const {
+  // at a fixed rate, anything missing the period by half is jank
+  float jankMs = d_policy == PACING_TARGET_FPS ?
+    static_cast<float>(1500.0 / d_targetFps) : 0.0f;
+  return d_stats.summarize( jankMs );
+}
+
+
+std::string FramePacer::report() const {
+  FrameStats::Summary sum = summarize();
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(2)
+     << pacingName(d_policy) << ": " << sum.d_fps << " fps, mean "
+     << sum.d_mean << " ms, p95 " << sum.d_p95 << " ms, p99 "
+     << sum.d_p99 << " ms, max " << sum.d_max << " ms, jank "
+     << sum.d_jank << "/" << sum.d_frames;
+  return os.str();
+}
+
+} // end namespace
@@ -0,0 +1,99 @@
+// ==========================================================================
+// $Id: frame_timer.h $
+// Frame pacing for a continuous render loop and rolling frame statistics
+// ==========================================================================
+#ifndef CSI4130_FRAME_TIMER_H_
+#define CSI4130_FRAME_TIMER_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace CSI4130 {
+
+enum PacingPolicy {
+  PACING_ON_DEMAND = 0, // redraw only after input (glutPostRedisplay)
+  PACING_UNLOCKED, // redraw as fast as possible, no vsync
+  PACING_VSYNC, // redraw continuously, swap locked to the display
+  PACING_TARGET_FPS, // redraw at a fixed rate, no vsync
+  PACING_NUM_POLICIES
+};
+
+const char* pacingName( PacingPolicy _policy );
+
+// Set the swap interval of the current context (0 = off, 1 = vsync)
+// Returns 0 on success
+int setSwapInterval( int _interval );
+
+
+/*
+ * Rolling window of frame times
+ */
+class FrameStats {
+ public:
+  struct Summary {
+    int d_frames;
+    float d_fps;
+    float d_mean; // all times in ms
+    float d_p50;
+    float d_p95;
+    float d_p99;
+    float d_max;
+    int d_jank; // frames longer than the jank threshold
+    Summary() : d_frames(0), d_fps(0.0f), d_mean(0.0f), d_p50(0.0f),
+		d_p95(0.0f), d_p99(0.0f), d_max(0.0f), d_jank(0) {}
+  };
+
+ private:
+  std::vector<float> d_times; // ring buffer in ms
+  int d_next;
+  int d_count;
+
+ public:
+  explicit FrameStats( int _window = 600 );
+
+  void addFrame( float _ms );
+  void clear();
+  // A frame is jank if it takes longer than _jankMs. With _jankMs <= 0
+  // twice the median of the window is used.
+  Summary summarize( float _jankMs = 0.0f ) const;
+};
+
+
+/*
+ * Decides when the next frame is due and collects the frame times
+ */
+class FramePacer {
+  typedef std::chrono::steady_clock Clock;
+
+  PacingPolicy d_policy;
+  double d_targetFps;
+  double d_reportInterval; // seconds
+  bool d_started;
+  Clock::time_point d_last;
+  Clock::time_point d_next;
+  Clock::time_point d_lastReport;
+  FrameStats d_stats;
+
+ public:
+  FramePacer( double _targetFps = 60.0, double _reportInterval = 2.0 );
+
+  // Applies the swap interval - needs a current GL context
+  void setPolicy( PacingPolicy _policy );
+  PacingPolicy getPolicy() const;
+  bool isContinuous() const;
+  void setTargetFps( double _fps );
+  double getTargetFps() const;
+
+  // ms until the next frame should start (0 if due)
+  int msUntilNextFrame() const;
+  // Call once per presented frame, after the swap
+  void frameDone();
+  // True once per report interval; the summary is of the current window
+  bool reportDue();
+  FrameStats::Summary summarize() const;
+  std::string report() const;
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,282 @@
+// ==========================================================================
+// $Id: gl_state.cpp $
+// Thin GL state tracker which skips redundant binds, enables and uniforms
+// ==========================================================================
+#include <cstring>
+
+#include "gl_state.h"
+
+namespace CSI4130 {
+
+GLStateCache::GLStateCache() : d_programKnown(false), d_program(0),
+			       d_vaoKnown(false), d_vao(0),
+			       d_restartKnown(false), d_restartIndex(0),
+			       d_depthFuncKnown(false), d_depthFunc(GL_LESS),
+			       d_depthMaskKnown(false), d_depthMask(GL_TRUE),
+			       d_colorMaskKnown(false), d_colorMask(GL_TRUE),
+			       d_issued(0), d_elided(0),
+			       d_lastIssued(0), d_lastElided(0) {
+}
+
+
+void GLStateCache::useProgram( GLuint _program ) {
+  if ( d_programKnown && d_program == _program ) {
+    ++d_elided;
+    return;
+  }
+  glUseProgram(_program);
+  d_program = _program;
+  d_programKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::bindVertexArray( GLuint _vao ) {
+  if ( d_vaoKnown && d_vao == _vao ) {
+    ++d_elided;
+    return;
+  }
+  glBindVertexArray(_vao);
+  d_vao = _vao;
+  d_vaoKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::bindBuffer( GLenum _target, GLuint _buffer ) {
+  if ( _target == GL_ELEMENT_ARRAY_BUFFER ) {
+    // only meaningful with a known vao
+    std::map<GLuint, GLuint>::iterator iter = d_elementBuffer.find(d_vao);
+    if ( d_vaoKnown && iter != d_elementBuffer.end() &&
+	 iter->second == _buffer ) {
+      ++d_elided;
+      return;
+    }
+    glBindBuffer(_target, _buffer);
+    if ( d_vaoKnown ) d_elementBuffer[d_vao] = _buffer;
+    ++d_issued;
+    return;
+  }
+  std::map<GLenum, GLuint>::iterator iter = d_buffers.find(_target);
+  if ( iter != d_buffers.end() && iter->second == _buffer ) {
+    ++d_elided;
+    return;
+  }
+  glBindBuffer(_target, _buffer);
+  d_buffers[_target] = _buffer;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::bindBufferRange( GLenum _target, GLuint _index,
+				    GLuint _buffer, GLintptr _offset,
+				    GLsizeiptr _size ) {
+  std::map<BindingKey, BufferRange>::iterator iter =
+    d_ranges.find(BindingKey(_target, _index));
+  if ( iter != d_ranges.end() && iter->second.d_buffer == _buffer &&
+       iter->second.d_offset == _offset && iter->second.d_size == _size ) {
+    ++d_elided;
+    return;
+  }
+  glBindBufferRange(_target, _index, _buffer, _offset, _size);
+  BufferRange range = { _buffer, _offset, _size };
+  d_ranges[BindingKey(_target, _index)] = range;
+  d_buffers[_target] = _buffer;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::enable( GLenum _cap ) {
+  std::map<GLenum, bool>::iterator iter = d_caps.find(_cap);
+  if ( iter != d_caps.end() && iter->second ) {
+    ++d_elided;
+    return;
+  }
+  glEnable(_cap);
+  d_caps[_cap] = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::disable( GLenum _cap ) {
+  std::map<GLenum, bool>::iterator iter = d_caps.find(_cap);
+  if ( iter != d_caps.end() && !iter->second ) {
+    ++d_elided;
+    return;
+  }
+  glDisable(_cap);
+  d_caps[_cap] = false;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::primitiveRestartIndex( GLuint _index ) {
+  if ( d_restartKnown && d_restartIndex == _index ) {
+    ++d_elided;
+    return;
+  }
+  glPrimitiveRestartIndex(_index);
+  d_restartIndex = _index;
+  d_restartKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::depthFunc( GLenum _func ) {
+  if ( d_depthFuncKnown && d_depthFunc == _func ) {
+    ++d_elided;
+    return;
+  }
+  glDepthFunc(_func);
+  d_depthFunc = _func;
+  d_depthFuncKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::depthMask( GLboolean _write ) {
+  if ( d_depthMaskKnown && d_depthMask == _write ) {
+    ++d_elided;
+    return;
+  }
+  glDepthMask(_write);
+  d_depthMask = _write;
+  d_depthMaskKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+void GLStateCache::colorMask( GLboolean _write ) {
+  if ( d_colorMaskKnown && d_colorMask == _write ) {
+    ++d_elided;
+    return;
+  }
+  glColorMask(_write, _write, _write, _write);
+  d_colorMask = _write;
+  d_colorMaskKnown = true;
+  ++d_issued;
+  return;
+}
+
+
+bool GLStateCache::uniformChanged( GLuint _program, GLint _loc,
+				   const GLfloat* _v, int _size ) {
+  // inactive uniform - nothing to upload
+  if ( _loc < 0 ) return false;
+  std::map<UniformKey, UniformValue>::iterator iter =
+    d_uniforms.find(UniformKey(_program, _loc));
+  if ( iter != d_uniforms.end() && iter->second.d_size == _size &&
+       memcmp(iter->second.d_value, _v, sizeof(GLfloat) * _size) == 0 ) {
+    ++d_elided;
+    return false;
+  }
+  UniformValue& val = d_uniforms[UniformKey(_program, _loc)];
+  memcpy(val.d_value, _v, sizeof(GLfloat) * _size);
+  val.d_size = _size;
+  ++d_issued;
+  return true;
+}
+
+
+void GLStateCache::programUniform1f( GLuint _program, GLint _loc,
+				     GLfloat _v ) {
+  if ( uniformChanged(_program, _loc, &_v, 1) ) {
+    glProgramUniform1f(_program, _loc, _v);
+  }
+  return;
+}
+
+
+void GLStateCache::programUniform1i( GLuint _program, GLint _loc,
+				     GLint _v ) {
+  // the cache compares bits, an int fits a float's slot
+  GLfloat bits;
+  memcpy(&bits, &_v, sizeof(GLfloat));
+  if ( uniformChanged(_program, _loc, &bits, 1) ) {
+    glProgramUniform1i(_program, _loc, _v);
+  }
+  return;
+}
+
+
+void GLStateCache::programUniform3fv( GLuint _program, GLint _loc,
+				      const GLfloat* _v ) {
+  if ( uniformChanged(_program, _loc, _v, 3) ) {
+    glProgramUniform3fv(_program, _loc, 1, _v);
+  }
+  return;
+}
+
+
+void GLStateCache::programUniform4fv( GLuint _program, GLint _loc,
+				      const GLfloat* _v ) {
+  if ( uniformChanged(_program, _loc, _v, 4) ) {
+    glProgramUniform4fv(_program, _loc, 1, _v);
+  }
+  return;
+}
+
+
+void GLStateCache::programUniformMatrix4fv( GLuint _program, GLint _loc,
+					    const GLfloat* _v ) {
+  if ( uniformChanged(_program, _loc, _v, 16) ) {
+    glProgramUniformMatrix4fv(_program, _loc, 1, GL_FALSE, _v);
+  }
+  return;
+}
+
+
+void GLStateCache::invalidate() {
+  d_programKnown = false;
+  d_vaoKnown = false;
+  d_elementBuffer.clear();
+  d_buffers.clear();
+  d_ranges.clear();
+  d_caps.clear();
+  d_restartKnown = false;
+  d_depthFuncKnown = false;
+  d_depthMaskKnown = false;
+  d_colorMaskKnown = false;
+  d_uniforms.clear();
+  return;
+}
+
+
+void GLStateCache::invalidateProgram( GLuint _program ) {
+  std::map<UniformKey, UniformValue>::iterator iter =
+    d_uniforms.lower_bound(UniformKey(_program, -1));
+  while ( iter != d_uniforms.end() && iter->first.first == _program ) {
+    d_uniforms.erase(iter++);
+  }
+  return;
+}
+
+
+void GLStateCache::beginFrame() {
+  d_lastIssued = d_issued;
+  d_lastElided = d_elided;
+  d_issued = 0;
+  d_elided = 0;
+  return;
+}
+
+
+int GLStateCache::getIssued() const {
+  return d_lastIssued;
+}
+
+
+int GLStateCache::getElided() const {
+  return d_lastElided;
+}
+
+} // end namespace
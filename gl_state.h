@@ -0,0 +1,102 @@
+// ==========================================================================
+// $Id: gl_state.h $
+// Thin GL state tracker which skips redundant binds, enables and uniforms
+// ==========================================================================
+// All state changes of the render loop go through GLStateCache. A call is
+// only forwarded to GL if the value differs from what the cache last set.
+// Code which changes GL state behind the cache's back must call
+// invalidate() afterwards.
+// ==========================================================================
+#ifndef CSI4130_GL_STATE_H_
+#define CSI4130_GL_STATE_H_
+
+#include <map>
+#include <utility>
+
+// gl types
+#include <GL/glew.h>
+
+namespace CSI4130 {
+
+class GLStateCache {
+  // last value uploaded to a uniform location
+  struct UniformValue {
+    GLfloat d_value[16];
+    int d_size;
+  };
+  typedef std::pair<GLuint, GLint> UniformKey;
+  // buffer range bound to an indexed binding point
+  struct BufferRange {
+    GLuint d_buffer;
+    GLintptr d_offset;
+    GLsizeiptr d_size;
+  };
+  typedef std::pair<GLenum, GLuint> BindingKey;
+
+  bool d_programKnown;
+  GLuint d_program;
+  bool d_vaoKnown;
+  GLuint d_vao;
+  // element array binding is part of the VAO state
+  std::map<GLuint, GLuint> d_elementBuffer;
+  std::map<GLenum, GLuint> d_buffers;
+  std::map<BindingKey, BufferRange> d_ranges;
+  std::map<GLenum, bool> d_caps;
+  bool d_restartKnown;
+  GLuint d_restartIndex;
+  bool d_depthFuncKnown;
+  GLenum d_depthFunc;
+  bool d_depthMaskKnown;
+  GLboolean d_depthMask;
+  bool d_colorMaskKnown;
+  GLboolean d_colorMask;
+  std::map<UniformKey, UniformValue> d_uniforms;
+
+  // counters for the current and the last completed frame
+  int d_issued;
+  int d_elided;
+  int d_lastIssued;
+  int d_lastElided;
+
+ public:
+  GLStateCache();
+
+  void useProgram( GLuint _program );
+  void bindVertexArray( GLuint _vao );
+  void bindBuffer( GLenum _target, GLuint _buffer );
+  // also binds _buffer to the generic _target
+  void bindBufferRange( GLenum _target, GLuint _index, GLuint _buffer,
+			GLintptr _offset, GLsizeiptr _size );
+  void enable( GLenum _cap );
+  void disable( GLenum _cap );
+  void primitiveRestartIndex( GLuint _index );
+  void depthFunc( GLenum _func );
+  void depthMask( GLboolean _write );
+  // same mask for all four channels
+  void colorMask( GLboolean _write );
+
+  void programUniform1f( GLuint _program, GLint _loc, GLfloat _v );
+  void programUniform1i( GLuint _program, GLint _loc, GLint _v );
+  void programUniform3fv( GLuint _program, GLint _loc, const GLfloat* _v );
+  void programUniform4fv( GLuint _program, GLint _loc, const GLfloat* _v );
+  void programUniformMatrix4fv( GLuint _program, GLint _loc,
+				const GLfloat* _v );
+
+  // forget all tracked state, e.g., after raw GL calls
+  void invalidate();
+  // forget the uniforms of a program, e.g., after relinking
+  void invalidateProgram( GLuint _program );
+
+  // start counting a new frame
+  void beginFrame();
+  // GL calls forwarded and skipped during the last completed frame
+  int getIssued() const;
+  int getElided() const;
+
+ private:
+  bool uniformChanged( GLuint _program, GLint _loc,
+		       const GLfloat* _v, int _size );
+};
+
+} // end namespace
+#endif
@@ -0,0 +1,220 @@
+// ==========================================================================
+// $Id: gpu_cull.cpp $
+// Frustum culling of the instances on the GPU with indirect draws
+// ==========================================================================
+#include <algorithm>
+#include <vector>
+
+#include "shader.h"
+#include "gpu_cull.h"
+
+namespace CSI4130 {
+
+namespace {
+// invocations per work group, as in cull_instances.cs
+const int c_groupSize = 64;
+// the minimum of GL_MAX_COMPUTE_WORK_GROUP_COUNT
+const int c_maxGroups = 65535;
+}
+
+
+GpuCuller::GpuCuller() : d_program(0), d_locFirst(-1), d_locCount(-1),
+			 d_locPlanes(-1), d_locRadius(-1),
+			 d_locHasMaterials(-1), d_locHasColors(-1),
+			 d_tfms(0), d_materials(0), d_colors(0),
+			 d_capacity(0), d_colorCapacity(0), d_commands(0),
+			 d_frame(0), d_visibleSum(0), d_testedSum(0),
+			 d_nFrames(0) {
+  for ( int r=0; r<2; ++r ) {
+    d_readback[r] = 0;
+    d_fence[r] = 0;
+    d_readbackCommands[r] = 0;
+    d_readbackTested[r] = 0;
+  }
+}
+
+
+bool GpuCuller::isSupported() {
+  return GLEW_VERSION_4_3 ||
+    (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object &&
+     GLEW_ARB_draw_indirect && GLEW_ARB_base_instance);
+}
+
+
+int GpuCuller::init( const char* _cs ) {
+  if ( !isSupported() ) {
+    cerr << "GPU culling: no GL 4.3 compute shaders" << endl;
+    return -1;
+  }
+  Shader shader;
+  if ( shader.load(_cs, GL_COMPUTE_SHADER) != 0 ) return -1;
+  GLuint handle;
+  if ( shader.installShader(handle, GL_COMPUTE_SHADER) != 0 ||
+       Shader::compile(handle) != 0 ) {
+    return -1;
+  }
+  vector<GLuint> handles(1, handle);
+  GLuint program;
+  if ( Shader::installProgram(handles, program) != 0 ) return -1;
+  d_program = program;
+  d_locFirst = glGetUniformLocation(d_program, "First");
+  d_locCount = glGetUniformLocation(d_program, "Count");
+  d_locPlanes = glGetUniformLocation(d_program, "Planes");
+  d_locRadius = glGetUniformLocation(d_program, "Radius");
+  d_locHasMaterials = glGetUniformLocation(d_program, "HasMaterials");
+  d_locHasColors = glGetUniformLocation(d_program, "HasColors");
+  // the names go into the vertex arrays of the culled draws
+  glGenBuffers(1, &d_tfms);
+  glGenBuffers(1, &d_materials);
+  glGenBuffers(1, &d_colors);
+  glGenBuffers(1, &d_commands);
+  glGenBuffers(2, d_readback);
+  errorOut();
+  return 0;
+}
+
+
+void GpuCuller::cull( GLuint _tfms, GLuint _materials, GLuint _colors,
+		      int _n, const std::vector<int>& _blockFirst,
+		      GLsizei _nIndices, const glm::mat4& _viewProj,
+		      float _radius, GLStateCache& _glState ) {
+  collectStats();
+  reserve(_n, _colors != 0);
+  // all blocks start out empty
+  int nCommands = std::max(static_cast<int>(_blockFirst.size()), 1);
+  d_reset.resize(nCommands);
+  for ( int b=0; b<nCommands; ++b ) {
+    DrawCommand cmd = { static_cast<GLuint>(_nIndices), 0, 0, 0,
+			b < static_cast<int>(_blockFirst.size()) ?
+			static_cast<GLuint>(_blockFirst[b]) : 0 };
+    d_reset[b] = cmd;
+  }
+  // orphaned, the draws of the last frame may still read the commands
+  glBindBuffer(GL_COPY_WRITE_BUFFER, d_commands);
+  glBufferData(GL_COPY_WRITE_BUFFER, sizeof(DrawCommand) * nCommands,
+	       d_reset.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if ( _n > 0 ) {
+    _glState.useProgram(d_program);
+    glm::vec4 planes[6];
+    frustumPlanes(_viewProj, planes);
+    glProgramUniform4fv(d_program, d_locPlanes, 6, &planes[0][0]);
+    glProgramUniform1f(d_program, d_locRadius, _radius);
+    glProgramUniform1i(d_program, d_locHasMaterials, _materials != 0);
+    glProgramUniform1i(d_program, d_locHasColors, _colors != 0);
+    glProgramUniform1i(d_program, d_locCount, _n);
+    // absent streams are never accessed, any buffer will do
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, d_commands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _tfms);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2,
+		     _materials ? _materials : _tfms);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, _colors ? _colors : _tfms);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, d_tfms);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, d_materials);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, _colors ? d_colors : d_tfms);
+    for ( int b=0; b<_n; b+=c_maxGroups * c_groupSize ) {
+      int groups = std::min((_n - b + c_groupSize - 1) / c_groupSize,
+			    c_maxGroups);
+      glProgramUniform1i(d_program, d_locFirst, b);
+      glDispatchCompute(groups, 1, 1);
+    }
+    // the draws read the commands and the visible instances, the
+    // statistics copy the commands
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT |
+		    GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+		    GL_BUFFER_UPDATE_BARRIER_BIT);
+  }
+  int r = d_frame % 2;
+  if ( !d_fence[r] ) {
+    glBindBuffer(GL_COPY_READ_BUFFER, d_commands);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, d_readback[r]);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(DrawCommand) * nCommands,
+		 NULL, GL_STREAM_READ);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+			sizeof(DrawCommand) * nCommands);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    d_fence[r] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    d_readbackCommands[r] = nCommands;
+    d_readbackTested[r] = _n;
+  }
+  ++d_frame;
+  errorOut();
+  return;
+}
+
+
+void GpuCuller::resetStats() {
+  d_visibleSum = 0;
+  d_testedSum = 0;
+  d_nFrames = 0;
+  return;
+}
+
+
+// Gribb and Hartmann: the planes are sums and differences of the rows
+void GpuCuller::frustumPlanes( const glm::mat4& _viewProj,
+			       glm::vec4 _planes[6] ) {
+  glm::vec4 row[4];
+  for ( int r=0; r<4; ++r ) {
+    row[r] = glm::vec4(_viewProj[0][r], _viewProj[1][r], _viewProj[2][r],
+		       _viewProj[3][r]);
+  }
+  for ( int p=0; p<6; ++p ) {
+    glm::vec4 plane = p % 2 == 0 ? row[3] + row[p / 2] : row[3] - row[p / 2];
+    _planes[p] = plane / glm::length(glm::vec3(plane));
+  }
+  return;
+}
+
+
+// Storage for _n visible instances; the contents are rewritten every pass
+void GpuCuller::reserve( int _n, bool _colors ) {
+  if ( _n > d_capacity ) {
+    d_capacity = std::max(_n, d_capacity + d_capacity / 2);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, d_tfms);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+		 static_cast<GLsizeiptr>(d_capacity) * sizeof(glm::mat4), NULL,
+		 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, d_materials);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+		 static_cast<GLsizeiptr>(d_capacity) * sizeof(GLuint), NULL,
+		 GL_DYNAMIC_COPY);
+  }
+  if ( _colors && _n > d_colorCapacity ) {
+    d_colorCapacity = d_capacity;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, d_colors);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+		 static_cast<GLsizeiptr>(d_colorCapacity) * sizeof(glm::vec4),
+		 NULL, GL_DYNAMIC_COPY);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return;
+}
+
+
+// Add the counts of the copies which the GPU has finished
+void GpuCuller::collectStats() {
+  for ( int r=0; r<2; ++r ) {
+    if ( !d_fence[r] ) continue;
+    GLenum status = glClientWaitSync(d_fence[r], 0, 0);
+    if ( status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED ) {
+      continue;
+    }
+    glDeleteSync(d_fence[r]);
+    d_fence[r] = 0;
+    std::vector<DrawCommand> cmds(d_readbackCommands[r]);
+    glBindBuffer(GL_COPY_READ_BUFFER, d_readback[r]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0,
+		       sizeof(DrawCommand) * cmds.size(), cmds.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    for ( size_t c=0; c<cmds.size(); ++c ) {
+      d_visibleSum += cmds[c].d_instanceCount;
+    }
+    d_testedSum += d_readbackTested[r];
+    ++d_nFrames;
+  }
+  return;
+}
+
+} // end namespace
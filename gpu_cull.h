@@ -0,0 +1,156 @@
+// ==========================================================================
+// $Id: gpu_cull.h $
+// Frustum culling of the instances on the GPU with indirect draws
+// ==========================================================================
+// A compute pass tests the bounding sphere of every instance in the
+// instance attribute buffers against the view frustum and compacts the
+// visible ones into buffers of the culler, which the culled vertex arrays
+// read. The number of visible instances of each material block is
+// counted atomically in the instanceCount of the block's
+// DrawElementsIndirectCommand; the draws take it from there with
+// glDrawElementsIndirect. The host writes the commands with zero
+// instances before the pass and never reads them back for drawing.
+//
+// Statistics are copied out of the command buffer after the pass and
+// read once a fence says the copy is done, so they never stall.
+// ==========================================================================
+#ifndef CSI4130_GPU_CULL_H_
+#define CSI4130_GPU_CULL_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+
+namespace CSI4130 {
+
+class GpuCuller {
+ public:
+  // as read by glDrawElementsIndirect
+  struct DrawCommand {
+    GLuint d_count;
+    GLuint d_instanceCount;
+    GLuint d_firstIndex;
+    GLuint d_baseVertex;
+    GLuint d_baseInstance;
+  };
+
+ private:
+  GLuint d_program;
+  GLint d_locFirst;
+  GLint d_locCount;
+  GLint d_locPlanes;
+  GLint d_locRadius;
+  GLint d_locHasMaterials;
+  GLint d_locHasColors;
+  // visible instances
+  GLuint d_tfms;
+  GLuint d_materials;
+  GLuint d_colors;
+  // allocated instances
+  int d_capacity;
+  int d_colorCapacity;
+  // one command per material block
+  GLuint d_commands;
+  std::vector<DrawCommand> d_reset;
+  // copies of the commands for the statistics, read when their fence
+  // has signalled
+  GLuint d_readback[2];
+  GLsync d_fence[2];
+  int d_readbackCommands[2];
+  int d_readbackTested[2];
+  int d_frame;
+  // statistics since the last resetStats()
+  long long d_visibleSum;
+  long long d_testedSum;
+  int d_nFrames;
+
+ public:
+  GpuCuller();
+
+  // GL 4.3 or the compute shader, storage buffer and indirect draw
+  // extensions
+  static bool isSupported();
+
+  // Compile the compute program _cs; returns 0 on success
+  int init( const char* _cs );
+  inline bool isReady() const;
+
+  // Cull the first _n instances of the attribute buffers (0 if absent)
+  // for the camera _viewProj. The instances of material block b start at
+  // _blockFirst[b]; every block gets a command of _nIndices indices.
+  void cull( GLuint _tfms, GLuint _materials, GLuint _colors, int _n,
+	     const std::vector<int>& _blockFirst, GLsizei _nIndices,
+	     const glm::mat4& _viewProj, float _radius,
+	     GLStateCache& _glState );
+
+  // attribute buffers of the culled draws, names stay the same
+  inline GLuint getTransforms() const;
+  inline GLuint getMaterials() const;
+  inline GLuint getColors() const;
+  // command buffer and the offset of the command of block _block
+  inline GLuint getCommands() const;
+  inline static size_t getCommandOffset( int _block );
+
+  // statistics
+  inline int getNFrames() const;
+  inline double getVisibleFraction() const;
+  inline long long getTestedSum() const;
+  void resetStats();
+
+  // Normalized planes of the frustum of _viewProj, inside is positive
+  static void frustumPlanes( const glm::mat4& _viewProj, glm::vec4 _planes[6] );
+
+ private:
+  void reserve( int _n, bool _colors );
+  void collectStats();
+
+  // no copy or assignment
+  GpuCuller(const GpuCuller& _oCuller );
+  GpuCuller& operator=( const GpuCuller& _oCuller );
+};
+
+
+bool GpuCuller::isReady() const {
+  return d_program != 0;
+}
+
+GLuint GpuCuller::getTransforms() const {
+  return d_tfms;
+}
+
+GLuint GpuCuller::getMaterials() const {
+  return d_materials;
+}
+
+GLuint GpuCuller::getColors() const {
+  return d_colors;
+}
+
+GLuint GpuCuller::getCommands() const {
+  return d_commands;
+}
+
+size_t GpuCuller::getCommandOffset( int _block ) {
+  return sizeof(DrawCommand) * _block;
+}
+
+int GpuCuller::getNFrames() const {
+  return d_nFrames;
+}
+
+double GpuCuller::getVisibleFraction() const {
+  return d_testedSum > 0 ?
+    static_cast<double>(d_visibleSum) / d_testedSum : 0.0;
+}
+
+long long GpuCuller::getTestedSum() const {
+  return d_testedSum;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,156 @@
+// ==========================================================================
+// $Id: instance_compute.cpp $
+// Instance transforms generated and animated by compute shaders
+// ==========================================================================
+#include <algorithm>
+#include <vector>
+
+#include "shader.h"
+#include "instance_compute.h"
+
+namespace CSI4130 {
+
+namespace {
+// invocations per work group, as in instances.cs
+const int c_groupSize = 64;
+// the minimum of GL_MAX_COMPUTE_WORK_GROUP_COUNT
+const int c_maxGroups = 65535;
+// vec4 axis and angle, offset and omega, position
+const int c_stateBytes = 3 * 4 * sizeof(GLfloat);
+
+enum ComputePass {
+  PASS_GENERATE = 0,
+  PASS_ANIMATE
+};
+}
+
+
+InstanceCompute::InstanceCompute() : d_program(0), d_locPass(-1),
+				     d_locFirst(-1), d_locCount(-1),
+				     d_locSeed(-1), d_locVolume(-1),
+				     d_locDt(-1), d_locOrbit(-1),
+				     d_stateBuffer(0), d_stateCapacity(0),
+				     d_nInstances(0) {
+}
+
+
+bool InstanceCompute::isSupported() {
+  return GLEW_VERSION_4_3 ||
+    (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+
+int InstanceCompute::init( const char* _cs ) {
+  if ( !isSupported() ) {
+    cerr << "Compute instances: no GL 4.3 compute shaders" << endl;
+    return -1;
+  }
+  Shader shader;
+  if ( shader.load(_cs, GL_COMPUTE_SHADER) != 0 ) return -1;
+  GLuint handle;
+  if ( shader.installShader(handle, GL_COMPUTE_SHADER) != 0 ||
+       Shader::compile(handle) != 0 ) {
+    return -1;
+  }
+  vector<GLuint> handles(1, handle);
+  GLuint program;
+  if ( Shader::installProgram(handles, program) != 0 ) return -1;
+  d_program = program;
+  d_locPass = glGetUniformLocation(d_program, "Pass");
+  d_locFirst = glGetUniformLocation(d_program, "First");
+  d_locCount = glGetUniformLocation(d_program, "Count");
+  d_locSeed = glGetUniformLocation(d_program, "Seed");
+  d_locVolume = glGetUniformLocation(d_program, "Volume");
+  d_locDt = glGetUniformLocation(d_program, "Dt");
+  d_locOrbit = glGetUniformLocation(d_program, "Orbit");
+  glGenBuffers(1, &d_stateBuffer);
+  errorOut();
+  return 0;
+}
+
+
+void InstanceCompute::generate( GLuint _tfms, unsigned _seed,
+				glm::vec3 _volume, int _first, int _n,
+				GLStateCache& _glState ) {
+  _first = std::min(_first, d_nInstances);
+  reserveStates(_n, _first);
+  d_nInstances = _n;
+  if ( _first >= _n ) return;
+  _glState.useProgram(d_program);
+  glProgramUniform1ui(d_program, d_locSeed, _seed);
+  glProgramUniform3fv(d_program, d_locVolume, 1, &_volume[0]);
+  dispatch(_tfms, PASS_GENERATE, _first, _n);
+  return;
+}
+
+
+void InstanceCompute::animate( GLuint _tfms, float _dt, AnimationMode _mode,
+			       GLStateCache& _glState ) {
+  if ( _mode == ANIMATION_OFF || d_nInstances == 0 ) return;
+  _glState.useProgram(d_program);
+  glProgramUniform1f(d_program, d_locDt, _dt);
+  glProgramUniform1i(d_program, d_locOrbit, _mode == ANIMATION_ORBIT);
+  dispatch(_tfms, PASS_ANIMATE, 0, d_nInstances);
+  return;
+}
+
+
+void InstanceCompute::readTransforms( GLuint _tfms, int _n, glm::mat4* _dst ) {
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, _tfms);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(glm::mat4) * _n, _dst);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  errorOut();
+  return;
+}
+
+
+// Grow by half like the instance buffers; the state of the first _keep
+// instances is copied on the GPU
+void InstanceCompute::reserveStates( int _n, int _keep ) {
+  if ( _n <= d_stateCapacity ) return;
+  int capacity = std::max(_n, d_stateCapacity + d_stateCapacity / 2);
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER,
+	       static_cast<GLsizeiptr>(capacity) * c_stateBytes, NULL,
+	       GL_DYNAMIC_COPY);
+  if ( _keep > 0 ) {
+    glBindBuffer(GL_COPY_READ_BUFFER, d_stateBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+			static_cast<GLsizeiptr>(_keep) * c_stateBytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &d_stateBuffer);
+  d_stateBuffer = buffer;
+  d_stateCapacity = capacity;
+  errorOut();
+  return;
+}
+
+
+// Run _pass for instances [_first,_n); the program is current
+void InstanceCompute::dispatch( GLuint _tfms, int _pass, int _first,
+				int _n ) {
+  glProgramUniform1i(d_program, d_locPass, _pass);
+  glProgramUniform1i(d_program, d_locCount, _n);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, d_stateBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _tfms);
+  // more than 4M instances take several dispatches
+  for ( int b=_first; b<_n; b+=c_maxGroups * c_groupSize ) {
+    int groups = std::min((_n - b + c_groupSize - 1) / c_groupSize,
+			  c_maxGroups);
+    glProgramUniform1i(d_program, d_locFirst, b);
+    glDispatchCompute(groups, 1, 1);
+  }
+  // the draws read the matrices as vertex attributes, the next pass
+  // reads the state
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+		  GL_SHADER_STORAGE_BARRIER_BIT);
+  errorOut();
+  return;
+}
+
+} // end namespace
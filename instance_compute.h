@@ -0,0 +1,83 @@
+// ==========================================================================
+// $Id: instance_compute.h $
+// Instance transforms generated and animated by compute shaders
+// ==========================================================================
+// The compute program writes the model matrices straight into the
+// instance attribute buffer of the draws, bound as a shader storage
+// buffer, so the transforms never pass through host memory. Generation
+// follows Attributes (same seed, same volume, same matrices up to
+// rounding) and the animation follows InstanceAnimation, whose state is
+// kept in a second storage buffer of the class.
+//
+// Needs GL 4.3 compute shaders and shader storage buffers. The host side
+// only issues dispatches; readTransforms() is for verification.
+// ==========================================================================
+#ifndef CSI4130_INSTANCE_COMPUTE_H_
+#define CSI4130_INSTANCE_COMPUTE_H_
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "gl_state.h"
+
+namespace CSI4130 {
+
+class InstanceCompute {
+  GLuint d_program;
+  GLint d_locPass;
+  GLint d_locFirst;
+  GLint d_locCount;
+  GLint d_locSeed;
+  GLint d_locVolume;
+  GLint d_locDt;
+  GLint d_locOrbit;
+  // animation state of the instances
+  GLuint d_stateBuffer;
+  int d_stateCapacity; // instances
+  int d_nInstances;
+
+ public:
+  InstanceCompute();
+
+  // GL 4.3 or the compute shader and storage buffer extensions
+  static bool isSupported();
+
+  // Compile the compute program _cs; returns 0 on success
+  int init( const char* _cs );
+  inline bool isReady() const;
+
+  // Place instances [_first,_n) for _seed in _volume; instances below
+  // _first keep their matrix and state. _tfms holds at least _n matrices.
+  void generate( GLuint _tfms, unsigned _seed, glm::vec3 _volume,
+		 int _first, int _n, GLStateCache& _glState );
+  // Advance all instances by _dt seconds
+  void animate( GLuint _tfms, float _dt, AnimationMode _mode,
+		GLStateCache& _glState );
+  inline int getNInstances() const;
+
+  // Copy the first _n matrices of _tfms to _dst; waits for the GPU
+  static void readTransforms( GLuint _tfms, int _n, glm::mat4* _dst );
+
+ private:
+  void reserveStates( int _n, int _keep );
+  void dispatch( GLuint _tfms, int _pass, int _first, int _n );
+
+  // no copy or assignment
+  InstanceCompute(const InstanceCompute& _oCompute );
+  InstanceCompute& operator=( const InstanceCompute& _oCompute );
+};
+
+
+bool InstanceCompute::isReady() const {
+  return d_program != 0;
+}
+
+int InstanceCompute::getNInstances() const {
+  return d_nInstances;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,165 @@
+// ==========================================================================
+// $Id: instance_sort.cpp $
+// Per-frame depth ordering of the instances
+// ==========================================================================
+#include <algorithm>
+#include <cfloat>
+
+#include "instance_sort.h"
+
+namespace CSI4130 {
+
+namespace {
+const int c_radixBits = 8;
+const int c_radixSize = 1 << c_radixBits;
+const int c_depthBits = 16;
+// smallest block worth a job
+const int c_minBlock = 1 << 14;
+
+// first element of block _b of _nBlocks
+inline int blockBegin( int _n, int _b, int _nBlocks ) {
+  return static_cast<long long>(_n) * _b / _nBlocks;
+}
+}
+
+
+const char* sortOrderName( SortOrder _order ) {
+  switch (_order) {
+  case SORT_NONE: return "none";
+  case SORT_FRONT_TO_BACK: return "front to back";
+  case SORT_BACK_TO_FRONT: return "back to front";
+  default: return "unknown";
+  }
+}
+
+
+InstanceSorter::InstanceSorter() : d_n(0), d_current(0) {
+}
+
+
+int InstanceSorter::numBlocks( int _n, JobSystem& _jobs ) const {
+  // a few blocks per thread to balance the load
+  int nBlocks = std::min(4 * _jobs.getNumThreads(),
+			 (_n + c_minBlock - 1) / c_minBlock);
+  return std::max(nBlocks, 1);
+}
+
+
+void InstanceSorter::sort( const glm::mat4* _tfms, int _n,
+			   const glm::mat4& _view, SortOrder _order,
+			   JobSystem& _jobs ) {
+  d_n = _n;
+  d_current = 0;
+  d_order[0].resize(_n);
+  if ( _order == SORT_NONE ) {
+    for ( int i=0; i<_n; ++i ) d_order[0][i] = i;
+    return;
+  }
+  d_depth.resize(_n);
+  d_keys[0].resize(_n);
+  int nBlocks = numBlocks(_n, _jobs);
+  d_blockMin.assign(nBlocks, FLT_MAX);
+  d_blockMax.assign(nBlocks, -FLT_MAX);
+  // the camera looks down -z: depth is -z of the origin in view space
+  glm::vec4 row(-_view[0][2], -_view[1][2], -_view[2][2], -_view[3][2]);
+  _jobs.parallelFor(0, nBlocks, 1, [&](int _bBegin, int _bEnd) {
+      for ( int b=_bBegin; b<_bEnd; ++b ) {
+	float dMin = FLT_MAX, dMax = -FLT_MAX;
+	for ( int i=blockBegin(_n, b, nBlocks); i<blockBegin(_n, b+1, nBlocks);
+	      ++i ) {
+	  const glm::vec4& pos = _tfms[i][3];
+	  float depth = row.x * pos.x + row.y * pos.y + row.z * pos.z + row.w;
+	  d_depth[i] = depth;
+	  dMin = std::min(dMin, depth);
+	  dMax = std::max(dMax, depth);
+	}
+	d_blockMin[b] = dMin;
+	d_blockMax[b] = dMax;
+      }
+    });
+  float dMin = *std::min_element(d_blockMin.begin(), d_blockMin.end());
+  float dMax = *std::max_element(d_blockMax.begin(), d_blockMax.end());
+  const uint32_t maxKey = (1u << c_depthBits) - 1;
+  float scale = dMax > dMin ? maxKey / (dMax - dMin) : 0.0f;
+  bool backToFront = _order == SORT_BACK_TO_FRONT;
+  uint32_t* keys = d_keys[0].data();
+  _jobs.parallelFor(0, _n, c_minBlock, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	uint32_t q = std::min(static_cast<uint32_t>((d_depth[i] - dMin) * scale),
+			      maxKey);
+	keys[i] = backToFront ? maxKey - q : q;
+      }
+    });
+  radixSort(keys, _n, c_depthBits, _jobs);
+  return;
+}
+
+
+void InstanceSorter::radixSort( const uint32_t* _keys, int _n, int _keyBits,
+				JobSystem& _jobs ) {
+  d_n = _n;
+  d_current = 0;
+  for ( int k=0; k<2; ++k ) {
+    d_keys[k].resize(_n);
+    d_order[k].resize(_n);
+  }
+  if ( _keys != d_keys[0].data() ) {
+    std::copy(_keys, _keys + _n, d_keys[0].begin());
+  }
+  for ( int i=0; i<_n; ++i ) d_order[0][i] = i;
+  int nBlocks = numBlocks(_n, _jobs);
+  d_hist.resize(nBlocks * c_radixSize);
+  for ( int shift=0; shift<_keyBits; shift+=c_radixBits ) {
+    const uint32_t* keyIn = d_keys[d_current].data();
+    const uint32_t* orderIn = d_order[d_current].data();
+    uint32_t* keyOut = d_keys[1 - d_current].data();
+    uint32_t* orderOut = d_order[1 - d_current].data();
+    // digit counts of each block
+    _jobs.parallelFor(0, nBlocks, 1, [&](int _bBegin, int _bEnd) {
+	for ( int b=_bBegin; b<_bEnd; ++b ) {
+	  uint32_t hist[c_radixSize] = { 0 };
+	  int s = shift;
+	  for ( int i=blockBegin(_n, b, nBlocks); i<blockBegin(_n, b+1, nBlocks);
+		++i ) {
+	    ++hist[(keyIn[i] >> s) & (c_radixSize - 1)];
+	  }
+	  std::copy(hist, hist + c_radixSize, &d_hist[b * c_radixSize]);
+	}
+      });
+    // start of each digit in each block: all smaller digits, then the
+    // same digit of the earlier blocks
+    uint32_t start = 0;
+    bool singleDigit = false;
+    for ( int d=0; d<c_radixSize; ++d ) {
+      uint32_t digitStart = start;
+      for ( int b=0; b<nBlocks; ++b ) {
+	uint32_t count = d_hist[b * c_radixSize + d];
+	d_hist[b * c_radixSize + d] = start;
+	start += count;
+      }
+      if ( start - digitStart == static_cast<uint32_t>(_n) ) singleDigit = true;
+    }
+    // nothing moves if all keys have the same digit
+    if ( singleDigit ) continue;
+    _jobs.parallelFor(0, nBlocks, 1, [&](int _bBegin, int _bEnd) {
+	for ( int b=_bBegin; b<_bEnd; ++b ) {
+	  // local copies: the stores below could alias the offsets
+	  uint32_t next[c_radixSize];
+	  std::copy(&d_hist[b * c_radixSize], &d_hist[(b + 1) * c_radixSize],
+		    next);
+	  int s = shift;
+	  for ( int i=blockBegin(_n, b, nBlocks); i<blockBegin(_n, b+1, nBlocks);
+		++i ) {
+	    uint32_t key = keyIn[i];
+	    uint32_t dst = next[(key >> s) & (c_radixSize - 1)]++;
+	    keyOut[dst] = key;
+	    orderOut[dst] = orderIn[i];
+	  }
+	}
+      });
+    d_current = 1 - d_current;
+  }
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,102 @@
+// ==========================================================================
+// $Id: instance_sort.h $
+// Per-frame depth ordering of the instances
+// ==========================================================================
+// Drawing near instances first lets the depth test reject the fragments
+// of hidden instances before they are shaded (early-z); back to front is
+// the order needed for blending. The view space depth of each instance
+// origin is quantised to 16 bits within the depth range of the frame and
+// the instances are ordered with a parallel LSD radix sort (two passes
+// of 8 bits). Each pass counts digits per block in parallel, computes the
+// block offsets serially and scatters the blocks in parallel, so the sort
+// is stable and its result does not depend on the number of threads.
+// ==========================================================================
+#ifndef CSI4130_INSTANCE_SORT_H_
+#define CSI4130_INSTANCE_SORT_H_
+
+#include <cstdint>
+#include <vector>
+
+// glm types
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+
+namespace CSI4130 {
+
+enum SortOrder {
+  SORT_NONE = 0, // generation order
+  SORT_FRONT_TO_BACK,
+  SORT_BACK_TO_FRONT,
+  SORT_NUM_ORDERS
+};
+
+const char* sortOrderName( SortOrder _order );
+
+
+class InstanceSorter {
+  int d_n;
+  std::vector<float> d_depth;
+  // keys and instance numbers, double buffered for the radix passes
+  std::vector<uint32_t> d_keys[2];
+  std::vector<uint32_t> d_order[2];
+  int d_current;
+  // per block: depth range and digit counts
+  std::vector<float> d_blockMin;
+  std::vector<float> d_blockMax;
+  std::vector<uint32_t> d_hist;
+
+ public:
+  InstanceSorter();
+
+  // Order the _n instances with model matrices _tfms seen with _view
+  void sort( const glm::mat4* _tfms, int _n, const glm::mat4& _view,
+	     SortOrder _order, JobSystem& _jobs = JobSystem::global() );
+
+  // Sort _n keys; the result is in getOrder() and getKeys()
+  void radixSort( const uint32_t* _keys, int _n, int _keyBits,
+		  JobSystem& _jobs = JobSystem::global() );
+
+  // Instance number of the i-th instance to draw
+  inline const uint32_t* getOrder() const;
+  inline const uint32_t* getKeys() const;
+  inline int size() const;
+
+  // _out[i] = _in[getOrder()[i]]
+  template <class T>
+  void gather( const T* _in, T* _out,
+	       JobSystem& _jobs = JobSystem::global() ) const;
+
+ private:
+  int numBlocks( int _n, JobSystem& _jobs ) const;
+
+  // no copy or assignment
+  InstanceSorter(const InstanceSorter& _oSorter );
+  InstanceSorter& operator=( const InstanceSorter& _oSorter );
+};
+
+
+const uint32_t* InstanceSorter::getOrder() const {
+  return d_order[d_current].data();
+}
+
+const uint32_t* InstanceSorter::getKeys() const {
+  return d_keys[d_current].data();
+}
+
+int InstanceSorter::size() const {
+  return d_n;
+}
+
+template <class T>
+void InstanceSorter::gather( const T* _in, T* _out,
+			     JobSystem& _jobs ) const {
+  const uint32_t* order = getOrder();
+  _jobs.parallelFor(0, d_n, 1 << 14, [=](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) _out[i] = _in[order[i]];
+    });
+  return;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,636 @@
+// ==========================================================================
+// $Id: instance_store.cpp $
+// Out-of-core instances paged in by chunks from a memory mapped file
+// ==========================================================================
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "instance_store.h"
+#include "instance_sort.h"
+#include "scene.h"
+
+namespace CSI4130 {
+
+namespace {
+const char c_magic[8] = { 'L', 'B', 'S', 'T', 'O', 'R', 'E', '1' };
+// chunks start on a page
+const uint64_t c_page = 4096;
+// requests in the loader queue; the rest waits for the next frame so the
+// queue follows the camera
+const int c_maxQueued = 8;
+// chunks per job
+const int c_grain = 256;
+// records read at a time from every run while merging
+const int c_mergeBlock = 4096;
+
+struct Header {
+  char d_magic[8];
+  uint32_t d_nChunks;
+  uint32_t d_chunkCapacity;
+  uint64_t d_nInstances;
+};
+
+// instance data of a chunk in the file, rounded up to whole pages
+uint64_t chunkBytes( int _capacity ) {
+  uint64_t bytes = static_cast<uint64_t>(_capacity) *
+    (sizeof(glm::mat4) + sizeof(GLuint));
+  return (bytes + c_page - 1) / c_page * c_page;
+}
+
+// An instance of a sorted run in the temporary file
+struct RunRecord {
+  uint32_t d_key;
+  GLuint d_material;
+  glm::mat4 d_tfm;
+};
+
+// A run being merged, read a block at a time
+struct RunReader {
+  long long d_next; // next record in the file
+  long long d_end;
+  std::vector<RunRecord> d_block;
+  size_t d_pos;
+};
+
+// files beyond 2 GB
+int seek( FILE* _file, long long _offset ) {
+#ifdef _WIN32
+  return _fseeki64(_file, _offset, SEEK_SET);
+#else
+  return fseeko(_file, _offset, SEEK_SET);
+#endif
+}
+
+// Next block of _run from _runs; false if it cannot be read
+bool readBlock( FILE* _runs, RunReader& _run ) {
+  size_t n = std::min<long long>(c_mergeBlock, _run.d_end - _run.d_next);
+  _run.d_block.resize(n);
+  _run.d_pos = 0;
+  if ( seek(_runs, _run.d_next * sizeof(RunRecord)) != 0 ||
+       fread(_run.d_block.data(), sizeof(RunRecord), n, _runs) != n ) {
+    return false;
+  }
+  _run.d_next += n;
+  return true;
+}
+
+// Spread the 10 low bits of _x to every third bit
+uint32_t spreadBits( uint32_t _x ) {
+  _x &= 0x3ff;
+  _x = (_x | (_x << 16)) & 0x030000ff;
+  _x = (_x | (_x << 8)) & 0x0300f00f;
+  _x = (_x | (_x << 4)) & 0x030c30c3;
+  _x = (_x | (_x << 2)) & 0x09249249;
+  return _x;
+}
+}
+
+
+InstanceStore::InstanceStore( size_t _hostBytes, size_t _gpuBytes ) :
+  d_map(0), d_mapBytes(0),
+#ifdef _WIN32
+  d_fileHandle(0), d_mapHandle(0),
+#else
+  d_fd(-1),
+#endif
+  d_chunkCapacity(0), d_nInstances(0), d_min(0.0f), d_max(0.0f),
+  d_hostBudget(_hostBytes), d_gpuBudget(_gpuBytes), d_quit(false),
+  d_loading(0), d_arrived(false), d_newLoads(0), d_newBytes(0),
+  d_newMs(0.0), d_frame(0), d_radius(1.0f), d_prefetch(0.0f) {
+  resetStats();
+}
+
+
+InstanceStore::~InstanceStore() {
+  close();
+}
+
+
+int InstanceStore::build( const char* _path, const char* _scenePath,
+			  int _chunkCapacity, int _runInstances,
+			  JobSystem& _jobs ) {
+  // first pass: the bounds of the positions for the Morton order
+  Scene scene;
+  SceneReader reader;
+  if ( reader.open(_scenePath, scene) != 0 ) return -1;
+  long long nInstances = scene.getNInstances();
+  int runSize = static_cast<int>
+    (std::max(std::min<long long>(_runInstances, nInstances), 1LL));
+  std::vector<glm::mat4> tfms(runSize);
+  std::vector<GLuint> materials(runSize);
+  int n;
+  while ( (n = reader.readChunk(scene, tfms.data(), materials.data(),
+				runSize, _jobs)) > 0 ) {}
+  if ( n < 0 ) return -1;
+  glm::vec3 lo = reader.getMin(), hi = reader.getMax();
+  glm::vec3 scale = glm::vec3(1023.0f) / glm::max(hi - lo, glm::vec3(1.0e-6f));
+
+  // second pass: runs sorted by their keys into a temporary file
+  std::string runPath = std::string(_path) + ".runs";
+  FILE* runs = fopen(runPath.c_str(), "w+b");
+  if ( !runs ) {
+    std::cerr << runPath << ": cannot write" << std::endl;
+    return -1;
+  }
+  std::vector<long long> runBegin(1, 0);
+  if ( reader.open(_scenePath, scene) == 0 ) {
+    std::vector<uint32_t> keys(runSize);
+    std::vector<RunRecord> records(runSize);
+    InstanceSorter sorter;
+    while ( (n = reader.readChunk(scene, tfms.data(), materials.data(),
+				  runSize, _jobs)) > 0 ) {
+      _jobs.parallelFor(0, n, 1 << 14, [&](int _begin, int _end) {
+	  for ( int i=_begin; i<_end; ++i ) {
+	    glm::vec3 q = (glm::vec3(tfms[i][3]) - lo) * scale;
+	    keys[i] = spreadBits(static_cast<uint32_t>(q.x)) |
+	      spreadBits(static_cast<uint32_t>(q.y)) << 1 |
+	      spreadBits(static_cast<uint32_t>(q.z)) << 2;
+	  }
+	});
+      // the radix sort is stable, so equal keys keep the scene order
+      sorter.radixSort(keys.data(), n, 30, _jobs);
+      const uint32_t* order = sorter.getOrder();
+      const uint32_t* sorted = sorter.getKeys();
+      _jobs.parallelFor(0, n, 1 << 14, [&](int _begin, int _end) {
+	  for ( int i=_begin; i<_end; ++i ) {
+	    records[i].d_key = sorted[i];
+	    records[i].d_material = materials[order[i]];
+	    records[i].d_tfm = tfms[order[i]];
+	  }
+	});
+      if ( fwrite(records.data(), sizeof(RunRecord), n, runs) !=
+	   static_cast<size_t>(n) ) {
+	std::cerr << runPath << ": write failed" << std::endl;
+	n = -1;
+	break;
+      }
+      runBegin.push_back(runBegin.back() + n);
+    }
+  }
+  reader.close();
+  int res = -1;
+  if ( n == 0 && runBegin.back() == nInstances ) {
+    // the merge only holds a block per run
+    std::vector<glm::mat4>().swap(tfms);
+    std::vector<GLuint>().swap(materials);
+    res = mergeRuns(_path, runs, runBegin, _chunkCapacity);
+  }
+  fclose(runs);
+  remove(runPath.c_str());
+  return res;
+}
+
+
+int InstanceStore::mergeRuns( const char* _path, FILE* _runs,
+			      const std::vector<long long>& _runBegin,
+			      int _chunkCapacity ) {
+  long long nInstances = _runBegin.back();
+  Header header;
+  memcpy(header.d_magic, c_magic, sizeof(c_magic));
+  header.d_nChunks = (nInstances + _chunkCapacity - 1) / _chunkCapacity;
+  header.d_chunkCapacity = _chunkCapacity;
+  header.d_nInstances = nInstances;
+  std::vector<ChunkInfo> chunks(header.d_nChunks);
+  FILE* file = fopen(_path, "wb");
+  if ( !file ) {
+    std::cerr << _path << ": cannot write" << std::endl;
+    return -1;
+  }
+  // the chunk table is written again once the chunks are known
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(chunks.data(), sizeof(ChunkInfo), chunks.size(), file);
+  uint64_t pos = sizeof(header) + sizeof(ChunkInfo) * chunks.size();
+  uint64_t offset = (pos + c_page - 1) / c_page * c_page;
+
+  // smallest key first, the earlier run on ties
+  typedef std::pair<uint32_t, int> Head;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+  std::vector<RunReader> runs(_runBegin.size() - 1);
+  bool ok = true;
+  for ( size_t r=0; ok && r<runs.size(); ++r ) {
+    runs[r].d_next = _runBegin[r];
+    runs[r].d_end = _runBegin[r+1];
+    ok = readBlock(_runs, runs[r]);
+    if ( ok && !runs[r].d_block.empty() ) {
+      heads.push(Head(runs[r].d_block[0].d_key, r));
+    }
+  }
+  std::vector<glm::mat4> tfms(_chunkCapacity);
+  std::vector<GLuint> materials(_chunkCapacity);
+  std::vector<char> zeros(c_page, 0);
+  for ( size_t c=0; ok && c<chunks.size(); ++c ) {
+    int count = std::min<long long>(_chunkCapacity,
+				    nInstances - c * _chunkCapacity);
+    glm::vec3 cMin(FLT_MAX), cMax(-FLT_MAX);
+    for ( int i=0; ok && i<count; ++i ) {
+      int r = heads.top().second;
+      RunReader& run = runs[r];
+      heads.pop();
+      const RunRecord& record = run.d_block[run.d_pos++];
+      tfms[i] = record.d_tfm;
+      materials[i] = record.d_material;
+      cMin = glm::min(cMin, glm::vec3(tfms[i][3]));
+      cMax = glm::max(cMax, glm::vec3(tfms[i][3]));
+      if ( run.d_pos == run.d_block.size() ) {
+	if ( run.d_next == run.d_end ) continue;
+	ok = readBlock(_runs, run);
+      }
+      if ( ok ) heads.push(Head(run.d_block[run.d_pos].d_key, r));
+    }
+    ChunkInfo& info = chunks[c];
+    for ( int k=0; k<3; ++k ) {
+      info.d_min[k] = cMin[k];
+      info.d_max[k] = cMax[k];
+    }
+    info.d_count = count;
+    info.d_pad = 0;
+    info.d_offset = offset;
+    offset += chunkBytes(_chunkCapacity);
+    // pad to the chunk
+    fwrite(zeros.data(), 1, info.d_offset - pos, file);
+    fwrite(tfms.data(), sizeof(glm::mat4), count, file);
+    fwrite(materials.data(), sizeof(GLuint), count, file);
+    pos = info.d_offset + count * (sizeof(glm::mat4) + sizeof(GLuint));
+  }
+  if ( !ok ) {
+    std::cerr << _path << ": cannot read the sorted runs" << std::endl;
+  }
+  seek(file, sizeof(header));
+  fwrite(chunks.data(), sizeof(ChunkInfo), chunks.size(), file);
+  ok = ok && !ferror(file);
+  fclose(file);
+  if ( !ok ) {
+    std::cerr << _path << ": write failed" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+int InstanceStore::open( const char* _path ) {
+  close();
+  d_path = _path;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+			    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if ( file == INVALID_HANDLE_VALUE ) {
+    std::cerr << _path << ": cannot open" << std::endl;
+    return -1;
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  d_fileHandle = file;
+  d_mapHandle = mapping;
+  d_mapBytes = size.QuadPart;
+  if ( mapping ) {
+    d_map = static_cast<const unsigned char*>
+      (MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  }
+#else
+  d_fd = ::open(_path, O_RDONLY);
+  if ( d_fd < 0 ) {
+    std::cerr << _path << ": cannot open" << std::endl;
+    return -1;
+  }
+  struct stat st;
+  fstat(d_fd, &st);
+  d_mapBytes = st.st_size;
+  void* map = mmap(0, d_mapBytes, PROT_READ, MAP_SHARED, d_fd, 0);
+  // chunks are read once, far apart
+  if ( map != MAP_FAILED ) {
+    madvise(map, d_mapBytes, MADV_RANDOM);
+    d_map = static_cast<const unsigned char*>(map);
+  }
+#endif
+  if ( !d_map ) {
+    std::cerr << _path << ": cannot map" << std::endl;
+    close();
+    return -1;
+  }
+  Header header;
+  if ( d_mapBytes < sizeof(header) ) {
+    std::cerr << _path << ": not an instance store" << std::endl;
+    close();
+    return -1;
+  }
+  memcpy(&header, d_map, sizeof(header));
+  size_t tableEnd = sizeof(header) +
+    static_cast<size_t>(header.d_nChunks) * sizeof(ChunkInfo);
+  if ( memcmp(header.d_magic, c_magic, sizeof(c_magic)) != 0 ||
+       header.d_chunkCapacity == 0 || tableEnd > d_mapBytes ) {
+    std::cerr << _path << ": not an instance store" << std::endl;
+    close();
+    return -1;
+  }
+  d_chunkCapacity = header.d_chunkCapacity;
+  d_nInstances = header.d_nInstances;
+  d_chunks.resize(header.d_nChunks);
+  memcpy(d_chunks.data(), d_map + sizeof(header),
+	 d_chunks.size() * sizeof(ChunkInfo));
+  d_min = glm::vec3(FLT_MAX);
+  d_max = glm::vec3(-FLT_MAX);
+  for ( size_t c=0; c<d_chunks.size(); ++c ) {
+    const ChunkInfo& info = d_chunks[c];
+    uint64_t end = info.d_offset +
+      info.d_count * (sizeof(glm::mat4) + sizeof(GLuint));
+    if ( info.d_count > header.d_chunkCapacity || end > d_mapBytes ) {
+      std::cerr << _path << ": chunk " << c << " is truncated" << std::endl;
+      close();
+      return -1;
+    }
+    d_min = glm::min(d_min, glm::vec3(info.d_min[0], info.d_min[1],
+				      info.d_min[2]));
+    d_max = glm::max(d_max, glm::vec3(info.d_max[0], info.d_max[1],
+				      info.d_max[2]));
+  }
+  d_chunkSlot.assign(d_chunks.size(), -1);
+  d_distance.resize(d_chunks.size());
+  size_t slotBytes = d_chunkCapacity * (sizeof(glm::mat4) + sizeof(GLuint));
+  int nSlots = std::max<size_t>(d_hostBudget / slotBytes, 1);
+  nSlots = std::min<size_t>(nSlots, d_chunks.size());
+  d_slots.resize(nSlots);
+  for ( int s=0; s<nSlots; ++s ) {
+    d_slots[s].d_chunk = -1;
+    d_slots[s].d_state = SLOT_FREE;
+    d_slots[s].d_lastWanted = 0;
+    d_slots[s].d_tfms.resize(d_chunkCapacity);
+    d_slots[s].d_materials.resize(d_chunkCapacity);
+  }
+  d_quit = false;
+  d_loader = std::thread(&InstanceStore::loaderLoop, this);
+  std::cerr << "Instance store " << _path << ": " << d_nInstances
+	    << " instances in " << d_chunks.size() << " chunks, "
+	    << nSlots << " host slots (" << (getHostBytes() >> 20)
+	    << " MB)" << std::endl;
+  return 0;
+}
+
+
+void InstanceStore::close() {
+  if ( d_loader.joinable() ) {
+    {
+      std::lock_guard<std::mutex> lock(d_mutex);
+      d_quit = true;
+      d_queue.clear();
+    }
+    d_wake.notify_all();
+    d_loader.join();
+  }
+#ifdef _WIN32
+  if ( d_map ) UnmapViewOfFile(d_map);
+  if ( d_mapHandle ) CloseHandle(d_mapHandle);
+  if ( d_fileHandle ) CloseHandle(d_fileHandle);
+  d_mapHandle = 0;
+  d_fileHandle = 0;
+#else
+  if ( d_map ) munmap(const_cast<unsigned char*>(d_map), d_mapBytes);
+  if ( d_fd >= 0 ) ::close(d_fd);
+  d_fd = -1;
+#endif
+  d_map = 0;
+  d_mapBytes = 0;
+  d_chunks.clear();
+  d_slots.clear();
+  d_chunkSlot.clear();
+  d_gathered.clear();
+  d_tfms.clear();
+  d_materials.clear();
+  d_loading = 0;
+  d_arrived = false;
+  return;
+}
+
+
+void InstanceStore::loaderLoop() {
+  std::unique_lock<std::mutex> lock(d_mutex);
+  while ( true ) {
+    d_wake.wait(lock, [this]() { return d_quit || !d_queue.empty(); });
+    if ( d_quit ) break;
+    Request request = d_queue.front();
+    d_queue.pop_front();
+    Slot& slot = d_slots[request.d_slot];
+    slot.d_state = SLOT_LOADING;
+    ++d_loading;
+    lock.unlock();
+    // the copy faults the pages in on this thread, not on the GL thread
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    const ChunkInfo& info = d_chunks[request.d_chunk];
+    const unsigned char* data = d_map + info.d_offset;
+    memcpy(slot.d_tfms.data(), data, info.d_count * sizeof(glm::mat4));
+    memcpy(slot.d_materials.data(), data + info.d_count * sizeof(glm::mat4),
+	   info.d_count * sizeof(GLuint));
+    double ms = std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    lock.lock();
+    slot.d_state = SLOT_READY;
+    --d_loading;
+    d_arrived = true;
+    ++d_newLoads;
+    d_newBytes += info.d_count * (sizeof(glm::mat4) + sizeof(GLuint));
+    d_newMs += ms;
+  }
+  return;
+}
+
+
+// Free slot or the least recently wanted ready slot not wanted this frame
+int InstanceStore::findSlot() {
+  int best = -1;
+  for ( size_t s=0; s<d_slots.size(); ++s ) {
+    const Slot& slot = d_slots[s];
+    if ( slot.d_state == SLOT_FREE ) return s;
+    if ( slot.d_state == SLOT_READY && slot.d_lastWanted != d_frame &&
+	 (best < 0 || slot.d_lastWanted < d_slots[best].d_lastWanted) ) {
+      best = s;
+    }
+  }
+  if ( best >= 0 ) {
+    d_chunkSlot[d_slots[best].d_chunk] = -1;
+    d_slots[best].d_chunk = -1;
+    d_slots[best].d_state = SLOT_FREE;
+    ++d_evictions;
+  }
+  return best;
+}
+
+
+bool InstanceStore::update( const glm::mat4& _view, const glm::mat4& _proj,
+			    JobSystem& _jobs ) {
+  if ( !d_map ) return false;
+  ++d_frame;
+  ++d_nFrames;
+  // frustum planes of proj * view (rows 3 +- 0, 1, 2), camera position
+  glm::mat4 m = _proj * _view;
+  glm::vec4 planes[6];
+  for ( int p=0; p<6; ++p ) {
+    int row = p / 2;
+    float sign = p % 2 ? -1.0f : 1.0f;
+    for ( int c=0; c<4; ++c ) planes[p][c] = m[c][3] + sign * m[c][row];
+  }
+  glm::vec3 eye(glm::inverse(_view)[3]);
+  std::vector<int> gathered;
+  // distance of every chunk, negative if it is in view
+  int nChunks = d_chunks.size();
+  float radius = d_radius;
+  _jobs.parallelFor(0, nChunks, c_grain, [&](int _begin, int _end) {
+      for ( int c=_begin; c<_end; ++c ) {
+	const ChunkInfo& info = d_chunks[c];
+	glm::vec3 lo = glm::vec3(info.d_min[0], info.d_min[1], info.d_min[2])
+	  - glm::vec3(radius);
+	glm::vec3 hi = glm::vec3(info.d_max[0], info.d_max[1], info.d_max[2])
+	  + glm::vec3(radius);
+	glm::vec3 d = glm::max(glm::max(lo - eye, eye - hi), glm::vec3(0.0f));
+	float dist = glm::length(d);
+	bool inside = true;
+	for ( int p=0; p<6 && inside; ++p ) {
+	  // corner furthest along the plane normal
+	  glm::vec3 corner(planes[p].x > 0.0f ? hi.x : lo.x,
+			   planes[p].y > 0.0f ? hi.y : lo.y,
+			   planes[p].z > 0.0f ? hi.z : lo.z);
+	  inside = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w >= 0.0f;
+	}
+	d_distance[c] = inside ? -1.0f - dist : dist;
+      }
+    });
+  // in view nearest first, then prefetch nearest first
+  d_wanted.clear();
+  for ( int c=0; c<nChunks; ++c ) {
+    if ( d_distance[c] < 0.0f || d_distance[c] <= d_prefetch ) {
+      d_wanted.push_back(c);
+    }
+  }
+  std::sort(d_wanted.begin(), d_wanted.end(), [this](int _a, int _b) {
+      bool inA = d_distance[_a] < 0.0f, inB = d_distance[_b] < 0.0f;
+      if ( inA != inB ) return inA;
+      return std::fabs(d_distance[_a]) < std::fabs(d_distance[_b]);
+    });
+  for ( size_t w=0; w<d_wanted.size(); ++w ) {
+    int s = d_chunkSlot[d_wanted[w]];
+    if ( s >= 0 ) d_slots[s].d_lastWanted = d_frame;
+  }
+  {
+    std::lock_guard<std::mutex> lock(d_mutex);
+    d_loads += d_newLoads;
+    d_bytesLoaded += d_newBytes;
+    d_loadMs += d_newMs;
+    d_newLoads = 0;
+    d_newBytes = 0;
+    d_newMs = 0.0;
+    d_arrived = false;
+    // requests not started yet are replaced by this frame's
+    for ( size_t r=0; r<d_queue.size(); ++r ) {
+      Slot& slot = d_slots[d_queue[r].d_slot];
+      d_chunkSlot[slot.d_chunk] = -1;
+      slot.d_chunk = -1;
+      slot.d_state = SLOT_FREE;
+    }
+    d_queue.clear();
+    bool full = false;
+    for ( size_t w=0; w<d_wanted.size(); ++w ) {
+      int c = d_wanted[w];
+      int s = d_chunkSlot[c];
+      if ( d_distance[c] < 0.0f && (s < 0 || d_slots[s].d_state != SLOT_READY) ) {
+	++d_misses;
+      }
+      if ( s >= 0 || full ||
+	   static_cast<int>(d_queue.size()) >= c_maxQueued ) continue;
+      s = findSlot();
+      // every slot holds a chunk wanted this frame
+      full = s < 0;
+      if ( full ) continue;
+      d_slots[s].d_chunk = c;
+      d_slots[s].d_state = SLOT_QUEUED;
+      d_slots[s].d_lastWanted = d_frame;
+      d_chunkSlot[c] = s;
+      Request request = { c, s };
+      d_queue.push_back(request);
+    }
+    // resident chunks in view, nearest first, up to the GPU budget
+    size_t bytes = 0;
+    for ( size_t w=0; w<d_wanted.size(); ++w ) {
+      int c = d_wanted[w];
+      if ( d_distance[c] >= 0.0f ) break;
+      int s = d_chunkSlot[c];
+      if ( s < 0 || d_slots[s].d_state != SLOT_READY ) continue;
+      bytes += d_chunks[c].d_count * (sizeof(glm::mat4) + sizeof(GLuint));
+      if ( bytes > d_gpuBudget ) break;
+      gathered.push_back(c);
+    }
+  }
+  d_wake.notify_one();
+  // ready slots only change on this thread; kept in chunk order so the
+  // same set is not gathered again
+  std::sort(gathered.begin(), gathered.end());
+  if ( gathered == d_gathered ) return false;
+  d_gathered.swap(gathered);
+  gather( _jobs );
+  return true;
+}
+
+
+void InstanceStore::gather( JobSystem& _jobs ) {
+  std::vector<int> first(d_gathered.size() + 1, 0);
+  for ( size_t g=0; g<d_gathered.size(); ++g ) {
+    first[g+1] = first[g] + d_chunks[d_gathered[g]].d_count;
+  }
+  d_tfms.resize(first.back());
+  d_materials.resize(first.back());
+  _jobs.parallelFor(0, d_gathered.size(), 1, [&](int _begin, int _end) {
+      for ( int g=_begin; g<_end; ++g ) {
+	const Slot& slot = d_slots[d_chunkSlot[d_gathered[g]]];
+	int count = first[g+1] - first[g];
+	memcpy(&d_tfms[first[g]], slot.d_tfms.data(),
+	       count * sizeof(glm::mat4));
+	memcpy(&d_materials[first[g]], slot.d_materials.data(),
+	       count * sizeof(GLuint));
+      }
+    });
+  return;
+}
+
+
+bool InstanceStore::isPending() {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  return !d_queue.empty() || d_loading > 0 || d_arrived;
+}
+
+
+int InstanceStore::getNResident() const {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  int n = 0;
+  for ( size_t s=0; s<d_slots.size(); ++s ) {
+    if ( d_slots[s].d_state == SLOT_READY ) ++n;
+  }
+  return n;
+}
+
+
+void InstanceStore::resetStats() {
+  d_loads = 0;
+  d_bytesLoaded = 0;
+  d_misses = 0;
+  d_evictions = 0;
+  d_nFrames = 0;
+  d_loadMs = 0.0;
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,277 @@
+// ==========================================================================
+// $Id: instance_store.h $
+// Out-of-core instances paged in by chunks from a memory mapped file
+// ==========================================================================
+// A store file holds the instances of a scene sorted along a Morton curve
+// of their positions and cut into chunks of a fixed number of instances,
+// so every chunk covers a compact region. The chunk table (bounds, count,
+// file offset) is read at open(); the instance data stays in the mapped
+// file and only chunks near the camera are copied into host slots.
+//
+// update() is called once per frame on the GL thread and never waits for
+// the disk:
+//   - chunks intersecting the view frustum are wanted first, nearest
+//     first, then chunks within the prefetch distance of the camera
+//   - wanted chunks that are resident are gathered, nearest first, into
+//     the instance arrays handed to the renderer up to the GPU budget;
+//     the arrays are only rebuilt when that set of chunks changes
+//   - missing chunks get a host slot (free or least recently wanted) and
+//     are queued for the loader thread, whose reads fault the pages in;
+//     a chunk shows up in the first update after it arrived.
+// ==========================================================================
+#ifndef CSI4130_INSTANCE_STORE_H_
+#define CSI4130_INSTANCE_STORE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+
+namespace CSI4130 {
+
+class InstanceStore {
+  // as in the file
+  struct ChunkInfo {
+    float d_min[3];
+    float d_max[3];
+    uint32_t d_count;
+    uint32_t d_pad;
+    uint64_t d_offset;
+  };
+
+  enum SlotState {
+    SLOT_FREE = 0,
+    SLOT_QUEUED,
+    SLOT_LOADING,
+    SLOT_READY
+  };
+
+  struct Slot {
+    int d_chunk;
+    SlotState d_state;
+    unsigned d_lastWanted; // frame
+    std::vector<glm::mat4> d_tfms;
+    std::vector<GLuint> d_materials;
+  };
+
+  struct Request {
+    int d_chunk;
+    int d_slot;
+  };
+
+  // file
+  std::string d_path;
+  const unsigned char* d_map;
+  size_t d_mapBytes;
+#ifdef _WIN32
+  void* d_fileHandle;
+  void* d_mapHandle;
+#else
+  int d_fd;
+#endif
+  int d_chunkCapacity;
+  long long d_nInstances;
+  std::vector<ChunkInfo> d_chunks;
+  glm::vec3 d_min;
+  glm::vec3 d_max;
+  // host residency
+  size_t d_hostBudget;
+  std::vector<Slot> d_slots;
+  std::vector<int> d_chunkSlot; // -1 if not resident
+  // instances handed to the renderer
+  size_t d_gpuBudget;
+  std::vector<int> d_gathered;
+  std::vector<glm::mat4> d_tfms;
+  std::vector<GLuint> d_materials;
+  // loader thread
+  std::thread d_loader;
+  mutable std::mutex d_mutex;
+  std::condition_variable d_wake;
+  std::deque<Request> d_queue;
+  bool d_quit;
+  int d_loading; // requests taken by the loader, not yet ready
+  bool d_arrived; // chunks ready since the last update()
+  // loader statistics not yet taken by update()
+  long long d_newLoads;
+  long long d_newBytes;
+  double d_newMs;
+  // per frame
+  unsigned d_frame;
+  float d_radius;
+  float d_prefetch;
+  std::vector<float> d_distance;
+  std::vector<int> d_wanted;
+  // statistics since the last resetStats()
+  long long d_loads;
+  long long d_bytesLoaded;
+  long long d_misses; // wanted in view but not resident
+  long long d_evictions;
+  int d_nFrames;
+  double d_loadMs;
+
+ public:
+  // _hostBytes of chunk slots in host memory, at most _gpuBytes of
+  // instance data per frame
+  InstanceStore( size_t _hostBytes = 256 << 20, size_t _gpuBytes = 64 << 20 );
+  ~InstanceStore();
+
+  // Write the instances of the scene file _scenePath to _path in chunks
+  // of _chunkCapacity. The scene is streamed twice, for the bounds and
+  // into sorted runs of _runInstances in a temporary file next to _path
+  // which are merged into the chunks, so it need not fit into memory.
+  // Returns 0 on success.
+  static int build( const char* _path, const char* _scenePath,
+		    int _chunkCapacity = 4096, int _runInstances = 1 << 20,
+		    JobSystem& _jobs = JobSystem::global() );
+
+  // Budgets of the next open()
+  inline void setBudgets( size_t _hostBytes, size_t _gpuBytes );
+
+  // Map the store _path and start the loader; returns 0 on success
+  int open( const char* _path );
+  void close();
+  inline bool isOpen() const;
+
+  // Instances are bounded by _radius about their position; chunks within
+  // _prefetch of the camera are loaded ahead of being seen
+  inline void setRadius( float _radius );
+  inline void setPrefetchDistance( float _prefetch );
+
+  // Choose, request and gather chunks for the camera; returns true if the
+  // instance arrays changed
+  bool update( const glm::mat4& _view, const glm::mat4& _proj,
+	       JobSystem& _jobs = JobSystem::global() );
+  // loads outstanding, i.e., another update() may bring more chunks
+  bool isPending();
+
+  inline const glm::mat4* getTransforms() const;
+  inline const GLuint* getMaterials() const;
+  inline int getNInstances() const;
+
+  inline long long getNTotal() const;
+  inline int getNChunks() const;
+  inline glm::vec3 getMin() const;
+  inline glm::vec3 getMax() const;
+
+  // statistics
+  int getNResident() const;
+  inline int getNGathered() const;
+  inline size_t getHostBytes() const;
+  inline long long getLoads() const;
+  inline long long getBytesLoaded() const;
+  inline long long getMisses() const;
+  inline long long getEvictions() const;
+  inline int getNFrames() const;
+  // ms the loader spent reading
+  inline double getLoadMs() const;
+  void resetStats();
+
+ private:
+  // Merge the sorted runs [_runBegin[r],_runBegin[r+1]) of _runs into
+  // the store _path; returns 0 on success
+  static int mergeRuns( const char* _path, FILE* _runs,
+			const std::vector<long long>& _runBegin,
+			int _chunkCapacity );
+  void loaderLoop();
+  int findSlot();
+  void gather( JobSystem& _jobs );
+
+  // no copy or assignment
+  InstanceStore(const InstanceStore& _oStore );
+  InstanceStore& operator=( const InstanceStore& _oStore );
+};
+
+
+bool InstanceStore::isOpen() const {
+  return d_map != 0;
+}
+
+void InstanceStore::setBudgets( size_t _hostBytes, size_t _gpuBytes ) {
+  d_hostBudget = _hostBytes;
+  d_gpuBudget = _gpuBytes;
+  return;
+}
+
+void InstanceStore::setRadius( float _radius ) {
+  d_radius = _radius;
+  return;
+}
+
+void InstanceStore::setPrefetchDistance( float _prefetch ) {
+  d_prefetch = _prefetch;
+  return;
+}
+
+const glm::mat4* InstanceStore::getTransforms() const {
+  return d_tfms.data();
+}
+
+const GLuint* InstanceStore::getMaterials() const {
+  return d_materials.data();
+}
+
+int InstanceStore::getNInstances() const {
+  return d_tfms.size();
+}
+
+long long InstanceStore::getNTotal() const {
+  return d_nInstances;
+}
+
+int InstanceStore::getNChunks() const {
+  return d_chunks.size();
+}
+
+glm::vec3 InstanceStore::getMin() const {
+  return d_min;
+}
+
+glm::vec3 InstanceStore::getMax() const {
+  return d_max;
+}
+
+int InstanceStore::getNGathered() const {
+  return d_gathered.size();
+}
+
+size_t InstanceStore::getHostBytes() const {
+  return d_slots.size() * d_chunkCapacity * (sizeof(glm::mat4) + sizeof(GLuint));
+}
+
+long long InstanceStore::getLoads() const {
+  return d_loads;
+}
+
+long long InstanceStore::getBytesLoaded() const {
+  return d_bytesLoaded;
+}
+
+long long InstanceStore::getMisses() const {
+  return d_misses;
+}
+
+long long InstanceStore::getEvictions() const {
+  return d_evictions;
+}
+
+int InstanceStore::getNFrames() const {
+  return d_nFrames;
+}
+
+double InstanceStore::getLoadMs() const {
+  return d_loadMs;
+}
+
+} // end namespace
+#endif
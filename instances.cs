@@ -0,0 +1,131 @@
+// ==========================================================================
+// $Id: instances.cs $
+// Generate and animate the instance transforms on the GPU
+// ==========================================================================
+// Pass 0 places instances [First,Count) exactly as Attributes does on the
+// host: the same hash, the same draws and the same rejection sampling of
+// the axis. It also sets up their animation state as InstanceAnimation
+// takes it from a transform. Pass 1 advances the state of all instances
+// by Dt and rebuilds their model matrices like InstanceAnimation.
+// ==========================================================================
+#version 430 core
+
+layout (local_size_x = 64) in;
+
+// per instance animation state
+struct InstanceState {
+  vec4 axisAngle; // angle in [-pi,pi]
+  vec4 offsetOmega; // radians per second
+  vec4 position; // placed position
+};
+
+layout (std430, binding = 0) buffer States {
+  InstanceState state[];
+};
+
+// the model matrix attribute of the draws
+layout (std430, binding = 1) buffer Transforms {
+  mat4 modelMatrix[];
+};
+
+uniform int Pass;
+uniform int First;
+uniform int Count;
+// generation
+uniform uint Seed;
+uniform vec3 Volume;
+// animation
+uniform float Dt;
+uniform bool Orbit;
+
+const float PI = 3.14159265;
+const float TWO_PI = 6.28318531;
+
+// Attributes::hash
+uint hash( uint x ) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Attributes::randomUnit
+float randomUnit( uint seed, uint inst, uint draw ) {
+  // the high word of the 64 bit key inst * 64 + draw (draw < 64)
+  uint high = inst >> 26;
+  uint inner = hash( inst * 64u + draw );
+  if ( high != 0u ) inner = hash( inner ^ high );
+  uint h = hash( seed ^ inner );
+  return float(h >> 8) * (1.0 / 16777216.0);
+}
+
+// Rotation by angle about the unit axis a, as glm::rotate
+mat3 rotation( vec3 a, float angle ) {
+  float s = sin(angle);
+  float c = cos(angle);
+  vec3 t = (1.0 - c) * a;
+  return mat3(c + t.x * a.x, t.x * a.y + s * a.z, t.x * a.z - s * a.y,
+	      t.y * a.x - s * a.z, c + t.y * a.y, t.y * a.z + s * a.x,
+	      t.z * a.x + s * a.y, t.z * a.y - s * a.x, c + t.z * a.z);
+}
+
+void setMatrix( uint i, mat3 rot, vec3 pos ) {
+  modelMatrix[i] = mat4(vec4(rot[0], 0.0), vec4(rot[1], 0.0),
+			vec4(rot[2], 0.0), vec4(pos, 1.0));
+}
+
+// Attributes::randomPlacement followed by rotate and translate
+void generate( uint i ) {
+  vec3 v;
+  float len2;
+  uint draw = 0u;
+  do {
+    v = vec3(2.0 * randomUnit(Seed, i, draw) - 1.0,
+	     2.0 * randomUnit(Seed, i, draw + 1u) - 1.0,
+	     2.0 * randomUnit(Seed, i, draw + 2u) - 1.0);
+    draw += 3u;
+    len2 = dot(v, v);
+  } while (( len2 > 1.0 || len2 == 0.0 ) && draw < 60u );
+  vec3 axis = v * (1.0 / sqrt(len2));
+  float angle = PI * (2.0 * randomUnit(Seed, i, 60u) - 1.0);
+  vec3 offset = vec3(randomUnit(Seed, i, 61u) - 0.5,
+		     randomUnit(Seed, i, 62u) - 0.5,
+		     randomUnit(Seed, i, 63u) - 0.5) * Volume;
+  mat3 rot = rotation(axis, angle);
+  vec3 pos = rot * offset;
+  setMatrix(i, rot, pos);
+  // InstanceAnimation recovers the angle in [0,pi] from the matrix
+  if ( angle < 0.0 ) {
+    axis = -axis;
+    angle = -angle;
+  }
+  // separate stream of the same seed: 0.2 .. 1 half turns per second
+  // in either direction
+  float speed = PI * (0.2 + 0.8 * randomUnit(Seed ^ 0x9e3779b9u, i, 0u));
+  float omega = randomUnit(Seed ^ 0x9e3779b9u, i, 1u) < 0.5 ? -speed : speed;
+  state[i].axisAngle = vec4(axis, angle);
+  state[i].offsetOmega = vec4(offset, omega);
+  state[i].position = vec4(pos, 1.0);
+}
+
+// InstanceAnimation::updateRange
+void animate( uint i ) {
+  float angle = state[i].axisAngle.w + state[i].offsetOmega.w * Dt;
+  angle -= TWO_PI * roundEven(angle * (1.0 / TWO_PI));
+  state[i].axisAngle.w = angle;
+  mat3 rot = rotation(state[i].axisAngle.xyz, angle);
+  vec3 pos = Orbit ? rot * state[i].offsetOmega.xyz : state[i].position.xyz;
+  setMatrix(i, rot, pos);
+}
+
+void main() {
+  uint i = uint(First) + gl_GlobalInvocationID.x;
+  if ( i >= uint(Count) ) return;
+  if ( Pass == 0 ) {
+    generate(i);
+  } else {
+    animate(i);
+  }
+}
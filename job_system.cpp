@@ -0,0 +1,207 @@
+// ==========================================================================
+// $Id: job_system.cpp $
+// Work-stealing job system for per-frame updates
+// ==========================================================================
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "job_system.h"
+
+namespace CSI4130 {
+
+namespace {
+// worker index of the current thread in the system which owns it
+thread_local const JobSystem* t_system = 0;
+thread_local int t_worker = 0;
+}
+
+
+JobSystem::JobSystem( int _nThreads ) : d_quit(false), d_queued(0) {
+  if ( _nThreads <= 0 ) {
+    _nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for ( int w=0; w<_nThreads; ++w ) {
+    d_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for ( int w=1; w<_nThreads; ++w ) {
+    d_threads.push_back(std::thread(&JobSystem::workerLoop, this, w));
+  }
+}
+
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(d_sleepMutex);
+    d_quit = true;
+  }
+  d_wake.notify_all();
+  for ( std::vector<std::thread>::iterator iter = d_threads.begin();
+	iter != d_threads.end(); ++iter ) {
+    iter->join();
+  }
+}
+
+
+JobSystem& JobSystem::global() {
+  static JobSystem s_system;
+  return s_system;
+}
+
+
+int JobSystem::getNumThreads() const {
+  return d_workers.size();
+}
+
+
+int JobSystem::currentWorker() const {
+  return t_system == this ? t_worker : 0;
+}
+
+
+void JobSystem::push( Job* _job ) {
+  Worker& worker = *d_workers[currentWorker()];
+  {
+    std::lock_guard<std::mutex> lock(worker.d_mutex);
+    worker.d_jobs.push_back(_job);
+  }
+  ++d_queued;
+  if ( !d_threads.empty() ) {
+    // lock so that a worker about to sleep does not miss the wake-up
+    std::lock_guard<std::mutex> lock(d_sleepMutex);
+    d_wake.notify_one();
+  }
+  return;
+}
+
+
+JobSystem::Job* JobSystem::pop( int _worker ) {
+  if ( d_queued.load() == 0 ) return 0;
+  // own deque: newest job first, it is likely still in cache
+  {
+    Worker& own = *d_workers[_worker];
+    std::lock_guard<std::mutex> lock(own.d_mutex);
+    if ( !own.d_jobs.empty() ) {
+      Job* job = own.d_jobs.back();
+      own.d_jobs.pop_back();
+      --d_queued;
+      return job;
+    }
+  }
+  // steal the oldest job of another worker
+  int nWorkers = d_workers.size();
+  for ( int i=1; i<nWorkers; ++i ) {
+    Worker& victim = *d_workers[(_worker + i) % nWorkers];
+    std::lock_guard<std::mutex> lock(victim.d_mutex);
+    if ( !victim.d_jobs.empty() ) {
+      Job* job = victim.d_jobs.front();
+      victim.d_jobs.pop_front();
+      --d_queued;
+      return job;
+    }
+  }
+  return 0;
+}
+
+
+void JobSystem::execute( Job* _job ) {
+  _job->d_fn();
+  JobCounter* counter = _job->d_counter;
+  delete _job;
+  if ( counter ) finish( counter );
+  return;
+}
+
+
+void JobSystem::finish( JobCounter* _counter ) {
+  // the counter is only done with its waiters taken; it may be gone
+  // once the lock is released
+  std::vector<void*> waiters;
+  {
+    std::lock_guard<std::mutex> lock(_counter->d_mutex);
+    if ( --_counter->d_count > 0 ) return;
+    // release the jobs which depend on this counter
+    waiters.swap(_counter->d_waiters);
+  }
+  for ( std::vector<void*>::iterator iter = waiters.begin();
+	iter != waiters.end(); ++iter ) {
+    push( static_cast<Job*>(*iter) );
+  }
+  return;
+}
+
+
+void JobSystem::run( const JobFunction& _fn, JobCounter* _counter,
+		     JobCounter* _dependency ) {
+  Job* job = new Job;
+  job->d_fn = _fn;
+  job->d_counter = _counter;
+  if ( _counter ) ++_counter->d_count;
+  if ( _dependency ) {
+    std::lock_guard<std::mutex> lock(_dependency->d_mutex);
+    if ( _dependency->d_count.load() > 0 ) {
+      _dependency->d_waiters.push_back(job);
+      return;
+    }
+  }
+  push( job );
+  return;
+}
+
+
+void JobSystem::wait( JobCounter& _counter ) {
+  int worker = currentWorker();
+  while ( !_counter.isDone() ) {
+    Job* job = pop( worker );
+    if ( job ) {
+      execute( job );
+    } else {
+      // the remaining jobs are running elsewhere
+      std::this_thread::yield();
+    }
+  }
+  // the last finish() may still hold the lock of the counter
+  std::lock_guard<std::mutex> lock(_counter.d_mutex);
+  return;
+}
+
+
+void JobSystem::parallelFor( int _begin, int _end, int _grain,
+			     const RangeFunction& _fn ) {
+  if ( _end <= _begin ) return;
+  _grain = std::max(_grain, 1);
+  if ( d_workers.size() == 1 || _end - _begin <= _grain ) {
+    _fn(_begin, _end);
+    return;
+  }
+  JobCounter counter;
+  // the first chunk is run by the calling thread
+  for ( int b=_begin+_grain; b<_end; b+=_grain ) {
+    int e = std::min(b + _grain, _end);
+    run( [&_fn, b, e]() { _fn(b, e); }, &counter );
+  }
+  _fn(_begin, std::min(_begin + _grain, _end));
+  wait( counter );
+  return;
+}
+
+
+void JobSystem::workerLoop( int _worker ) {
+  t_system = this;
+  t_worker = _worker;
+  while ( !d_quit.load() ) {
+    Job* job = pop( _worker );
+    if ( job ) {
+      execute( job );
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(d_sleepMutex);
+    if ( d_queued.load() == 0 && !d_quit.load() ) {
+      // timeout as a guard against a missed notification
+      d_wake.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+  return;
+}
+
+} // end namespace
@@ -0,0 +1,107 @@
+// ==========================================================================
+// $Id: job_system.h $
+// Work-stealing job system for per-frame updates
+// ==========================================================================
+// Every worker owns a deque of jobs. A worker pushes and pops at the back
+// of its own deque and steals from the front of the others when it runs
+// dry. The thread which created the system takes part as worker 0: wait()
+// executes jobs until the awaited counter reaches zero instead of blocking.
+//
+// A JobCounter counts unfinished jobs. It is both the handle to wait on
+// and a dependency: a job run with a dependency is only queued once the
+// dependency counter reaches zero.
+// ==========================================================================
+#ifndef CSI4130_JOB_SYSTEM_H_
+#define CSI4130_JOB_SYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CSI4130 {
+
+class JobSystem;
+
+class JobCounter {
+  friend class JobSystem;
+  std::atomic<int> d_count;
+  std::mutex d_mutex;
+  // jobs waiting for this counter to reach zero
+  std::vector<void*> d_waiters;
+ public:
+  JobCounter() : d_count(0) {}
+  inline bool isDone() const { return d_count.load() == 0; }
+ private:
+  // no copy or assignment
+  JobCounter(const JobCounter& _oCounter );
+  JobCounter& operator=( const JobCounter& _oCounter );
+};
+
+
+class JobSystem {
+ public:
+  typedef std::function<void()> JobFunction;
+  typedef std::function<void(int, int)> RangeFunction;
+
+ private:
+  struct Job {
+    JobFunction d_fn;
+    JobCounter* d_counter;
+  };
+
+  struct Worker {
+    std::mutex d_mutex;
+    std::deque<Job*> d_jobs;
+  };
+
+  std::vector<std::unique_ptr<Worker> > d_workers; // 0 is the owner thread
+  std::vector<std::thread> d_threads;
+  std::atomic<bool> d_quit;
+  std::atomic<int> d_queued;
+  std::mutex d_sleepMutex;
+  std::condition_variable d_wake;
+
+ public:
+  // _nThreads includes the calling thread, 0 uses all hardware threads
+  explicit JobSystem( int _nThreads = 0 );
+  ~JobSystem();
+
+  int getNumThreads() const;
+
+  // Run _fn on some worker. _counter (may be NULL) is incremented now and
+  // decremented once _fn has run. If _dependency is given, _fn is only
+  // started after the dependency counter reached zero.
+  void run( const JobFunction& _fn, JobCounter* _counter,
+	    JobCounter* _dependency = 0 );
+
+  // Execute jobs until _counter is zero
+  void wait( JobCounter& _counter );
+
+  // Call _fn(begin, end) for chunks of at most _grain elements of
+  // [_begin,_end) in parallel and return when all are done
+  void parallelFor( int _begin, int _end, int _grain,
+		    const RangeFunction& _fn );
+
+  // Shared system with all hardware threads, created on first use
+  static JobSystem& global();
+
+ private:
+  void push( Job* _job );
+  Job* pop( int _worker );
+  void execute( Job* _job );
+  void finish( JobCounter* _counter );
+  void workerLoop( int _worker );
+  int currentWorker() const;
+
+  // no copy or assignment
+  JobSystem(const JobSystem& _oSystem );
+  JobSystem& operator=( const JobSystem& _oSystem );
+};
+
+} // end namespace
+#endif
@@ -60,6 +60,8 @@
 // glm types
 #include <glm/glm.hpp>
 
+#include "gl_state.h"
+
 
 namespace CSI4130 {
 
@@ -124,8 +126,14 @@ public:
     return d_lights.size();
   }
 
+  void clear() {
+    d_lights.clear();
+    return;
+  }
+
 
-  void setLight( GLuint program, int _l ) {
+  // Uniforms go through the state cache - unchanged values are not uploaded
+  void setLight( GLuint program, int _l, GLStateCache& _state ) {
     assert( _l < d_lights.size());
     GLint locLight = -1;
     std::string varName("lights[");
@@ -133,52 +141,52 @@ public:
     os << varName << _l;
     varName = os.str();
     if ((locLight = glGetUniformLocation(program, (varName + "].ambient").c_str()))>=0)
-      glProgramUniform4fv(program, locLight, 1, glm::value_ptr(d_lights[_l].d_ambient));
+      _state.programUniform4fv(program, locLight, glm::value_ptr(d_lights[_l].d_ambient));
     if ((locLight = glGetUniformLocation(program, (varName  + "].diffuse").c_str()))>=0)
-      glProgramUniform4fv(program, locLight, 1, glm::value_ptr(d_lights[_l].d_diffuse));
+      _state.programUniform4fv(program, locLight, glm::value_ptr(d_lights[_l].d_diffuse));
     if ((locLight = glGetUniformLocation(program, (varName  + "].specular").c_str()))>=0)
-      glProgramUniform4fv(program, locLight, 1, glm::value_ptr(d_lights[_l].d_specular));
+      _state.programUniform4fv(program, locLight, glm::value_ptr(d_lights[_l].d_specular));
     // boolean pointLight is not used in shader
     if ((locLight = glGetUniformLocation(program, (varName  + "].spot_direction").c_str()))>=0)
-      glProgramUniform3fv(program, locLight, 1, glm::value_ptr(d_lights[_l].d_spot_direction));
+      _state.programUniform3fv(program, locLight, glm::value_ptr(d_lights[_l].d_spot_direction));
     if ((locLight = glGetUniformLocation(program, (varName  + "].spot_exponent").c_str()))>=0)
-      glProgramUniform1f(program, locLight, d_lights[_l].d_spot_exponent);
+      _state.programUniform1f(program, locLight, d_lights[_l].d_spot_exponent);
     if ((locLight = glGetUniformLocation(program, (varName  + "].spot_cutoff").c_str()))>=0)
-      glProgramUniform1f(program, locLight, d_lights[_l].d_spot_cutoff);
+      _state.programUniform1f(program, locLight, d_lights[_l].d_spot_cutoff);
     if ((locLight = glGetUniformLocation(program, (varName  + "].constant_attenuation").c_str()))>=0)
-      glProgramUniform1f(program, locLight, d_lights[_l].d_constant_attenuation);
+      _state.programUniform1f(program, locLight, d_lights[_l].d_constant_attenuation);
     if ((locLight = glGetUniformLocation(program, (varName  + "].linear_attenuation").c_str()))>=0)
-      glProgramUniform1f(program, locLight, d_lights[_l].d_linear_attenuation);
+      _state.programUniform1f(program, locLight, d_lights[_l].d_linear_attenuation);
     if ((locLight = glGetUniformLocation(program, (varName  + "].quadratic_attenuation").c_str()))>=0)
-      glProgramUniform1f(program, locLight, d_lights[_l].d_quadratic_attenuation);
+      _state.programUniform1f(program, locLight, d_lights[_l].d_quadratic_attenuation);
   
     return;
   }
 
-  void setPosition( GLuint program, int _l ) {
+  void setPosition( GLuint program, int _l, GLStateCache& _state ) {
     assert( _l < d_lights.size());
     std::string varName("lightPosition[");
     std::ostringstream os;
     os << varName << _l;
     varName = os.str();
     GLint locLight = glGetUniformLocation(program, (varName  + "]").c_str());
-    glProgramUniform4fv(program, locLight, 1, glm::value_ptr(d_lights[_l].d_position));
+    _state.programUniform4fv(program, locLight, glm::value_ptr(d_lights[_l].d_position));
     return;
   }
 
-  void setLights( GLuint program ) {
+  void setLights( GLuint program, GLStateCache& _state ) {
     int maxLight = d_lights.size();
     for ( int l=0; l<maxLight; ++l )  {
-      setLight(program, l );
+      setLight(program, l, _state );
     }
     return;
   }
 
-  void setPositions( GLuint program ) {
+  void setPositions( GLuint program, GLStateCache& _state ) {
     int maxLight = d_lights.size();
     std::string varName("lights[");
     for ( int l=0; l<maxLight; ++l )  {
-      setPosition(program, l );
+      setPosition(program, l, _state );
     }
     return;
   }
@@ -5,8 +5,17 @@
 #include <stack>
 #include <iostream>
 #include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <sstream>
 #include <GL/glew.h>
 #include <GL/glut.h>
+#ifdef CSI4130_GL_DEBUG_OUTPUT
+// context flags
+#include <GL/freeglut.h>
+#endif
 
 // glm types
 #define GLM_FORCE_RADIANS
@@ -21,13 +30,24 @@
 #include "light.h"
 #include "material.h"
 #include "sphere.h"
+#include "profiler.h"
+#include "frame_timer.h"
+#include "gl_state.h"
+#include "command_list.h"
+#include "animation.h"
+#include "instance_sort.h"
+#include "occlusion.h"
+#include "shadow_map.h"
+#include "scene.h"
+#include "instance_store.h"
+#include "regression.h"
+#include "instance_compute.h"
+#include "gpu_cull.h"
 
 using namespace CSI4130;
 using std::cerr;
 using std::endl;
 
-#define UNIFORM
-
 namespace CSI4130 {
 
 // Window dimensions
@@ -52,14 +72,76 @@ struct Transformations {
   GLint locP;
   GLint locVM;
   GLint locMM; // per instance model matrix
-  Transformations() : locP(-1), locVM(-1), locMM(-1) {}
+  GLint locBase; // first instance of the draw, buffer fetch only
+  Transformations() : locP(-1), locVM(-1), locMM(-1), locBase(-1) {}
 };
 
 struct Attributes {
   GLint locPos;
   GLint locNorm;
   GLint locColor;
-  Attributes() : locPos(-1), locNorm(-1), locColor(-1) {} 
+  GLint locMaterial;
+  Attributes() : locPos(-1), locNorm(-1), locColor(-1), locMaterial(-1) {} 
+};
+
+// Instances drawn with one block of the material table
+struct MaterialBatch {
+  int d_block;
+  int d_first; // base instance
+  int d_count;
+};
+
+// Render passes, most significant part of the command sort key
+enum RenderPass {
+  PASS_FRAME = 0, // per-frame uniforms
+  PASS_DEPTH, // optional depth pre-pass
+  PASS_LIT
+};
+
+// All camera presets side by side: in one instanced pass, or as one
+// pass per preset to compare against
+enum MultiViewMode {
+  MULTIVIEW_OFF = 0,
+  MULTIVIEW_SINGLE_PASS,
+  MULTIVIEW_SEQUENTIAL,
+  MULTIVIEW_NUM_MODES
+};
+
+const char* multiViewName( MultiViewMode _mode ) {
+  switch ( _mode ) {
+  case MULTIVIEW_SINGLE_PASS: return "single pass";
+  case MULTIVIEW_SEQUENTIAL: return "sequential passes";
+  default: return "off";
+  }
+}
+
+// Source of the per-instance data of the vertex shaders, chosen at
+// startup: instanced attributes, or buffers indexed by the instance
+enum InstanceFetch {
+  FETCH_ATTRIBUTES = 0,
+  FETCH_TEXTURE_BUFFER,
+  FETCH_STORAGE_BUFFER
+};
+
+const char* instanceFetchName( InstanceFetch _fetch ) {
+  switch ( _fetch ) {
+  case FETCH_TEXTURE_BUFFER: return "texture buffers";
+  case FETCH_STORAGE_BUFFER: return "storage buffers";
+  default: return "attributes";
+  }
+}
+
+// Uniforms of the multi-view vertex shaders
+struct MultiViewLocations {
+  GLint locNumViews;
+  GLint locViewMatrices[5];
+  GLint locViewTiles[5];
+};
+
+// Shape part of the command sort key
+enum ShapeId {
+  SHAPE_BOX = 1,
+  SHAPE_SPHERE
 };
 
 struct ControlParameter {
@@ -73,11 +155,31 @@ const int g_numBoxes = 21;
 BoxShape g_boxShape;
 //TODO: Add sphere 
 Sphere g_sphere;
+// shape of all instances, chosen by the scene
+RenderShape* g_shape = &g_sphere;
+ShapeId g_shapeId = SHAPE_SPHERE;
+// scene file, the built-in scene if it cannot be read
+std::string g_scenePath("lit_boxes.scene");
+Scene g_scene;
 
 GLuint g_ebo; 
 GLuint g_vao;
+GLuint g_mmbo = 0;
+GLuint g_cbo = 0;
+// per-instance material index and the material table
+GLuint g_mbo = 0;
+GLuint g_materialUbo = 0;
+int g_numMaterials = 4;
+bool g_baseInstance = false;
+std::vector<GLuint> g_materialIds;
+std::vector<MaterialBatch> g_batches(1);
 GLuint g_program;
 Transformations g_tfm;
+// depth pre-pass
+bool g_prepass = false;
+GLuint g_depthProgram;
+GLuint g_depthVao;
+Transformations g_depthTfm;
 Attributes g_attrib;
 WindowSize g_winSize;  
 int g_cLight = 0;
@@ -86,8 +188,106 @@ MaterialArray g_matArray;
 GLfloat g_lightAngle = 0.0f;
 GLfloat g_camX = 0.0f, g_camY = 0.0f;
 ControlParameter g_control;
+FramePacer g_pacer;
+GLStateCache g_glState;
+std::vector<CommandList> g_cmdLists(2);
+CommandQueue g_cmdQueue;
+std::vector<GLint> g_locLightPos;
+InstanceAnimation g_animation;
+std::chrono::steady_clock::time_point g_animLast;
+// depth ordering of the instances
+SortOrder g_sortOrder = SORT_NONE;
+InstanceSorter g_sorter;
+std::vector<glm::mat4> g_sortedTfms;
+std::vector<glm::vec4> g_sortedColors;
+std::vector<GLuint> g_sortedMaterials;
+// view and projection the instances were last sorted or culled for
+glm::mat4 g_instancesView;
+glm::mat4 g_instancesProj;
+glm::mat4 g_projection;
+bool g_instancesChanged = false;
+// instances [g_resizedFrom,n) are new since the last upload
+int g_resizedFrom = -1;
+// allocated size of the instance attribute buffers
+std::map<GLuint, GLsizeiptr> g_bufferCapacity;
+int g_nDrawInstances = g_numBoxes;
+double g_sortMs = 0.0;
+int g_sortFrames = 0;
+// fragments passing the depth test, read two frames later
+GLuint g_samplesQuery[2];
+int g_samplesFrame = 0;
+GLuint64 g_samplesPassed = 0;
+int g_samplesFrames = 0;
+// software occlusion culling
+bool g_occlusion = false;
+OcclusionCuller g_occlusionCuller;
+float g_innerRadius = 0.0f;
+float g_outerRadius = 0.0f;
+std::vector<glm::mat4> g_visibleTfms;
+std::vector<glm::vec4> g_visibleColors;
+std::vector<GLuint> g_visibleMaterials;
+// instances bucketed by material block
+InstanceSorter g_batcher;
+std::vector<uint32_t> g_batchKeys;
+std::vector<glm::mat4> g_batchedTfms;
+std::vector<glm::vec4> g_batchedColors;
+std::vector<GLuint> g_batchedMaterials;
+long long g_occludedSum = 0;
+long long g_testedSum = 0;
+double g_cullMs = 0.0;
+int g_cullFrames = 0;
+// camera presets '0'-'4' in a grid of tiles
+const int g_nViewPresets = 5;
+const int g_viewCols = 3;
+const int g_viewRows = 2;
+MultiViewMode g_multiView = MULTIVIEW_OFF;
+// draw instances per instance in the buffers
+int g_nViews = 1;
+MultiViewLocations g_viewLocs;
+MultiViewLocations g_depthViewLocs;
+// gpu time of the passes, read two frames later: begin and end
+// timestamps per frame, which may nest in the profiler's frame query
+GLuint g_viewQuery[4];
+int g_viewFrame = 0;
+double g_viewGpuMs = 0.0;
+int g_viewFrames = 0;
+// cached shadow map of the current light
+bool g_shadows = true;
+ShadowMap g_shadowMap;
+GLuint g_shadowProgram;
+GLint g_locShadowMatrix = -1;
+GLint g_locShadowStrength = -1;
+float g_sceneRadius = 0.0f;
+// out-of-core instances replacing the scene's: --store <file>
+std::string g_storePath;
+InstanceStore g_store;
+bool g_streaming = false;
+// instances generated and animated by compute shaders: --compute
+bool g_compute = false;
+InstanceCompute g_instanceCompute;
+// frustum culling on the GPU into indirect draws: --gpu-cull
+bool g_gpuCull = false;
+GpuCuller g_gpuCuller;
+GLuint g_culledVao = 0;
+GLuint g_culledDepthVao = 0;
+// first instance of every block of the material table
+std::vector<int> g_blockFirst;
+// per-instance data from buffers: --instance-fetch tbo|ssbo
+InstanceFetch g_instanceFetch = FETCH_ATTRIBUTES;
+// matrices and materials as texture buffers on units 2-3
+const GLuint g_instanceUnit = 2;
+GLuint g_instanceTextures[2] = { 0, 0 };
+// buffers attached to the textures
+GLuint g_fetchBuffers[2] = { 0, 0 };
+GLint g_maxTextureBufferSize = 0;
+bool g_timerPending = false;
+#ifdef CSI4130_PROFILE
+bool g_showProfile = false;
+const char* g_traceFile = "lit_boxes_trace.json";
+#endif
 
-void initMaterial() {
+void initMaterial( int _nMaterials ) {
+  g_matArray.clear();
   Material mat;
   // material 0 - blue plastic
   mat.d_ambient = glm::vec4(0.02f, 0.02f, 0.05f, 1.0f); 
@@ -113,6 +313,36 @@ void initMaterial() {
   mat.d_specular = glm::vec4(0.3f, 0.3f, 0.3f, 1.0f); 
   mat.d_shininess = 8;
   g_matArray.append( mat );
+  // more materials around the hue circle
+  for ( int m=g_matArray.size(); m<_nMaterials; ++m ) {
+    float hue = 6.0f * m / _nMaterials;
+    glm::vec3 rgb = glm::clamp(glm::vec3(std::fabs(hue - 3.0f) - 1.0f,
+					 2.0f - std::fabs(hue - 2.0f),
+					 2.0f - std::fabs(hue - 4.0f)),
+			       0.0f, 1.0f);
+    mat.d_ambient = glm::vec4(0.1f * rgb, 1.0f);
+    mat.d_diffuse = glm::vec4(glm::vec3(0.2f) + 0.6f * rgb, 1.0f);
+    mat.d_specular = glm::vec4(glm::vec3(0.1f + 0.3f * (m % 3)), 1.0f);
+    mat.d_shininess = 8.0f + 16.0f * (m % 5);
+    g_matArray.append( mat );
+  }
+  return;
+}
+
+
+// Random material of each instance, drawn from the seed of the transforms;
+// materials below _first are kept
+void assignMaterials( int _nInstances, unsigned _seed, int _first = 0 ) {
+  g_materialIds.resize(_nInstances);
+  int nMaterials = g_matArray.size();
+  JobSystem::global().parallelFor(_first, _nInstances, 1 << 14,
+    [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	int m = static_cast<int>
+	  (::Attributes::randomUnit(_seed ^ 0x85ebca6bU, i, 0) * nMaterials);
+	g_materialIds[i] = std::min(m, nMaterials - 1);
+      }
+    });
   return;
 }
 
@@ -125,8 +355,149 @@ void initLight( int _nLights ) {
 }
 
 
+// Lab scene without a scene file
+void initBuiltinScene() {
+  g_lightArray.clear();
+  initLight(2);
+  initMaterial(g_numMaterials);
+  g_shape = &g_sphere;
+  g_shapeId = SHAPE_SPHERE;
+  g_shape->updateTransforms(g_numBoxes,
+	  glm::vec3(-g_winSize.d_width / 2.0f,
+		  -g_winSize.d_height / 2.0f,
+		  -(g_winSize.d_far - g_winSize.d_near) / 2.0f),
+	  glm::vec3(g_winSize.d_width / 2.0f,
+		  g_winSize.d_height / 2.0f,
+		  (g_winSize.d_far - g_winSize.d_near) / 2.0f));
+  assignMaterials(g_shape->getNTransforms(), g_shape->getSeed());
+  return;
+}
+
+
+// Shape, lights, materials and instances from the scene file _path;
+// the instances are streamed into the shape's transforms and the
+// material indices unless _instances is false. Returns 0 on success.
+int loadScene( const char* _path, bool _instances = true ) {
+  SceneReader reader;
+  if ( reader.open(_path, g_scene) != 0 ) return -1;
+  // four texels per matrix; vertex attributes have no such limit
+  if ( _instances && g_instanceFetch == FETCH_TEXTURE_BUFFER &&
+       4LL * g_scene.getNInstances() > g_maxTextureBufferSize ) {
+    cerr << _path << ": more than " << g_maxTextureBufferSize / 4
+	 << " instances for texture buffers, using vertex attributes" << endl;
+    g_instanceFetch = FETCH_ATTRIBUTES;
+    g_baseInstance = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+  }
+  if ( !g_baseInstance &&
+       g_scene.d_materials.size() > MaterialArray::BLOCK_SIZE ) {
+    cerr << _path << ": more than " << MaterialArray::BLOCK_SIZE
+	 << " materials need GL 4.2 base instances" << endl;
+    return -1;
+  }
+  RenderShape* shape = &g_sphere;
+  ShapeId shapeId = SHAPE_SPHERE;
+  if ( g_scene.d_shape == "box" ) {
+    shape = &g_boxShape;
+    shapeId = SHAPE_BOX;
+  }
+  int nInstances = _instances ? g_scene.getNInstances() : 0;
+  if ( _instances && g_scene.getNInstances() > 0x7fffffff ) {
+    cerr << _path << ": too many instances, use an instance store" << endl;
+    return -1;
+  }
+  glm::mat4* tfms = shape->allocateTransforms(nInstances);
+  g_materialIds.resize(nInstances);
+  if ( _instances &&
+       reader.readInstances(g_scene, tfms, g_materialIds.data()) != 0 ) {
+    return -1;
+  }
+  g_shape = shape;
+  g_shapeId = shapeId;
+  // the volume sizes the shadow map and the animation
+  glm::vec3 extent = nInstances > 0 ?
+    2.0f * glm::max(glm::abs(reader.getMin()), glm::abs(reader.getMax())) :
+    glm::vec3(0.0f);
+  g_shape->setVolume(extent);
+  if ( !g_scene.d_sets.empty() ) g_shape->setSeed(g_scene.d_sets[0].d_seed);
+  g_matArray.clear();
+  for ( size_t m=0; m<g_scene.d_materials.size(); ++m ) {
+    g_matArray.append(g_scene.d_materials[m]);
+  }
+  g_numMaterials = g_matArray.size();
+  g_lightArray.clear();
+  for ( size_t l=0; l<g_scene.d_lights.size(); ++l ) {
+    g_lightArray.append(g_scene.d_lights[l]);
+  }
+  // at least one light to control
+  if ( g_lightArray.size() == 0 ) initLight(1);
+  double seconds = std::max(reader.getMs(), 1.0e-3) * 1.0e-3;
+  if ( !_instances ) {
+    cerr << "Scene " << _path << ": instances from the store" << endl;
+    return 0;
+  }
+  double mb = reader.getBytes() / (1024.0 * 1024.0);
+  cerr << "Scene " << _path << ": " << nInstances << " instances, "
+       << mb << " MB in " << reader.getMs() << " ms ("
+       << nInstances / seconds * 1.0e-6 << " M instances/s, "
+       << mb / seconds << " MB/s)" << endl;
+  return 0;
+}
+
+
+// Write the current instances with the scene's shape, materials and
+// lights
+void saveScene( const char* _path, bool _binary ) {
+  if ( g_compute ) {
+    cerr << "Save scene: not with compute instances" << endl;
+    return;
+  }
+  g_scene.d_shape = g_shapeId == SHAPE_BOX ? "box" : "sphere";
+  g_scene.d_materials.clear();
+  for ( size_t m=0; m<g_matArray.size(); ++m ) {
+    g_scene.d_materials.push_back(g_matArray.get(m));
+  }
+  g_scene.d_lights.clear();
+  for ( size_t l=0; l<g_lightArray.size(); ++l ) {
+    g_scene.d_lights.push_back(g_lightArray.get(l));
+  }
+  if ( writeScene(_path, g_scene, g_animation.getTransforms(),
+		  g_materialIds.data(), g_animation.getNInstances(),
+		  _binary) == 0 ) {
+    cerr << "Saved scene " << _path << endl;
+  }
+  return;
+}
+
+
+// Compile and link a vertex and fragment shader
+// _define selects a variant of the vertex shader
+GLuint loadProgram( const char* _vs, const char* _fs,
+		    const char* _define = NULL ) {
+  vector<GLuint> sHandles;
+  GLuint handle;
+  Shader shader;
+  if ( !shader.load(_vs, GL_VERTEX_SHADER )) {
+    if ( _define ) shader.define( _define, GL_VERTEX_SHADER );
+    shader.installShader( handle, GL_VERTEX_SHADER );
+    Shader::compile( handle );
+    sHandles.push_back( handle );
+  }
+  if ( !shader.load(_fs, GL_FRAGMENT_SHADER )) {
+    shader.installShader( handle, GL_FRAGMENT_SHADER ); 
+    Shader::compile( handle );
+    sHandles.push_back( handle );
+  }
+  cerr << "No of handles: " << sHandles.size() << endl;
+  GLuint program;
+  Shader::installProgram(sHandles, program); 
+  errorOut();
+  return program;
+}
+
+
 void init(void) 
 {
+  PROFILE_CPU_ZONE("init");
   glClearColor (0.0, 0.0, 0.0, 0.0);
   glEnable( GL_DEPTH_TEST );
   errorOut();
@@ -140,27 +511,51 @@ void init(void)
     exit(-1);
   }
 
-  // init lights and material in our global arrays
-  initLight(2);
-  initMaterial();
+  // the vertex shader reads the matrices and materials from storage buffers
+  if ( g_instanceFetch == FETCH_STORAGE_BUFFER ) {
+    GLint nBlocks = 0;
+    if ( GLEW_VERSION_4_3 || GLEW_ARB_shader_storage_buffer_object ) {
+      glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &nBlocks);
+    }
+    if ( nBlocks < 2 ) {
+      cerr << "Instance fetch: no storage buffers in vertex shaders" << endl;
+      g_instanceFetch = FETCH_ATTRIBUTES;
+    }
+  }
+  // loadScene() checks the scene against the texture buffer size
+  if ( g_instanceFetch == FETCH_TEXTURE_BUFFER ) {
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &g_maxTextureBufferSize);
+  }
+  // batches of more than one block start at an instance > 0; the buffer
+  // fetch adds the first instance in the shader
+  g_baseInstance = g_instanceFetch != FETCH_ATTRIBUTES ||
+    GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+  // lights, materials and instances in our global arrays; a store has
+  // the instances, only the rest of the scene is read
+  bool streamed = !g_storePath.empty() &&
+    g_store.open(g_storePath.c_str()) == 0;
+  if ( loadScene( g_scenePath.c_str(), !streamed ) != 0 ) {
+    cerr << "Using the built-in scene" << endl;
+    initBuiltinScene();
+  }
+  if ( streamed ) {
+    // the store's bounds size the shadow map
+    g_shape->setVolume(2.0f * glm::max(glm::abs(g_store.getMin()),
+				       glm::abs(g_store.getMax())));
+  }
+  g_nDrawInstances = g_shape->getNTransforms();
+  // the first frame uploads the instances and builds the material batches
+  g_instancesChanged = true;
+  bool fetched = g_instanceFetch != FETCH_ATTRIBUTES;
 
   // Load shaders
-  vector<GLuint> sHandles;
-  GLuint handle;
-  Shader boxes;
-  if ( !boxes.load("lit_boxes.vs", GL_VERTEX_SHADER )) {
-    boxes.installShader( handle, GL_VERTEX_SHADER );
-    Shader::compile( handle );
-    sHandles.push_back( handle );
+  const char* fetchDefine = NULL;
+  if ( g_instanceFetch == FETCH_TEXTURE_BUFFER ) {
+    fetchDefine = "INSTANCE_FETCH_TBO";
+  } else if ( g_instanceFetch == FETCH_STORAGE_BUFFER ) {
+    fetchDefine = "INSTANCE_FETCH_SSBO";
   }
-  if ( !boxes.load("lit_boxes.fs", GL_FRAGMENT_SHADER )) {
-    boxes.installShader( handle, GL_FRAGMENT_SHADER ); 
-    Shader::compile( handle );
-    sHandles.push_back( handle );
-  }
-  cerr << "No of handles: " << sHandles.size() << endl;
-  Shader::installProgram(sHandles, g_program); 
-  errorOut();
+  g_program = loadProgram("lit_boxes.vs", "lit_boxes.fs", fetchDefine);
 
   // find the locations of uniforms and attributes. Store them in a
   // global structure for later access
@@ -172,10 +567,18 @@ void init(void)
   g_attrib.locPos = glGetAttribLocation(g_program, "position");
   g_attrib.locNorm = glGetAttribLocation(g_program, "normal");
   g_attrib.locColor = glGetAttribLocation(g_program, "color");
+  g_attrib.locMaterial = glGetAttribLocation(g_program, "materialIndex");
   // transform uniforms and attributes
   g_tfm.locMM = glGetAttribLocation( g_program, "ModelMatrix");
   g_tfm.locVM = glGetUniformLocation( g_program, "ViewMatrix");
   g_tfm.locP = glGetUniformLocation( g_program, "ProjectionMatrix");
+  g_tfm.locBase = glGetUniformLocation( g_program, "InstanceBase");
+  // light positions are set every frame
+  for ( size_t l=0; l<g_lightArray.size(); ++l ) {
+    std::ostringstream os;
+    os << "lightPosition[" << l << "]";
+    g_locLightPos.push_back(glGetUniformLocation(g_program, os.str().c_str()));
+  }
   errorOut();
 
   // Element array buffer object
@@ -187,9 +590,14 @@ void init(void)
 
   //TODO: Add sphere
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	  sizeof(GLushort) * g_sphere.getNIndices(),
-	  g_sphere.getIndicies(), GL_STATIC_DRAW);
+	  sizeof(GLushort) * g_shape->getNIndices(),
+	  g_shape->getIndicies(), GL_STATIC_DRAW);
   errorOut();
+  // the topology was picked when the shape was built
+  cerr << "Shape indices: " << g_shape->getNIndices() << " as "
+       << (g_shape->getTopology() == RenderShape::TOPOLOGY_STRIP ?
+	   "strips" : "a list") << ", "
+       << 3 * g_shape->getNTriangles() << " as a list" << endl;
 
   // Generate a VAO
   glGenVertexArrays(1, &g_vao );
@@ -205,8 +613,8 @@ void init(void)
 
   //TODO: ADD SPHERE
   glBufferData(GL_ARRAY_BUFFER,
-	  sizeof(GLfloat) * 3 * g_sphere.getNPoints(),
-	  g_sphere.getVertices(), GL_STATIC_DRAW);
+	  sizeof(GLfloat) * 3 * g_shape->getNPoints(),
+	  g_shape->getVertices(), GL_STATIC_DRAW);
 
   // pointer into the array of vertices which is now in the VAO
   glVertexAttribPointer(g_attrib.locPos, 3, GL_FLOAT, GL_FALSE, 0, 0 );
@@ -214,8 +622,8 @@ void init(void)
   errorOut();
 
   // Normal buffer
+  GLuint nbo = 0;
   if ( g_attrib.locNorm >= 0 ) { // May be optimized away if not used in vertex shader
-    GLuint nbo;
     glGenBuffers( 1, &nbo );
     errorOut();
     glBindBuffer(GL_ARRAY_BUFFER, nbo );
@@ -225,30 +633,30 @@ void init(void)
 
 	//TODO: Add sphere
 	glBufferData(GL_ARRAY_BUFFER,
-		sizeof(GLfloat) * 3 * g_sphere.getNPoints(),
-		g_sphere.getNormals(), GL_STATIC_DRAW);
+		sizeof(GLfloat) * 3 * g_shape->getNPoints(),
+		g_shape->getNormals(), GL_STATIC_DRAW);
 
     // pointer into the array of vertices which is now in the VAO
     glVertexAttribPointer(g_attrib.locNorm, 3, GL_FLOAT, GL_FALSE, 0, 0 );
     glEnableVertexAttribArray(g_attrib.locNorm); 
     errorOut();
   }
-  // Color buffer
+  // Color buffer, only read as an attribute
   if ( g_attrib.locColor >= 0 ) {
     //g_boxShape.updateColors(g_numBoxes); // ensure that we have enough colors
 
 	//TODO: Add sphere
-	  g_sphere.updateColors(g_numBoxes);
+	  g_shape->updateColors(g_shape->getNTransforms());
 
-    GLuint cbo;
-    glGenBuffers(1, &cbo);
-    glBindBuffer(GL_ARRAY_BUFFER, cbo);
+    glGenBuffers(1, &g_cbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_cbo);
     /*glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * g_boxShape.getNColors(),
 		 g_boxShape.d_colors, GL_DYNAMIC_DRAW);*/
 
 	//TODO: Add sphere
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * g_sphere.getNColors(),
-		g_sphere.d_colors, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * g_shape->getNColors(),
+		g_shape->d_colors, GL_DYNAMIC_DRAW);
+    g_bufferCapacity[g_cbo] = sizeof(GLfloat) * 4 * g_shape->getNColors();
     glVertexAttribPointer(g_attrib.locColor, 4, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(g_attrib.locColor);
     // Ensure the colors are used per instance and not for each vertex
@@ -264,29 +672,22 @@ void init(void)
 			   g_winSize.d_height/2.0f,
 			   (g_winSize.d_far - g_winSize.d_near)/2.0f));*/
 
-  //TODO: Add sphere
-  g_sphere.updateTransforms(g_numBoxes,
-	  glm::vec3(-g_winSize.d_width / 2.0f,
-		  -g_winSize.d_height / 2.0f,
-		  -(g_winSize.d_far - g_winSize.d_near) / 2.0f),
-	  glm::vec3(g_winSize.d_width / 2.0f,
-		  g_winSize.d_height / 2.0f,
-		  (g_winSize.d_far - g_winSize.d_near) / 2.0f));
+  // the transforms come from the scene
 
   // Matrix attribute
-  if ( g_tfm.locMM >= 0 ) {
-    GLuint mmbo;
-    glGenBuffers(1, &mmbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mmbo);
+  if ( g_tfm.locMM >= 0 || fetched ) {
+    glGenBuffers(1, &g_mmbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_mmbo);
     /*glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * g_boxShape.getNTransforms(), 
 		 g_boxShape.d_tfms, GL_DYNAMIC_DRAW);*/
 
 	//TODO: Add sphere
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * g_sphere.getNTransforms(),
-		g_sphere.d_tfms, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * g_shape->getNTransforms(),
+		g_shape->d_tfms, GL_DYNAMIC_DRAW);
+    g_bufferCapacity[g_mmbo] = sizeof(glm::mat4) * g_shape->getNTransforms();
 
     // Need to set each column separately.
-    for (int i = 0; i < 4; ++i) {
+    for (int i = 0; i < 4 && !fetched; ++i) {
       // Set up the vertex attribute
       glVertexAttribPointer(g_tfm.locMM + i,             // Location
 			    4, GL_FLOAT, GL_FALSE,       // Column with four floats
@@ -298,33 +699,180 @@ void init(void)
     }
     errorOut();
   }
-  // Light source uniforms
-  g_lightArray.setLights(g_program);
+  // Material index per instance, assigned by the scene
+  if ( g_attrib.locMaterial >= 0 || fetched ) {
+    glGenBuffers(1, &g_mbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_mbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * g_materialIds.size(),
+		 g_materialIds.data(), GL_DYNAMIC_DRAW);
+    g_bufferCapacity[g_mbo] = sizeof(GLuint) * g_materialIds.size();
+    if ( !fetched ) {
+      // integer attribute
+      glVertexAttribIPointer(g_attrib.locMaterial, 1, GL_UNSIGNED_INT, 0, 0);
+      glEnableVertexAttribArray(g_attrib.locMaterial);
+      glVertexAttribDivisor(g_attrib.locMaterial, 1);
+    }
+    errorOut();
+  }
+  // Depth pre-pass: position only view of the same buffers
+  g_depthProgram = loadProgram("depth_only.vs", "depth_only.fs", fetchDefine);
+  g_depthTfm.locVM = glGetUniformLocation( g_depthProgram, "ViewMatrix");
+  g_depthTfm.locP = glGetUniformLocation( g_depthProgram, "ProjectionMatrix");
+  g_depthTfm.locBase = glGetUniformLocation( g_depthProgram, "InstanceBase");
+  glGenVertexArrays(1, &g_depthVao );
+  glBindVertexArray( g_depthVao );
+  glBindBuffer(GL_ARRAY_BUFFER, vbo );
+  glVertexAttribPointer(g_attrib.locPos, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+  glEnableVertexAttribArray(g_attrib.locPos); 
+  if ( g_mmbo && !fetched ) {
+    glBindBuffer(GL_ARRAY_BUFFER, g_mmbo);
+    for (int i = 0; i < 4; ++i) {
+      glVertexAttribPointer(g_tfm.locMM + i, 4, GL_FLOAT, GL_FALSE,
+			    sizeof(glm::mat4),
+			    (void *)(sizeof(GLfloat) * 4 * i));
+      glEnableVertexAttribArray(g_tfm.locMM + i);
+      glVertexAttribDivisor(g_tfm.locMM  + i, 1);
+    }
+  }
+  // GPU culling: the same vertex arrays reading the visible instances
+  if ( GpuCuller::isSupported() &&
+       g_gpuCuller.init("cull_instances.cs") == 0 && fetched ) {
+    // the buffers of the culler are bound for the fetch instead
+    g_culledVao = g_vao;
+    g_culledDepthVao = g_depthVao;
+  } else if ( g_gpuCuller.isReady() ) {
+    for ( int v=0; v<2; ++v ) {
+      GLuint& vao = v == 0 ? g_culledVao : g_culledDepthVao;
+      glGenVertexArrays(1, &vao);
+      glBindVertexArray(vao);
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      glVertexAttribPointer(g_attrib.locPos, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(g_attrib.locPos);
+      if ( g_tfm.locMM >= 0 ) {
+	glBindBuffer(GL_ARRAY_BUFFER, g_gpuCuller.getTransforms());
+	for (int i = 0; i < 4; ++i) {
+	  glVertexAttribPointer(g_tfm.locMM + i, 4, GL_FLOAT, GL_FALSE,
+				sizeof(glm::mat4),
+				(void *)(sizeof(GLfloat) * 4 * i));
+	  glEnableVertexAttribArray(g_tfm.locMM + i);
+	  glVertexAttribDivisor(g_tfm.locMM  + i, 1);
+	}
+      }
+      // the lit pass also needs normals, colors and materials
+      if ( v == 1 ) continue;
+      if ( nbo ) {
+	glBindBuffer(GL_ARRAY_BUFFER, nbo);
+	glVertexAttribPointer(g_attrib.locNorm, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(g_attrib.locNorm);
+      }
+      if ( g_cbo ) {
+	glBindBuffer(GL_ARRAY_BUFFER, g_gpuCuller.getColors());
+	glVertexAttribPointer(g_attrib.locColor, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(g_attrib.locColor);
+	glVertexAttribDivisor(g_attrib.locColor, 1);
+      }
+      if ( g_mbo ) {
+	glBindBuffer(GL_ARRAY_BUFFER, g_gpuCuller.getMaterials());
+	glVertexAttribIPointer(g_attrib.locMaterial, 1, GL_UNSIGNED_INT, 0, 0);
+	glEnableVertexAttribArray(g_attrib.locMaterial);
+	glVertexAttribDivisor(g_attrib.locMaterial, 1);
+      }
+    }
+  }
+  // Buffer fetch: the samplers or storage blocks of both programs; the
+  // buffers are attached by the first frame
+  const char* fetchNames[2] = { "InstanceMatrices", "InstanceMaterials" };
+  if ( g_instanceFetch == FETCH_TEXTURE_BUFFER ) {
+    glGenTextures(2, g_instanceTextures);
+    for ( int t=0; t<2; ++t ) {
+      glActiveTexture(GL_TEXTURE0 + g_instanceUnit + t);
+      glBindTexture(GL_TEXTURE_BUFFER, g_instanceTextures[t]);
+      glProgramUniform1i(g_program,
+			 glGetUniformLocation(g_program, fetchNames[t]),
+			 g_instanceUnit + t);
+    }
+    glProgramUniform1i(g_depthProgram,
+		       glGetUniformLocation(g_depthProgram, fetchNames[0]),
+		       g_instanceUnit);
+    glActiveTexture(GL_TEXTURE0);
+  } else if ( g_instanceFetch == FETCH_STORAGE_BUFFER ) {
+    for ( int p=0; p<2; ++p ) {
+      GLuint program = p == 0 ? g_program : g_depthProgram;
+      for ( int b=0; b<2; ++b ) {
+	GLuint index = glGetProgramResourceIndex(program,
+						 GL_SHADER_STORAGE_BLOCK,
+						 fetchNames[b]);
+	if ( index != GL_INVALID_INDEX ) {
+	  glShaderStorageBlockBinding(program, index, b);
+	}
+      }
+    }
+  }
+  cerr << "Instance fetch: " << instanceFetchName( g_instanceFetch );
+  if ( g_instanceFetch == FETCH_TEXTURE_BUFFER ) {
+    cerr << ", at most " << g_maxTextureBufferSize / 4 << " instances";
+  }
+  cerr << endl;
+  glBindVertexArray( g_vao );
   errorOut();
-  // Could use material uniforms
-#ifdef UNIFORM
-  g_matArray.setMaterials(g_program);
+  // animation starts from the static transforms
+  g_animation.init(*g_shape);
+  glGenQueries(2, g_samplesQuery);
+  shapeRadii(*g_shape, g_innerRadius, g_outerRadius);
+  // Shadow map: its own depth-only program and instance buffer
+  g_shadowProgram = loadProgram("depth_only.vs", "depth_only.fs");
+  g_shadowMap.init(g_shadowProgram, vbo, g_ebo, *g_shape, g_outerRadius);
+  g_shadowMap.setInstances(g_animation.getTransforms(),
+			   g_animation.getNInstances());
+  g_sceneRadius = 0.5f * glm::length(g_shape->getVolume()) + g_outerRadius;
+  if ( streamed ) {
+    // chunks within half the view depth are loaded ahead
+    g_streaming = true;
+    g_store.setRadius(g_outerRadius);
+    g_store.setPrefetchDistance(0.5f * (g_winSize.d_far - g_winSize.d_near));
+    g_sceneRadius = g_outerRadius +
+      glm::length(glm::max(glm::abs(g_store.getMin()),
+			   glm::abs(g_store.getMax())));
+  }
+  for ( int p=0; p<2; ++p ) {
+    GLuint program = p == 0 ? g_program : g_depthProgram;
+    MultiViewLocations& locs = p == 0 ? g_viewLocs : g_depthViewLocs;
+    locs.locNumViews = glGetUniformLocation(program, "NumViews");
+    for ( int v=0; v<g_nViewPresets; ++v ) {
+      std::ostringstream index;
+      index << "[" << v << "]";
+      locs.locViewMatrices[v] =
+	glGetUniformLocation(program, ("ViewMatrices" + index.str()).c_str());
+      locs.locViewTiles[v] =
+	glGetUniformLocation(program, ("ViewTiles" + index.str()).c_str());
+    }
+  }
+  glGenQueries(4, g_viewQuery);
+  if ( InstanceCompute::isSupported() ) {
+    g_instanceCompute.init("instances.cs");
+  }
+  g_locShadowMatrix = glGetUniformLocation(g_program, "ShadowMatrix");
+  g_locShadowStrength = glGetUniformLocation(g_program, "shadowStrength");
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "shadowMap"),
+		     1);
+  glProgramUniform1f(g_program, g_locShadowStrength, g_shadows ? 1.0f : 0.0f);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, g_shadowMap.getTexture());
+  glActiveTexture(GL_TEXTURE0);
   errorOut();
-  // or an uniform buffer object
-#else
-  // Generate an uniform buffer object
-  GLuint ubo;
-  glGenBuffers(1, &ubo); 
-  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
-  // reserve the memory
-  glBufferData(GL_UNIFORM_BUFFER, g_matArray.getSize(), 0,
-	       GL_STATIC_DRAW );
-  // copy the data to OpenGL
-  g_matArray.setMaterialsUBO(ubo);
+  // Light source uniforms
+  g_lightArray.setLights(g_program, g_glState);
   errorOut();
+  // Material table in an uniform buffer object, bound one block at a
+  // time by the draws
+  glGenBuffers(1, &g_materialUbo); 
+  g_matArray.setMaterialsUBO(g_materialUbo);
   // Now link the buffer object to the material uniform block
   GLuint bI = glGetUniformBlockIndex(g_program, "MaterialBlock" );
-  if ( bI >= 0 ) {
+  if ( bI != GL_INVALID_INDEX ) {
     glUniformBlockBinding( g_program, bI, 0);
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo);
   }
   errorOut();
-#endif
 
   // set the projection matrix with a uniform
   glm::mat4 Projection = 
@@ -332,15 +880,51 @@ void init(void)
 		-g_winSize.d_height/2.0f, g_winSize.d_height/2.0f,
 		g_winSize.d_near, g_winSize.d_far );
   glUniformMatrix4fv(g_tfm.locP, 1, GL_FALSE, glm::value_ptr(Projection));
+  glProgramUniformMatrix4fv(g_depthProgram, g_depthTfm.locP, 1, GL_FALSE,
+			    glm::value_ptr(Projection));
+  g_projection = Projection;
   errorOut();
+  // state was set directly above - start tracking from scratch
+  g_glState.invalidate();
 }
 
 
-void display(void)
-{
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+// Instead of moving the coordinate system into the scene,
+// use lookAt -- use the center of the viewing volume as the reference coordinates
+glm::mat4 viewMatrix( GLfloat _camX, GLfloat _camY ) {
+  return glm::lookAt( glm::vec3(_camX, _camY, -(g_winSize.d_far+g_winSize.d_near)/2.0f ),
+		      glm::vec3(0, 0, 0),// at is the center of the cube
+		      glm::vec3(0, 1.0f, 0 )); // y is up
+}
+
+
+glm::mat4 viewMatrix() {
+  return viewMatrix( g_camX, g_camY );
+}
+
+
+// Camera position of the presets '0'-'4'
+void presetCamera( int _preset, GLfloat& _camX, GLfloat& _camY ) {
+  const GLfloat signX[] = { 0.0f, 1.0f, 1.0f, -1.0f, -1.0f };
+  const GLfloat signY[] = { 0.0f, -1.0f, 1.0f, 1.0f, -1.0f };
+  _camX = signX[_preset] * g_winSize.d_width/6.0f;
+  _camY = signY[_preset] * g_winSize.d_height/6.0f;
+  return;
+}
+
 
-  // Place the current light source at a radius from the camera
+// Tile of view _v in normalized device coordinates: center and scale.
+// The scale is the same in x and y so the views keep the aspect ratio.
+glm::vec4 viewTile( int _v ) {
+  float scale = 1.0f / std::max(g_viewCols, g_viewRows);
+  int col = _v % g_viewCols, row = _v / g_viewCols;
+  return glm::vec4( -1.0f + (2.0f * col + 1.0f) / g_viewCols,
+		    1.0f - (2.0f * row + 1.0f) / g_viewRows, scale, scale );
+}
+
+
+// Place the current light source at a radius from the camera
+glm::vec4 lightPosition() {
   LightSource light = g_lightArray.get( g_cLight );
 #ifdef DEBUG_DISPLAY
   cerr << cos(g_lightAngle)*g_winSize.d_width << "," <<
@@ -348,49 +932,935 @@ void display(void)
     //static_cast<GLfloat>( !light.d_pointLight ) 
     20.0f << "," <<
     static_cast<GLfloat>( light.d_pointLight) << endl; 
+  cerr << "Location lightPosition[" << g_cLight << "] : "
+       << g_locLightPos[g_cLight] << endl;
 #endif
-  std::ostringstream os;
-  os << "lightPosition[" << g_cLight << "]";
-  std::string varName = os.str();
-  GLuint locLightPos = glGetUniformLocation(g_program, varName.c_str());
-#ifdef DEBUG_DISPLAY
-  cerr << "Location " << varName << " : " << locLightPos << endl;
-#endif
-  glm::vec4 lightPos = 
-    glm::vec4( cos(g_lightAngle)*g_winSize.d_width, 
-	       sin(g_lightAngle)*g_winSize.d_width, 
-	       20.0f, // * static_cast<GLfloat>( !light.d_pointLight ), 
-	       static_cast<GLfloat>( light.d_pointLight )); 
-  glProgramUniform4fv(g_program, locLightPos, 1, glm::value_ptr(lightPos));
-  errorOut();
+  return glm::vec4( cos(g_lightAngle)*g_winSize.d_width, 
+		    sin(g_lightAngle)*g_winSize.d_width, 
+		    20.0f, // * static_cast<GLfloat>( !light.d_pointLight ), 
+		    static_cast<GLfloat>( light.d_pointLight )); 
+}
 
-  // Instead of moving the coordinate system into the scene,
-  // use lookAt -- use the center of the viewing volume as the reference coordinates
-  glm::mat4 ModelView = 
-    glm::lookAt( glm::vec3(g_camX, g_camY, -(g_winSize.d_far+g_winSize.d_near)/2.0f ),
-		 glm::vec3(0, 0, 0),// at is the center of the cube
-		 glm::vec3(0, 1.0f, 0 )); // y is up
+
+// Record the per-frame uniforms
+void recordFrameState( CommandList& _list ) {
+  uint64_t key = commandKey(PASS_FRAME, g_program);
+  glm::vec4 lightPos = lightPosition();
+  _list.uniform(key, g_program, g_locLightPos[g_cLight],
+		glm::value_ptr(lightPos), 4);
+  if ( g_shadows ) {
+    glm::mat4 shadowMatrix = g_shadowMap.getShadowMatrix();
+    _list.uniform(key, g_program, g_locShadowMatrix,
+		  glm::value_ptr(shadowMatrix), 16);
+  }
+
+  glm::mat4 ModelView = viewMatrix();
    // Update uniform for this drawing
-  glUniformMatrix4fv(g_tfm.locVM, 1, GL_FALSE, glm::value_ptr(ModelView));
-  // VAO is still bound - to be clear bind again
-  glBindVertexArray(g_vao);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,g_ebo);
-  glEnable(GL_PRIMITIVE_RESTART);
-  //glPrimitiveRestartIndex(g_boxShape.getRestart());
+  _list.useProgram(key, g_program);
+  _list.uniform(key, g_program, g_tfm.locVM, glm::value_ptr(ModelView), 16);
+  _list.uniform(key, g_depthProgram, g_depthTfm.locVM,
+		glm::value_ptr(ModelView), 16);
+  // the views of the single pass
+  GLfloat nViews = static_cast<GLfloat>(g_nViews);
+  for ( int p=0; p<2; ++p ) {
+    GLuint program = p == 0 ? g_program : g_depthProgram;
+    const MultiViewLocations& locs = p == 0 ? g_viewLocs : g_depthViewLocs;
+    _list.uniform(key, program, locs.locNumViews, &nViews, 1);
+    for ( int v=0; v<g_nViews && g_nViews > 1; ++v ) {
+      GLfloat camX, camY;
+      presetCamera(v, camX, camY);
+      glm::mat4 view = viewMatrix(camX, camY);
+      glm::vec4 tile = viewTile(v);
+      _list.uniform(key, program, locs.locViewMatrices[v],
+		    glm::value_ptr(view), 16);
+      _list.uniform(key, program, locs.locViewTiles[v],
+		    glm::value_ptr(tile), 4);
+    }
+  }
+  return;
+}
 
-  //TODO: ADD SPHERE
-  glPrimitiveRestartIndex(g_sphere.getRestart());
-  /*glDrawElementsInstanced(GL_TRIANGLE_STRIP, g_boxShape.getNIndices(), 
-	GL_UNSIGNED_SHORT, 0, g_numBoxes);*/
 
-  //TODO: ADD SPHERE
-  glDrawElementsInstanced(GL_TRIANGLE_STRIP, g_sphere.getNIndices(),
-	  GL_UNSIGNED_SHORT, 0, g_numBoxes);
+// Depth and color state of the passes: after the depth pre-pass the lit
+// pass only shades the fragments which are visible
+void recordPassState( CommandList& _list ) {
+  if ( g_prepass ) {
+    uint64_t key = commandKey(PASS_DEPTH, g_depthProgram);
+    _list.useProgram(key, g_depthProgram);
+    _list.colorMask(key, GL_FALSE);
+    _list.depthMask(key, GL_TRUE);
+    _list.depthFunc(key, GL_LESS);
+  }
+  uint64_t key = commandKey(PASS_LIT, g_program);
+  _list.useProgram(key, g_program);
+  _list.colorMask(key, GL_TRUE);
+  _list.depthMask(key, g_prepass ? GL_FALSE : GL_TRUE);
+  _list.depthFunc(key, g_prepass ? GL_EQUAL : GL_LESS);
+  return;
+}
+
 
+// Record the instanced draw of a shape
+void recordShape( CommandList& _list, RenderPass _pass, GLuint _program,
+		  GLuint _vao, const RenderShape& _shape,
+		  ShapeId _shapeId, int _nInstances,
+		  int _firstInstance = 0, int _materialBlock = 0 ) {
+  uint64_t key = commandKey(_pass, _program, _shapeId, _materialBlock);
+  // VAO is still bound - the state cache skips the bind if nothing changed
+  _list.bindVertexArray(key, _vao);
+  _list.bindBuffer(key, GL_ELEMENT_ARRAY_BUFFER, g_ebo);
+  _list.enable(key, GL_PRIMITIVE_RESTART);
+  _list.primitiveRestartIndex(key, _shape.getRestart());
+  if ( g_instanceFetch != FETCH_ATTRIBUTES ) {
+    // gl_InstanceID starts at 0 in every draw, the shader adds the first
+    // instance; culled blocks start where the culler put them
+    GLint base = g_gpuCull ? g_blockFirst[_materialBlock] : _firstInstance;
+    _list.uniform(key, _program,
+		  _program == g_program ? g_tfm.locBase : g_depthTfm.locBase,
+		  base);
+    _firstInstance = 0;
+  }
+  if ( g_gpuCull ) {
+    // the count and first instance of the block are on the GPU
+    _list.drawElementsIndirect(key, _shape.getPrimitive(), GL_UNSIGNED_SHORT,
+			       g_gpuCuller.getCommands(),
+			       GpuCuller::getCommandOffset(_materialBlock));
+    return;
+  }
+  // every instance once per view, the divisor keeps the attributes; the
+  // base instance is not scaled by the divisor
+  _list.drawElementsInstanced(key, _shape.getPrimitive(), _shape.getNIndices(),
+			      GL_UNSIGNED_SHORT, 0, _nInstances * g_nViews,
+			      _firstInstance);
+  return;
+}
+
+
+// Record the lit draws of a shape, one per block of the material table
+void recordMaterialBatches( CommandList& _list, const RenderShape& _shape,
+			    ShapeId _shapeId ) {
+  GLsizeiptr blockBytes = MaterialArray::getBlockBytes();
+  for ( std::vector<MaterialBatch>::const_iterator iter = g_batches.begin();
+	iter != g_batches.end(); ++iter ) {
+    uint64_t key = commandKey(PASS_LIT, g_program, _shapeId, iter->d_block);
+    _list.bindBufferRange(key, GL_UNIFORM_BUFFER, 0, g_materialUbo,
+			  iter->d_block * blockBytes, blockBytes);
+    recordShape( _list, PASS_LIT, g_program,
+		 g_gpuCull ? g_culledVao : g_vao, _shape, _shapeId,
+		 iter->d_count, iter->d_first, iter->d_block );
+  }
+  return;
+}
+
+
+// Replace the contents of an instance attribute buffer; the storage
+// grows by half like the host arrays, so changing instance counts do not
+// reallocate every frame
+void uploadInstances( GLuint _buffer, const void* _data, GLsizeiptr _size ) {
+  GLsizeiptr& capacity = g_bufferCapacity[_buffer];
+  if ( _size > capacity ) {
+    capacity = std::max(_size, capacity + capacity / 2);
+  }
+  g_glState.bindBuffer(GL_ARRAY_BUFFER, _buffer);
+  // orphan the old storage so the upload does not wait for the last draw
+  glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, _size, _data);
+}
+
+
+// Upload bytes [_offset,_size) of the instance attribute array _data whose
+// earlier bytes are in the buffer already; all of it if the buffer is
+// too small
+void updateInstanceRange( GLuint _buffer, const void* _data,
+			  GLsizeiptr _offset, GLsizeiptr _size ) {
+  if ( _size > g_bufferCapacity[_buffer] ) {
+    uploadInstances(_buffer, _data, _size);
+    return;
+  }
+  if ( _size <= _offset ) return;
+  g_glState.bindBuffer(GL_ARRAY_BUFFER, _buffer);
+  glBufferSubData(GL_ARRAY_BUFFER, _offset, _size - _offset,
+		  static_cast<const char*>(_data) + _offset);
+}
+
+
+// Room for _size bytes in the instance attribute buffer _buffer which is
+// written on the GPU; its contents are kept when it grows
+void reserveInstanceBuffer( GLuint _buffer, GLsizeiptr _size ) {
+  GLsizeiptr& capacity = g_bufferCapacity[_buffer];
+  if ( _size <= capacity ) return;
+  GLsizeiptr grown = std::max(_size, capacity + capacity / 2);
+  GLuint copy;
+  glGenBuffers(1, &copy);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+  glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STREAM_COPY);
+  glBindBuffer(GL_COPY_READ_BUFFER, _buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+		      capacity);
+  glBufferData(GL_COPY_READ_BUFFER, grown, NULL, GL_DYNAMIC_DRAW);
+  glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0,
+		      capacity);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &copy);
+  capacity = grown;
   errorOut();
+}
+
+
+int numInstances() {
+  return g_compute ? g_instanceCompute.getNInstances() :
+    g_animation.getNInstances();
+}
+
+
+// Instances of the compute path: the matrices are generated and animated
+// in their buffer, only colors and materials are uploaded when they change
+void updateComputeInstances() {
+  int nInstances = g_instanceCompute.getNInstances();
+  if ( g_instancesChanged ) {
+    if ( g_cbo ) {
+      uploadInstances(g_cbo, g_shape->d_colors,
+		      sizeof(glm::vec4) * nInstances);
+    }
+    if ( g_mbo ) {
+      uploadInstances(g_mbo, g_materialIds.data(),
+		      sizeof(GLuint) * nInstances);
+    }
+    // a single block of materials
+    g_batches.clear();
+    MaterialBatch batch = { 0, 0, nInstances };
+    g_batches.push_back(batch);
+    g_nDrawInstances = nInstances;
+    g_instancesChanged = false;
+    g_resizedFrom = -1;
+  }
+  if ( g_animation.getMode() != ANIMATION_OFF ) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float dt = std::chrono::duration<float>(now - g_animLast).count();
+    g_animLast = now;
+    PROFILE_GPU_ZONE("compute instances");
+    g_instanceCompute.animate(g_mmbo, std::min(dt, 0.1f),
+			      g_animation.getMode(), g_glState);
+  }
+  errorOut();
+}
+
+
+// Upload the instance transforms of the last animation update, in depth
+// order and without occluded instances if requested, and start the next
+// update; the workers build it while this frame is recorded and drawn
+void updateInstances() {
+  if ( g_compute ) {
+    updateComputeInstances();
+    return;
+  }
+  bool animate = g_animation.getMode() != ANIMATION_OFF;
+  bool sorted = g_sortOrder != SORT_NONE;
+  glm::mat4 view = viewMatrix();
+  // streamed chunks arrive in the background, the resident ones in view
+  // are taken as they are
+  if ( g_streaming && g_store.update(view, g_projection) ) {
+    g_instancesChanged = true;
+  }
+  // static instances only need a new order or culling when the view changed
+  bool viewChanged =
+    memcmp(&view, &g_instancesView, sizeof(glm::mat4)) != 0 ||
+    memcmp(&g_projection, &g_instancesProj, sizeof(glm::mat4)) != 0;
+  if ( !g_mmbo || !(animate || g_instancesChanged ||
+		    ((sorted || g_occlusion) && viewChanged)) ) {
+    return;
+  }
+  g_instancesView = view;
+  g_instancesProj = g_projection;
+  PROFILE_CPU_ZONE("instances");
+  g_animation.endUpdate();
+  int nInstances = g_animation.getNInstances();
+  const glm::mat4* tfms = g_animation.getTransforms();
+  const GLuint* materials = g_materialIds.data();
+  if ( g_streaming ) {
+    nInstances = g_store.getNInstances();
+    tfms = g_store.getTransforms();
+    materials = g_store.getMaterials();
+  }
+  if ( g_shadows ) {
+    // all instances cast shadows, in any order
+    PROFILE_CPU_ZONE("shadow invalidation");
+    g_shadowMap.setInstances(tfms, nInstances);
+  }
+  // colors are only used if the shader reads them; they depend on the
+  // count, the streamed instances get the colors of the resident set
+  if ( g_cbo && (g_streaming || g_shape->getNColors() < nInstances) ) {
+    g_shape->updateColors(nInstances);
+  }
+  const glm::vec4* colors = g_shape->d_colors;
+  if ( sorted ) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    g_sorter.sort(tfms, nInstances, view, g_sortOrder);
+    g_sortedTfms.resize(nInstances);
+    g_sortedMaterials.resize(nInstances);
+    g_sorter.gather(tfms, g_sortedTfms.data());
+    g_sorter.gather(materials, g_sortedMaterials.data());
+    tfms = g_sortedTfms.data();
+    materials = g_sortedMaterials.data();
+    if ( g_cbo ) {
+      g_sortedColors.resize(nInstances);
+      g_sorter.gather(colors, g_sortedColors.data());
+      colors = g_sortedColors.data();
+    }
+    g_sortMs += std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    ++g_sortFrames;
+  }
+  if ( g_occlusion ) {
+    PROFILE_CPU_ZONE("occlusion");
+    nInstances = g_occlusionCuller.cull(tfms, nInstances, g_innerRadius,
+					g_outerRadius, view, g_projection);
+    g_visibleTfms.resize(nInstances);
+    g_visibleMaterials.resize(nInstances);
+    g_occlusionCuller.gather(tfms, g_visibleTfms.data());
+    g_occlusionCuller.gather(materials, g_visibleMaterials.data());
+    tfms = g_visibleTfms.data();
+    materials = g_visibleMaterials.data();
+    if ( g_cbo ) {
+      g_visibleColors.resize(nInstances);
+      g_occlusionCuller.gather(colors, g_visibleColors.data());
+      colors = g_visibleColors.data();
+    }
+    g_occludedSum += g_occlusionCuller.getNTested() - nInstances;
+    g_testedSum += g_occlusionCuller.getNTested();
+    g_cullMs += g_occlusionCuller.getMs();
+    ++g_cullFrames;
+  }
+  // one draw per block of the material table: bucket the instances by
+  // block, the stable sort keeps the depth order within a bucket
+  int nBlocks = g_matArray.getNBlocks();
+  bool batched = nBlocks > 1;
+  g_batches.clear();
+  if ( batched ) {
+    PROFILE_CPU_ZONE("material batches");
+    g_batchKeys.resize(nInstances);
+    for ( int i=0; i<nInstances; ++i ) {
+      g_batchKeys[i] = materials[i] / MaterialArray::BLOCK_SIZE;
+    }
+    int keyBits = 1;
+    while ( (1 << keyBits) < nBlocks ) ++keyBits;
+    g_batcher.radixSort(g_batchKeys.data(), nInstances, keyBits);
+    g_batchedTfms.resize(nInstances);
+    g_batchedMaterials.resize(nInstances);
+    g_batcher.gather(tfms, g_batchedTfms.data());
+    g_batcher.gather(materials, g_batchedMaterials.data());
+    tfms = g_batchedTfms.data();
+    materials = g_batchedMaterials.data();
+    if ( g_cbo ) {
+      g_batchedColors.resize(nInstances);
+      g_batcher.gather(colors, g_batchedColors.data());
+      colors = g_batchedColors.data();
+    }
+    const uint32_t* keys = g_batcher.getKeys();
+    for ( int i=0; i<nInstances; ++i ) {
+      if ( i == 0 || keys[i] != keys[i-1] ) {
+	MaterialBatch batch = { static_cast<int>(keys[i]), i, 0 };
+	g_batches.push_back(batch);
+      }
+      ++g_batches.back().d_count;
+    }
+  } else {
+    MaterialBatch batch = { 0, 0, nInstances };
+    g_batches.push_back(batch);
+  }
+  g_nDrawInstances = nInstances;
+  if ( g_resizedFrom >= 0 && !animate && !sorted && !g_occlusion &&
+       !batched && !g_streaming ) {
+    // only the number of instances changed: the buffers hold the first
+    // ones in generation order, the colors depend on the count
+    updateInstanceRange(g_mmbo, tfms, sizeof(glm::mat4) * g_resizedFrom,
+			sizeof(glm::mat4) * nInstances);
+    if ( g_cbo ) {
+      uploadInstances(g_cbo, colors, sizeof(glm::vec4) * nInstances);
+    }
+    if ( g_mbo ) {
+      updateInstanceRange(g_mbo, materials, sizeof(GLuint) * g_resizedFrom,
+			  sizeof(GLuint) * nInstances);
+    }
+  } else {
+    uploadInstances(g_mmbo, tfms, sizeof(glm::mat4) * nInstances);
+    // colors and materials follow their instances
+    bool reordered = sorted || g_occlusion || batched || g_instancesChanged;
+    if ( g_cbo && reordered ) {
+      uploadInstances(g_cbo, colors, sizeof(glm::vec4) * nInstances);
+    }
+    if ( g_mbo && reordered ) {
+      uploadInstances(g_mbo, materials, sizeof(GLuint) * nInstances);
+    }
+  }
+  g_instancesChanged = false;
+  g_resizedFrom = -1;
+  if ( animate ) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float dt = std::chrono::duration<float>(now - g_animLast).count();
+    g_animLast = now;
+    // no jump after a pause, e.g., on demand rendering
+    g_animation.beginUpdate(std::min(dt, 0.1f));
+  }
+  errorOut();
+}
+
+
+void setSortOrder( SortOrder _order ) {
+  if ( g_compute && _order != SORT_NONE ) {
+    cerr << "Instance order: not with compute instances" << endl;
+    return;
+  }
+  g_sortOrder = _order;
+  // upload once in the new order, or in generation order
+  g_instancesChanged = true;
+  g_sortMs = 0.0;
+  g_sortFrames = 0;
+  g_samplesPassed = 0;
+  g_samplesFrames = 0;
+  cerr << "Instance order: " << sortOrderName( _order ) << endl;
+}
+
+
+// Follow the light and redraw the out of date part of the shadow map
+void updateShadowMap() {
+  if ( !g_shadows ) return;
+  PROFILE_CPU_ZONE("shadow map");
+  // the light is placed relative to the camera
+  LightSource light = g_lightArray.get( g_cLight );
+  glm::mat4 toWorld = glm::inverse(viewMatrix());
+  glm::mat4 lightView, lightProj;
+  ShadowMap::lightMatrices(toWorld * lightPosition(),
+			   glm::mat3(toWorld) * light.d_spot_direction,
+			   light.d_spot_cutoff, g_sceneRadius,
+			   lightView, lightProj);
+  g_shadowMap.setLight(lightView, lightProj);
+  PROFILE_GPU_ZONE("shadow pass");
+  if ( g_shadowMap.render(g_glState) ) {
+    glViewport( 0, 0, g_winSize.d_widthPixel, g_winSize.d_heightPixel );
+  }
+  errorOut();
+}
+
+
+void setShadows( bool _on ) {
+  if ( g_compute && _on ) {
+    cerr << "Shadows: not with compute instances" << endl;
+    return;
+  }
+  g_shadows = _on;
+  g_glState.programUniform1f(g_program, g_locShadowStrength,
+			     _on ? 1.0f : 0.0f);
+  if ( _on ) {
+    // the instances may have moved while the map was not updated
+    g_shadowMap.setInstances(g_animation.getTransforms(),
+			     g_animation.getNInstances());
+    g_shadowMap.invalidate();
+  }
+  g_shadowMap.resetStats();
+  cerr << "Shadows: " << (_on ? "on" : "off") << endl;
+}
+
+
+// Table of _nMaterials materials, randomly assigned to the instances;
+// replaces the materials of the scene
+void setNumMaterials( int _nMaterials ) {
+  if ( !g_baseInstance && _nMaterials > MaterialArray::BLOCK_SIZE ) {
+    cerr << "More than " << MaterialArray::BLOCK_SIZE
+	 << " materials need GL 4.2 base instances" << endl;
+    _nMaterials = MaterialArray::BLOCK_SIZE;
+  }
+  if ( g_compute && _nMaterials > MaterialArray::BLOCK_SIZE ) {
+    cerr << "More than " << MaterialArray::BLOCK_SIZE
+	 << " materials are batched on the host, not with compute instances"
+	 << endl;
+    _nMaterials = MaterialArray::BLOCK_SIZE;
+  }
+  g_numMaterials = std::max(_nMaterials, 1);
+  initMaterial( g_numMaterials );
+  g_matArray.setMaterialsUBO( g_materialUbo );
+  // the running update does not read the materials
+  assignMaterials( numInstances(), g_shape->getSeed() );
+  g_instancesChanged = true;
+  cerr << "Materials: " << g_matArray.size() << " in "
+       << g_matArray.getNBlocks() << " blocks" << endl;
+}
+
+
+// _nInstances instances: existing ones keep their transform, material
+// and animation state, new ones are generated in the volume of the scene
+void setNumInstances( int _nInstances ) {
+  if ( g_streaming ) {
+    cerr << "Instances: not with streamed instances" << endl;
+    return;
+  }
+  _nInstances = std::max(_nInstances, 1);
+  if ( g_instanceFetch == FETCH_TEXTURE_BUFFER &&
+       4LL * _nInstances > g_maxTextureBufferSize ) {
+    _nInstances = g_maxTextureBufferSize / 4;
+    cerr << "Instances: at most " << _nInstances << " with texture buffers"
+	 << endl;
+  }
+  if ( g_compute ) {
+    // only the new instances are generated, on the GPU
+    int first = std::min(g_instanceCompute.getNInstances(), _nInstances);
+    assignMaterials(_nInstances, g_shape->getSeed(), first);
+    if ( g_cbo ) g_shape->updateColors(_nInstances);
+    reserveInstanceBuffer(g_mmbo, sizeof(glm::mat4) * _nInstances);
+    g_instanceCompute.generate(g_mmbo, g_shape->getSeed(),
+			       g_shape->getVolume(), first, _nInstances,
+			       g_glState);
+    g_instancesChanged = true;
+    cerr << "Instances: " << _nInstances << " generated on the GPU" << endl;
+    return;
+  }
+  // the running update reads the transforms
+  g_animation.endUpdate();
+  int nOld = g_animation.getNInstances();
+  g_shape->resizeTransforms(_nInstances);
+  assignMaterials(_nInstances, g_shape->getSeed(), std::min(nOld, _nInstances));
+  g_animation.init(*g_shape, std::min(nOld, _nInstances));
+  if ( g_cbo ) g_shape->updateColors(_nInstances);
+  g_resizedFrom = g_resizedFrom < 0 ? std::min(nOld, _nInstances)
+    : std::min(g_resizedFrom, std::min(nOld, _nInstances));
+  g_instancesChanged = true;
+  if ( g_shadows ) {
+    g_shadowMap.setInstances(g_animation.getTransforms(), _nInstances);
+  }
+  AlignedPool& pool = AlignedPool::global();
+  cerr << "Instances: " << _nInstances << " (" << (pool.getSystemBytes() >> 20)
+       << " MB pooled, " << pool.getNSystem() << " allocations, "
+       << pool.getNReused() << " reused)" << endl;
+}
+
+
+void setOcclusion( bool _on ) {
+  if ( g_compute && _on ) {
+    cerr << "Occlusion culling: not with compute instances" << endl;
+    return;
+  }
+  g_occlusion = _on;
+  g_instancesChanged = true;
+  g_occludedSum = 0;
+  g_testedSum = 0;
+  g_cullMs = 0.0;
+  g_cullFrames = 0;
+  cerr << "Occlusion culling: " << (_on ? "on" : "off") << endl;
+}
+
+
+// Count the fragments which pass the depth test, i.e., are shaded with
+// early-z. The result of the query of two frames ago is collected first.
+void beginSamplesQuery() {
+  GLuint query = g_samplesQuery[g_samplesFrame % 2];
+  if ( g_samplesFrame >= 2 ) {
+    GLuint available = 0;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if ( available ) {
+      GLuint64 samples = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+      g_samplesPassed += samples;
+      ++g_samplesFrames;
+    }
+  }
+  glBeginQuery(GL_SAMPLES_PASSED, query);
+}
+
+
+void endSamplesQuery() {
+  glEndQuery(GL_SAMPLES_PASSED);
+  ++g_samplesFrame;
+}
+
+
+// Time the passes of the multi-view modes; the result of two frames ago
+// is collected first
+void beginViewQuery() {
+  GLuint* query = &g_viewQuery[2 * (g_viewFrame % 2)];
+  if ( g_viewFrame >= 2 ) {
+    // timestamps complete in order, the end implies the begin
+    GLuint available = 0;
+    glGetQueryObjectuiv(query[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if ( available ) {
+      GLuint64 begin = 0, end = 0;
+      glGetQueryObjectui64v(query[0], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(query[1], GL_QUERY_RESULT, &end);
+      g_viewGpuMs += (end - begin) * 1.0e-6;
+      ++g_viewFrames;
+    }
+  }
+  glQueryCounter(query[0], GL_TIMESTAMP);
+}
+
+
+void endViewQuery() {
+  glQueryCounter(g_viewQuery[2 * (g_viewFrame % 2) + 1], GL_TIMESTAMP);
+  ++g_viewFrame;
+}
+
+
+// The instance attributes advance once every _divisor draw instances
+void setInstanceDivisor( GLuint _divisor ) {
+  g_glState.bindVertexArray(g_vao);
+  for ( int i=0; i<4 && g_tfm.locMM >= 0; ++i ) {
+    glVertexAttribDivisor(g_tfm.locMM + i, _divisor);
+  }
+  if ( g_attrib.locColor >= 0 ) {
+    glVertexAttribDivisor(g_attrib.locColor, _divisor);
+  }
+  if ( g_attrib.locMaterial >= 0 ) {
+    glVertexAttribDivisor(g_attrib.locMaterial, _divisor);
+  }
+  g_glState.bindVertexArray(g_depthVao);
+  for ( int i=0; i<4 && g_tfm.locMM >= 0; ++i ) {
+    glVertexAttribDivisor(g_tfm.locMM + i, _divisor);
+  }
+  g_glState.bindVertexArray(g_vao);
+  errorOut();
+}
+
+
+void setMultiView( MultiViewMode _mode ) {
+  // the software and GPU culling only know the main camera
+  if ( _mode != MULTIVIEW_OFF && g_occlusion ) setOcclusion( false );
+  if ( _mode != MULTIVIEW_OFF && g_gpuCull ) {
+    g_gpuCull = false;
+    cerr << "GPU culling: off" << endl;
+  }
+  g_multiView = _mode;
+  g_nViews = _mode == MULTIVIEW_SINGLE_PASS ? g_nViewPresets : 1;
+  setInstanceDivisor( g_nViews );
+  // the tile edges clip the views of the single pass
+  for ( int c=0; c<4; ++c ) {
+    if ( _mode == MULTIVIEW_SINGLE_PASS ) {
+      g_glState.enable(GL_CLIP_DISTANCE0 + c);
+    } else {
+      g_glState.disable(GL_CLIP_DISTANCE0 + c);
+    }
+  }
+  g_viewGpuMs = 0.0;
+  g_viewFrames = 0;
+  cerr << "Multi-view: " << multiViewName( _mode ) << endl;
+}
+
+
+void setAnimation( AnimationMode _mode ) {
+  if ( g_streaming && _mode != ANIMATION_OFF ) {
+    cerr << "Animation: not with streamed instances" << endl;
+    return;
+  }
+  // the running update reads the mode
+  g_animation.endUpdate();
+  g_animation.setMode( _mode );
+  g_animLast = std::chrono::steady_clock::now();
+  cerr << "Animation: " << animationName( _mode ) << " "
+       << numInstances() << " instances" << endl;
+}
+
+
+// Generate the instances with the compute shaders in the matrix buffer,
+// or go back to the host transforms
+void setCompute( bool _on ) {
+  if ( _on == g_compute ) return;
+  if ( _on && ( !g_instanceCompute.isReady() || !g_mmbo )) {
+    cerr << "Compute instances: need GL 4.3 compute shaders" << endl;
+    return;
+  }
+  if ( _on && g_streaming ) {
+    cerr << "Compute instances: not with streamed instances" << endl;
+    return;
+  }
+  // the running update reads the transforms
+  g_animation.endUpdate();
+  int nInstances = numInstances();
+  if ( _on ) {
+    // order, culling, material batches and shadow casters need the
+    // transforms on the host
+    if ( g_sortOrder != SORT_NONE ) setSortOrder( SORT_NONE );
+    if ( g_occlusion ) setOcclusion( false );
+    if ( g_shadows ) setShadows( false );
+    if ( g_matArray.getNBlocks() > 1 ) {
+      setNumMaterials( MaterialArray::BLOCK_SIZE );
+    }
+    g_compute = true;
+    // placed like new instances of the scene
+    reserveInstanceBuffer(g_mmbo, sizeof(glm::mat4) * nInstances);
+    g_instanceCompute.generate(g_mmbo, g_shape->getSeed(),
+			       g_shape->getVolume(), 0, nInstances, g_glState);
+  } else {
+    g_compute = false;
+    if ( nInstances != g_animation.getNInstances() ) {
+      setNumInstances( nInstances );
+    }
+    // the matrix buffer holds the GPU's transforms
+    g_resizedFrom = -1;
+  }
+  g_instancesChanged = true;
+  g_animLast = std::chrono::steady_clock::now();
+  cerr << "Compute instances: " << (_on ? "on" : "off") << ", "
+       << nInstances << " instances" << endl;
+}
+
+
+// Frustum cull the instances of the attribute buffers on the GPU into
+// the visible instances and draw commands of the culled draws
+void cullInstances() {
+  PROFILE_GPU_ZONE("gpu cull");
+  g_blockFirst.assign(g_matArray.getNBlocks(), 0);
+  for ( size_t b=0; b<g_batches.size(); ++b ) {
+    g_blockFirst[g_batches[b].d_block] = g_batches[b].d_first;
+  }
+  g_gpuCuller.cull(g_mmbo, g_mbo, g_cbo, g_nDrawInstances, g_blockFirst,
+		   g_shape->getNIndices(), g_projection * viewMatrix(),
+		   g_outerRadius, g_glState);
+  errorOut();
+}
+
+
+// Attach the instances drawn this frame, the visible ones with GPU
+// culling, to the buffer fetch. The compute passes use the same storage
+// buffer bindings and run first.
+void bindInstanceData() {
+  GLuint buffers[2] = { g_mmbo, g_mbo };
+  if ( g_gpuCull ) {
+    buffers[0] = g_gpuCuller.getTransforms();
+    buffers[1] = g_gpuCuller.getMaterials();
+  }
+  if ( g_instanceFetch == FETCH_STORAGE_BUFFER ) {
+    for ( int b=0; b<2; ++b ) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+    }
+  } else if ( g_instanceFetch == FETCH_TEXTURE_BUFFER &&
+	      buffers[0] != g_fetchBuffers[0] ) {
+    // a texture follows its buffer when the storage is reallocated
+    const GLenum formats[2] = { GL_RGBA32F, GL_R32UI };
+    for ( int t=0; t<2; ++t ) {
+      glActiveTexture(GL_TEXTURE0 + g_instanceUnit + t);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[t], buffers[t]);
+      g_fetchBuffers[t] = buffers[t];
+    }
+    glActiveTexture(GL_TEXTURE0);
+  }
+  errorOut();
+}
+
+
+void setGpuCull( bool _on ) {
+  if ( _on && !g_gpuCuller.isReady() ) {
+    cerr << "GPU culling: need GL 4.3 compute shaders" << endl;
+    return;
+  }
+  // the commands are culled for the main camera only
+  if ( _on && g_multiView != MULTIVIEW_OFF ) setMultiView( MULTIVIEW_OFF );
+  g_gpuCull = _on;
+  g_gpuCuller.resetStats();
+  cerr << "GPU culling: " << (_on ? "on" : "off") << endl;
+}
+
+
+void renderFrame()
+{
+  PROFILE_CPU_ZONE("display");
+  g_glState.beginFrame();
+  updateInstances();
+  if ( g_gpuCull ) cullInstances();
+  if ( g_instanceFetch != FETCH_ATTRIBUTES ) bindInstanceData();
+  updateShadowMap();
+  {
+    PROFILE_CPU_ZONE("record");
+    // list 0: frame state, list 1: shapes
+    recordParallel(g_cmdLists, [](CommandList& _list, int _i) {
+	_list.clear();
+	if ( _i == 0 ) {
+	  recordFrameState( _list );
+	  recordPassState( _list );
+	} else {
+	  if ( g_prepass && g_gpuCull ) {
+	    // one indirect draw per block as in the lit pass
+	    for ( size_t b=0; b<g_batches.size(); ++b ) {
+	      recordShape( _list, PASS_DEPTH, g_depthProgram, g_culledDepthVao,
+			   *g_shape, g_shapeId, g_batches[b].d_count,
+			   g_batches[b].d_first, g_batches[b].d_block );
+	    }
+	  } else if ( g_prepass ) {
+	    recordShape( _list, PASS_DEPTH, g_depthProgram, g_depthVao,
+			 *g_shape, g_shapeId, g_nDrawInstances );
+	  }
+	  recordMaterialBatches( _list, *g_shape, g_shapeId );
+	}
+      });
+    g_cmdQueue.clear();
+    for ( size_t l=0; l<g_cmdLists.size(); ++l ) {
+      g_cmdQueue.add(g_cmdLists[l]);
+    }
+    g_cmdQueue.sort();
+  }
+  // clearing is subject to the write masks
+  g_glState.colorMask(GL_TRUE);
+  g_glState.depthMask(GL_TRUE);
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+  g_cmdQueue.executePass(g_glState, PASS_FRAME);
+  if ( g_multiView != MULTIVIEW_OFF ) beginViewQuery();
+  if ( g_multiView == MULTIVIEW_SEQUENTIAL ) {
+    // the passes once per view, in its tile of the window
+    beginSamplesQuery();
+    for ( int v=0; v<g_nViewPresets; ++v ) {
+      GLfloat camX, camY;
+      presetCamera(v, camX, camY);
+      glm::mat4 view = viewMatrix(camX, camY);
+      g_glState.programUniformMatrix4fv(g_program, g_tfm.locVM,
+					glm::value_ptr(view));
+      g_glState.programUniformMatrix4fv(g_depthProgram, g_depthTfm.locVM,
+					glm::value_ptr(view));
+      glm::vec4 tile = viewTile(v);
+      GLfloat w = tile.z * g_winSize.d_widthPixel;
+      GLfloat h = tile.w * g_winSize.d_heightPixel;
+      glViewport(static_cast<GLint>((tile.x + 1.0f) * 0.5f *
+				    g_winSize.d_widthPixel - 0.5f * w),
+		 static_cast<GLint>((tile.y + 1.0f) * 0.5f *
+				    g_winSize.d_heightPixel - 0.5f * h),
+		 static_cast<GLsizei>(w), static_cast<GLsizei>(h));
+      if ( g_prepass ) g_cmdQueue.executePass(g_glState, PASS_DEPTH);
+      g_cmdQueue.executePass(g_glState, PASS_LIT);
+    }
+    endSamplesQuery();
+    glViewport(0, 0, g_winSize.d_widthPixel, g_winSize.d_heightPixel);
+  } else {
+    if ( g_prepass ) {
+      PROFILE_GPU_ZONE("depth pass");
+      g_cmdQueue.executePass(g_glState, PASS_DEPTH);
+    }
+    {
+      PROFILE_GPU_ZONE("lit pass");
+      beginSamplesQuery();
+      g_cmdQueue.executePass(g_glState, PASS_LIT);
+      endSamplesQuery();
+    }
+  }
+  if ( g_multiView != MULTIVIEW_OFF ) endViewQuery();
+  errorOut();
+}
+
+
+void pacedRedisplay( int ) {
+  g_timerPending = false;
+  glutPostRedisplay();
+}
+
+
+void idle() {
+  glutPostRedisplay();
+}
+
+
+void setPacing( PacingPolicy _policy ) {
+  g_pacer.setPolicy( _policy );
+  cerr << "Pacing: " << pacingName( _policy );
+  if ( _policy == PACING_TARGET_FPS ) cerr << " " << g_pacer.getTargetFps();
+  cerr << endl;
+  // unlocked and vsync redraw whenever idle, target fps uses a timer
+  if ( _policy == PACING_UNLOCKED || _policy == PACING_VSYNC ) {
+    glutIdleFunc(idle);
+  } else {
+    glutIdleFunc(NULL);
+  }
+  glutPostRedisplay();
+}
+
+
+void display(void)
+{
+  PROFILE_FRAME_BEGIN();
+  renderFrame();
   // swap buffers
   glFlush();
   glutSwapBuffers();
+  PROFILE_FRAME_END();
+  g_pacer.frameDone();
+  if ( g_pacer.reportDue() ) {
+    cerr << g_pacer.report() << endl;
+    cerr << "GL state: " << g_glState.getIssued() << " calls issued, "
+	 << g_glState.getElided() << " elided per frame" << endl;
+    cerr << "Materials: " << g_matArray.size() << " in " << g_batches.size()
+	 << " draw calls" << endl;
+    cerr << "Instance order: " << sortOrderName( g_sortOrder );
+    if ( g_sortFrames > 0 ) {
+      cerr << ", sort " << g_sortMs / g_sortFrames << " ms";
+    }
+    if ( g_samplesFrames > 0 ) {
+      cerr << ", " << g_samplesPassed / g_samplesFrames
+	   << " samples passed per frame";
+    }
+    cerr << endl;
+    g_sortMs = 0.0;
+    g_sortFrames = 0;
+    g_samplesPassed = 0;
+    g_samplesFrames = 0;
+    if ( g_cullFrames > 0 ) {
+      cerr << "Occlusion: " << 100.0 * g_occludedSum / std::max(g_testedSum, 1LL)
+	   << "% of " << g_testedSum / g_cullFrames << " instances occluded, cull "
+	   << g_cullMs / g_cullFrames << " ms" << endl;
+    }
+    g_occludedSum = 0;
+    g_testedSum = 0;
+    g_cullMs = 0.0;
+    g_cullFrames = 0;
+    if ( g_shadows && g_shadowMap.getNFrames() > 0 ) {
+      cerr << "Shadow map: " << g_shadowMap.getNFull() << " full and "
+	   << g_shadowMap.getNPartial() << " partial redraws in "
+	   << g_shadowMap.getNFrames() << " frames, "
+	   << 100.0 * g_shadowMap.getTexelFraction()
+	   << "% of the texels per frame, " << g_shadowMap.getCpuMs()
+	   << " ms cpu, " << g_shadowMap.getGpuMs() << " ms gpu per redraw"
+	   << endl;
+      g_shadowMap.resetStats();
+    }
+    if ( g_multiView != MULTIVIEW_OFF && g_viewFrames > 0 ) {
+      int nPasses = g_multiView == MULTIVIEW_SEQUENTIAL ? g_nViewPresets : 1;
+      cerr << "Multi-view: " << multiViewName( g_multiView ) << ", "
+	   << g_nViewPresets << " views in " << nPasses * g_batches.size()
+	   << " draw calls, " << g_viewGpuMs / g_viewFrames
+	   << " ms gpu per frame" << endl;
+      g_viewGpuMs = 0.0;
+      g_viewFrames = 0;
+    }
+    if ( g_gpuCull && g_gpuCuller.getNFrames() > 0 ) {
+      cerr << "GPU culling: " << 100.0 * g_gpuCuller.getVisibleFraction()
+	   << "% of " << g_gpuCuller.getTestedSum() / g_gpuCuller.getNFrames()
+	   << " instances visible, " << g_batches.size()
+	   << " indirect draws" << endl;
+      g_gpuCuller.resetStats();
+    }
+    if ( g_streaming && g_store.getNFrames() > 0 ) {
+      double seconds = std::max(g_store.getLoadMs(), 1.0e-3) * 1.0e-3;
+      cerr << "Store: " << g_store.getNInstances() << " of "
+	   << g_store.getNTotal() << " instances in "
+	   << g_store.getNGathered() << " chunks, "
+	   << g_store.getNResident() << " of " << g_store.getNChunks()
+	   << " chunks resident (" << (g_store.getHostBytes() >> 20)
+	   << " MB), " << g_store.getLoads() << " loads, "
+	   << g_store.getEvictions() << " evictions, "
+	   << static_cast<double>(g_store.getMisses()) / g_store.getNFrames()
+	   << " chunks missing per frame, "
+	   << g_store.getBytesLoaded() / seconds / (1024.0 * 1024.0)
+	   << " MB/s read" << endl;
+      g_store.resetStats();
+    }
+  }
+  // keep drawing while chunks are on their way
+  if ( g_streaming && g_store.isPending() ) glutPostRedisplay();
+  if ( g_pacer.getPolicy() == PACING_TARGET_FPS && !g_timerPending ) {
+    g_timerPending = true;
+    glutTimerFunc(g_pacer.msUntilNextFrame(), pacedRedisplay, 0);
+  }
+#ifdef CSI4130_PROFILE
+  // per-frame aggregation in the window title
+  static int s_frame = 0;
+  if ( g_showProfile && (++s_frame % Profiler::PROFILER_WINDOW) == 0 ) {
+    glutSetWindowTitle( Profiler::instance().summary().c_str() );
+  }
+#endif
 }
 
 
@@ -398,6 +1868,7 @@ void display(void)
  * OpenGL reshape function - main window
  */
 void reshape( GLsizei _width, GLsizei _height ) {
+  PROFILE_CPU_ZONE("reshape");
   GLfloat minDim = std::min(g_winSize.d_width,g_winSize.d_height);
   // adjust the view volume to the correct aspect ratio
   if ( _width > _height ) {
@@ -417,7 +1888,10 @@ void reshape( GLsizei _width, GLsizei _height ) {
 			     -g_winSize.d_height/2.0f, g_winSize.d_height/2.0f,
 			     g_winSize.d_near, g_winSize.d_far );
   }
-  glUniformMatrix4fv(g_tfm.locP, 1, GL_FALSE, glm::value_ptr(Projection));
+  g_glState.programUniformMatrix4fv(g_program, g_tfm.locP, glm::value_ptr(Projection));
+  g_glState.programUniformMatrix4fv(g_depthProgram, g_depthTfm.locP,
+				    glm::value_ptr(Projection));
+  g_projection = Projection;
   g_winSize.d_widthPixel = _width;
   g_winSize.d_heightPixel = _height;
   // reshape our viewport
@@ -475,13 +1949,13 @@ void keyboard (unsigned char key, int x, int y)
     light = g_lightArray.get( g_cLight );
     light.d_ambient = glm::vec4( 1.0f, 1.0f, 1.0f, 1.0f);
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case 'a':
     light = g_lightArray.get( g_cLight );
     light.d_ambient = glm::vec4( 0.0f, 0.0f, 0.0f, 1.0f);
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
     // directional/point light
   case 'D':
@@ -489,13 +1963,13 @@ void keyboard (unsigned char key, int x, int y)
     light.d_spot_cutoff = 180.0f; // No spot light
     light.d_pointLight = false;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case 'd':
     light = g_lightArray.get( g_cLight );
     light.d_pointLight = true;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
     // spot light on/off
   case 'S':
@@ -505,7 +1979,7 @@ void keyboard (unsigned char key, int x, int y)
     g_control.d_spot = true;
     g_control.d_attenuation = false;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     cerr << "Spot light: " <<  light.d_spot_exponent 
 	 << " " << light.d_spot_cutoff << endl;
     break;
@@ -514,7 +1988,7 @@ void keyboard (unsigned char key, int x, int y)
     light.d_spot_cutoff = 180.0f;
     g_control.d_spot = false;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     cerr << "Spot light: " <<  light.d_spot_exponent 
 	 << " " << light.d_spot_cutoff << endl;
     break;
@@ -527,7 +2001,7 @@ void keyboard (unsigned char key, int x, int y)
     g_control.d_attenuation = true;
     g_control.d_spot = false;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     cerr << "Attenuation: " <<  light.d_constant_attenuation 
 	 << " " <<light.d_linear_attenuation 
 	 << " " << light.d_quadratic_attenuation << endl;
@@ -539,27 +2013,86 @@ void keyboard (unsigned char key, int x, int y)
     light.d_quadratic_attenuation = 0.0f;
     g_control.d_attenuation = false;
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     cerr << "Attenuation: " <<  light.d_constant_attenuation 
 	 << " " << light.d_linear_attenuation 
 	 << " " << light.d_quadratic_attenuation << endl;
     break;
     // predefined camera positions
   case '0':
-    g_camX = 0.0f, g_camY = 0.0f;
-    break;
   case '1':
-    g_camX = g_winSize.d_width/6.0f, g_camY = -g_winSize.d_height/6.0f;
-    break;
   case '2':
-    g_camX = g_winSize.d_width/6.0f, g_camY = g_winSize.d_height/6.0f;
-    break;
   case '3':
-    g_camX = -g_winSize.d_width/6.0f, g_camY = g_winSize.d_height/6.0f;
-    break;
   case '4':
-    g_camX = -g_winSize.d_width/6.0f, g_camY = -g_winSize.d_height/6.0f;
+    presetCamera( key - '0', g_camX, g_camY );
+    break;
+  case 'v':
+    // cycle through one view, all presets in one pass and one per preset
+    setMultiView( static_cast<MultiViewMode>
+		  ((g_multiView + 1) % MULTIVIEW_NUM_MODES));
+    break;
+  case 'm':
+    // cycle through static, spinning and orbiting instances
+    setAnimation( static_cast<AnimationMode>
+		  ((g_animation.getMode() + 1) % ANIMATION_NUM_MODES));
+    if ( g_animation.getMode() != ANIMATION_OFF && !g_pacer.isContinuous() ) {
+      setPacing( PACING_VSYNC );
+    }
+    break;
+  case 'e':
+    // depth pre-pass on/off
+    g_prepass = !g_prepass;
+    cerr << "Depth pre-pass: " << (g_prepass ? "on" : "off") << endl;
+    break;
+  case 'w':
+    // shadows on/off
+    setShadows( !g_shadows );
+    break;
+  case 'h':
+    // software occlusion culling on/off
+    setOcclusion( !g_occlusion );
+    break;
+  case 'n':
+    // half or twice the instances
+    setNumInstances( numInstances() / 2 );
+    break;
+  case 'N':
+    setNumInstances( numInstances() * 2 );
+    break;
+  case 'g':
+    // instances generated and animated by compute shaders on/off
+    setCompute( !g_compute );
+    break;
+  case 'u':
+    // frustum culling on the GPU with indirect draws on/off
+    setGpuCull( !g_gpuCull );
+    break;
+  case 'o':
+    // cycle through generation, front to back and back to front order
+    setSortOrder( static_cast<SortOrder>
+		  ((g_sortOrder + 1) % SORT_NUM_ORDERS));
+    break;
+  case 'c':
+    // cycle through on demand, unlocked, vsync and target fps rendering
+    setPacing( static_cast<PacingPolicy>
+	       ((g_pacer.getPolicy() + 1) % PACING_NUM_POLICIES));
     break;
+#ifdef CSI4130_PROFILE
+  case 'f':
+    // profiler summary in the window title
+    g_showProfile = !g_showProfile;
+    break;
+  case 'j':
+    // start trace recording or stop and export
+    if ( Profiler::instance().isRecording() ) {
+      Profiler::instance().setRecording(false);
+      Profiler::instance().exportChromeTrace(g_traceFile);
+    } else {
+      cerr << "Profiler: recording trace" << endl;
+      Profiler::instance().setRecording(true);
+    }
+    break;
+#endif
   default:
     break;
   }
@@ -586,7 +2119,7 @@ void specialkeys( int key, int x, int y )
 	   << " " << light.d_quadratic_attenuation << endl;
     }
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case GLUT_KEY_RIGHT: 
     light = g_lightArray.get( g_cLight );
@@ -603,7 +2136,7 @@ void specialkeys( int key, int x, int y )
 	   << " " << light.d_quadratic_attenuation << endl;
     }
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case GLUT_KEY_UP:
     light = g_lightArray.get( g_cLight );
@@ -619,7 +2152,7 @@ void specialkeys( int key, int x, int y )
 	   << " " << light.d_quadratic_attenuation << endl;
     }
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case GLUT_KEY_DOWN: 
     light = g_lightArray.get( g_cLight );
@@ -636,7 +2169,7 @@ void specialkeys( int key, int x, int y )
 	   << " " << light.d_quadratic_attenuation << endl;
     }
     g_lightArray.set( g_cLight, light );
-    g_lightArray.setLight(g_program, g_cLight );
+    g_lightArray.setLight(g_program, g_cLight, g_glState );
     break;
   case GLUT_KEY_PAGE_UP: 
     g_winSize.d_height += 0.2f;
@@ -653,13 +2186,346 @@ void specialkeys( int key, int x, int y )
   glutPostRedisplay();
 }
 
+
+// Generate the instances of the scene's seed and volume with the compute
+// shaders and with Attributes on the host, and animate both for
+// g_verifySteps frames in either mode; returns the number of failed
+// comparisons
+const int g_verifySteps = 60;
+
+int verifyCompute() {
+  if ( !g_instanceCompute.isReady() || !g_mmbo ) {
+    cerr << "Verify compute: need GL 4.3 compute shaders" << endl;
+    return 1;
+  }
+  g_animation.endUpdate();
+  int nInstances = numInstances();
+  unsigned seed = g_shape->getSeed();
+  glm::vec3 volume = g_shape->getVolume();
+  // sin and cos differ in the last bits, translations scale with the volume
+  float tolerance = 1.0e-5f * std::max(1.0f, glm::length(volume));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ::Attributes host(1, 0);
+  host.setSeed(seed);
+  host.updateTransforms(nInstances, -0.5f * volume, 0.5f * volume);
+  double hostMs = std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  reserveInstanceBuffer(g_mmbo, sizeof(glm::mat4) * nInstances);
+  std::vector<glm::mat4> tfms(nInstances);
+  InstanceAnimation animation;
+  const float dt = 1.0f / 60.0f;
+  // the first dispatch may compile the program
+  g_instanceCompute.generate(g_mmbo, seed, volume, 0, nInstances, g_glState);
+  int nFailed = 0;
+  for ( int m=ANIMATION_OFF; m<ANIMATION_NUM_MODES; ++m ) {
+    AnimationMode mode = static_cast<AnimationMode>(m);
+    glFinish();
+    start = std::chrono::steady_clock::now();
+    g_instanceCompute.generate(g_mmbo, seed, volume, 0, nInstances,
+			       g_glState);
+    glFinish();
+    double gpuMs = std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    const glm::mat4* expected = host.d_tfms;
+    if ( mode != ANIMATION_OFF ) {
+      for ( int f=0; f<g_verifySteps; ++f ) {
+	g_instanceCompute.animate(g_mmbo, dt, mode, g_glState);
+      }
+      animation.init(host);
+      animation.setMode(mode);
+      for ( int f=0; f<g_verifySteps; ++f ) animation.update(dt);
+      expected = animation.getTransforms();
+    }
+    InstanceCompute::readTransforms(g_mmbo, nInstances, tfms.data());
+    float maxError = 0.0f;
+    int nBad = 0;
+    for ( int i=0; i<nInstances; ++i ) {
+      float error = 0.0f;
+      for ( int c=0; c<4; ++c ) {
+	glm::vec4 d = glm::abs(tfms[i][c] - expected[i][c]);
+	error = std::max(error, std::max(std::max(d.x, d.y),
+					 std::max(d.z, d.w)));
+      }
+      maxError = std::max(maxError, error);
+      if ( !(error <= tolerance) ) ++nBad;
+    }
+    cerr << "Verify compute: ";
+    if ( mode == ANIMATION_OFF ) {
+      cerr << "generation of " << nInstances << " instances, " << gpuMs
+	   << " ms gpu, " << hostMs << " ms host";
+    } else {
+      cerr << animationName(mode) << " for " << g_verifySteps << " frames";
+    }
+    cerr << ", max error " << maxError << ", " << nBad
+	 << " instances beyond " << tolerance
+	 << (nBad > 0 ? " FAILED" : " passed") << endl;
+    if ( nBad > 0 ) ++nFailed;
+  }
+  // the draws take the instances from the buffer again
+  if ( g_compute ) {
+    g_instanceCompute.generate(g_mmbo, seed, volume, 0, nInstances,
+			       g_glState);
+  }
+  g_instancesChanged = true;
+  g_resizedFrom = -1;
+  return nFailed;
 }
 
+
+// Views of the regression run: light 0 of the scene with spot light and
+// attenuation on or off, in both projections
+struct RegressionView {
+  const char* d_name;
+  bool d_perspective;
+  bool d_spot;
+  bool d_attenuation;
+};
+
+const RegressionView g_regressionViews[] = {
+  { "ortho", false, false, false },
+  { "ortho_spot", false, true, false },
+  { "ortho_atten", false, false, true },
+  { "ortho_spot_atten", false, true, true },
+  { "persp", true, false, false },
+  { "persp_spot", true, true, false },
+  { "persp_atten", true, false, true },
+  { "persp_spot_atten", true, true, true }
+};
+const int g_regressionSize = 256;
+const int g_regressionFrames = 20;
+
+
+// Color and depth renderbuffers of _size x _size pixels in a framebuffer
+// which is bound; returns 0 if it is complete
+int createOffscreen( GLsizei _size, GLuint& _fbo, GLuint _rbo[2] ) {
+  glGenFramebuffers(1, &_fbo);
+  glGenRenderbuffers(2, _rbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, _rbo[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _size, _size);
+  glBindRenderbuffer(GL_RENDERBUFFER, _rbo[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _size, _size);
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			    GL_RENDERBUFFER, _rbo[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			    GL_RENDERBUFFER, _rbo[1]);
+  return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE ?
+    0 : -1;
+}
+
+
+void deleteOffscreen( GLuint _fbo, GLuint _rbo[2] ) {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &_fbo);
+  glDeleteRenderbuffers(2, _rbo);
+  return;
+}
+
+
+// Render every view into an offscreen framebuffer, compare it with the
+// golden image and its best frame time with the baseline in _dir, or
+// replace both if _update; returns the number of failed views
+int runRegression( const std::string& _dir, bool _update,
+		   const RegressionTolerance& _tol ) {
+  // images and baselines are named after the scene file
+  std::string scene(g_scenePath);
+  scene = scene.substr(scene.find_last_of("/\\") + 1);
+  scene = scene.substr(0, scene.find('.'));
+  std::string timesPath = _dir + "/" + scene + "_times.txt";
+  std::map<std::string, double> baselines;
+  readBaselines(timesPath, baselines);
+  // the same frames every run
+  setAnimation(ANIMATION_OFF);
+  g_camX = 0.0f, g_camY = 0.0f;
+  g_lightAngle = 0.0f;
+  GLuint fbo, rbo[2];
+  if ( createOffscreen(g_regressionSize, fbo, rbo) != 0 ) {
+    cerr << "Regression: offscreen framebuffer incomplete" << endl;
+    return 1;
+  }
+  LightSource base = g_lightArray.get(0);
+  int nViews = sizeof(g_regressionViews) / sizeof(RegressionView);
+  int nFailed = 0;
+  // every view must test something the others do not
+  std::vector<Image> images;
+  for ( int v=0; v<nViews; ++v ) {
+    const RegressionView& view = g_regressionViews[v];
+    std::string name = scene + "_" + view.d_name;
+    LightSource light = base;
+    if ( view.d_spot ) {
+      light.d_pointLight = true;
+      light.d_spot_cutoff = c_regressionSpotCutoff;
+      light.d_spot_exponent = c_regressionSpotExponent;
+    }
+    if ( view.d_attenuation ) {
+      light.d_constant_attenuation = 1.0f;
+      light.d_linear_attenuation = 0.001f;
+      light.d_quadratic_attenuation = 0.0005f;
+    }
+    g_lightArray.set(0, light);
+    g_lightArray.setLight(g_program, 0, g_glState);
+    g_winSize.d_perspective = view.d_perspective;
+    reshape(g_regressionSize, g_regressionSize);
+    // the first frame builds the shadow map
+    renderFrame();
+    glFinish();
+    // the best frame, noise only makes frames slower
+    double best = 1.0e30;
+    for ( int f=0; f<g_regressionFrames; ++f ) {
+      std::chrono::steady_clock::time_point start =
+	std::chrono::steady_clock::now();
+      renderFrame();
+      glFinish();
+      best = std::min(best, std::chrono::duration<double, std::milli>
+		      (std::chrono::steady_clock::now() - start).count());
+    }
+    Image image;
+    image.d_width = image.d_height = g_regressionSize;
+    image.d_rgb.resize(3 * g_regressionSize * g_regressionSize);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, g_regressionSize, g_regressionSize, GL_RGB,
+		 GL_UNSIGNED_BYTE, image.d_rgb.data());
+    // GL rows are bottom to top
+    int rowBytes = 3 * g_regressionSize;
+    for ( int y=0; y<g_regressionSize/2; ++y ) {
+      std::swap_ranges(&image.d_rgb[y * rowBytes],
+		       &image.d_rgb[(y + 1) * rowBytes],
+		       &image.d_rgb[(g_regressionSize - 1 - y) * rowBytes]);
+    }
+    int same = 0;
+    while ( same < v && images[same].d_rgb != image.d_rgb ) ++same;
+    images.push_back(image);
+    if ( same < v ) {
+      cerr << "Regression: " << name << " is the same image as "
+	   << scene << "_" << g_regressionViews[same].d_name << " FAILED"
+	   << endl;
+      ++nFailed;
+      continue;
+    }
+    std::string goldenPath = _dir + "/" + name + ".ppm";
+    if ( _update ) {
+      if ( writePPM(goldenPath, image) != 0 ) ++nFailed;
+      baselines[name] = best;
+      cerr << "Regression: " << name << " updated, " << best << " ms"
+	   << endl;
+      continue;
+    }
+    bool failed = false;
+    cerr << "Regression: " << name << " ";
+    Image golden;
+    if ( readPPM(goldenPath, golden) != 0 ||
+	 golden.d_width != image.d_width || golden.d_height != image.d_height ) {
+      cerr << "no golden image " << goldenPath;
+      failed = true;
+    } else {
+      ImageDiff diff = compareImages(image, golden, _tol.d_channel);
+      failed = diff.d_badFraction > _tol.d_badFraction;
+      cerr << 100.0 * diff.d_badFraction << "% of the pixels differ (rmse "
+	   << diff.d_rmse << ", max " << diff.d_maxDiff << ")";
+      // keep the image for inspection
+      if ( failed ) writePPM(_dir + "/" + name + "_failed.ppm", image);
+    }
+    cerr << ", " << best << " ms";
+    std::map<std::string, double>::const_iterator baseline =
+      baselines.find(name);
+    if ( baseline != baselines.end() ) {
+      cerr << " (baseline " << baseline->second << " ms)";
+      if ( best > baseline->second * (1.0 + _tol.d_slowdown) ) {
+	cerr << " too slow";
+	failed = true;
+      }
+    }
+    cerr << (failed ? " FAILED" : " passed") << endl;
+    if ( failed ) ++nFailed;
+  }
+  if ( _update ) writeBaselines(timesPath, baselines);
+  deleteOffscreen(fbo, rbo);
+  cerr << "Regression: " << nFailed << " of " << nViews << " views failed"
+       << endl;
+  return nFailed;
+}
+
+
+// Frame times of the current settings, e.g., to compare the instance
+// fetch paths: _frames offscreen frames of the perspective view after
+// one to build the shadow map
+int runBenchmark( int _frames ) {
+  const GLsizei size = 512;
+  GLuint fbo, rbo[2];
+  if ( createOffscreen(size, fbo, rbo) != 0 ) {
+    cerr << "Benchmark: offscreen framebuffer incomplete" << endl;
+    return 1;
+  }
+  g_winSize.d_perspective = true;
+  reshape(size, size);
+  renderFrame();
+  glFinish();
+  double sum = 0.0, best = 1.0e30;
+  for ( int f=0; f<_frames; ++f ) {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    renderFrame();
+    glFinish();
+    double ms = std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    sum += ms;
+    best = std::min(best, ms);
+  }
+  cerr << "Benchmark: " << instanceFetchName( g_instanceFetch ) << ", "
+       << (g_streaming ? g_store.getNInstances() : numInstances())
+       << " instances, " << _frames << " frames: mean "
+       << sum / std::max(_frames, 1) << " ms, best " << best << " ms"
+       << endl;
+  // what the errorOut() checks cost: the frames again with as many
+  // checks more, which release and debug output builds save
+  unsigned long long checks = g_errorChecks;
+  renderFrame();
+  glFinish();
+  unsigned long long perFrame = g_errorChecks - checks;
+  if ( perFrame == 0 ) {
+    cerr << "Benchmark: errorOut() is a no-op in this build" << endl;
+    deleteOffscreen(fbo, rbo);
+    return 0;
+  }
+  double checkedSum = 0.0, checkedBest = 1.0e30;
+  for ( int f=0; f<_frames; ++f ) {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    renderFrame();
+    for ( unsigned long long c=0; c<perFrame; ++c ) {
+      _printOpenGLerrors(__FILE__, __LINE__);
+    }
+    glFinish();
+    double ms = std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - start).count();
+    checkedSum += ms;
+    checkedBest = std::min(checkedBest, ms);
+  }
+  deleteOffscreen(fbo, rbo);
+  // the difference may be within the noise of the frame times
+  cerr << "Benchmark: errorOut() " << perFrame << " checks per frame cost "
+       << (checkedSum - sum) / std::max(_frames, 1) << " ms mean, "
+       << checkedBest - best << " ms best" << endl;
+  return 0;
+}
+
+}
+
+// Wait for the animation jobs at exit, before the job system is gone
+void endAnimation() {
+  g_animation.endUpdate();
+  return;
+}
+
+
 int main(int argc, char** argv) {
   glutInit(&argc, argv);
   glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
   glutInitWindowSize (800, 600); 
   glutInitWindowPosition (0, 0);
+#ifdef CSI4130_GL_DEBUG_OUTPUT
+  glutInitContextFlags(GLUT_DEBUG);
+#endif
   glutCreateWindow (argv[0]);
   GLenum err = glewInit();
   if (GLEW_OK != err) {
@@ -668,6 +2534,49 @@ int main(int argc, char** argv) {
     return -1;
   }
   cerr << "Using GLEW " << glewGetString(GLEW_VERSION) << endl;
+#ifdef CSI4130_GL_DEBUG_OUTPUT
+  installDebugOutput(GL_DEBUG_SEVERITY_MEDIUM);
+#endif
+  PROFILE_INIT_GL();
+  // exit handlers and static destructors run in reverse order: the
+  // handler registered after the job system exists runs before it is
+  // destroyed, whether 'q' exits or main returns
+  JobSystem::global();
+  atexit(endAnimation);
+  // the scene is needed by init: --scene <file>, instances streamed from
+  // a store: --store <file> [--store-host-mb <n>] [--store-gpu-mb <n>],
+  // instance data from buffers: --instance-fetch attrib|tbo|ssbo,
+  // the scene file written as a store first: --build-store <file>
+  size_t hostMB = 256, gpuMB = 64;
+  std::string buildStore;
+  for ( int i=1; i+1<argc; ++i ) {
+    std::string arg(argv[i]);
+    if ( arg == "--scene" ) g_scenePath = argv[i+1];
+    if ( arg == "--store" ) g_storePath = argv[i+1];
+    if ( arg == "--build-store" ) buildStore = argv[i+1];
+    if ( arg == "--store-host-mb" ) hostMB = atoi(argv[i+1]);
+    if ( arg == "--store-gpu-mb" ) gpuMB = atoi(argv[i+1]);
+    if ( arg == "--instance-fetch" ) {
+      std::string fetch(argv[i+1]);
+      if ( fetch == "tbo" ) {
+	g_instanceFetch = FETCH_TEXTURE_BUFFER;
+      } else if ( fetch == "ssbo" ) {
+	g_instanceFetch = FETCH_STORAGE_BUFFER;
+      } else {
+	g_instanceFetch = FETCH_ATTRIBUTES;
+      }
+    }
+  }
+  // the store is built from the scene file, not from loaded instances
+  if ( !buildStore.empty() ) {
+    if ( g_scenePath.empty() ) {
+      cerr << "Build store: needs --scene <file>" << endl;
+    } else if ( InstanceStore::build(buildStore.c_str(),
+				     g_scenePath.c_str()) == 0 ) {
+      cerr << "Built instance store " << buildStore << endl;
+    }
+  }
+  g_store.setBudgets(hostMB << 20, gpuMB << 20);
   cerr << "Before init" << endl;
   init();
   cerr << "After init" << endl;
@@ -675,6 +2584,90 @@ int main(int argc, char** argv) {
   glutDisplayFunc(display); 
   glutSpecialFunc(specialkeys); 
   glutKeyboardFunc(keyboard);
+  // continuous rendering: --unlocked, --vsync or --fps <n>
+  // animated instances: --spin or --orbit
+  // instance order: --sort front or --sort back
+  // occlusion culling: --occlusion, depth pre-pass: --prepass
+  // no shadow map: --no-shadows, material table size: --materials <n>
+  // number of instances: --instances <n>
+  // all camera presets: --multiview [sequential]
+  // instances generated and animated by compute shaders: --compute,
+  //   compared with the host: --verify-compute
+  // frustum culling on the GPU with indirect draws: --gpu-cull
+  // write the scene: --save-scene <file> or --save-scene-binary <file>
+  // regression run instead of the window: --regress <dir> [--regress-update]
+  //   [--regress-slowdown <f>] [--regress-tolerance <channel> <fraction>]
+  // frame times instead of the window: --bench-frames <n>
+  std::string regressDir;
+  int benchFrames = 0;
+  bool regressUpdate = false;
+  bool verify = false;
+  RegressionTolerance tolerance;
+  for ( int i=1; i<argc; ++i ) {
+    std::string arg(argv[i]);
+    if ( arg == "--unlocked" ) {
+      setPacing( PACING_UNLOCKED );
+    } else if ( arg == "--vsync" ) {
+      setPacing( PACING_VSYNC );
+    } else if ( arg == "--fps" && i+1 < argc ) {
+      g_pacer.setTargetFps( atof(argv[++i]) );
+      setPacing( PACING_TARGET_FPS );
+    } else if ( arg == "--spin" || arg == "--orbit" ) {
+      setAnimation( arg == "--spin" ? ANIMATION_SPIN : ANIMATION_ORBIT );
+      if ( !g_pacer.isContinuous() ) setPacing( PACING_VSYNC );
+    } else if ( arg == "--sort" && i+1 < argc ) {
+      std::string order(argv[++i]);
+      setSortOrder( order == "back" ? SORT_BACK_TO_FRONT : SORT_FRONT_TO_BACK );
+    } else if ( arg == "--occlusion" ) {
+      setOcclusion( true );
+    } else if ( arg == "--prepass" ) {
+      g_prepass = true;
+    } else if ( arg == "--no-shadows" ) {
+      setShadows( false );
+    } else if ( arg == "--materials" && i+1 < argc ) {
+      setNumMaterials( atoi(argv[++i]) );
+    } else if ( arg == "--multiview" ) {
+      bool sequential = i+1 < argc && std::string(argv[i+1]) == "sequential";
+      if ( sequential ) ++i;
+      setMultiView( sequential ? MULTIVIEW_SEQUENTIAL : MULTIVIEW_SINGLE_PASS );
+    } else if ( arg == "--instances" && i+1 < argc ) {
+      setNumInstances( atoi(argv[++i]) );
+    } else if ( arg == "--compute" ) {
+      setCompute( true );
+    } else if ( arg == "--verify-compute" ) {
+      verify = true;
+    } else if ( arg == "--gpu-cull" ) {
+      setGpuCull( true );
+    } else if (( arg == "--scene" || arg == "--store" ||
+		 arg == "--store-host-mb" || arg == "--store-gpu-mb" ||
+		 arg == "--instance-fetch" || arg == "--build-store" ) &&
+	       i+1 < argc ) {
+      ++i;
+    } else if (( arg == "--save-scene" || arg == "--save-scene-binary" ) &&
+	       i+1 < argc ) {
+      saveScene( argv[++i], arg == "--save-scene-binary" );
+    } else if ( arg == "--regress" && i+1 < argc ) {
+      regressDir = argv[++i];
+    } else if ( arg == "--bench-frames" && i+1 < argc ) {
+      benchFrames = atoi(argv[++i]);
+    } else if ( arg == "--regress-update" ) {
+      regressUpdate = true;
+    } else if ( arg == "--regress-slowdown" && i+1 < argc ) {
+      tolerance.d_slowdown = atof(argv[++i]);
+    } else if ( arg == "--regress-tolerance" && i+2 < argc ) {
+      tolerance.d_channel = atoi(argv[++i]);
+      tolerance.d_badFraction = atof(argv[++i]);
+    }
+  }
+  if ( verify ) {
+    return verifyCompute() == 0 ? 0 : 1;
+  }
+  if ( !regressDir.empty() ) {
+    return runRegression(regressDir, regressUpdate, tolerance) == 0 ? 0 : 1;
+  }
+  if ( benchFrames > 0 ) {
+    return runBenchmark(benchFrames);
+  }
   glutMainLoop();
   return 0;
 }
@@ -49,6 +49,8 @@ in vec4 colorVertFrag;
 in vec3 normalFrag; 
 in vec3 eyeFrag; 
 in vec3 lightFrag; 
+in vec4 shadowFrag; 
+flat in uint materialFrag; 
 
 out vec4 color;
 
@@ -71,6 +73,11 @@ struct LightSource {
  
 uniform LightSource lights[2];
 
+// depth of the closest surface seen from lights[0], compared in hardware
+uniform sampler2DShadow shadowMap;
+// 0 without shadows, 1 with
+uniform float shadowStrength;
+
 struct Material {
   vec4 emissive;
   vec4 ambient;
@@ -79,8 +86,10 @@ struct Material {
   float shininess;
 };
 
+// one block of MaterialArray::BLOCK_SIZE materials; instances are drawn
+// in batches per block
 layout (std140) uniform MaterialBlock {
-  uniform Material materials[4];	       
+  uniform Material materials[64];	       
 };
 
 
@@ -96,12 +105,21 @@ void main() {
      lights[0].linear_attenuation * distanceLight +
      lights[0].quadratic_attenuation * distanceLight * distanceLight);
 
+  Material material = materials[materialFrag % 64u];
+
   // ambient term
-  vec4 ambient =  colorVertFrag * lights[0].ambient;
+  vec4 ambient = material.emissive + material.ambient * lights[0].ambient;
 
   // diffuse term
   float dotNL = max(0.0,dot(NVec,LVec));
-  vec4 diffuse = colorVertFrag * lights[0].diffuse * dotNL;
+  vec4 diffuse = material.diffuse * lights[0].diffuse * dotNL;
+
+  // specular term
+  if ( dotNL > 0.0 ) {
+    vec3 RVec = reflect(-LVec, NVec);
+    diffuse += material.specular * lights[0].specular *
+      pow(max(0.0, dot(RVec, EVec)), material.shininess);
+  }
 
   // spot light
   float spot_attenuation = 1.0;
@@ -112,7 +130,13 @@ void main() {
     spot_attenuation = pow(dotSV,lights[0].spot_exponent);
   }
 
+  // shadow: 1 is lit; nothing behind a perspective light is shadowed
+  float lit = 1.0;
+  if ( shadowStrength > 0.0 && shadowFrag.w > 0.0 ) {
+    lit = mix(1.0, textureProj(shadowMap, shadowFrag), shadowStrength);
+  }
+
   // color
   color = ambient + 
-  	 attenuation * spot_attenuation * diffuse;
+  	 lit * attenuation * spot_attenuation * diffuse;
 }
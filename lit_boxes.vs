@@ -44,28 +44,83 @@
 //
 // ==========================================================================
 #version 330 core
+// The host defines INSTANCE_FETCH_TBO or INSTANCE_FETCH_SSBO to read the
+// per-instance data from buffers instead of instanced attributes
+#ifdef INSTANCE_FETCH_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
 layout (location=0) in vec4 position;
 layout (location=1) in vec3 normal;
+
+#if defined(INSTANCE_FETCH_TBO)
+// matrices as 4 texels, one per column
+uniform samplerBuffer InstanceMatrices;
+uniform usamplerBuffer InstanceMaterials;
+#elif defined(INSTANCE_FETCH_SSBO)
+layout (std430) readonly buffer InstanceMatrices {
+  mat4 instanceMatrix[];
+};
+layout (std430) readonly buffer InstanceMaterials {
+  uint instanceMaterial[];
+};
+#else
 layout (location=2) in vec4 color;
+out vec4 colorVertFrag; // Pass the color on to rasterization
 
 layout (location = 3) in mat4 ModelMatrix;	
+// index into the material table, per instance
+layout (location = 7) in uint materialIndex;
+#endif
+// Buffer fetch: first instance of the draw, gl_InstanceID does not
+// include the base instance
+uniform int InstanceBase = 0;
 
 uniform mat4 ViewMatrix;
 uniform mat4 ProjectionMatrix;
 
 uniform vec4 lightPosition[2];
+// world to shadow map coordinates
+uniform mat4 ShadowMatrix;
+
+// Multi-view: instance i of the draw is instance i / NumViews of the
+// buffers (attribute divisor NumViews) seen by view i % NumViews, whose
+// image is scaled into its tile of the window (NDC center xy, scale zw)
+uniform float NumViews = 1.0;
+uniform mat4 ViewMatrices[5];
+uniform vec4 ViewTiles[5];
+// the tile edges, enabled in multi-view only
+out float gl_ClipDistance[4];
 
-out vec4 colorVertFrag; // Pass the color on to rasterization
 out vec3 normalFrag; // Pass the normal to rasterization
 out vec3 eyeFrag; // Pass an eye vector along
 out vec3 lightFrag; // Pass a light vector along
+out vec4 shadowFrag; // Pass the shadow map coordinates along
+flat out uint materialFrag; // Pass the material along
+
+// depth_only.vs computes the same position for the depth pre-pass
+invariant gl_Position;
 
 
 void main() {
+  int nViews = int(NumViews);
+  int view = gl_InstanceID % nViews;
+  mat4 View = nViews > 1 ? ViewMatrices[view] : ViewMatrix;
+  // the instance advances once every nViews draw instances
+  int instance = InstanceBase + gl_InstanceID / nViews;
+#if defined(INSTANCE_FETCH_TBO)
+  mat4 ModelMatrix = mat4(texelFetch(InstanceMatrices, 4 * instance),
+			  texelFetch(InstanceMatrices, 4 * instance + 1),
+			  texelFetch(InstanceMatrices, 4 * instance + 2),
+			  texelFetch(InstanceMatrices, 4 * instance + 3));
+  uint materialIndex = texelFetch(InstanceMaterials, instance).r;
+#elif defined(INSTANCE_FETCH_SSBO)
+  mat4 ModelMatrix = instanceMatrix[instance];
+  uint materialIndex = instanceMaterial[instance];
+#endif
 
   // map the vertex position into clipping space 
-  mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
+  mat4 ModelViewMatrix = View * ModelMatrix;
   // postion in camera coordinates
   vec4 posVec = ModelViewMatrix * position;
   eyeFrag = -posVec.xyz;  
@@ -82,6 +137,20 @@ void main() {
   normalFrag = mat3(ModelViewMatrix) * normal;
 
   gl_Position = ProjectionMatrix * posVec;
+  // clip to the view's own volume, then move it into the tile
+  gl_ClipDistance[0] = gl_Position.w + gl_Position.x;
+  gl_ClipDistance[1] = gl_Position.w - gl_Position.x;
+  gl_ClipDistance[2] = gl_Position.w + gl_Position.y;
+  gl_ClipDistance[3] = gl_Position.w - gl_Position.y;
+  if ( nViews > 1 ) {
+    gl_Position.xy = ViewTiles[view].xy * gl_Position.w +
+      ViewTiles[view].zw * gl_Position.xy;
+  }
+
+  shadowFrag = ShadowMatrix * (ModelMatrix * position);
 
+#if !defined(INSTANCE_FETCH_TBO) && !defined(INSTANCE_FETCH_SSBO)
   colorVertFrag = color;
+#endif
+  materialFrag = materialIndex;
 }
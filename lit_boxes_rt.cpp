@@ -0,0 +1,159 @@
+// ==========================================================================
+// $Id: lit_boxes_rt.cpp $
+// Ray traced reference images of lit_boxes scenes - no GL context
+// ==========================================================================
+// The scene, camera and light 0 are set up as lit_boxes places them
+// without animation: the camera looks at the center of the viewing
+// volume from preset 0 (or --cam), the light sits at angle 0 relative to
+// the camera. --spot and --atten change light 0 as the regression views
+// do. The image is rendered once per thread count and written as PPM.
+// ==========================================================================
+#define GLM_ENABLE_EXPERIMENTAL
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "box_shape.h"
+#include "sphere.h"
+#include "scene.h"
+#include "regression.h"
+#include "ray_tracer.h"
+
+using namespace CSI4130;
+using std::cerr;
+using std::endl;
+
+namespace {
+// viewing volume of lit_boxes
+const float c_near = 1.0f;
+const float c_far = 21.0f;
+const float c_size = 12.5f;
+}
+
+
+// usage: lit_boxes_rt [--scene <file>] [--out <ppm>] [--size <w> <h>]
+//   [--persp] [--spot] [--atten] [--no-shadows] [--threads <n>]
+//   [--cam <x> <y>]
+int main( int argc, char** argv ) {
+  std::string scenePath("lit_boxes.scene");
+  std::string outPath("lit_boxes_rt.ppm");
+  int width = 512, height = 512;
+  bool perspective = false, spot = false, atten = false, shadows = true;
+  int nThreads = 0;
+  float camX = 0.0f, camY = 0.0f;
+  for ( int i=1; i<argc; ++i ) {
+    std::string arg(argv[i]);
+    if ( arg == "--scene" && i+1 < argc ) {
+      scenePath = argv[++i];
+    } else if ( arg == "--out" && i+1 < argc ) {
+      outPath = argv[++i];
+    } else if ( arg == "--size" && i+2 < argc ) {
+      width = std::max(atoi(argv[++i]), 1);
+      height = std::max(atoi(argv[++i]), 1);
+    } else if ( arg == "--persp" ) {
+      perspective = true;
+    } else if ( arg == "--spot" ) {
+      spot = true;
+    } else if ( arg == "--atten" ) {
+      atten = true;
+    } else if ( arg == "--no-shadows" ) {
+      shadows = false;
+    } else if ( arg == "--threads" && i+1 < argc ) {
+      nThreads = std::max(atoi(argv[++i]), 1);
+    } else if ( arg == "--cam" && i+2 < argc ) {
+      camX = static_cast<float>(atof(argv[++i]));
+      camY = static_cast<float>(atof(argv[++i]));
+    } else {
+      cerr << "Unknown argument " << arg << endl;
+      return 1;
+    }
+  }
+
+  Scene scene;
+  SceneReader reader;
+  if ( reader.open(scenePath.c_str(), scene) != 0 ) return 1;
+  BoxShape box;
+  Sphere sphere;
+  RenderShape* shape = &sphere;
+  if ( scene.d_shape == "box" ) shape = &box;
+  int nInstances = scene.getNInstances();
+  glm::mat4* tfms = shape->allocateTransforms(nInstances);
+  std::vector<GLuint> materialIds(nInstances);
+  if ( reader.readInstances(scene, tfms, materialIds.data()) != 0 ) return 1;
+  reader.close();
+
+  RayTracer tracer;
+  int shapeId = tracer.addShape(*shape);
+  tracer.addInstances(shapeId, shape->d_tfms, materialIds.data(), nInstances);
+  tracer.build();
+  cerr << "Ray tracing: " << nInstances << " instances, top level depth "
+       << tracer.getTopDepth() << ", built in " << tracer.getBuildMs()
+       << " ms" << endl;
+  tracer.setMaterials(scene.d_materials);
+
+  // the view volume keeps the aspect ratio of the image, as reshape()
+  float w = c_size, h = c_size;
+  if ( width > height ) {
+    w = c_size * width / height;
+  } else {
+    h = c_size * height / width;
+  }
+  glm::mat4 view = glm::lookAt(glm::vec3(camX, camY, -(c_far + c_near) / 2.0f),
+			       glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj = perspective ?
+    glm::frustum(-w / 2.0f, w / 2.0f, -h / 2.0f, h / 2.0f, c_near, c_far) :
+    glm::ortho(-w / 2.0f, w / 2.0f, -h / 2.0f, h / 2.0f, c_near, c_far);
+  tracer.setCamera(view, proj);
+
+  LightSource light;
+  if ( !scene.d_lights.empty() ) light = scene.d_lights[0];
+  if ( spot ) {
+    light.d_pointLight = true;
+    light.d_spot_cutoff = c_regressionSpotCutoff;
+    light.d_spot_exponent = c_regressionSpotExponent;
+  }
+  if ( atten ) {
+    light.d_constant_attenuation = 1.0f;
+    light.d_linear_attenuation = 0.001f;
+    light.d_quadratic_attenuation = 0.0005f;
+  }
+  // lightPosition() of lit_boxes at angle 0, in camera coordinates
+  glm::vec4 lightPos(w, 0.0f, 20.0f, light.d_pointLight ? 1.0f : 0.0f);
+  glm::mat4 toWorld = glm::inverse(view);
+  tracer.setLight(light, toWorld * lightPos,
+		  glm::mat3(toWorld) * light.d_spot_direction, shadows);
+
+  std::vector<int> counts;
+  if ( nThreads > 0 ) {
+    counts.push_back(nThreads);
+  } else {
+    int hw = std::max(1u, std::thread::hardware_concurrency());
+    for ( int t=1; t<hw; t*=2 ) counts.push_back(t);
+    counts.push_back(hw);
+  }
+  Image image;
+  image.d_width = width;
+  image.d_height = height;
+  for ( size_t c=0; c<counts.size(); ++c ) {
+    JobSystem jobs(counts[c]);
+    tracer.render(image, jobs);
+    double mrays = tracer.getNRays() / (tracer.getMs() * 1.0e3);
+    cerr << "Ray tracing: " << counts[c] << " threads, "
+	 << tracer.getNRays() << " rays in " << tracer.getMs() << " ms, "
+	 << mrays << " Mrays/s (" << mrays / counts[c] << " per thread)"
+	 << endl;
+  }
+  if ( writePPM(outPath, image) != 0 ) {
+    cerr << "Could not write " << outPath << endl;
+    return 1;
+  }
+  cerr << "Wrote " << outPath << endl;
+  return 0;
+}
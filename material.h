@@ -42,9 +42,14 @@
 // Created skeleton for lighting lab
 //
 // ==========================================================================
+#ifndef CSI4130_MATERIAL_H
+#define CSI4130_MATERIAL_H
+
 #include <cassert>
 #include <sstream>
+#include <cstring>
 #include <string>
+#include <vector>
 
 // gl types
 #include <GL/glew.h>
@@ -76,10 +81,33 @@ class MaterialArray {
   std::vector<Material> d_materials;
     
 public:
+  // materials[] of MaterialBlock in lit_boxes.fs; larger tables are
+  // bound one block at a time
+  const static int BLOCK_SIZE = 64;
+
   int getSize() {
     return STRIDE * sizeof(float) * d_materials.size();
   }
 
+  size_t size() const {
+    return d_materials.size();
+  }
+
+  void clear() {
+    d_materials.clear();
+    return;
+  }
+
+  int getNBlocks() const {
+    return (d_materials.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  }
+
+  // bytes of one block - a multiple of 256, the largest uniform buffer
+  // offset alignment in practice
+  static GLsizeiptr getBlockBytes() {
+    return STRIDE * sizeof(float) * BLOCK_SIZE;
+  }
+
   Material get( int i ) {
     assert(i < d_materials.size());
     return d_materials[i];
@@ -125,20 +153,31 @@ public:
   }
 
 
+  // std140 layout: 4 vec4 and a float padded to the next vec4, whole
+  // blocks so every block can be bound with glBindBufferRange
+  void packStd140( std::vector<GLfloat>& _data ) const {
+    _data.assign(STRIDE * BLOCK_SIZE * getNBlocks(), 0.0f);
+    for ( size_t m=0; m<d_materials.size(); ++m )  {
+      GLfloat* dst = &_data[STRIDE * m];
+      const Material& mat = d_materials[m];
+      memcpy(dst, glm::value_ptr(mat.d_emissive), 4 * sizeof(GLfloat));
+      memcpy(dst + 4, glm::value_ptr(mat.d_ambient), 4 * sizeof(GLfloat));
+      memcpy(dst + 8, glm::value_ptr(mat.d_diffuse), 4 * sizeof(GLfloat));
+      memcpy(dst + 12, glm::value_ptr(mat.d_specular), 4 * sizeof(GLfloat));
+      dst[16] = mat.d_shininess;
+    }
+    return;
+  }
+
+  // Upload all materials with one call; the buffer is resized to whole
+  // blocks
   void setMaterialsUBO( GLuint _ubo ) {
+    std::vector<GLfloat> data;
+    packStd140(data);
     glBindBuffer(GL_UNIFORM_BUFFER, _ubo);
-    // We will send our data one material at a time
-    int mId = 0;
-    // cerr <<  "Overall size: " << STRIDE * d_materials.size() << endl;
-    for ( std::vector<Material>::const_iterator iter = d_materials.begin();
-	  iter != d_materials.end(); ++iter )  {
-      Material m = *iter;
-      // cerr << "Offset: " << mId*STRIDE*sizeof(float) << " Size: " << sizeof(Material) << endl;
-      glBufferSubData(GL_UNIFORM_BUFFER, mId*STRIDE*sizeof(float), sizeof(Material), reinterpret_cast<const GLvoid*>(&m) );
-      ++mId;
-      errorOut();
-    }
-    // glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(GLfloat) * data.size(),
+		 data.data(), GL_STATIC_DRAW);
+    errorOut();
     return;
   }
 
@@ -149,3 +188,4 @@ public:
 
 
 }; // end namespace
+#endif
@@ -0,0 +1,265 @@
+// ==========================================================================
+// $Id: occlusion.cpp $
+// Software hierarchical-z occlusion culling of instances
+// ==========================================================================
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "occlusion.h"
+
+namespace CSI4130 {
+
+namespace {
+// instances per test job
+const int c_grain = 1 << 12;
+// rows per rasterisation job
+const int c_bandRows = 16;
+
+// texels of pyramid level _level along a side of _size pixels
+inline int levelSize( int _size, int _level ) {
+  return (_size + (1 << _level) - 1) >> _level;
+}
+}
+
+
+void shapeRadii( const RenderShape& _shape, float& _inner, float& _outer ) {
+  // getNPoints() counts coordinates
+  int nVertices = _shape.getNPoints() / 3;
+  _outer = 0.0f;
+  for ( int v=0; v<nVertices; ++v ) {
+    _outer = std::max(_outer, glm::length(_shape.getVertex(v)));
+  }
+  // closest plane of the triangles as drawn; any triangle of a
+  // convex shape about the origin is at most as far as the faces
+  _inner = _outer;
+  std::vector<GLuint> corners;
+  _shape.getTriangles(corners);
+  for ( size_t t=0; t<corners.size(); t+=3 ) {
+    glm::vec3 a = _shape.getVertex(corners[t]);
+    glm::vec3 b = _shape.getVertex(corners[t+1]);
+    glm::vec3 c = _shape.getVertex(corners[t+2]);
+    glm::vec3 n = glm::cross(b - a, c - a);
+    float len = glm::length(n);
+    // skip degenerate triangles
+    if ( len < 1.0e-6f * _outer * _outer ) continue;
+    _inner = std::min(_inner, std::fabs(glm::dot(n, a)) / len);
+  }
+  return;
+}
+
+
+OcclusionCuller::OcclusionCuller( int _width, int _height,
+				  int _nOccluders ) :
+  d_width((_width + 7) & ~7), d_height((_height + 7) & ~7),
+  d_nOccluders(_nOccluders), d_nTested(0), d_ms(0.0) {
+  // odd sizes round up, the last texel covers the edge
+  for ( int l=0; ; ++l ) {
+    int w = levelSize(d_width, l), h = levelSize(d_height, l);
+    d_levels.push_back(std::vector<float>(w * h, FLT_MAX));
+    if ( w == 1 || h == 1 ) break;
+  }
+}
+
+
+int OcclusionCuller::cull( const glm::mat4* _tfms, int _n,
+			   float _innerRadius, float _outerRadius,
+			   const glm::mat4& _view, const glm::mat4& _proj,
+			   JobSystem& _jobs ) {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  d_nTested = _n;
+  d_center.resize(_n);
+  d_depth.resize(_n);
+  d_occluded.resize(_n);
+  // the matrices are only read once, the tests use the compact centers
+  _jobs.parallelFor(0, _n, c_grain, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	d_center[i] = glm::vec3(_view * _tfms[i][3]);
+	// the camera looks down -z
+	d_depth[i] = -d_center[i].z;
+      }
+    });
+
+  // nearest instances in front of the camera become occluders
+  d_nearest.resize(_n);
+  std::iota(d_nearest.begin(), d_nearest.end(), 0);
+  int nOccluders = std::min(d_nOccluders, _n);
+  std::nth_element(d_nearest.begin(), d_nearest.begin() + nOccluders,
+		   d_nearest.end(), [this](uint32_t _a, uint32_t _b) {
+		     return d_depth[_a] < d_depth[_b]; });
+  d_rects.clear();
+  for ( int o=0; o<nOccluders; ++o ) {
+    int i = d_nearest[o];
+    if ( d_depth[i] - _innerRadius <= 0.0f ) continue;
+    glm::vec4 clip = _proj * glm::vec4(d_center[i], 1.0f);
+    if ( clip.w <= 0.0f ) continue;
+    // half size of the square inscribed in the screen disc in pixels
+    float s = _innerRadius / (clip.w * std::sqrt(2.0f));
+    float hx = s * std::fabs(_proj[0][0]) * 0.5f * d_width;
+    float hy = s * std::fabs(_proj[1][1]) * 0.5f * d_height;
+    float cx = (clip.x / clip.w * 0.5f + 0.5f) * d_width;
+    float cy = (clip.y / clip.w * 0.5f + 0.5f) * d_height;
+    // pixels entirely inside
+    Rect rect = { std::max(static_cast<int>(std::ceil(cx - hx)), 0),
+		  std::max(static_cast<int>(std::ceil(cy - hy)), 0),
+		  std::min(static_cast<int>(std::floor(cx + hx)), d_width),
+		  std::min(static_cast<int>(std::floor(cy + hy)), d_height),
+		  d_depth[i] + _innerRadius };
+    if ( rect.d_x0 < rect.d_x1 && rect.d_y0 < rect.d_y1 ) {
+      d_rects.push_back(rect);
+    }
+  }
+  rasterizeOccluders( _jobs );
+  buildPyramid( _jobs );
+
+  // perspective needs the corners of the bounding box, orthographic
+  // projection only moves the center
+  bool perspective = _proj[2][3] != 0.0f;
+  _jobs.parallelFor(0, _n, c_grain, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	float nearDepth = d_depth[i] - _outerRadius;
+	d_occluded[i] = 0;
+	if ( nearDepth <= 0.0f ) continue;
+	float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+	glm::vec4 center(d_center[i], 1.0f);
+	if ( perspective ) {
+	  for ( int c=0; c<8; ++c ) {
+	    glm::vec4 corner = center + glm::vec4(c & 1 ? _outerRadius : -_outerRadius,
+						  c & 2 ? _outerRadius : -_outerRadius,
+						  c & 4 ? _outerRadius : -_outerRadius,
+						  0.0f);
+	    glm::vec4 clip = _proj * corner;
+	    x0 = std::min(x0, clip.x / clip.w);
+	    x1 = std::max(x1, clip.x / clip.w);
+	    y0 = std::min(y0, clip.y / clip.w);
+	    y1 = std::max(y1, clip.y / clip.w);
+	  }
+	} else {
+	  glm::vec4 clip = _proj * center;
+	  float hx = _outerRadius * std::fabs(_proj[0][0]);
+	  float hy = _outerRadius * std::fabs(_proj[1][1]);
+	  x0 = clip.x - hx; x1 = clip.x + hx;
+	  y0 = clip.y - hy; y1 = clip.y + hy;
+	}
+	d_occluded[i] = isOccluded((x0 * 0.5f + 0.5f) * d_width,
+				   (y0 * 0.5f + 0.5f) * d_height,
+				   (x1 * 0.5f + 0.5f) * d_width,
+				   (y1 * 0.5f + 0.5f) * d_height,
+				   nearDepth);
+      }
+    });
+  d_visible.clear();
+  for ( int i=0; i<_n; ++i ) {
+    if ( !d_occluded[i] ) d_visible.push_back(i);
+  }
+  d_ms = std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  return d_visible.size();
+}
+
+
+void OcclusionCuller::rasterizeOccluders( JobSystem& _jobs ) {
+  std::vector<float>& depth = d_levels[0];
+  int nBands = (d_height + c_bandRows - 1) / c_bandRows;
+  _jobs.parallelFor(0, nBands, 1, [&](int _bBegin, int _bEnd) {
+      for ( int b=_bBegin; b<_bEnd; ++b ) {
+	int yBegin = b * c_bandRows;
+	int yEnd = std::min(yBegin + c_bandRows, d_height);
+	std::fill(&depth[yBegin * d_width], &depth[0] + yEnd * d_width, FLT_MAX);
+	for ( std::vector<Rect>::const_iterator iter = d_rects.begin();
+	      iter != d_rects.end(); ++iter ) {
+	  int y0 = std::max(iter->d_y0, yBegin);
+	  int y1 = std::min(iter->d_y1, yEnd);
+	  for ( int y=y0; y<y1; ++y ) {
+	    float* row = &depth[y * d_width];
+	    int x = iter->d_x0;
+#ifdef __SSE2__
+	    __m128 d = _mm_set1_ps(iter->d_depth);
+	    for ( ; x+4 <= iter->d_x1; x+=4 ) {
+	      _mm_storeu_ps(row + x, _mm_min_ps(_mm_loadu_ps(row + x), d));
+	    }
+#endif
+	    for ( ; x<iter->d_x1; ++x ) row[x] = std::min(row[x], iter->d_depth);
+	  }
+	}
+      }
+    });
+  return;
+}
+
+
+void OcclusionCuller::buildPyramid( JobSystem& _jobs ) {
+  for ( size_t l=1; l<d_levels.size(); ++l ) {
+    const float* src = d_levels[l-1].data();
+    float* dst = d_levels[l].data();
+    int srcWidth = levelSize(d_width, l-1);
+    int srcHeight = levelSize(d_height, l-1);
+    int width = levelSize(d_width, l);
+    int height = levelSize(d_height, l);
+    _jobs.parallelFor(0, height, c_bandRows, [=](int _begin, int _end) {
+	for ( int y=_begin; y<_end; ++y ) {
+	  const float* row0 = src + 2 * y * srcWidth;
+	  // an odd last row or column is folded into the edge texels
+	  const float* row1 = 2 * y + 1 < srcHeight ? row0 + srcWidth : row0;
+	  int x = 0;
+#ifdef __SSE2__
+	  // 4 texels from 8 columns of 2 rows
+	  for ( ; x+4 <= srcWidth / 2; x+=4 ) {
+	    __m128 a = _mm_max_ps(_mm_loadu_ps(row0 + 2*x),
+				  _mm_loadu_ps(row1 + 2*x));
+	    __m128 b = _mm_max_ps(_mm_loadu_ps(row0 + 2*x + 4),
+				  _mm_loadu_ps(row1 + 2*x + 4));
+	    __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	    __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	    _mm_storeu_ps(dst + y * width + x, _mm_max_ps(even, odd));
+	  }
+#endif
+	  for ( ; x<width; ++x ) {
+	    int x1 = std::min(2*x + 1, srcWidth - 1);
+	    dst[y * width + x] = std::max(std::max(row0[2*x], row0[x1]),
+					  std::max(row1[2*x], row1[x1]));
+	  }
+	}
+      });
+  }
+  return;
+}
+
+
+bool OcclusionCuller::isOccluded( float _x0, float _y0, float _x1, float _y1,
+				  float _near ) const {
+  // only the part on screen matters
+  _x0 = std::max(_x0, 0.0f);
+  _y0 = std::max(_y0, 0.0f);
+  _x1 = std::min(_x1, static_cast<float>(d_width));
+  _y1 = std::min(_y1, static_cast<float>(d_height));
+  if ( _x0 >= _x1 || _y0 >= _y1 ) return false;
+  // level where the rectangle spans at most 3 texels in each direction
+  float size = std::max(_x1 - _x0, _y1 - _y0);
+  int level = 0;
+  while ( level+1 < static_cast<int>(d_levels.size()) &&
+	  static_cast<float>(2 << level) < size ) {
+    ++level;
+  }
+  int width = levelSize(d_width, level);
+  int height = levelSize(d_height, level);
+  int tx0 = static_cast<int>(_x0) >> level;
+  int ty0 = static_cast<int>(_y0) >> level;
+  int tx1 = std::min(static_cast<int>(std::ceil(_x1) - 1) >> level, width - 1);
+  int ty1 = std::min(static_cast<int>(std::ceil(_y1) - 1) >> level, height - 1);
+  const float* depth = d_levels[level].data();
+  for ( int y=ty0; y<=ty1; ++y ) {
+    for ( int x=tx0; x<=tx1; ++x ) {
+      if ( depth[y * width + x] >= _near ) return false;
+    }
+  }
+  return true;
+}
+
+} // end namespace
@@ -0,0 +1,128 @@
+// ==========================================================================
+// $Id: occlusion.h $
+// Software hierarchical-z occlusion culling of instances
+// ==========================================================================
+// The nearest instances are drawn as occluders into a small CPU depth
+// buffer (view depth, far is FLT_MAX). An occluder is the square
+// inscribed in the screen disc of the sphere inscribed in the shape, at
+// the far side of that sphere, so it never covers more than the shape
+// does in any orientation. A pyramid is built on top where every texel
+// keeps the farthest depth of the 2x2 texels below. An instance is
+// occluded if the near side of its bounding sphere is behind the
+// farthest depth of all pyramid texels under its screen rectangle; the
+// level is chosen such that only a few texels need to be read.
+//
+// Rasterisation (in horizontal bands), pyramid levels and tests run as
+// jobs; the inner loops use SSE2 when available.
+// ==========================================================================
+#ifndef CSI4130_OCCLUSION_H_
+#define CSI4130_OCCLUSION_H_
+
+#include <cstdint>
+#include <vector>
+
+// glm types
+#include <glm/glm.hpp>
+
+#include "render_shape.h"
+#include "job_system.h"
+
+namespace CSI4130 {
+
+// Radii of the spheres about the origin inside and around _shape
+void shapeRadii( const RenderShape& _shape, float& _inner, float& _outer );
+
+
+class OcclusionCuller {
+  struct Rect {
+    int d_x0, d_y0, d_x1, d_y1; // pixels [x0,x1) x [y0,y1)
+    float d_depth;
+  };
+
+  int d_width;
+  int d_height;
+  int d_nOccluders;
+  // level 0 is d_width x d_height, each level above is half the size
+  // rounded up
+  std::vector<std::vector<float> > d_levels;
+  std::vector<glm::vec3> d_center; // view space
+  std::vector<float> d_depth; // view depth of the instance centers
+  std::vector<uint32_t> d_nearest;
+  std::vector<Rect> d_rects;
+  std::vector<unsigned char> d_occluded;
+  std::vector<uint32_t> d_visible;
+  // statistics of the last cull
+  int d_nTested;
+  double d_ms;
+
+ public:
+  // _width and _height are rounded up to a multiple of 8
+  OcclusionCuller( int _width = 256, int _height = 256,
+		   int _nOccluders = 64 );
+
+  inline void setNOccluders( int _nOccluders );
+
+  // Test the _n instances with model matrices _tfms. The shape fits into
+  // _outerRadius and contains a sphere of _innerRadius. Returns the
+  // number of visible instances.
+  int cull( const glm::mat4* _tfms, int _n, float _innerRadius,
+	    float _outerRadius, const glm::mat4& _view, const glm::mat4& _proj,
+	    JobSystem& _jobs = JobSystem::global() );
+
+  // Instance numbers of the visible instances in their original order
+  inline const uint32_t* getVisible() const;
+  inline int getNVisible() const;
+  inline int getNTested() const;
+  // ms of the last cull
+  inline double getMs() const;
+
+  // _out[i] = _in[getVisible()[i]]
+  template <class T>
+  void gather( const T* _in, T* _out,
+	       JobSystem& _jobs = JobSystem::global() ) const;
+
+ private:
+  void rasterizeOccluders( JobSystem& _jobs );
+  void buildPyramid( JobSystem& _jobs );
+  bool isOccluded( float _x0, float _y0, float _x1, float _y1,
+		   float _near ) const;
+
+  // no copy or assignment
+  OcclusionCuller(const OcclusionCuller& _oCuller );
+  OcclusionCuller& operator=( const OcclusionCuller& _oCuller );
+};
+
+
+void OcclusionCuller::setNOccluders( int _nOccluders ) {
+  d_nOccluders = _nOccluders;
+  return;
+}
+
+const uint32_t* OcclusionCuller::getVisible() const {
+  return d_visible.data();
+}
+
+int OcclusionCuller::getNVisible() const {
+  return d_visible.size();
+}
+
+int OcclusionCuller::getNTested() const {
+  return d_nTested;
+}
+
+double OcclusionCuller::getMs() const {
+  return d_ms;
+}
+
+template <class T>
+void OcclusionCuller::gather( const T* _in, T* _out,
+			      JobSystem& _jobs ) const {
+  const uint32_t* visible = getVisible();
+  _jobs.parallelFor(0, getNVisible(), 1 << 14, [=](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) _out[i] = _in[visible[i]];
+    });
+  return;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,243 @@
+// ==========================================================================
+// $Id: profiler.cpp $
+// Frame profiler with CPU scoped zones, GL timer queries and trace export
+// ==========================================================================
+#ifdef CSI4130_PROFILE
+
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "profiler.h"
+
+namespace CSI4130 {
+
+namespace {
+// Small thread ids for the trace, 0 is used for the GPU
+unsigned traceThreadId() {
+  static std::atomic<unsigned> s_next(1);
+  thread_local unsigned tid = s_next++;
+  return tid;
+}
+}
+
+
+Profiler& Profiler::instance() {
+  static Profiler s_profiler;
+  return s_profiler;
+}
+
+
+Profiler::Profiler() : d_start(std::chrono::steady_clock::now()),
+		       d_record(false), d_dropped(0),
+		       d_glReady(false), d_cFrame(0), d_frameNo(0),
+		       d_gpuOffset(0), d_gpuDepth(0), d_gpuMissed(0) {
+}
+
+
+long long Profiler::now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::steady_clock::now() - d_start).count();
+}
+
+
+void Profiler::initGL() {
+  for ( int f=0; f<PROFILER_FRAME_LATENCY; ++f ) {
+    glGenQueries(1, &d_gpu[f].d_elapsed);
+    glGenQueries(2*PROFILER_MAX_GPU_ZONES, d_gpu[f].d_stamps);
+  }
+  // offset between GPU and CPU clock to place GPU events in the trace
+  GLint64 gpuNow;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  d_gpuOffset = now() * 1000 - gpuNow;
+  d_glReady = true;
+  return;
+}
+
+
+void Profiler::beginFrame() {
+  if ( !d_glReady ) return;
+  d_cFrame = d_frameNo % PROFILER_FRAME_LATENCY;
+  GpuFrame& frame = d_gpu[d_cFrame];
+  // results of the frame which used this slot before
+  if ( frame.d_pending ) collectGpu( frame );
+  frame.d_nZones = 0;
+  d_gpuDepth = 0;
+  glBeginQuery(GL_TIME_ELAPSED, frame.d_elapsed);
+  return;
+}
+
+
+void Profiler::endFrame() {
+  if ( d_glReady ) {
+    glEndQuery(GL_TIME_ELAPSED);
+    d_gpu[d_cFrame].d_pending = true;
+    ++d_frameNo;
+  }
+  std::lock_guard<std::mutex> lock(d_mutex);
+  closeWindow(d_cpuStats);
+  return;
+}
+
+
+void Profiler::cpuZone( const char* _name, long long _start, long long _end ) {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  accumulate(d_cpuStats, _name, (_end - _start)/1000.0);
+  if ( d_record ) {
+    if ( d_events.size() < PROFILER_MAX_EVENTS ) {
+      Event ev = { _name, _start, _end - _start, traceThreadId() };
+      d_events.push_back(ev);
+    } else {
+      ++d_dropped;
+    }
+  }
+  return;
+}
+
+
+void Profiler::beginGpuZone( const char* _name ) {
+  assert( d_gpuDepth < PROFILER_MAX_GPU_ZONES );
+  GpuFrame& frame = d_gpu[d_cFrame];
+  if ( !d_glReady || frame.d_nZones >= PROFILER_MAX_GPU_ZONES ) {
+    d_gpuStack[d_gpuDepth++] = -1;
+    return;
+  }
+  int zone = frame.d_nZones++;
+  frame.d_names[zone] = _name;
+  glQueryCounter(frame.d_stamps[2*zone], GL_TIMESTAMP);
+  d_gpuStack[d_gpuDepth++] = zone;
+  return;
+}
+
+
+void Profiler::endGpuZone() {
+  assert( d_gpuDepth > 0 );
+  int zone = d_gpuStack[--d_gpuDepth];
+  if ( zone >= 0 ) {
+    glQueryCounter(d_gpu[d_cFrame].d_stamps[2*zone+1], GL_TIMESTAMP);
+  }
+  return;
+}
+
+
+void Profiler::collectGpu( GpuFrame& _frame ) {
+  _frame.d_pending = false;
+  // Never wait - if the oldest frame is still not done, drop it
+  GLint available = 0;
+  glGetQueryObjectiv(_frame.d_elapsed, GL_QUERY_RESULT_AVAILABLE, &available);
+  if ( available && _frame.d_nZones > 0 ) {
+    glGetQueryObjectiv(_frame.d_stamps[2*_frame.d_nZones-1],
+		       GL_QUERY_RESULT_AVAILABLE, &available);
+  }
+  if ( !available ) {
+    ++d_gpuMissed;
+    return;
+  }
+  GLuint64 elapsed;
+  glGetQueryObjectui64v(_frame.d_elapsed, GL_QUERY_RESULT, &elapsed);
+  std::lock_guard<std::mutex> lock(d_mutex);
+  accumulate(d_gpuStats, "frame", elapsed/1.0e6);
+  for ( int z=0; z<_frame.d_nZones; ++z ) {
+    GLuint64 t0, t1;
+    glGetQueryObjectui64v(_frame.d_stamps[2*z], GL_QUERY_RESULT, &t0);
+    glGetQueryObjectui64v(_frame.d_stamps[2*z+1], GL_QUERY_RESULT, &t1);
+    accumulate(d_gpuStats, _frame.d_names[z], (t1-t0)/1.0e6);
+    if ( d_record && d_events.size() < PROFILER_MAX_EVENTS ) {
+      Event ev = { _frame.d_names[z],
+		   (static_cast<long long>(t0) + d_gpuOffset)/1000,
+		   static_cast<long long>(t1-t0)/1000, 0 };
+      d_events.push_back(ev);
+    }
+  }
+  closeWindow(d_gpuStats);
+  return;
+}
+
+
+void Profiler::accumulate( std::map<std::string, Aggregate>& _stats,
+			   const char* _name, double _ms ) {
+  _stats[_name].d_frameSum += _ms;
+  return;
+}
+
+
+void Profiler::closeWindow( std::map<std::string, Aggregate>& _stats ) {
+  for ( std::map<std::string, Aggregate>::iterator iter = _stats.begin();
+	iter != _stats.end(); ++iter ) {
+    Aggregate& agg = iter->second;
+    agg.d_windowSum += agg.d_frameSum;
+    agg.d_frameSum = 0.0;
+    if ( ++agg.d_windowFrames == PROFILER_WINDOW ) {
+      agg.d_average = agg.d_windowSum / PROFILER_WINDOW;
+      agg.d_windowSum = 0.0;
+      agg.d_windowFrames = 0;
+    }
+  }
+  return;
+}
+
+
+void Profiler::setRecording( bool _record ) {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  d_record = _record;
+  return;
+}
+
+
+bool Profiler::isRecording() const {
+  return d_record;
+}
+
+
+std::string Profiler::summary() {
+  std::lock_guard<std::mutex> lock(d_mutex);
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(2) << "cpu:";
+  for ( std::map<std::string, Aggregate>::const_iterator iter = d_cpuStats.begin();
+	iter != d_cpuStats.end(); ++iter ) {
+    os << " " << iter->first << " " << iter->second.d_average << "ms";
+  }
+  os << " | gpu:";
+  for ( std::map<std::string, Aggregate>::const_iterator iter = d_gpuStats.begin();
+	iter != d_gpuStats.end(); ++iter ) {
+    os << " " << iter->first << " " << iter->second.d_average << "ms";
+  }
+  if ( d_gpuMissed > 0 ) {
+    os << " (" << d_gpuMissed << " late)";
+  }
+  return os.str();
+}
+
+
+int Profiler::exportChromeTrace( const std::string& _filename ) {
+  std::ofstream out(_filename.c_str());
+  if ( !out ) {
+    std::cerr << "Error: unable to open: " << _filename << std::endl;
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(d_mutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+      << "\"args\":{\"name\":\"GPU\"}}";
+  for ( std::vector<Event>::const_iterator iter = d_events.begin();
+	iter != d_events.end(); ++iter ) {
+    out << ",\n{\"name\":\"" << iter->d_name << "\",\"cat\":\""
+	<< (iter->d_tid ? "cpu" : "gpu") << "\",\"ph\":\"X\",\"ts\":"
+	<< iter->d_start << ",\"dur\":" << iter->d_duration
+	<< ",\"pid\":1,\"tid\":" << iter->d_tid << "}";
+  }
+  out << "\n]}\n";
+  if ( d_dropped > 0 ) {
+    std::cerr << "Profiler: " << d_dropped << " events not recorded" << std::endl;
+  }
+  std::cerr << "Profiler: wrote " << d_events.size() << " events to "
+       << _filename << std::endl;
+  return out.good() ? 0 : -1;
+}
+
+} // end namespace
+
+#endif // CSI4130_PROFILE
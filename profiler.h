@@ -0,0 +1,171 @@
+// ==========================================================================
+// $Id: profiler.h $
+// Frame profiler with CPU scoped zones, GL timer queries and trace export
+// ==========================================================================
+// The profiler is only compiled in if CSI4130_PROFILE is defined. Otherwise
+// all PROFILE_* macros expand to nothing and no code or data is generated.
+//
+// CPU zones are RAII objects timing a scope with a steady clock. GPU zones
+// bracket GL commands with GL_TIMESTAMP queries; the whole frame is
+// additionally measured with a GL_TIME_ELAPSED query. Queries are kept in
+// a ring of PROFILER_FRAME_LATENCY frames and are only read back once
+// available, i.e., a later frame never waits for the GPU.
+// ==========================================================================
+#ifndef CSI4130_PROFILER_H_
+#define CSI4130_PROFILER_H_
+
+#ifdef CSI4130_PROFILE
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+
+namespace CSI4130 {
+
+class Profiler {
+ public:
+  // Number of frames in flight before GPU queries are reused
+  static const int PROFILER_FRAME_LATENCY = 4;
+  // Maximum number of GPU zones per frame
+  static const int PROFILER_MAX_GPU_ZONES = 32;
+  // Number of frames averaged in the summary
+  static const int PROFILER_WINDOW = 60;
+  // Upper bound on the number of events kept for trace export
+  static const size_t PROFILER_MAX_EVENTS = 1 << 20;
+
+ private:
+  struct Event {
+    const char* d_name;
+    long long d_start; // us since profiler start
+    long long d_duration; // us
+    unsigned d_tid; // 0 is reserved for the GPU
+  };
+
+  struct GpuFrame {
+    GLuint d_elapsed;
+    GLuint d_stamps[2*PROFILER_MAX_GPU_ZONES];
+    const char* d_names[PROFILER_MAX_GPU_ZONES];
+    int d_nZones;
+    bool d_pending;
+    GpuFrame() : d_elapsed(0), d_nZones(0), d_pending(false) {}
+  };
+
+  // Running sum over the averaging window
+  struct Aggregate {
+    double d_frameSum; // sum of zone time in the current frame (ms)
+    double d_windowSum; // sum over the completed frames in the window (ms)
+    int d_windowFrames;
+    double d_average; // average per frame over the last window (ms)
+    Aggregate() : d_frameSum(0.0), d_windowSum(0.0), d_windowFrames(0),
+		  d_average(0.0) {}
+  };
+
+  std::chrono::steady_clock::time_point d_start;
+  std::mutex d_mutex;
+  std::vector<Event> d_events;
+  bool d_record;
+  size_t d_dropped;
+
+  bool d_glReady;
+  GpuFrame d_gpu[PROFILER_FRAME_LATENCY];
+  int d_cFrame;
+  long long d_frameNo;
+  long long d_gpuOffset; // ns to add to GPU timestamps for CPU timeline
+  int d_gpuStack[PROFILER_MAX_GPU_ZONES];
+  int d_gpuDepth;
+  size_t d_gpuMissed;
+
+  std::map<std::string, Aggregate> d_cpuStats;
+  std::map<std::string, Aggregate> d_gpuStats;
+
+ public:
+  static Profiler& instance();
+
+  // Needs a current GL context. Without it only CPU zones are recorded.
+  void initGL();
+  void beginFrame();
+  void endFrame();
+
+  void cpuZone( const char* _name, long long _start, long long _end );
+  void beginGpuZone( const char* _name );
+  void endGpuZone();
+
+  // microseconds since the profiler was created
+  long long now() const;
+
+  // Keep (or stop keeping) events for trace export
+  void setRecording( bool _record );
+  bool isRecording() const;
+  // Write all recorded events as Chrome trace JSON (chrome://tracing)
+  // Returns 0 on success
+  int exportChromeTrace( const std::string& _filename );
+
+  // One line with the average time per frame of every zone
+  std::string summary();
+
+ private:
+  Profiler();
+  void collectGpu( GpuFrame& _frame );
+  void accumulate( std::map<std::string, Aggregate>& _stats,
+		   const char* _name, double _ms );
+  void closeWindow( std::map<std::string, Aggregate>& _stats );
+
+  // no copy or assignment
+  Profiler(const Profiler& _oProfiler );
+  Profiler& operator=( const Profiler& _oProfiler );
+};
+
+
+// RAII CPU zone
+class CpuZone {
+  const char* d_name;
+  long long d_start;
+ public:
+  inline explicit CpuZone( const char* _name ) :
+  d_name(_name), d_start(Profiler::instance().now()) {}
+  inline ~CpuZone() {
+    Profiler& prof = Profiler::instance();
+    prof.cpuZone(d_name, d_start, prof.now());
+  }
+};
+
+// RAII GPU zone - must be used on the GL thread
+class GpuZone {
+ public:
+  inline explicit GpuZone( const char* _name ) {
+    Profiler::instance().beginGpuZone(_name);
+  }
+  inline ~GpuZone() {
+    Profiler::instance().endGpuZone();
+  }
+};
+
+} // end namespace
+
+#define CSI4130_PROFILE_CAT2(a,b) a##b
+#define CSI4130_PROFILE_CAT(a,b) CSI4130_PROFILE_CAT2(a,b)
+
+#define PROFILE_INIT_GL() CSI4130::Profiler::instance().initGL()
+#define PROFILE_FRAME_BEGIN() CSI4130::Profiler::instance().beginFrame()
+#define PROFILE_FRAME_END() CSI4130::Profiler::instance().endFrame()
+#define PROFILE_CPU_ZONE(name) \
+  CSI4130::CpuZone CSI4130_PROFILE_CAT(_cpuZone,__LINE__)(name)
+#define PROFILE_GPU_ZONE(name) \
+  CSI4130::GpuZone CSI4130_PROFILE_CAT(_gpuZone,__LINE__)(name)
+
+#else // CSI4130_PROFILE
+
+#define PROFILE_INIT_GL()
+#define PROFILE_FRAME_BEGIN()
+#define PROFILE_FRAME_END()
+#define PROFILE_CPU_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+
+#endif // CSI4130_PROFILE
+
+#endif
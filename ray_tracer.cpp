@@ -0,0 +1,613 @@
+// ==========================================================================
+// $Id: ray_tracer.cpp $
+// CPU ray tracer over instanced shapes: reference images of lit_boxes
+// ==========================================================================
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ray_tracer.h"
+
+namespace CSI4130 {
+
+namespace {
+// pixels per side of the tile of a job
+const int c_tileSize = 16;
+// start of the shadow rays off the surface, shapes are about 1 across
+const float c_shadowOffset = 1.0e-3f;
+
+// Four float lanes and lane masks, SSE2 or plain arrays
+#ifdef __SSE2__
+typedef __m128 Float4;
+typedef __m128 Mask4;
+
+inline Float4 splat4( float _x ) { return _mm_set1_ps(_x); }
+inline Float4 load4( const float* _p ) { return _mm_loadu_ps(_p); }
+inline void store4( float* _p, Float4 _x ) { _mm_storeu_ps(_p, _x); }
+inline Float4 add4( Float4 _a, Float4 _b ) { return _mm_add_ps(_a, _b); }
+inline Float4 sub4( Float4 _a, Float4 _b ) { return _mm_sub_ps(_a, _b); }
+inline Float4 mul4( Float4 _a, Float4 _b ) { return _mm_mul_ps(_a, _b); }
+inline Float4 div4( Float4 _a, Float4 _b ) { return _mm_div_ps(_a, _b); }
+inline Float4 min4( Float4 _a, Float4 _b ) { return _mm_min_ps(_a, _b); }
+inline Float4 max4( Float4 _a, Float4 _b ) { return _mm_max_ps(_a, _b); }
+inline Float4 abs4( Float4 _a ) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), _a);
+}
+inline Mask4 lt4( Float4 _a, Float4 _b ) { return _mm_cmplt_ps(_a, _b); }
+inline Mask4 le4( Float4 _a, Float4 _b ) { return _mm_cmple_ps(_a, _b); }
+inline Mask4 and4( Mask4 _a, Mask4 _b ) { return _mm_and_ps(_a, _b); }
+// _a and not _b
+inline Mask4 andNot4( Mask4 _a, Mask4 _b ) { return _mm_andnot_ps(_b, _a); }
+inline Float4 select4( Mask4 _m, Float4 _a, Float4 _b ) {
+  return _mm_or_ps(_mm_and_ps(_m, _a), _mm_andnot_ps(_m, _b));
+}
+inline int bits4( Mask4 _m ) { return _mm_movemask_ps(_m); }
+inline Mask4 lanes4( int _bits ) {
+  const __m128i bit = _mm_set_epi32(8, 4, 2, 1);
+  __m128i b = _mm_and_si128(_mm_set1_epi32(_bits), bit);
+  return _mm_castsi128_ps(_mm_cmpeq_epi32(b, bit));
+}
+#else
+struct Float4 {
+  float d_v[4];
+};
+
+struct Mask4 {
+  bool d_v[4];
+};
+
+#define CSI4130_LANES(_r, _expr) for ( int k=0; k<4; ++k ) _r.d_v[k] = _expr
+inline Float4 splat4( float _x ) {
+  Float4 r; CSI4130_LANES(r, _x); return r;
+}
+inline Float4 load4( const float* _p ) {
+  Float4 r; CSI4130_LANES(r, _p[k]); return r;
+}
+inline void store4( float* _p, Float4 _x ) {
+  for ( int k=0; k<4; ++k ) _p[k] = _x.d_v[k];
+}
+inline Float4 add4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, _a.d_v[k] + _b.d_v[k]); return r;
+}
+inline Float4 sub4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, _a.d_v[k] - _b.d_v[k]); return r;
+}
+inline Float4 mul4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, _a.d_v[k] * _b.d_v[k]); return r;
+}
+inline Float4 div4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, _a.d_v[k] / _b.d_v[k]); return r;
+}
+inline Float4 min4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, std::min(_a.d_v[k], _b.d_v[k])); return r;
+}
+inline Float4 max4( Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, std::max(_a.d_v[k], _b.d_v[k])); return r;
+}
+inline Float4 abs4( Float4 _a ) {
+  Float4 r; CSI4130_LANES(r, std::fabs(_a.d_v[k])); return r;
+}
+inline Mask4 lt4( Float4 _a, Float4 _b ) {
+  Mask4 r; CSI4130_LANES(r, _a.d_v[k] < _b.d_v[k]); return r;
+}
+inline Mask4 le4( Float4 _a, Float4 _b ) {
+  Mask4 r; CSI4130_LANES(r, _a.d_v[k] <= _b.d_v[k]); return r;
+}
+inline Mask4 and4( Mask4 _a, Mask4 _b ) {
+  Mask4 r; CSI4130_LANES(r, _a.d_v[k] && _b.d_v[k]); return r;
+}
+inline Mask4 andNot4( Mask4 _a, Mask4 _b ) {
+  Mask4 r; CSI4130_LANES(r, _a.d_v[k] && !_b.d_v[k]); return r;
+}
+inline Float4 select4( Mask4 _m, Float4 _a, Float4 _b ) {
+  Float4 r; CSI4130_LANES(r, _m.d_v[k] ? _a.d_v[k] : _b.d_v[k]); return r;
+}
+inline int bits4( Mask4 _m ) {
+  return _m.d_v[0] | _m.d_v[1] << 1 | _m.d_v[2] << 2 | _m.d_v[3] << 3;
+}
+inline Mask4 lanes4( int _bits ) {
+  Mask4 r; CSI4130_LANES(r, (_bits >> k & 1) != 0); return r;
+}
+#undef CSI4130_LANES
+#endif
+
+inline int countBits( int _bits ) {
+  return (_bits & 1) + (_bits >> 1 & 1) + (_bits >> 2 & 1) + (_bits >> 3 & 1);
+}
+
+// a vector per lane
+struct Vec4x3 {
+  Float4 d_x, d_y, d_z;
+};
+
+inline Vec4x3 splat4( const glm::vec3& _v ) {
+  Vec4x3 r = { splat4(_v.x), splat4(_v.y), splat4(_v.z) };
+  return r;
+}
+
+inline Vec4x3 sub4( const Vec4x3& _a, const Vec4x3& _b ) {
+  Vec4x3 r = { sub4(_a.d_x, _b.d_x), sub4(_a.d_y, _b.d_y),
+	       sub4(_a.d_z, _b.d_z) };
+  return r;
+}
+
+inline Float4 dot4( const Vec4x3& _a, const Vec4x3& _b ) {
+  return add4(add4(mul4(_a.d_x, _b.d_x), mul4(_a.d_y, _b.d_y)),
+	      mul4(_a.d_z, _b.d_z));
+}
+
+inline Vec4x3 cross4( const Vec4x3& _a, const Vec4x3& _b ) {
+  Vec4x3 r = { sub4(mul4(_a.d_y, _b.d_z), mul4(_a.d_z, _b.d_y)),
+	       sub4(mul4(_a.d_z, _b.d_x), mul4(_a.d_x, _b.d_z)),
+	       sub4(mul4(_a.d_x, _b.d_y), mul4(_a.d_y, _b.d_x)) };
+  return r;
+}
+
+// _m * (_v, _w) without the projective row
+inline Vec4x3 transform4( const glm::mat4& _m, const Vec4x3& _v, float _w ) {
+  Vec4x3 r;
+  Float4* out[3] = { &r.d_x, &r.d_y, &r.d_z };
+  for ( int i=0; i<3; ++i ) {
+    *out[i] = add4(add4(mul4(splat4(_m[0][i]), _v.d_x),
+			mul4(splat4(_m[1][i]), _v.d_y)),
+		   add4(mul4(splat4(_m[2][i]), _v.d_z),
+			splat4(_m[3][i] * _w)));
+  }
+  return r;
+}
+
+// 1/_d, zero components are replaced by a tiny value of the same sign
+inline Float4 inverse4( Float4 _d ) {
+  Float4 tiny = splat4(1.0e-20f);
+  Mask4 small = lt4(abs4(_d), tiny);
+  return div4(splat4(1.0f), select4(small, select4(lt4(_d, splat4(0.0f)),
+						   splat4(-1.0e-20f), tiny),
+				     _d));
+}
+}
+
+
+// rays of the lanes: o + t d for t in (d_tMin, d_tMax)
+struct RayTracer::Packet {
+  Vec4x3 d_o;
+  Vec4x3 d_d;
+  Vec4x3 d_inv;
+  Float4 d_tMin;
+  Float4 d_tMax;
+  Mask4 d_active;
+
+  void setInverse() {
+    d_inv.d_x = inverse4(d_d.d_x);
+    d_inv.d_y = inverse4(d_d.d_y);
+    d_inv.d_z = inverse4(d_d.d_z);
+  }
+
+  // lanes which enter the box of _node before d_tMax
+  Mask4 hitBox( const BvhNode& _node ) const {
+    Float4 tNear = d_tMin, tFar = d_tMax;
+    const Float4* o[3] = { &d_o.d_x, &d_o.d_y, &d_o.d_z };
+    const Float4* inv[3] = { &d_inv.d_x, &d_inv.d_y, &d_inv.d_z };
+    for ( int a=0; a<3; ++a ) {
+      Float4 t0 = mul4(sub4(splat4(_node.d_min[a]), *o[a]), *inv[a]);
+      Float4 t1 = mul4(sub4(splat4(_node.d_max[a]), *o[a]), *inv[a]);
+      tNear = max4(tNear, min4(t0, t1));
+      tFar = min4(tFar, max4(t0, t1));
+    }
+    return and4(d_active, le4(tNear, tFar));
+  }
+};
+
+
+// closest hit of every lane; d_instance[k] < 0 if lane k hit nothing
+struct RayTracer::PacketHit {
+  int d_instance[4];
+  int d_triangle[4];
+  float d_u[4];
+  float d_v[4];
+};
+
+
+RayTracer::RayTracer() : d_lightPosition(0.0f, 0.0f, 1.0f, 0.0f),
+			 d_spotDirection(0.0f, 0.0f, -1.0f), d_shadows(true),
+			 d_invViewProj(1.0f), d_eye(0.0f), d_nRays(0),
+			 d_ms(0.0), d_buildMs(0.0) {
+}
+
+
+RayTracer::~RayTracer() {
+  for ( size_t m=0; m<d_meshes.size(); ++m ) {
+    delete d_meshes[m];
+  }
+}
+
+
+int RayTracer::addShape( const RenderShape& _shape ) {
+  // the triangles as drawn, strips or a list
+  std::vector<GLuint> corners;
+  _shape.getTriangles(corners);
+  std::vector<glm::ivec3> tris;
+  for ( size_t c=0; c<corners.size(); c+=3 ) {
+    tris.push_back(glm::ivec3(corners[c], corners[c+1], corners[c+2]));
+  }
+  std::vector<glm::vec3> tMin(tris.size()), tMax(tris.size());
+  for ( size_t t=0; t<tris.size(); ++t ) {
+    glm::vec3 a = _shape.getVertex(tris[t].x);
+    glm::vec3 b = _shape.getVertex(tris[t].y);
+    glm::vec3 c = _shape.getVertex(tris[t].z);
+    tMin[t] = glm::min(a, glm::min(b, c));
+    tMax[t] = glm::max(a, glm::max(b, c));
+  }
+  Mesh* mesh = new Mesh;
+  mesh->d_bvh.build(tMin, tMax);
+  const std::vector<int>& prims = mesh->d_bvh.getPrims();
+  for ( size_t p=0; p<prims.size(); ++p ) {
+    const glm::ivec3& tri = tris[prims[p]];
+    glm::vec3 a = _shape.getVertex(tri.x);
+    mesh->d_v0.push_back(a);
+    mesh->d_e1.push_back(_shape.getVertex(tri.y) - a);
+    mesh->d_e2.push_back(_shape.getVertex(tri.z) - a);
+    mesh->d_n0.push_back(_shape.getNormal(tri.x));
+    mesh->d_n1.push_back(_shape.getNormal(tri.y));
+    mesh->d_n2.push_back(_shape.getNormal(tri.z));
+  }
+  d_meshes.push_back(mesh);
+  return static_cast<int>(d_meshes.size()) - 1;
+}
+
+
+void RayTracer::addInstances( int _shape, const glm::mat4* _tfms,
+			      const GLuint* _materials, int _n ) {
+  size_t first = d_instances.size();
+  d_instances.resize(first + _n);
+  for ( int i=0; i<_n; ++i ) {
+    Instance& inst = d_instances[first + i];
+    inst.d_toWorld = _tfms[i];
+    inst.d_toObject = glm::inverse(_tfms[i]);
+    inst.d_mesh = _shape;
+    inst.d_material = _materials ? _materials[i] : 0;
+  }
+  return;
+}
+
+
+void RayTracer::build( JobSystem& _jobs ) {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  int n = getNInstances();
+  std::vector<glm::vec3> iMin(n), iMax(n);
+  _jobs.parallelFor(0, n, 1 << 12, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	const Instance& inst = d_instances[i];
+	const std::vector<BvhNode>& nodes = d_meshes[inst.d_mesh]->d_bvh.getNodes();
+	iMin[i] = glm::vec3(FLT_MAX);
+	iMax[i] = glm::vec3(-FLT_MAX);
+	if ( nodes.empty() ) continue;
+	// the world box around the corners of the object box
+	for ( int c=0; c<8; ++c ) {
+	  glm::vec3 corner((c & 1) ? nodes[0].d_max.x : nodes[0].d_min.x,
+			   (c & 2) ? nodes[0].d_max.y : nodes[0].d_min.y,
+			   (c & 4) ? nodes[0].d_max.z : nodes[0].d_min.z);
+	  glm::vec3 w = glm::vec3(inst.d_toWorld * glm::vec4(corner, 1.0f));
+	  iMin[i] = glm::min(iMin[i], w);
+	  iMax[i] = glm::max(iMax[i], w);
+	}
+      }
+    });
+  d_top.build(iMin, iMax, 2);
+  // leaves refer to ranges of the instances
+  const std::vector<int>& prims = d_top.getPrims();
+  std::vector<Instance> ordered(n);
+  for ( int i=0; i<n; ++i ) {
+    ordered[i] = d_instances[prims[i]];
+  }
+  d_instances.swap(ordered);
+  d_buildMs = std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  return;
+}
+
+
+void RayTracer::setMaterials( const std::vector<Material>& _materials ) {
+  d_materials = _materials;
+  return;
+}
+
+
+void RayTracer::setLight( const LightSource& _light,
+			  const glm::vec4& _position,
+			  const glm::vec3& _spotDirection, bool _shadows ) {
+  d_light = _light;
+  d_lightPosition = _position;
+  d_spotDirection = glm::normalize(_spotDirection);
+  d_shadows = _shadows;
+  return;
+}
+
+
+void RayTracer::setCamera( const glm::mat4& _view, const glm::mat4& _proj ) {
+  d_invViewProj = glm::inverse(_proj * _view);
+  d_eye = glm::vec3(glm::inverse(_view)[3]);
+  return;
+}
+
+
+void RayTracer::render( Image& _image, JobSystem& _jobs ) {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  _image.d_rgb.assign(3 * _image.d_width * _image.d_height, 0);
+  int tilesX = (_image.d_width + c_tileSize - 1) / c_tileSize;
+  int tilesY = (_image.d_height + c_tileSize - 1) / c_tileSize;
+  std::atomic<long long> nRays(0);
+  _jobs.parallelFor(0, tilesX * tilesY, 1, [&](int _begin, int _end) {
+      for ( int t=_begin; t<_end; ++t ) {
+	int x0 = (t % tilesX) * c_tileSize, y0 = (t / tilesX) * c_tileSize;
+	nRays += renderTile(_image, x0, y0,
+			    std::min(x0 + c_tileSize, _image.d_width),
+			    std::min(y0 + c_tileSize, _image.d_height));
+      }
+    });
+  d_nRays = nRays;
+  d_ms = std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  return;
+}
+
+
+// Pixels [_x0,_x1) x [_y0,_y1), rows from the top; returns the rays traced
+long long RayTracer::renderTile( Image& _image, int _x0, int _y0, int _x1,
+				 int _y1 ) const {
+  long long nRays = 0;
+  float w = static_cast<float>(_image.d_width);
+  float h = static_cast<float>(_image.d_height);
+  for ( int y=_y0; y<_y1; y+=2 ) {
+    for ( int x=_x0; x<_x1; x+=2 ) {
+      // lane k is pixel (x + k%2, y + k/2); the near and far points of its
+      // pixel center give the ray, t = 1 is the far plane
+      float o[3][4], d[3][4];
+      int inside = 0;
+      for ( int k=0; k<4; ++k ) {
+	int px = x + k % 2, py = y + k / 2;
+	if ( px < _x1 && py < _y1 ) inside |= 1 << k;
+	glm::vec2 ndc(2.0f * (px + 0.5f) / w - 1.0f,
+		      1.0f - 2.0f * (py + 0.5f) / h);
+	glm::vec4 nearP = d_invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farP = d_invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 n3 = glm::vec3(nearP) / nearP.w;
+	glm::vec3 f3 = glm::vec3(farP) / farP.w;
+	for ( int a=0; a<3; ++a ) {
+	  o[a][k] = n3[a];
+	  d[a][k] = f3[a] - n3[a];
+	}
+      }
+      Packet packet;
+      packet.d_o.d_x = load4(o[0]);
+      packet.d_o.d_y = load4(o[1]);
+      packet.d_o.d_z = load4(o[2]);
+      packet.d_d.d_x = load4(d[0]);
+      packet.d_d.d_y = load4(d[1]);
+      packet.d_d.d_z = load4(d[2]);
+      packet.setInverse();
+      packet.d_tMin = splat4(0.0f);
+      packet.d_tMax = splat4(1.0f);
+      packet.d_active = lanes4(inside);
+      PacketHit hit;
+      trace(packet, hit, false);
+      nRays += countBits(inside);
+      float tHit[4];
+      store4(tHit, packet.d_tMax);
+      // shading inputs of the lanes which hit
+      glm::vec3 pos[4], normal[4], toLight[4];
+      float lightDist[4];
+      glm::vec4 color[4];
+      float sO[3][4], sD[3][4], sMax[4];
+      int shadowed = 0;
+      for ( int k=0; k<4; ++k ) {
+	color[k] = glm::vec4(0.0f);
+	sO[0][k] = sO[1][k] = sO[2][k] = 0.0f;
+	sD[0][k] = sD[1][k] = 0.0f;
+	sD[2][k] = 1.0f;
+	sMax[k] = 0.0f;
+	if ( !(inside >> k & 1) || hit.d_instance[k] < 0 ) continue;
+	const Instance& inst = d_instances[hit.d_instance[k]];
+	const Mesh& mesh = *d_meshes[inst.d_mesh];
+	int tri = hit.d_triangle[k];
+	pos[k] = glm::vec3(o[0][k], o[1][k], o[2][k]) +
+	  tHit[k] * glm::vec3(d[0][k], d[1][k], d[2][k]);
+	glm::vec3 n = (1.0f - hit.d_u[k] - hit.d_v[k]) * mesh.d_n0[tri] +
+	  hit.d_u[k] * mesh.d_n1[tri] + hit.d_v[k] * mesh.d_n2[tri];
+	if ( glm::dot(n, n) == 0.0f ) {
+	  n = glm::cross(mesh.d_e1[tri], mesh.d_e2[tri]);
+	}
+	normal[k] = glm::normalize(glm::mat3(inst.d_toWorld) * n);
+	// directional lights have no distance but attenuate by the length
+	// of their position as in lit_boxes.vs
+	toLight[k] = d_lightPosition.w > 0.0f ?
+	  glm::vec3(d_lightPosition) - pos[k] : glm::vec3(d_lightPosition);
+	lightDist[k] = glm::length(toLight[k]);
+	if ( d_shadows && glm::dot(normal[k], toLight[k]) > 0.0f ) {
+	  glm::vec3 L = toLight[k] / lightDist[k];
+	  glm::vec3 start = pos[k] + c_shadowOffset * normal[k];
+	  for ( int a=0; a<3; ++a ) {
+	    sO[a][k] = start[a];
+	    sD[a][k] = L[a];
+	  }
+	  sMax[k] = d_lightPosition.w > 0.0f ? lightDist[k] : FLT_MAX;
+	  shadowed |= 1 << k;
+	}
+      }
+      // lanes whose shadow ray hits something are in shadow
+      int lit = 0xF;
+      if ( shadowed ) {
+	Packet shadow;
+	shadow.d_o.d_x = load4(sO[0]);
+	shadow.d_o.d_y = load4(sO[1]);
+	shadow.d_o.d_z = load4(sO[2]);
+	shadow.d_d.d_x = load4(sD[0]);
+	shadow.d_d.d_y = load4(sD[1]);
+	shadow.d_d.d_z = load4(sD[2]);
+	shadow.setInverse();
+	shadow.d_tMin = splat4(0.0f);
+	shadow.d_tMax = load4(sMax);
+	shadow.d_active = lanes4(shadowed);
+	PacketHit occluder;
+	trace(shadow, occluder, true);
+	nRays += countBits(shadowed);
+	for ( int k=0; k<4; ++k ) {
+	  if ( (shadowed >> k & 1) && occluder.d_instance[k] >= 0 ) {
+	    lit &= ~(1 << k);
+	  }
+	}
+      }
+      for ( int k=0; k<4; ++k ) {
+	if ( !(inside >> k & 1) ) continue;
+	if ( hit.d_instance[k] >= 0 ) {
+	  const Instance& inst = d_instances[hit.d_instance[k]];
+	  Material mat;
+	  if ( !d_materials.empty() ) {
+	    mat = d_materials[inst.d_material % d_materials.size()];
+	  }
+	  glm::vec3 N = normal[k];
+	  glm::vec3 L = toLight[k] / lightDist[k];
+	  glm::vec3 E = glm::normalize(d_eye - pos[k]);
+	  float attenuation = 1.0f /
+	    (d_light.d_constant_attenuation +
+	     d_light.d_linear_attenuation * lightDist[k] +
+	     d_light.d_quadratic_attenuation * lightDist[k] * lightDist[k]);
+	  glm::vec4 ambient = mat.d_emissive + mat.d_ambient * d_light.d_ambient;
+	  float dotNL = std::max(0.0f, glm::dot(N, L));
+	  glm::vec4 diffuse = mat.d_diffuse * d_light.d_diffuse * dotNL;
+	  if ( dotNL > 0.0f ) {
+	    glm::vec3 R = glm::reflect(-L, N);
+	    diffuse += mat.d_specular * d_light.d_specular *
+	      std::pow(std::max(0.0f, glm::dot(R, E)), mat.d_shininess);
+	  }
+	  float dotSV = glm::dot(-L, d_spotDirection);
+	  float spot = dotSV < std::cos(glm::radians(d_light.d_spot_cutoff)) ?
+	    0.0f : std::pow(dotSV, d_light.d_spot_exponent);
+	  float shade = (lit >> k & 1) ? 1.0f : 0.0f;
+	  color[k] = ambient + shade * attenuation * spot * diffuse;
+	}
+	unsigned char* rgb = &_image.d_rgb[3 * ((y + k / 2) * _image.d_width +
+						x + k % 2)];
+	for ( int c=0; c<3; ++c ) {
+	  rgb[c] = static_cast<unsigned char>
+	    (std::min(std::max(color[k][c], 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+      }
+    }
+  }
+  return nRays;
+}
+
+
+// Closest hit of the active lanes, or with _any whether anything is hit
+// before d_tMax; d_tMax ends at the hit
+void RayTracer::trace( Packet& _packet, PacketHit& _hit, bool _any ) const {
+  for ( int k=0; k<4; ++k ) {
+    _hit.d_instance[k] = -1;
+  }
+  const std::vector<BvhNode>& nodes = d_top.getNodes();
+  if ( nodes.empty() ) return;
+  int stack[Bvh::MAX_DEPTH + 1];
+  int top = 0;
+  stack[top++] = 0;
+  while ( top > 0 && bits4(_packet.d_active) ) {
+    const BvhNode& node = nodes[stack[--top]];
+    if ( !bits4(_packet.hitBox(node)) ) continue;
+    if ( !node.isLeaf() ) {
+      // the far child waits, a packet usually shares its direction
+      int a = node.d_first, b = a + 1;
+      glm::vec3 gap = nodes[b].d_min + nodes[b].d_max -
+	nodes[a].d_min - nodes[a].d_max;
+      float dx[4], dy[4], dz[4];
+      store4(dx, _packet.d_d.d_x);
+      store4(dy, _packet.d_d.d_y);
+      store4(dz, _packet.d_d.d_z);
+      if ( glm::dot(gap, glm::vec3(dx[0], dy[0], dz[0])) < 0.0f ) {
+	std::swap(a, b);
+      }
+      stack[top++] = b;
+      stack[top++] = a;
+      continue;
+    }
+    for ( int i=node.d_first; i<node.d_first+node.d_count; ++i ) {
+      const Instance& inst = d_instances[i];
+      Packet local;
+      local.d_o = transform4(inst.d_toObject, _packet.d_o, 1.0f);
+      local.d_d = transform4(inst.d_toObject, _packet.d_d, 0.0f);
+      local.setInverse();
+      local.d_tMin = _packet.d_tMin;
+      local.d_tMax = _packet.d_tMax;
+      local.d_active = _packet.d_active;
+      traceMesh(*d_meshes[inst.d_mesh], local, _hit, i, _any);
+      _packet.d_tMax = local.d_tMax;
+      _packet.d_active = local.d_active;
+      if ( !bits4(_packet.d_active) ) break;
+    }
+  }
+  return;
+}
+
+
+void RayTracer::traceMesh( const Mesh& _mesh, Packet& _packet,
+			   PacketHit& _hit, int _instance, bool _any ) const {
+  const std::vector<BvhNode>& nodes = _mesh.d_bvh.getNodes();
+  if ( nodes.empty() ) return;
+  int stack[Bvh::MAX_DEPTH + 1];
+  int top = 0;
+  stack[top++] = 0;
+  while ( top > 0 ) {
+    const BvhNode& node = nodes[stack[--top]];
+    Mask4 active = _packet.hitBox(node);
+    if ( !bits4(active) ) continue;
+    if ( !node.isLeaf() ) {
+      stack[top++] = node.d_first + 1;
+      stack[top++] = node.d_first;
+      continue;
+    }
+    for ( int t=node.d_first; t<node.d_first+node.d_count; ++t ) {
+      // Moeller-Trumbore for the four lanes, two-sided
+      Vec4x3 e1 = splat4(_mesh.d_e1[t]), e2 = splat4(_mesh.d_e2[t]);
+      Vec4x3 p = cross4(_packet.d_d, e2);
+      Float4 det = dot4(e1, p);
+      Float4 inv = div4(splat4(1.0f), det);
+      Vec4x3 s = sub4(_packet.d_o, splat4(_mesh.d_v0[t]));
+      Float4 u = mul4(dot4(s, p), inv);
+      Vec4x3 q = cross4(s, e1);
+      Float4 v = mul4(dot4(_packet.d_d, q), inv);
+      Float4 tHit = mul4(dot4(e2, q), inv);
+      Float4 zero = splat4(0.0f);
+      Mask4 m = and4(active, lt4(splat4(1.0e-12f), abs4(det)));
+      m = and4(m, and4(le4(zero, u), le4(zero, v)));
+      m = and4(m, le4(add4(u, v), splat4(1.0f)));
+      m = and4(m, and4(lt4(_packet.d_tMin, tHit), lt4(tHit, _packet.d_tMax)));
+      int hitBits = bits4(m);
+      if ( !hitBits ) continue;
+      _packet.d_tMax = select4(m, tHit, _packet.d_tMax);
+      float uu[4], vv[4];
+      store4(uu, u);
+      store4(vv, v);
+      for ( int k=0; k<4; ++k ) {
+	if ( !(hitBits >> k & 1) ) continue;
+	_hit.d_instance[k] = _instance;
+	_hit.d_triangle[k] = t;
+	_hit.d_u[k] = uu[k];
+	_hit.d_v[k] = vv[k];
+      }
+      if ( _any ) {
+	// a lane is done with its first hit
+	_packet.d_active = andNot4(_packet.d_active, m);
+	active = andNot4(active, m);
+	if ( !bits4(_packet.d_active) ) return;
+      }
+    }
+  }
+  return;
+}
+
+} // end namespace
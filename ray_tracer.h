@@ -0,0 +1,146 @@
+// ==========================================================================
+// $Id: ray_tracer.h $
+// CPU ray tracer over instanced shapes: reference images of lit_boxes
+// ==========================================================================
+// Two levels of bounding volume hierarchies: one over the triangles of
+// every shape in object space (bottom level) and one over the world
+// boxes of the instances (top level). Rays are traced in packets of 2x2
+// pixels, four rays in the lanes of SSE2 registers when available. A
+// packet enters an instance by moving its rays into object space. The
+// directions are not normalized there, so the ray parameter t is the
+// same in both spaces. The triangles are those of the index array as
+// drawn, with the vertex normals of the shape.
+//
+// Shading is the model of lit_boxes.fs for light 0: ambient plus
+// attenuated, spot limited diffuse and Phong specular with the material
+// of the instance. Instead of the shadow map, a shadow ray towards the
+// light decides whether a point is lit. Tiles of the image are rendered
+// as jobs.
+// ==========================================================================
+#ifndef CSI4130_RAY_TRACER_H_
+#define CSI4130_RAY_TRACER_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "bvh.h"
+#include "job_system.h"
+// errorOut used by material.h
+#include "shader.h"
+#include "light.h"
+#include "material.h"
+#include "regression.h"
+#include "render_shape.h"
+
+namespace CSI4130 {
+
+class RayTracer {
+  // bottom level, triangles in leaf order
+  struct Mesh {
+    Bvh d_bvh;
+    std::vector<glm::vec3> d_v0;
+    std::vector<glm::vec3> d_e1;
+    std::vector<glm::vec3> d_e2;
+    // vertex normals of the corners
+    std::vector<glm::vec3> d_n0;
+    std::vector<glm::vec3> d_n1;
+    std::vector<glm::vec3> d_n2;
+  };
+
+  struct Instance {
+    glm::mat4 d_toWorld;
+    glm::mat4 d_toObject;
+    int d_mesh;
+    GLuint d_material;
+  };
+
+  std::vector<Mesh*> d_meshes;
+  // in leaf order of the top level after build()
+  std::vector<Instance> d_instances;
+  Bvh d_top;
+  std::vector<Material> d_materials;
+  // world space
+  LightSource d_light;
+  glm::vec4 d_lightPosition;
+  glm::vec3 d_spotDirection;
+  bool d_shadows;
+  glm::mat4 d_invViewProj;
+  glm::vec3 d_eye;
+  // statistics of the last render
+  long long d_nRays;
+  double d_ms;
+  double d_buildMs;
+
+ public:
+  RayTracer();
+  ~RayTracer();
+
+  // Build the bottom level of _shape; returns its number
+  int addShape( const RenderShape& _shape );
+  // _n instances of shape _shape with model matrices _tfms and material
+  // indices _materials (NULL for material 0)
+  void addInstances( int _shape, const glm::mat4* _tfms,
+		     const GLuint* _materials, int _n );
+  // Build the top level over all instances
+  void build( JobSystem& _jobs = JobSystem::global() );
+
+  void setMaterials( const std::vector<Material>& _materials );
+  // Light 0 with its position and spot direction in world space, as the
+  // shadow map places it
+  void setLight( const LightSource& _light, const glm::vec4& _position,
+		 const glm::vec3& _spotDirection, bool _shadows = true );
+  void setCamera( const glm::mat4& _view, const glm::mat4& _proj );
+
+  // Render into _image of its size
+  void render( Image& _image, JobSystem& _jobs = JobSystem::global() );
+
+  inline int getNInstances() const;
+  inline int getTopDepth() const;
+  // primary and shadow rays, ms of the last render
+  inline long long getNRays() const;
+  inline double getMs() const;
+  // ms of the last build()
+  inline double getBuildMs() const;
+
+ private:
+  struct Packet;
+  struct PacketHit;
+  void trace( Packet& _packet, PacketHit& _hit, bool _any ) const;
+  void traceMesh( const Mesh& _mesh, Packet& _packet, PacketHit& _hit,
+		  int _instance, bool _any ) const;
+  long long renderTile( Image& _image, int _x0, int _y0, int _x1,
+			int _y1 ) const;
+
+  // no copy or assignment
+  RayTracer(const RayTracer& _oTracer );
+  RayTracer& operator=( const RayTracer& _oTracer );
+};
+
+
+int RayTracer::getNInstances() const {
+  return static_cast<int>(d_instances.size());
+}
+
+int RayTracer::getTopDepth() const {
+  return d_top.getDepth();
+}
+
+long long RayTracer::getNRays() const {
+  return d_nRays;
+}
+
+double RayTracer::getMs() const {
+  return d_ms;
+}
+
+double RayTracer::getBuildMs() const {
+  return d_buildMs;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Regression run of every scene in regress/ on llvmpipe. Run from anywhere;
+# LIT_BOXES is the executable (default build/lit_boxes), extra arguments
+# go to lit_boxes, e.g., --regress-update to replace the golden images.
+cd "$(dirname "$0")/.." || exit 1
+LIT_BOXES=${LIT_BOXES:-build/lit_boxes}
+export LIBGL_ALWAYS_SOFTWARE=1
+
+# GLUT needs a display for its context
+run() {
+  if [ -z "$DISPLAY" ]; then
+    xvfb-run -a -s "-screen 0 640x480x24" "$@"
+  else
+    "$@"
+  fi
+}
+
+status=0
+for scene in regress/*.scene; do
+  run "$LIT_BOXES" --scene "$scene" --regress regress "$@" || status=1
+done
+exit $status
@@ -0,0 +1,92 @@
+// ==========================================================================
+// $Id: regression.cpp $
+// Golden images and frame time baselines for the regression run
+// ==========================================================================
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "regression.h"
+
+namespace CSI4130 {
+
+int readPPM( const std::string& _path, Image& _image ) {
+  std::ifstream in(_path.c_str(), std::ios::binary);
+  std::string magic;
+  int maxVal = 0;
+  in >> magic >> _image.d_width >> _image.d_height >> maxVal;
+  if ( !in || magic != "P6" || maxVal != 255 ||
+       _image.d_width <= 0 || _image.d_height <= 0 ) {
+    return -1;
+  }
+  // one whitespace character ends the header
+  in.get();
+  _image.d_rgb.resize(3 * _image.d_width * _image.d_height);
+  in.read(reinterpret_cast<char*>(_image.d_rgb.data()), _image.d_rgb.size());
+  return in ? 0 : -1;
+}
+
+
+int writePPM( const std::string& _path, const Image& _image ) {
+  std::ofstream out(_path.c_str(), std::ios::binary);
+  out << "P6\n" << _image.d_width << " " << _image.d_height << "\n255\n";
+  out.write(reinterpret_cast<const char*>(_image.d_rgb.data()),
+	    _image.d_rgb.size());
+  if ( !out ) {
+    std::cerr << "Cannot write " << _path << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+
+ImageDiff compareImages( const Image& _a, const Image& _b, int _channelTol ) {
+  ImageDiff diff = { 0.0, 0, 0.0 };
+  size_t nPixels = _a.d_rgb.size() / 3;
+  if ( nPixels == 0 ) return diff;
+  double sumSq = 0.0;
+  size_t nBad = 0;
+  for ( size_t p=0; p<nPixels; ++p ) {
+    int worst = 0;
+    for ( int c=0; c<3; ++c ) {
+      int d = std::abs(_a.d_rgb[3*p+c] - _b.d_rgb[3*p+c]);
+      sumSq += d * d;
+      worst = std::max(worst, d);
+    }
+    diff.d_maxDiff = std::max(diff.d_maxDiff, worst);
+    if ( worst > _channelTol ) ++nBad;
+  }
+  diff.d_rmse = std::sqrt(sumSq / (3.0 * nPixels));
+  diff.d_badFraction = static_cast<double>(nBad) / nPixels;
+  return diff;
+}
+
+
+int readBaselines( const std::string& _path,
+		   std::map<std::string, double>& _ms ) {
+  std::ifstream in(_path.c_str());
+  std::string name;
+  double ms;
+  while ( in >> name >> ms ) _ms[name] = ms;
+  return 0;
+}
+
+
+int writeBaselines( const std::string& _path,
+		    const std::map<std::string, double>& _ms ) {
+  std::ofstream out(_path.c_str());
+  for ( std::map<std::string, double>::const_iterator iter = _ms.begin();
+	iter != _ms.end(); ++iter ) {
+    out << iter->first << " " << iter->second << "\n";
+  }
+  if ( !out ) {
+    std::cerr << "Cannot write " << _path << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+} // end namespace
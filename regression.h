@@ -0,0 +1,68 @@
+// ==========================================================================
+// $Id: regression.h $
+// Golden images and frame time baselines for the regression run
+// ==========================================================================
+// A regression run renders fixed views of a seeded scene offscreen and
+// compares every image with its golden image of the same name:
+//   - a pixel differs if one of its channels is off by more than the
+//     channel tolerance, which absorbs rounding differences between
+//     rasterizers
+//   - an image passes if at most the allowed fraction of pixels differ
+// The best frame time of every view is compared with the baseline of
+// the same name; a view fails if it is slower by more than the allowed
+// slowdown. Images are binary PPM (P6), the baselines a text file of
+// "<name> <ms>" lines.
+// ==========================================================================
+#ifndef CSI4130_REGRESSION_H_
+#define CSI4130_REGRESSION_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace CSI4130 {
+
+struct Image {
+  int d_width;
+  int d_height;
+  // rows top to bottom, 3 bytes per pixel
+  std::vector<unsigned char> d_rgb;
+
+  Image() : d_width(0), d_height(0) {}
+};
+
+struct ImageDiff {
+  double d_rmse; // over all channels, 0-255
+  int d_maxDiff;
+  double d_badFraction; // of the pixels
+};
+
+struct RegressionTolerance {
+  int d_channel;
+  double d_badFraction;
+  double d_slowdown; // 0.2: fail above 1.2 times the baseline
+
+  RegressionTolerance() : d_channel(8), d_badFraction(0.001),
+    d_slowdown(0.2) {}
+};
+
+// Spot light of the regression views and of lit_boxes_rt --spot: a cone
+// narrow enough to leave part of the scene dark, falling off inside
+const float c_regressionSpotCutoff = 25.0f;
+const float c_regressionSpotExponent = 2.0f;
+
+// return 0 on success
+int readPPM( const std::string& _path, Image& _image );
+int writePPM( const std::string& _path, const Image& _image );
+
+// _a and _b must have the same size
+ImageDiff compareImages( const Image& _a, const Image& _b, int _channelTol );
+
+// Frame times in ms by name; reading a missing file gives no baselines
+int readBaselines( const std::string& _path,
+		   std::map<std::string, double>& _ms );
+int writeBaselines( const std::string& _path,
+		    const std::map<std::string, double>& _ms );
+
+} // end namespace
+#endif
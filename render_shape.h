@@ -50,17 +50,24 @@
 
 #include "shape.h"
 #include "attributes.h"
+#include "weld.h"
+#include "stripify.h"
 
 class RenderShape : public Shape, public Attributes {
+ public:
+  // how d_index lists the triangles
+  enum Topology { TOPOLOGY_LIST, TOPOLOGY_STRIP };
+
  protected:
+  Topology d_topology = TOPOLOGY_STRIP;
   // index-based rendering
   GLushort d_restart = 0xFFFF; //-32768;
   // Vertex coordinates
   std::vector<GLfloat> d_vertex;
 	std::vector<GLfloat> d_normal;
   std::vector<GLushort> d_index;
-  // direct specification with all faces unrolled
-  std::vector<GLfloat> d_vertex_direct;
+  // the direct specification with all faces unrolled is derived from
+  // the indices on demand
   
  public:
   
@@ -84,14 +91,31 @@ class RenderShape : public Shape, public Attributes {
 
 
 	inline GLushort getRestart() const;
+  inline Topology getTopology() const;
+  // GL_TRIANGLES or GL_TRIANGLE_STRIP for the draw calls
+  inline GLenum getPrimitive() const;
 
   inline const GLfloat* getVertices() const;
 	inline const GLfloat* getNormals() const;
   inline const GLushort* getIndicies() const;
 	
+  // Vertex numbers of the corners of the triangles as drawn
+  inline void getTriangles( std::vector<GLuint>& _corners ) const;
+
   // direct drawing
   inline int getNTriangles() const;
-  inline const GLfloat* getVertexDirect() const;
+  // Positions of the corners, 9 floats per triangle
+  inline void getVertexDirect( std::vector<GLfloat>& _vertex ) const;
+
+  // Replace the indices by the triangle list _corners, as strips if they
+  // need fewer indices; returns the number of indices saved
+  inline int setTriangles( const std::vector<GLuint>& _corners );
+
+  // Replace the indexed data by the welded triangle soup
+  // _vertex/_normal; returns 0 on success
+  inline int weld( const std::vector<GLfloat>& _vertex,
+		   const std::vector<GLfloat>& _normal,
+		   float _eps = 1.0e-5f );
   
   // instanced drawing
   inline int getNColors() const;
@@ -140,6 +164,14 @@ GLushort RenderShape::getRestart() const {
   return d_restart;
 }
 
+RenderShape::Topology RenderShape::getTopology() const {
+  return d_topology;
+}
+
+GLenum RenderShape::getPrimitive() const {
+  return d_topology == TOPOLOGY_STRIP ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+}
+
 const GLfloat* RenderShape::getVertices() const {
   return d_vertex.data();
 }
@@ -153,13 +185,81 @@ const GLushort* RenderShape::getIndicies() const {
 }
 
 
-const GLfloat* RenderShape::getVertexDirect() const {
-  return d_vertex_direct.data();
+// A list as it is, or strips separated by restarts; every other
+// triangle of a strip is turned around to keep the winding as GL does
+void RenderShape::getTriangles( std::vector<GLuint>& _corners ) const {
+  _corners.clear();
+  if ( d_topology == TOPOLOGY_LIST ) {
+    _corners.assign(d_index.begin(), d_index.end());
+    return;
+  }
+  int inStrip = 0;
+  for ( size_t i=0; i<d_index.size(); ++i ) {
+    if ( d_index[i] == d_restart ) {
+      inStrip = 0;
+      continue;
+    }
+    if ( ++inStrip < 3 ) continue;
+    bool odd = inStrip % 2 == 0;
+    _corners.push_back(d_index[odd ? i-1 : i-2]);
+    _corners.push_back(d_index[odd ? i-2 : i-1]);
+    _corners.push_back(d_index[i]);
+  }
+  return;
 }
 
 
 int RenderShape::getNTriangles() const {
-  return d_vertex_direct.size()/3/3; // d_nTriangles and number of coords;
+  if ( d_topology == TOPOLOGY_LIST ) return d_index.size() / 3;
+  int nTriangles = 0, inStrip = 0;
+  for ( size_t i=0; i<d_index.size(); ++i ) {
+    inStrip = d_index[i] == d_restart ? 0 : inStrip + 1;
+    if ( inStrip >= 3 ) ++nTriangles;
+  }
+  return nTriangles;
+}
+
+
+void RenderShape::getVertexDirect( std::vector<GLfloat>& _vertex ) const {
+  std::vector<GLuint> corners;
+  getTriangles(corners);
+  _vertex.resize(3 * corners.size());
+  for ( size_t c=0; c<corners.size(); ++c ) {
+    for ( int k=0; k<3; ++k ) {
+      _vertex[3*c+k] = d_vertex[3*corners[c]+k];
+    }
+  }
+  return;
+}
+
+
+// Strips pay a restart per strip, so meshes which only give short strips
+// stay lists
+int RenderShape::setTriangles( const std::vector<GLuint>& _corners ) {
+  std::vector<GLuint> strips;
+  CSI4130::stripify(_corners, d_restart, strips);
+  int saved = static_cast<int>(_corners.size()) -
+    static_cast<int>(strips.size());
+  const std::vector<GLuint>& index = saved > 0 ? strips : _corners;
+  d_topology = saved > 0 ? TOPOLOGY_STRIP : TOPOLOGY_LIST;
+  d_index.assign(index.begin(), index.end());
+  return saved > 0 ? saved : 0;
+}
+
+
+int RenderShape::weld( const std::vector<GLfloat>& _vertex,
+		       const std::vector<GLfloat>& _normal, float _eps ) {
+  std::vector<GLfloat> vertex, normal;
+  std::vector<GLuint> corners;
+  // the restart index is not a vertex
+  if ( CSI4130::weldVertices(_vertex, _normal, _eps, vertex, normal,
+			     corners, d_restart) < 0 ) {
+    return -1;
+  }
+  d_vertex.swap(vertex);
+  d_normal.swap(normal);
+  setTriangles(corners);
+  return 0;
 }
 
 int RenderShape::getNColors() const {
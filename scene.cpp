@@ -0,0 +1,629 @@
+// ==========================================================================
+// $Id: scene.cpp $
+// Scene description files: shape, materials, lights and instance sets
+// ==========================================================================
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#define GLM_FORCE_RADIANS
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "scene.h"
+#include "attributes.h"
+
+namespace CSI4130 {
+
+namespace {
+const char c_magic[8] = { 'L', 'B', 'S', 'C', 'E', 'N', 'E', '1' };
+// bytes read per chunk of instance data
+const size_t c_chunkBytes = 1 << 22;
+// instances per job
+const int c_grain = 1 << 13;
+// floats of a material and a light record in the binary form
+const int c_materialFloats = 17;
+const int c_lightFloats = 20;
+
+typedef std::chrono::steady_clock Clock;
+
+// files beyond 2 GB
+int seek( FILE* _file, long long _offset ) {
+#ifdef _WIN32
+  return _fseeki64(_file, _offset, SEEK_SET);
+#else
+  return fseeko(_file, _offset, SEEK_SET);
+#endif
+}
+
+double msSince( Clock::time_point _start ) {
+  return std::chrono::duration<double, std::milli>
+    (Clock::now() - _start).count();
+}
+
+bool readVec3( std::istream& _is, glm::vec3& _v ) {
+  return static_cast<bool>(_is >> _v.x >> _v.y >> _v.z);
+}
+
+bool readColor( std::istream& _is, glm::vec4& _c ) {
+  glm::vec3 rgb;
+  if ( !readVec3(_is, rgb) ) return false;
+  _c = glm::vec4(rgb, 1.0f);
+  return true;
+}
+
+// Parse one instance line [_begin,_end) of the text form
+bool parseInstance( const char* _begin, const char* _end, glm::mat4& _tfm,
+		    GLuint& _material ) {
+  // the line ends with '\n' or the 0 after the buffer (see textList);
+  // numbers running into the next line are an error
+  char* next;
+  unsigned long m = strtoul(_begin, &next, 10);
+  if ( next == _begin ) return false;
+  float v[7];
+  for ( int k=0; k<7; ++k ) {
+    const char* cur = next;
+    v[k] = strtof(cur, &next);
+    if ( next == cur || next > _end ) return false;
+  }
+  glm::vec3 axis(v[3], v[4], v[5]);
+  if ( glm::dot(axis, axis) == 0.0f ) axis = glm::vec3(1.0f, 0.0f, 0.0f);
+  _tfm = glm::rotate( glm::radians(v[6]), axis );
+  _tfm[3] = glm::vec4(v[0], v[1], v[2], 1.0f);
+  _material = static_cast<GLuint>(m);
+  return true;
+}
+
+void writeBinaryMaterial( FILE* _file, const Material& _mat ) {
+  GLfloat data[c_materialFloats];
+  memcpy(data, glm::value_ptr(_mat.d_emissive), 4 * sizeof(GLfloat));
+  memcpy(data + 4, glm::value_ptr(_mat.d_ambient), 4 * sizeof(GLfloat));
+  memcpy(data + 8, glm::value_ptr(_mat.d_diffuse), 4 * sizeof(GLfloat));
+  memcpy(data + 12, glm::value_ptr(_mat.d_specular), 4 * sizeof(GLfloat));
+  data[16] = _mat.d_shininess;
+  fwrite(data, sizeof(data), 1, _file);
+  return;
+}
+
+void writeBinaryLight( FILE* _file, const LightSource& _light ) {
+  uint32_t point = _light.d_pointLight ? 1 : 0;
+  GLfloat data[c_lightFloats];
+  memcpy(data, glm::value_ptr(_light.d_ambient), 4 * sizeof(GLfloat));
+  memcpy(data + 4, glm::value_ptr(_light.d_diffuse), 4 * sizeof(GLfloat));
+  memcpy(data + 8, glm::value_ptr(_light.d_specular), 4 * sizeof(GLfloat));
+  memcpy(data + 12, glm::value_ptr(_light.d_spot_direction),
+	 3 * sizeof(GLfloat));
+  data[15] = _light.d_spot_exponent;
+  data[16] = _light.d_spot_cutoff;
+  data[17] = _light.d_constant_attenuation;
+  data[18] = _light.d_linear_attenuation;
+  data[19] = _light.d_quadratic_attenuation;
+  fwrite(&point, sizeof(point), 1, _file);
+  fwrite(data, sizeof(data), 1, _file);
+  return;
+}
+
+void writeText( FILE* _file, const char* _key, const glm::vec4& _c ) {
+  fprintf(_file, " %s %.9g %.9g %.9g", _key, _c.x, _c.y, _c.z);
+  return;
+}
+}
+
+
+long long Scene::getNInstances() const {
+  long long n = 0;
+  for ( size_t s=0; s<d_sets.size(); ++s ) n += d_sets[s].d_count;
+  return n;
+}
+
+
+SceneReader::SceneReader() : d_file(0), d_binary(false), d_line(0),
+			     d_set(0), d_inSet(0), d_listPos(0),
+			     d_min(FLT_MAX), d_max(-FLT_MAX), d_bytes(0),
+			     d_ms(0.0) {}
+
+
+SceneReader::~SceneReader() {
+  close();
+}
+
+
+void SceneReader::close() {
+  if ( d_file ) fclose(d_file);
+  d_file = 0;
+  d_buffer.clear();
+  return;
+}
+
+
+int SceneReader::error( const std::string& _msg ) const {
+  std::cerr << d_path;
+  if ( !d_binary && d_line > 0 ) std::cerr << ":" << d_line;
+  std::cerr << ": " << _msg << std::endl;
+  return -1;
+}
+
+
+int SceneReader::open( const char* _path, Scene& _scene ) {
+  Clock::time_point start = Clock::now();
+  close();
+  d_path = _path;
+  d_line = 0;
+  d_set = 0;
+  d_inSet = 0;
+  d_bytes = 0;
+  d_ms = 0.0;
+  d_min = glm::vec3(FLT_MAX);
+  d_max = glm::vec3(-FLT_MAX);
+  d_file = fopen(_path, "rb");
+  if ( !d_file ) return error("cannot open");
+  char magic[sizeof(c_magic)];
+  d_binary = fread(magic, 1, sizeof(magic), d_file) == sizeof(magic) &&
+    memcmp(magic, c_magic, sizeof(magic)) == 0;
+  if ( !d_binary ) rewind(d_file);
+  _scene = Scene();
+  int res = d_binary ? readBinaryHeader(_scene) : readTextHeader(_scene);
+  if ( res == 0 && _scene.d_materials.empty() ) {
+    res = error("no materials");
+  }
+  for ( size_t s=0; res == 0 && s<_scene.d_sets.size(); ++s ) {
+    if ( _scene.d_sets[s].d_material >=
+	 static_cast<int>(_scene.d_materials.size()) ) {
+      res = error("instance set with an unknown material");
+    }
+  }
+  // the list data follows the header
+  d_listPos = ftell(d_file);
+  d_bytes += ftell(d_file);
+  d_ms += msSince(start);
+  return res;
+}
+
+
+int SceneReader::readTextHeader( Scene& _scene ) {
+  char line[1024];
+  while ( fgets(line, sizeof(line), d_file) ) {
+    ++d_line;
+    std::istringstream is(line);
+    std::string key;
+    // empty line or comment
+    if ( !(is >> key) || key[0] == '#' ) continue;
+    if ( key == "data" ) return 0;
+    if ( key == "shape" ) {
+      is >> _scene.d_shape;
+      if ( _scene.d_shape != "sphere" && _scene.d_shape != "box" ) {
+	return error("unknown shape " + _scene.d_shape);
+      }
+    } else if ( key == "material" ) {
+      Material mat;
+      bool ok = true;
+      while ( ok && is >> key && key[0] != '#' ) {
+	if ( key == "emissive" ) ok = readColor(is, mat.d_emissive);
+	else if ( key == "ambient" ) ok = readColor(is, mat.d_ambient);
+	else if ( key == "diffuse" ) ok = readColor(is, mat.d_diffuse);
+	else if ( key == "specular" ) ok = readColor(is, mat.d_specular);
+	else if ( key == "shininess" ) ok = static_cast<bool>(is >> mat.d_shininess);
+	else return error("unknown material parameter " + key);
+      }
+      if ( !ok ) return error("bad material parameter " + key);
+      _scene.d_materials.push_back(mat);
+    } else if ( key == "light" ) {
+      LightSource light;
+      std::string type;
+      is >> type;
+      if ( type == "directional" ) {
+	light.d_pointLight = false;
+      } else if ( type != "point" && type != "spot" ) {
+	return error("unknown light " + type);
+      }
+      bool ok = true;
+      while ( ok && is >> key && key[0] != '#' ) {
+	if ( key == "ambient" ) ok = readColor(is, light.d_ambient);
+	else if ( key == "diffuse" ) ok = readColor(is, light.d_diffuse);
+	else if ( key == "specular" ) ok = readColor(is, light.d_specular);
+	else if ( key == "direction" ) ok = readVec3(is, light.d_spot_direction);
+	else if ( key == "exponent" ) ok = static_cast<bool>(is >> light.d_spot_exponent);
+	else if ( key == "cutoff" ) ok = static_cast<bool>(is >> light.d_spot_cutoff);
+	else if ( key == "attenuation" ) {
+	  ok = static_cast<bool>(is >> light.d_constant_attenuation
+				 >> light.d_linear_attenuation
+				 >> light.d_quadratic_attenuation);
+	} else return error("unknown light parameter " + key);
+      }
+      if ( !ok ) return error("bad light parameter " + key);
+      _scene.d_lights.push_back(light);
+    } else if ( key == "instances" ) {
+      InstanceSet set;
+      std::string type;
+      is >> type >> set.d_count;
+      if ( !is || set.d_count < 0 ) return error("bad instance count");
+      if ( type == "list" ) {
+	set.d_kind = InstanceSet::SET_LIST;
+      } else if ( type != "random" ) {
+	return error("unknown instance set " + type);
+      }
+      bool ok = true;
+      while ( ok && set.d_kind == InstanceSet::SET_RANDOM &&
+	      is >> key && key[0] != '#' ) {
+	if ( key == "seed" ) ok = static_cast<bool>(is >> set.d_seed);
+	else if ( key == "min" ) ok = readVec3(is, set.d_min);
+	else if ( key == "max" ) ok = readVec3(is, set.d_max);
+	else if ( key == "material" ) {
+	  std::string m;
+	  is >> m;
+	  set.d_material = m == "random" ? -1 : atoi(m.c_str());
+	  ok = m == "random" || (!m.empty() && set.d_material >= 0);
+	} else return error("unknown instance parameter " + key);
+      }
+      if ( !ok ) return error("bad instance parameter " + key);
+      _scene.d_sets.push_back(set);
+    } else {
+      return error("unknown statement " + key);
+    }
+  }
+  // no data section is fine without list sets
+  for ( size_t s=0; s<_scene.d_sets.size(); ++s ) {
+    if ( _scene.d_sets[s].d_kind == InstanceSet::SET_LIST &&
+	 _scene.d_sets[s].d_count > 0 ) return error("missing data");
+  }
+  return 0;
+}
+
+
+int SceneReader::readBinaryHeader( Scene& _scene ) {
+  uint32_t shape, n;
+  if ( fread(&shape, sizeof(shape), 1, d_file) != 1 ) return error("truncated");
+  _scene.d_shape = shape == 0 ? "sphere" : "box";
+  if ( fread(&n, sizeof(n), 1, d_file) != 1 ) return error("truncated");
+  for ( uint32_t m=0; m<n; ++m ) {
+    GLfloat data[c_materialFloats];
+    if ( fread(data, sizeof(data), 1, d_file) != 1 ) return error("truncated");
+    Material mat;
+    mat.d_emissive = glm::make_vec4(data);
+    mat.d_ambient = glm::make_vec4(data + 4);
+    mat.d_diffuse = glm::make_vec4(data + 8);
+    mat.d_specular = glm::make_vec4(data + 12);
+    mat.d_shininess = data[16];
+    _scene.d_materials.push_back(mat);
+  }
+  if ( fread(&n, sizeof(n), 1, d_file) != 1 ) return error("truncated");
+  for ( uint32_t l=0; l<n; ++l ) {
+    uint32_t point;
+    GLfloat data[c_lightFloats];
+    if ( fread(&point, sizeof(point), 1, d_file) != 1 ||
+	 fread(data, sizeof(data), 1, d_file) != 1 ) return error("truncated");
+    LightSource light;
+    light.d_pointLight = point != 0;
+    light.d_ambient = glm::make_vec4(data);
+    light.d_diffuse = glm::make_vec4(data + 4);
+    light.d_specular = glm::make_vec4(data + 8);
+    light.d_spot_direction = glm::make_vec3(data + 12);
+    light.d_spot_exponent = data[15];
+    light.d_spot_cutoff = data[16];
+    light.d_constant_attenuation = data[17];
+    light.d_linear_attenuation = data[18];
+    light.d_quadratic_attenuation = data[19];
+    _scene.d_lights.push_back(light);
+  }
+  if ( fread(&n, sizeof(n), 1, d_file) != 1 ) return error("truncated");
+  for ( uint32_t s=0; s<n; ++s ) {
+    uint32_t head[3];
+    int32_t material;
+    GLfloat bounds[6];
+    if ( fread(head, sizeof(head), 1, d_file) != 1 ||
+	 fread(&material, sizeof(material), 1, d_file) != 1 ||
+	 fread(bounds, sizeof(bounds), 1, d_file) != 1 ) return error("truncated");
+    InstanceSet set;
+    set.d_kind = head[0] == 0 ? InstanceSet::SET_RANDOM : InstanceSet::SET_LIST;
+    set.d_count = head[1];
+    set.d_seed = head[2];
+    set.d_material = material;
+    set.d_min = glm::make_vec3(bounds);
+    set.d_max = glm::make_vec3(bounds + 3);
+    if ( set.d_count < 0 ) return error("bad instance count");
+    _scene.d_sets.push_back(set);
+  }
+  return 0;
+}
+
+
+int SceneReader::readInstances( const Scene& _scene, glm::mat4* _tfms,
+				GLuint* _materials, JobSystem& _jobs ) {
+  long long n = _scene.getNInstances();
+  if ( n > 0x7fffffff ) return error("too many instances to read at once");
+  return readChunk(_scene, _tfms, _materials, static_cast<int>(n),
+		   _jobs) < 0 ? -1 : 0;
+}
+
+
+int SceneReader::readChunk( const Scene& _scene, glm::mat4* _tfms,
+			    GLuint* _materials, int _capacity,
+			    JobSystem& _jobs ) {
+  if ( !d_file ) return error("not open");
+  Clock::time_point start = Clock::now();
+  // text data may have been read beyond the last instance
+  long long textPos = ftell(d_file) - static_cast<long long>(d_buffer.size());
+  int nMaterials = _scene.d_materials.size();
+  int res = 0;
+  int first = 0;
+  while ( res == 0 && first < _capacity && d_set < _scene.d_sets.size() ) {
+    const InstanceSet& set = _scene.d_sets[d_set];
+    int n = std::min(_capacity - first, set.d_count - d_inSet);
+    if ( set.d_kind == InstanceSet::SET_RANDOM ) {
+      randomSet(set, nMaterials, d_inSet, n, _tfms + first,
+		_materials + first, _jobs);
+    } else if ( d_binary ) {
+      res = binaryList(set, d_inSet, n, _tfms + first, _materials + first);
+    } else {
+      res = textList(n, _tfms + first, _materials + first, _jobs);
+    }
+    first += n;
+    d_inSet += n;
+    if ( d_inSet == set.d_count ) {
+      if ( set.d_kind == InstanceSet::SET_LIST ) {
+	d_listPos += static_cast<long long>(set.d_count) *
+	  (sizeof(glm::mat4) + sizeof(GLuint));
+      }
+      ++d_set;
+      d_inSet = 0;
+    }
+  }
+  // binary materials are not checked while reading
+  std::atomic<int> bad(0);
+  if ( res == 0 ) {
+    _jobs.parallelFor(0, first, c_grain, [&](int _begin, int _end) {
+	for ( int i=_begin; i<_end; ++i ) {
+	  if ( _materials[i] >= static_cast<GLuint>(nMaterials) ) ++bad;
+	}
+      });
+    if ( bad > 0 ) res = error("instances with unknown materials");
+    bound(_tfms, first, _jobs);
+  }
+  if ( !d_binary ) {
+    d_bytes += ftell(d_file) - static_cast<long long>(d_buffer.size()) -
+      textPos;
+  }
+  d_ms += msSince(start);
+  return res == 0 ? first : -1;
+}
+
+
+void SceneReader::randomSet( const InstanceSet& _set, int _nMaterials,
+			     int _first, int _n, glm::mat4* _tfms,
+			     GLuint* _materials, JobSystem& _jobs ) {
+  glm::vec3 volume = _set.d_max - _set.d_min;
+  glm::vec3 center = 0.5f * (_set.d_min + _set.d_max);
+  _jobs.parallelFor(0, _n, c_grain, [&](int _begin, int _end) {
+      for ( int i=_begin; i<_end; ++i ) {
+	int inst = _first + i;
+	glm::vec3 axis, offset;
+	float angle;
+	// same placement and material draw as Attributes and lit_boxes
+	::Attributes::randomPlacement(_set.d_seed, inst, volume, axis, angle,
+				      offset);
+	_tfms[i] = glm::rotate( angle, axis );
+	_tfms[i] = glm::translate( _tfms[i], offset );
+	_tfms[i][3] += glm::vec4(center, 0.0f);
+	if ( _set.d_material >= 0 ) {
+	  _materials[i] = _set.d_material;
+	} else {
+	  int m = static_cast<int>
+	    (::Attributes::randomUnit(_set.d_seed ^ 0x85ebca6bU, inst, 0) *
+	     _nMaterials);
+	  _materials[i] = std::min(m, _nMaterials - 1);
+	}
+      }
+    });
+  return;
+}
+
+
+int SceneReader::binaryList( const InstanceSet& _set, int _first, int _n,
+			     glm::mat4* _tfms, GLuint* _materials ) {
+  // the matrices of the set, then its materials; straight into place,
+  // one chunk per call
+  size_t count = _n;
+  if ( seek(d_file, d_listPos + static_cast<long long>(_first) *
+	    sizeof(glm::mat4)) != 0 ) {
+    return error("truncated");
+  }
+  size_t perChunk = c_chunkBytes / sizeof(glm::mat4);
+  for ( size_t i=0; i<count; i+=perChunk ) {
+    size_t n = std::min(perChunk, count - i);
+    if ( fread(glm::value_ptr(_tfms[i]), sizeof(glm::mat4), n, d_file) != n ) {
+      return error("truncated");
+    }
+  }
+  if ( seek(d_file, d_listPos + static_cast<long long>(_set.d_count) *
+	    sizeof(glm::mat4) + static_cast<long long>(_first) *
+	    sizeof(GLuint)) != 0 ) {
+    return error("truncated");
+  }
+  perChunk = c_chunkBytes / sizeof(GLuint);
+  for ( size_t i=0; i<count; i+=perChunk ) {
+    size_t n = std::min(perChunk, count - i);
+    if ( fread(_materials + i, sizeof(GLuint), n, d_file) != n ) {
+      return error("truncated");
+    }
+  }
+  d_bytes += count * (sizeof(glm::mat4) + sizeof(GLuint));
+  return 0;
+}
+
+
+int SceneReader::textList( int _n, glm::mat4* _tfms, GLuint* _materials,
+			   JobSystem& _jobs ) {
+  int done = 0;
+  bool eof = false;
+  // per line of a chunk: instance number or -1, end of the line
+  std::vector<int> lines;
+  std::vector<size_t> ends;
+  while ( done < _n ) {
+    // top up the buffer
+    if ( !eof ) {
+      size_t have = d_buffer.size();
+      d_buffer.resize(have + c_chunkBytes);
+      size_t got = fread(&d_buffer[have], 1, c_chunkBytes, d_file);
+      d_buffer.resize(have + got);
+      eof = got < c_chunkBytes;
+    }
+    // complete lines, at most as many instances as are left in this set;
+    // blank and comment lines keep their slot for the line numbers
+    lines.clear();
+    ends.clear();
+    size_t end = 0;
+    const char* data = d_buffer.data();
+    size_t size = d_buffer.size();
+    int nInstances = 0;
+    while ( end < size && done + nInstances < _n ) {
+      const char* nl = static_cast<const char*>
+	(memchr(data + end, '\n', size - end));
+      if ( !nl && !eof ) break;
+      size_t lineEnd = nl ? nl - data : size;
+      size_t p = end;
+      while ( p < lineEnd && (data[p] == ' ' || data[p] == '\t' ||
+			      data[p] == '\r') ) ++p;
+      bool blank = p == lineEnd || data[p] == '#';
+      lines.push_back(blank ? -1 : nInstances++);
+      ends.push_back(lineEnd);
+      end = nl ? lineEnd + 1 : size;
+    }
+    if ( lines.empty() && eof ) return error("missing instances");
+    int firstLine = d_line + 1;
+    d_buffer.push_back('\0');
+    data = d_buffer.data();
+    std::atomic<int> badLine(INT32_MAX);
+    _jobs.parallelFor(0, lines.size(), c_grain / 4, [&](int _begin, int _end) {
+	for ( int l=_begin; l<_end; ++l ) {
+	  if ( lines[l] < 0 ) continue;
+	  size_t lineBegin = l > 0 ? ends[l-1] + 1 : 0;
+	  if ( !parseInstance(data + lineBegin, data + ends[l],
+			      _tfms[done + lines[l]],
+			      _materials[done + lines[l]]) ) {
+	    int prev = badLine.load();
+	    while ( l < prev && !badLine.compare_exchange_weak(prev, l) ) {}
+	  }
+	}
+      });
+    d_buffer.pop_back();
+    if ( badLine.load() != INT32_MAX ) {
+      d_line = firstLine + badLine.load();
+      return error("bad instance");
+    }
+    d_line += lines.size();
+    done += nInstances;
+    d_buffer.erase(d_buffer.begin(), d_buffer.begin() + end);
+    if ( done < _n && eof && d_buffer.empty() ) {
+      return error("missing instances");
+    }
+  }
+  return 0;
+}
+
+
+void SceneReader::bound( const glm::mat4* _tfms, int _n, JobSystem& _jobs ) {
+  int nBlocks = (_n + c_grain - 1) / c_grain;
+  std::vector<glm::vec3> lo(nBlocks, glm::vec3(FLT_MAX));
+  std::vector<glm::vec3> hi(nBlocks, glm::vec3(-FLT_MAX));
+  _jobs.parallelFor(0, nBlocks, 1, [&](int _begin, int _end) {
+      for ( int b=_begin; b<_end; ++b ) {
+	int iEnd = std::min(_n, (b + 1) * c_grain);
+	for ( int i=b*c_grain; i<iEnd; ++i ) {
+	  glm::vec3 p(_tfms[i][3]);
+	  lo[b] = glm::min(lo[b], p);
+	  hi[b] = glm::max(hi[b], p);
+	}
+      }
+    });
+  for ( int b=0; b<nBlocks; ++b ) {
+    d_min = glm::min(d_min, lo[b]);
+    d_max = glm::max(d_max, hi[b]);
+  }
+  return;
+}
+
+
+int writeScene( const char* _path, const Scene& _scene,
+		const glm::mat4* _tfms, const GLuint* _materials, int _n,
+		bool _binary ) {
+  FILE* file = fopen(_path, _binary ? "wb" : "w");
+  if ( !file ) {
+    std::cerr << _path << ": cannot write" << std::endl;
+    return -1;
+  }
+  if ( _binary ) {
+    fwrite(c_magic, sizeof(c_magic), 1, file);
+    uint32_t u = _scene.d_shape == "sphere" ? 0 : 1;
+    fwrite(&u, sizeof(u), 1, file);
+    u = _scene.d_materials.size();
+    fwrite(&u, sizeof(u), 1, file);
+    for ( size_t m=0; m<_scene.d_materials.size(); ++m ) {
+      writeBinaryMaterial(file, _scene.d_materials[m]);
+    }
+    u = _scene.d_lights.size();
+    fwrite(&u, sizeof(u), 1, file);
+    for ( size_t l=0; l<_scene.d_lights.size(); ++l ) {
+      writeBinaryLight(file, _scene.d_lights[l]);
+    }
+    // one list set
+    u = 1;
+    fwrite(&u, sizeof(u), 1, file);
+    uint32_t head[3] = { 1, static_cast<uint32_t>(_n), 1 };
+    int32_t material = 0;
+    GLfloat bounds[6] = { -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+    fwrite(head, sizeof(head), 1, file);
+    fwrite(&material, sizeof(material), 1, file);
+    fwrite(bounds, sizeof(bounds), 1, file);
+    fwrite(glm::value_ptr(_tfms[0]), sizeof(glm::mat4), _n, file);
+    fwrite(_materials, sizeof(GLuint), _n, file);
+  } else {
+    fprintf(file, "# lit_boxes scene\nshape %s\n", _scene.d_shape.c_str());
+    for ( size_t m=0; m<_scene.d_materials.size(); ++m ) {
+      const Material& mat = _scene.d_materials[m];
+      fprintf(file, "material");
+      writeText(file, "emissive", mat.d_emissive);
+      writeText(file, "ambient", mat.d_ambient);
+      writeText(file, "diffuse", mat.d_diffuse);
+      writeText(file, "specular", mat.d_specular);
+      fprintf(file, " shininess %.9g\n", mat.d_shininess);
+    }
+    for ( size_t l=0; l<_scene.d_lights.size(); ++l ) {
+      const LightSource& light = _scene.d_lights[l];
+      fprintf(file, "light %s", light.d_pointLight ? "point" : "directional");
+      writeText(file, "ambient", light.d_ambient);
+      writeText(file, "diffuse", light.d_diffuse);
+      writeText(file, "specular", light.d_specular);
+      writeText(file, "direction", glm::vec4(light.d_spot_direction, 0.0f));
+      fprintf(file, " exponent %.9g cutoff %.9g attenuation %.9g %.9g %.9g\n",
+	      light.d_spot_exponent, light.d_spot_cutoff,
+	      light.d_constant_attenuation, light.d_linear_attenuation,
+	      light.d_quadratic_attenuation);
+    }
+    fprintf(file, "instances list %d\ndata\n", _n);
+    for ( int i=0; i<_n; ++i ) {
+      glm::vec3 axis;
+      float angle;
+      ::Attributes::rotationAxisAngle(glm::mat3(_tfms[i]), axis, angle);
+      fprintf(file, "%u %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", _materials[i],
+	      _tfms[i][3].x, _tfms[i][3].y, _tfms[i][3].z,
+	      axis.x, axis.y, axis.z, glm::degrees(angle));
+    }
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  if ( !ok ) {
+    std::cerr << _path << ": write failed" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+} // end namespace
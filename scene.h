@@ -0,0 +1,175 @@
+// ==========================================================================
+// $Id: scene.h $
+// Scene description files: shape, materials, lights and instance sets
+// ==========================================================================
+// Text form, one statement per line, '#' starts a comment:
+//
+//   shape sphere|box
+//   material [emissive r g b] [ambient r g b] [diffuse r g b]
+//            [specular r g b] [shininess s]
+//   light point|directional|spot [ambient r g b] [diffuse r g b]
+//         [specular r g b] [direction x y z] [exponent e] [cutoff deg]
+//         [attenuation kc kl kq]
+//   instances random <n> [seed s] [min x y z] [max x y z]
+//             [material m|random]
+//   instances list <n>
+//   data
+//
+// A random set is placed like Attributes does it and only depends on the
+// seed. The instances of the list sets follow 'data' in the order of the
+// sets, one line per instance:
+//
+//   <material> <x y z> <axis x y z> <angle in degrees>
+//
+// which is translate(x y z) * rotate(angle, axis). The binary form holds
+// the same header as records and stores list sets as arrays of model
+// matrices and material indices (native byte order); it starts with the
+// magic "LBSCENE1".
+//
+// SceneReader::open() reads everything but the instances. The instances
+// go straight into the caller's arrays, chunk by chunk: binary chunks are
+// read into place, text chunks are split at line ends and parsed by
+// jobs, random sets are generated by jobs. There is no intermediate copy
+// of the scene. readChunk() hands them out a bounded number at a time for
+// scenes which do not fit into memory.
+// ==========================================================================
+#ifndef CSI4130_SCENE_H_
+#define CSI4130_SCENE_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// errorOut used by material.h
+#include "shader.h"
+#include "light.h"
+#include "material.h"
+#include "job_system.h"
+
+namespace CSI4130 {
+
+struct InstanceSet {
+  enum Kind {
+    SET_RANDOM = 0,
+    SET_LIST
+  };
+  Kind d_kind;
+  int d_count;
+  unsigned d_seed;
+  glm::vec3 d_min;
+  glm::vec3 d_max;
+  int d_material; // -1 for random materials
+  InstanceSet() : d_kind(SET_RANDOM), d_count(0), d_seed(1),
+		  d_min(-1.0f), d_max(1.0f), d_material(0) {}
+};
+
+
+struct Scene {
+  std::string d_shape;
+  std::vector<Material> d_materials;
+  std::vector<LightSource> d_lights;
+  std::vector<InstanceSet> d_sets;
+
+  Scene() : d_shape("sphere") {}
+  long long getNInstances() const;
+};
+
+
+class SceneReader {
+  FILE* d_file;
+  std::string d_path;
+  bool d_binary;
+  int d_line;
+  // next instance: set and instance within it
+  size_t d_set;
+  int d_inSet;
+  // binary: file offset of the current list set
+  long long d_listPos;
+  // text data not yet parsed
+  std::vector<char> d_buffer;
+  // bounds of the instance positions read so far
+  glm::vec3 d_min;
+  glm::vec3 d_max;
+  // statistics
+  long long d_bytes;
+  double d_ms;
+
+ public:
+  SceneReader();
+  ~SceneReader();
+
+  // Read the header of _path into _scene; returns 0 on success
+  int open( const char* _path, Scene& _scene );
+
+  // Fill _tfms and _materials, getNInstances() entries each, with the
+  // instances of all sets in order. Returns 0 on success.
+  int readInstances( const Scene& _scene, glm::mat4* _tfms,
+		     GLuint* _materials,
+		     JobSystem& _jobs = JobSystem::global() );
+  // Fill _tfms and _materials with up to _capacity instances following
+  // those read so far. Returns the number read, 0 after the last
+  // instance, or -1 on an error.
+  int readChunk( const Scene& _scene, glm::mat4* _tfms, GLuint* _materials,
+		 int _capacity, JobSystem& _jobs = JobSystem::global() );
+
+  void close();
+
+  // Bounds of the instance positions read so far
+  inline glm::vec3 getMin() const;
+  inline glm::vec3 getMax() const;
+  // Bytes read and ms spent in open() and readInstances()
+  inline long long getBytes() const;
+  inline double getMs() const;
+
+ private:
+  int readTextHeader( Scene& _scene );
+  int readBinaryHeader( Scene& _scene );
+  // _n instances of _set from instance _first on
+  void randomSet( const InstanceSet& _set, int _nMaterials, int _first,
+		  int _n, glm::mat4* _tfms, GLuint* _materials,
+		  JobSystem& _jobs );
+  int binaryList( const InstanceSet& _set, int _first, int _n,
+		  glm::mat4* _tfms, GLuint* _materials );
+  // the next _n instance lines
+  int textList( int _n, glm::mat4* _tfms, GLuint* _materials,
+		JobSystem& _jobs );
+  void bound( const glm::mat4* _tfms, int _n, JobSystem& _jobs );
+  int error( const std::string& _msg ) const;
+
+  // no copy or assignment
+  SceneReader(const SceneReader& _oReader );
+  SceneReader& operator=( const SceneReader& _oReader );
+};
+
+
+// Write _scene with its list sets replaced by one list of the _n
+// instances _tfms/_materials; returns 0 on success
+int writeScene( const char* _path, const Scene& _scene,
+		const glm::mat4* _tfms, const GLuint* _materials, int _n,
+		bool _binary );
+
+
+glm::vec3 SceneReader::getMin() const {
+  return d_min;
+}
+
+glm::vec3 SceneReader::getMax() const {
+  return d_max;
+}
+
+long long SceneReader::getBytes() const {
+  return d_bytes;
+}
+
+double SceneReader::getMs() const {
+  return d_ms;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,355 @@
+// ==========================================================================
+// $Id: shadow_map.cpp $
+// Cached shadow map of the active light with incremental invalidation
+// ==========================================================================
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#define GLM_FORCE_RADIANS
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shadow_map.h"
+
+namespace CSI4130 {
+
+namespace {
+// instances per comparison job
+const int c_grain = 1 << 14;
+// texels around a moved instance for the filtered lookups
+const int c_margin = 1;
+// a partial redraw larger than this fraction is counted as full
+const float c_fullFraction = 0.5f;
+const float c_pi = 3.14159265f;
+}
+
+
+ShadowMap::ShadowMap( int _size ) :
+  d_size(_size), d_fbo(0), d_texture(0), d_vao(0), d_tbo(0), d_ebo(0),
+  d_program(0), d_locVM(-1), d_locP(-1), d_shape(0), d_radius(0.0f),
+  d_view(1.0f), d_proj(1.0f), d_full(true), d_uploadBegin(0),
+  d_uploadEnd(0), d_stampsPending(false) {
+  Rect empty = { 0, 0, 0, 0 };
+  d_dirty = empty;
+  d_stamps[0] = d_stamps[1] = 0;
+  resetStats();
+}
+
+
+void ShadowMap::init( GLuint _program, GLuint _vbo, GLuint _ebo,
+		      const RenderShape& _shape, float _radius ) {
+  d_program = _program;
+  d_ebo = _ebo;
+  d_shape = &_shape;
+  d_radius = _radius;
+  d_locVM = glGetUniformLocation(d_program, "ViewMatrix");
+  d_locP = glGetUniformLocation(d_program, "ProjectionMatrix");
+  GLint locPos = glGetAttribLocation(d_program, "position");
+  GLint locMM = glGetAttribLocation(d_program, "ModelMatrix");
+
+  // depth texture with hardware comparison; outside of the map is lit
+  glGenTextures(1, &d_texture);
+  glBindTexture(GL_TEXTURE_2D, d_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, d_size, d_size, 0,
+	       GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+		  GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &d_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, d_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+			 d_texture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  if ( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE ) {
+    std::cerr << "Shadow map: incomplete framebuffer" << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  // position and model matrix of all instances
+  glGenVertexArrays(1, &d_vao);
+  glBindVertexArray(d_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+  glVertexAttribPointer(locPos, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(locPos);
+  glGenBuffers(1, &d_tbo);
+  glBindBuffer(GL_ARRAY_BUFFER, d_tbo);
+  for ( int i=0; i<4; ++i ) {
+    glVertexAttribPointer(locMM + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+			  (void *)(sizeof(GLfloat) * 4 * i));
+    glEnableVertexAttribArray(locMM + i);
+    glVertexAttribDivisor(locMM + i, 1);
+  }
+  glBindVertexArray(0);
+  glGenQueries(2, d_stamps);
+  d_full = true;
+  return;
+}
+
+
+void ShadowMap::lightMatrices( const glm::vec4& _light,
+			       const glm::vec3& _spotDirection, float _cutoff,
+			       float _sceneRadius, glm::mat4& _view,
+			       glm::mat4& _proj ) {
+  float r = _sceneRadius;
+  if ( _light.w == 0.0f ) {
+    // directional: orthographic box around the scene sphere
+    glm::vec3 dir = glm::normalize(glm::vec3(_light));
+    glm::vec3 up = std::fabs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) :
+      glm::vec3(0.0f, 1.0f, 0.0f);
+    _view = glm::lookAt(2.0f * r * dir, glm::vec3(0.0f), up);
+    _proj = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+    return;
+  }
+  glm::vec3 pos = glm::vec3(_light) / _light.w;
+  float dist = glm::length(pos);
+  glm::vec3 dir;
+  float halfAngle;
+  if ( _cutoff < 90.0f ) {
+    dir = glm::normalize(_spotDirection);
+    halfAngle = std::max(_cutoff, 0.5f) * c_pi / 180.0f;
+  } else {
+    dir = dist > 0.0f ? -pos / dist : glm::vec3(0.0f, 0.0f, -1.0f);
+    // cone around the scene sphere, limited if the light is inside
+    halfAngle = dist > r ? std::asin(r / dist) : 75.0f * c_pi / 180.0f;
+  }
+  glm::vec3 up = std::fabs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) :
+    glm::vec3(0.0f, 1.0f, 0.0f);
+  _view = glm::lookAt(pos, pos + dir, up);
+  float farPlane = dist + r;
+  float nearPlane = std::max(dist - r, 0.01f * farPlane);
+  _proj = glm::perspective(2.0f * halfAngle, 1.0f, nearPlane, farPlane);
+  return;
+}
+
+
+void ShadowMap::setLight( const glm::mat4& _view, const glm::mat4& _proj ) {
+  if ( memcmp(&_view, &d_view, sizeof(glm::mat4)) != 0 ||
+       memcmp(&_proj, &d_proj, sizeof(glm::mat4)) != 0 ) {
+    d_view = _view;
+    d_proj = _proj;
+    d_full = true;
+  }
+  return;
+}
+
+
+ShadowMap::Rect ShadowMap::lightRect( const glm::mat4& _tfm ) const {
+  Rect all = { 0, 0, d_size, d_size };
+  // light space box around the bounding sphere
+  glm::vec4 center = d_view * _tfm[3];
+  float x0 = 1.0f, y0 = 1.0f, x1 = -1.0f, y1 = -1.0f;
+  for ( int c=0; c<8; ++c ) {
+    glm::vec4 corner = center + glm::vec4(c & 1 ? d_radius : -d_radius,
+					  c & 2 ? d_radius : -d_radius,
+					  c & 4 ? d_radius : -d_radius, 0.0f);
+    glm::vec4 clip = d_proj * corner;
+    // crosses the plane of the light
+    if ( clip.w <= 0.0f ) return all;
+    x0 = std::min(x0, clip.x / clip.w);
+    x1 = std::max(x1, clip.x / clip.w);
+    y0 = std::min(y0, clip.y / clip.w);
+    y1 = std::max(y1, clip.y / clip.w);
+  }
+  float s = 0.5f * d_size;
+  Rect rect = {
+    std::max(static_cast<int>(std::floor((x0 + 1.0f) * s)) - c_margin, 0),
+    std::max(static_cast<int>(std::floor((y0 + 1.0f) * s)) - c_margin, 0),
+    std::min(static_cast<int>(std::ceil((x1 + 1.0f) * s)) + c_margin, d_size),
+    std::min(static_cast<int>(std::ceil((y1 + 1.0f) * s)) + c_margin, d_size) };
+  return rect;
+}
+
+
+void ShadowMap::setInstances( const glm::mat4* _tfms, int _n,
+			      JobSystem& _jobs ) {
+  if ( static_cast<int>(d_tfms.size()) != _n ) {
+    d_tfms.assign(_tfms, _tfms + _n);
+    d_uploadBegin = 0;
+    d_uploadEnd = _n;
+    d_full = true;
+    return;
+  }
+  int nBlocks = (_n + c_grain - 1) / c_grain;
+  Rect empty = { d_size, d_size, 0, 0 };
+  d_blockRect.assign(nBlocks, empty);
+  d_blockBegin.assign(nBlocks, _n);
+  d_blockEnd.assign(nBlocks, 0);
+  // no need for the rectangles if everything is redrawn anyway
+  bool full = d_full;
+  _jobs.parallelFor(0, nBlocks, 1, [&](int _bBegin, int _bEnd) {
+      for ( int b=_bBegin; b<_bEnd; ++b ) {
+	Rect rect = empty;
+	bool covered = full;
+	int first = _n, last = 0;
+	for ( int i=b*c_grain; i<std::min((b+1)*c_grain, _n); ++i ) {
+	  if ( memcmp(&_tfms[i], &d_tfms[i], sizeof(glm::mat4)) == 0 ) continue;
+	  first = std::min(first, i);
+	  last = i + 1;
+	  if ( !covered ) {
+	    // old and new place of the instance
+	    Rect from = lightRect(d_tfms[i]);
+	    Rect to = lightRect(_tfms[i]);
+	    rect.d_x0 = std::min(rect.d_x0, std::min(from.d_x0, to.d_x0));
+	    rect.d_y0 = std::min(rect.d_y0, std::min(from.d_y0, to.d_y0));
+	    rect.d_x1 = std::max(rect.d_x1, std::max(from.d_x1, to.d_x1));
+	    rect.d_y1 = std::max(rect.d_y1, std::max(from.d_y1, to.d_y1));
+	    covered = rect.d_x0 == 0 && rect.d_y0 == 0 &&
+	      rect.d_x1 == d_size && rect.d_y1 == d_size;
+	  }
+	  d_tfms[i] = _tfms[i];
+	}
+	d_blockRect[b] = rect;
+	d_blockBegin[b] = first;
+	d_blockEnd[b] = last;
+      }
+    });
+  for ( int b=0; b<nBlocks; ++b ) {
+    const Rect& rect = d_blockRect[b];
+    if ( d_blockBegin[b] < d_blockEnd[b] ) {
+      if ( d_uploadBegin < d_uploadEnd ) {
+	d_uploadBegin = std::min(d_uploadBegin, d_blockBegin[b]);
+	d_uploadEnd = std::max(d_uploadEnd, d_blockEnd[b]);
+      } else {
+	d_uploadBegin = d_blockBegin[b];
+	d_uploadEnd = d_blockEnd[b];
+      }
+    }
+    if ( rect.d_x0 >= rect.d_x1 || rect.d_y0 >= rect.d_y1 ) continue;
+    if ( d_dirty.d_x0 < d_dirty.d_x1 ) {
+      d_dirty.d_x0 = std::min(d_dirty.d_x0, rect.d_x0);
+      d_dirty.d_y0 = std::min(d_dirty.d_y0, rect.d_y0);
+      d_dirty.d_x1 = std::max(d_dirty.d_x1, rect.d_x1);
+      d_dirty.d_y1 = std::max(d_dirty.d_y1, rect.d_y1);
+    } else {
+      d_dirty = rect;
+    }
+  }
+  float area = static_cast<float>(d_dirty.d_x1 - d_dirty.d_x0) *
+    (d_dirty.d_y1 - d_dirty.d_y0);
+  if ( d_dirty.d_x0 < d_dirty.d_x1 &&
+       area > c_fullFraction * d_size * d_size ) {
+    d_full = true;
+  }
+  return;
+}
+
+
+void ShadowMap::collectGpuTime() {
+  if ( !d_stampsPending ) return;
+  GLuint available = 0;
+  glGetQueryObjectuiv(d_stamps[1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if ( !available ) return;
+  GLuint64 begin = 0, end = 0;
+  glGetQueryObjectui64v(d_stamps[0], GL_QUERY_RESULT, &begin);
+  glGetQueryObjectui64v(d_stamps[1], GL_QUERY_RESULT, &end);
+  d_gpuMs += (end - begin) * 1.0e-6;
+  ++d_gpuRenders;
+  d_stampsPending = false;
+  return;
+}
+
+
+bool ShadowMap::render( GLStateCache& _state ) {
+  ++d_nFrames;
+  collectGpuTime();
+  if ( d_uploadBegin < d_uploadEnd ) {
+    // the instance buffer follows the transforms even if nothing is drawn
+    _state.bindBuffer(GL_ARRAY_BUFFER, d_tbo);
+    if ( d_uploadBegin == 0 && d_uploadEnd == static_cast<int>(d_tfms.size()) ) {
+      glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * d_tfms.size(),
+		   d_tfms.data(), GL_DYNAMIC_DRAW);
+    } else {
+      glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * d_uploadBegin,
+		      sizeof(glm::mat4) * (d_uploadEnd - d_uploadBegin),
+		      &d_tfms[d_uploadBegin]);
+    }
+    d_uploadBegin = d_uploadEnd = 0;
+  }
+  if ( !isDirty() || !d_shape ) return false;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  bool timed = !d_stampsPending;
+  if ( timed ) glQueryCounter(d_stamps[0], GL_TIMESTAMP);
+  // back to the framebuffer of the frame afterwards, e.g., offscreen
+  GLint frameFbo = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &frameFbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, d_fbo);
+  glViewport(0, 0, d_size, d_size);
+  _state.depthMask(GL_TRUE);
+  _state.depthFunc(GL_LESS);
+  Rect rect = { 0, 0, d_size, d_size };
+  if ( !d_full ) {
+    rect = d_dirty;
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(rect.d_x0, rect.d_y0, rect.d_x1 - rect.d_x0,
+	      rect.d_y1 - rect.d_y0);
+  }
+  glClear(GL_DEPTH_BUFFER_BIT);
+  // against self-shadowing of the lit surfaces
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+  _state.useProgram(d_program);
+  _state.programUniformMatrix4fv(d_program, d_locVM, glm::value_ptr(d_view));
+  _state.programUniformMatrix4fv(d_program, d_locP, glm::value_ptr(d_proj));
+  _state.bindVertexArray(d_vao);
+  _state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, d_ebo);
+  _state.enable(GL_PRIMITIVE_RESTART);
+  _state.primitiveRestartIndex(d_shape->getRestart());
+  glDrawElementsInstanced(d_shape->getPrimitive(), d_shape->getNIndices(),
+			  GL_UNSIGNED_SHORT, 0,
+			  static_cast<GLsizei>(d_tfms.size()));
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, frameFbo);
+  if ( timed ) {
+    glQueryCounter(d_stamps[1], GL_TIMESTAMP);
+    d_stampsPending = true;
+  }
+  if ( d_full ) {
+    ++d_nFull;
+  } else {
+    ++d_nPartial;
+  }
+  d_texels += static_cast<double>(rect.d_x1 - rect.d_x0) *
+    (rect.d_y1 - rect.d_y0) / (static_cast<double>(d_size) * d_size);
+  d_full = false;
+  Rect nothing = { 0, 0, 0, 0 };
+  d_dirty = nothing;
+  d_cpuMs += std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+
+glm::mat4 ShadowMap::getShadowMatrix() const {
+  // clip space [-1,1] to texture space [0,1]
+  glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) *
+    glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+  return bias * d_proj * d_view;
+}
+
+
+void ShadowMap::resetStats() {
+  d_nFull = 0;
+  d_nPartial = 0;
+  d_nFrames = 0;
+  d_texels = 0.0;
+  d_cpuMs = 0.0;
+  d_gpuMs = 0.0;
+  d_gpuRenders = 0;
+  return;
+}
+
+} // end namespace
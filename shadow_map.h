@@ -0,0 +1,174 @@
+// ==========================================================================
+// $Id: shadow_map.h $
+// Cached shadow map of the active light with incremental invalidation
+// ==========================================================================
+// The shadow map is a depth texture rendered from the light with the
+// depth-only program. It is kept between frames and only redrawn when it
+// is out of date:
+//   - the light view or projection changed (e.g., '+'/'-', spot cutoff,
+//     window width which places the light): full redraw
+//   - the number of instances changed: full redraw
+//   - some instances moved: the rectangle covering their old and new
+//     light space bounds is cleared and redrawn with the scissor test.
+// Moved instances are found by comparing the transforms with a copy of
+// those last drawn, in parallel on the job threads; only the changed
+// range of the instance buffer is uploaded. All instances are drawn from
+// a buffer of the shadow map, so culling of the camera view does not
+// remove shadow casters.
+// ==========================================================================
+#ifndef CSI4130_SHADOW_MAP_H_
+#define CSI4130_SHADOW_MAP_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+#include "job_system.h"
+#include "render_shape.h"
+
+namespace CSI4130 {
+
+class ShadowMap {
+  // pixel rectangle [x0,x1) x [y0,y1), empty if x0 >= x1
+  struct Rect {
+    int d_x0, d_y0, d_x1, d_y1;
+  };
+
+  int d_size;
+  GLuint d_fbo;
+  GLuint d_texture;
+  GLuint d_vao;
+  GLuint d_tbo; // instance transforms
+  GLuint d_ebo;
+  GLuint d_program;
+  GLint d_locVM;
+  GLint d_locP;
+  const RenderShape* d_shape;
+  float d_radius; // bounding radius of the shape
+  glm::mat4 d_view;
+  glm::mat4 d_proj;
+  // transforms as last drawn into the map
+  std::vector<glm::mat4> d_tfms;
+  // per block of the comparison
+  std::vector<Rect> d_blockRect;
+  std::vector<int> d_blockBegin;
+  std::vector<int> d_blockEnd;
+  // what needs to be redrawn
+  bool d_full;
+  Rect d_dirty;
+  int d_uploadBegin;
+  int d_uploadEnd;
+  // statistics since the last resetStats()
+  int d_nFull;
+  int d_nPartial;
+  int d_nFrames;
+  double d_texels; // redrawn, in maps
+  double d_cpuMs;
+  double d_gpuMs;
+  int d_gpuRenders;
+  GLuint d_stamps[2];
+  bool d_stampsPending;
+
+ public:
+  // _size x _size texels
+  ShadowMap( int _size = 2048 );
+
+  // Create the GL objects; _program is a depth-only program with the
+  // vertex layout of depth_only.vs, the shape's vertices are in _vbo and
+  // its indices in _ebo. _radius bounds the shape about its origin.
+  void init( GLuint _program, GLuint _vbo, GLuint _ebo,
+	     const RenderShape& _shape, float _radius );
+
+  // View and projection of a light at _light (world space, w = 0 for a
+  // directional light) which cover a scene within _sceneRadius of the
+  // origin. A spot light with a cutoff below 90 degrees looks along
+  // _spotDirection, other lights look at the origin.
+  static void lightMatrices( const glm::vec4& _light,
+			     const glm::vec3& _spotDirection, float _cutoff,
+			     float _sceneRadius, glm::mat4& _view,
+			     glm::mat4& _proj );
+
+  // Redraw everything if the light moved
+  void setLight( const glm::mat4& _view, const glm::mat4& _proj );
+
+  // Compare the _n transforms with the ones last drawn
+  void setInstances( const glm::mat4* _tfms, int _n,
+		     JobSystem& _jobs = JobSystem::global() );
+
+  // Force a full redraw, e.g., after the map was not updated for a while
+  inline void invalidate();
+  inline bool isDirty() const;
+
+  // Redraw what is out of date into the map; the framebuffer binding is
+  // restored but the viewport is left for the caller. Returns true if
+  // anything was drawn.
+  bool render( GLStateCache& _state );
+
+  // World to shadow map texture coordinates and depth
+  glm::mat4 getShadowMatrix() const;
+  inline GLuint getTexture() const;
+
+  inline int getNFull() const;
+  inline int getNPartial() const;
+  inline int getNFrames() const;
+  // average fraction of the map redrawn per frame
+  inline double getTexelFraction() const;
+  // per render
+  inline double getCpuMs() const;
+  inline double getGpuMs() const;
+  void resetStats();
+
+ private:
+  Rect lightRect( const glm::mat4& _tfm ) const;
+  void collectGpuTime();
+
+  // no copy or assignment
+  ShadowMap(const ShadowMap& _oShadowMap );
+  ShadowMap& operator=( const ShadowMap& _oShadowMap );
+};
+
+
+void ShadowMap::invalidate() {
+  d_full = true;
+  return;
+}
+
+bool ShadowMap::isDirty() const {
+  return d_full || d_dirty.d_x0 < d_dirty.d_x1;
+}
+
+GLuint ShadowMap::getTexture() const {
+  return d_texture;
+}
+
+int ShadowMap::getNFull() const {
+  return d_nFull;
+}
+
+int ShadowMap::getNPartial() const {
+  return d_nPartial;
+}
+
+int ShadowMap::getNFrames() const {
+  return d_nFrames;
+}
+
+double ShadowMap::getTexelFraction() const {
+  return d_nFrames > 0 ? d_texels / d_nFrames : 0.0;
+}
+
+double ShadowMap::getCpuMs() const {
+  int nRenders = d_nFull + d_nPartial;
+  return nRenders > 0 ? d_cpuMs / nRenders : 0.0;
+}
+
+double ShadowMap::getGpuMs() const {
+  return d_gpuRenders > 0 ? d_gpuMs / d_gpuRenders : 0.0;
+}
+
+} // end namespace
+#endif
@@ -0,0 +1,333 @@
+// ==========================================================================
+// $Id: simplifier.cpp $
+// Quadric error mesh simplification into levels of detail
+// ==========================================================================
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+#include "simplifier.h"
+
+namespace CSI4130 {
+
+namespace {
+// boundary planes count this many times a plane of a triangle
+const double c_boundaryWeight = 1000.0;
+// a collapse across normals which differ by 90 degrees costs its squared
+// edge length this many times
+const double c_normalWeight = 1.0;
+// a collapse may turn a triangle by less than about 80 degrees, else it
+// folds over its neighbours
+const float c_minCos = 0.2f;
+// coefficients of a quadric
+const int c_nq = 10;
+
+// _w times the quadric of the plane _n.x + _d = 0 added to _q
+void addPlane( double* _q, const glm::dvec3& _n, double _d, double _w ) {
+  _q[0] += _w * _n.x * _n.x;
+  _q[1] += _w * _n.x * _n.y;
+  _q[2] += _w * _n.x * _n.z;
+  _q[3] += _w * _n.x * _d;
+  _q[4] += _w * _n.y * _n.y;
+  _q[5] += _w * _n.y * _n.z;
+  _q[6] += _w * _n.y * _d;
+  _q[7] += _w * _n.z * _n.z;
+  _q[8] += _w * _n.z * _d;
+  _q[9] += _w * _d * _d;
+  return;
+}
+
+// (_q + _r) at _p
+double evaluate( const double* _q, const double* _r, const glm::vec3& _p ) {
+  double s[c_nq];
+  for ( int i=0; i<c_nq; ++i ) s[i] = _q[i] + _r[i];
+  double x = _p.x, y = _p.y, z = _p.z;
+  return s[0] * x * x + 2.0 * s[1] * x * y + 2.0 * s[2] * x * z +
+    2.0 * s[3] * x + s[4] * y * y + 2.0 * s[5] * y * z + 2.0 * s[6] * y +
+    s[7] * z * z + 2.0 * s[8] * z + s[9];
+}
+
+// moving d_from onto d_to, valid while the stamps of both are unchanged
+struct Collapse {
+  double d_cost;
+  int d_from;
+  int d_to;
+  int d_stampFrom;
+  int d_stampTo;
+
+  bool operator>( const Collapse& _o ) const { return d_cost > _o.d_cost; }
+};
+
+struct Edge {
+  int d_a; // d_a < d_b
+  int d_b;
+  int d_tri;
+
+  bool operator<( const Edge& _o ) const {
+    return d_a < _o.d_a || (d_a == _o.d_a && d_b < _o.d_b);
+  }
+};
+
+inline bool contains( const glm::ivec3& _tri, int _v ) {
+  return _tri.x == _v || _tri.y == _v || _tri.z == _v;
+}
+}
+
+
+Simplifier::Simplifier() {
+}
+
+
+int Simplifier::setShape( const RenderShape& _shape ) {
+  std::vector<GLuint> tris;
+  _shape.getTriangles(tris);
+  // getNPoints() counts coordinates
+  return setMesh(_shape.getVertices(), _shape.getNormals(),
+		 _shape.getNPoints() / 3, tris);
+}
+
+
+int Simplifier::setMesh( const GLfloat* _vertex, const GLfloat* _normal,
+			 int _nVertices, const std::vector<GLuint>& _tris ) {
+  d_pos.clear();
+  d_normal.clear();
+  d_tris.clear();
+  // the levels are indexed with GLushort, 0xFFFF is the restart index
+  if ( _nVertices > 0xFFFF ) {
+    std::cerr << "Simplifier: " << _nVertices
+	      << " vertices do not fit short indices" << std::endl;
+    return -1;
+  }
+  for ( size_t t=0; t+2<_tris.size(); t+=3 ) {
+    if ( _tris[t] >= static_cast<GLuint>(_nVertices) ||
+	 _tris[t+1] >= static_cast<GLuint>(_nVertices) ||
+	 _tris[t+2] >= static_cast<GLuint>(_nVertices) ) {
+      std::cerr << "Simplifier: index out of range in triangle " << t / 3
+		<< std::endl;
+      return -1;
+    }
+  }
+  d_pos.resize(_nVertices);
+  d_normal.resize(_nVertices);
+  for ( int v=0; v<_nVertices; ++v ) {
+    d_pos[v] = glm::vec3(_vertex[3*v], _vertex[3*v+1], _vertex[3*v+2]);
+    glm::vec3 n(_normal[3*v], _normal[3*v+1], _normal[3*v+2]);
+    float len = glm::length(n);
+    d_normal[v] = len > 0.0f ? n / len : n;
+  }
+  for ( size_t t=0; t+2<_tris.size(); t+=3 ) {
+    d_tris.push_back(glm::ivec3(_tris[t], _tris[t+1], _tris[t+2]));
+  }
+  initQuadrics();
+  return 0;
+}
+
+
+// Planes of the triangles and the planes along boundaries
+void Simplifier::initQuadrics() {
+  int nV = getNVertices(), nT = getNTriangles();
+  d_quadric.assign(c_nq * nV, 0.0);
+  std::vector<glm::dvec3> faceNormal(nT, glm::dvec3(0.0));
+  std::vector<Edge> edges;
+  edges.reserve(3 * nT);
+  for ( int t=0; t<nT; ++t ) {
+    const glm::ivec3& tri = d_tris[t];
+    glm::dvec3 p0(d_pos[tri.x]), p1(d_pos[tri.y]), p2(d_pos[tri.z]);
+    glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    double len = glm::length(n);
+    if ( len == 0.0 ) continue;
+    n = n / len;
+    faceNormal[t] = n;
+    for ( int k=0; k<3; ++k ) {
+      addPlane(&d_quadric[c_nq * tri[k]], n, -glm::dot(n, p0), 1.0);
+      Edge e = { std::min(tri[k], tri[(k+1)%3]),
+		 std::max(tri[k], tri[(k+1)%3]), t };
+      edges.push_back(e);
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for ( size_t e=0; e<edges.size(); ) {
+    size_t end = e + 1;
+    while ( end < edges.size() && edges[end].d_a == edges[e].d_a &&
+	    edges[end].d_b == edges[e].d_b ) {
+      ++end;
+    }
+    if ( end == e + 1 ) {
+      glm::dvec3 a(d_pos[edges[e].d_a]), b(d_pos[edges[e].d_b]);
+      glm::dvec3 n = glm::cross(b - a, faceNormal[edges[e].d_tri]);
+      double len = glm::length(n);
+      if ( len > 0.0 ) {
+	n = n / len;
+	addPlane(&d_quadric[c_nq * edges[e].d_a], n, -glm::dot(n, a),
+		 c_boundaryWeight);
+	addPlane(&d_quadric[c_nq * edges[e].d_b], n, -glm::dot(n, a),
+		 c_boundaryWeight);
+      }
+    }
+    e = end;
+  }
+  return;
+}
+
+
+void Simplifier::simplify( float _ratio, LodMesh& _lod ) const {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  int nV = getNVertices(), nT = getNTriangles();
+  int target = static_cast<int>(std::min(_ratio, 1.0f) * nT + 0.5f);
+  std::vector<glm::ivec3> tris(d_tris);
+  std::vector<char> triAlive(nT, 1);
+  std::vector<double> quadric(d_quadric);
+  std::vector<char> alive(nV, 1);
+  std::vector<int> stamp(nV, 0);
+  std::vector<std::vector<int> > adjacent(nV);
+  for ( int t=0; t<nT; ++t ) {
+    for ( int k=0; k<3; ++k ) adjacent[tris[t][k]].push_back(t);
+  }
+  std::priority_queue<Collapse, std::vector<Collapse>,
+		      std::greater<Collapse> > heap;
+  // the cheaper direction of the edge _a _b
+  auto pushEdge = [&](int _a, int _b) {
+    const double* qa = &quadric[c_nq * _a];
+    const double* qb = &quadric[c_nq * _b];
+    glm::vec3 e = d_pos[_b] - d_pos[_a];
+    double normal = c_normalWeight * glm::dot(e, e) *
+      (1.0 - glm::dot(d_normal[_a], d_normal[_b]));
+    double toB = evaluate(qa, qb, d_pos[_b]) + normal;
+    double toA = evaluate(qa, qb, d_pos[_a]) + normal;
+    Collapse c = { toB, _a, _b, stamp[_a], stamp[_b] };
+    if ( toA < toB ) {
+      c.d_cost = toA;
+      c.d_from = _b;
+      c.d_to = _a;
+      std::swap(c.d_stampFrom, c.d_stampTo);
+    }
+    heap.push(c);
+  };
+  std::vector<std::pair<int, int> > edges;
+  edges.reserve(3 * nT);
+  for ( int t=0; t<nT; ++t ) {
+    for ( int k=0; k<3; ++k ) {
+      int a = tris[t][k], b = tris[t][(k+1)%3];
+      edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  for ( size_t e=0; e<edges.size(); ++e ) {
+    if ( edges[e].first != edges[e].second ) {
+      pushEdge(edges[e].first, edges[e].second);
+    }
+  }
+  int live = nT;
+  double maxError = 0.0;
+  std::vector<int> neighbours;
+  while ( live > target && !heap.empty() ) {
+    Collapse c = heap.top();
+    heap.pop();
+    int from = c.d_from, to = c.d_to;
+    if ( !alive[from] || !alive[to] || stamp[from] != c.d_stampFrom ||
+	 stamp[to] != c.d_stampTo ) {
+      continue;
+    }
+    // no triangle may turn over or degenerate
+    bool flips = false;
+    for ( size_t i=0; i<adjacent[from].size() && !flips; ++i ) {
+      int t = adjacent[from][i];
+      if ( !triAlive[t] || contains(tris[t], to) ) continue;
+      glm::ivec3 moved = tris[t];
+      for ( int k=0; k<3; ++k ) {
+	if ( moved[k] == from ) moved[k] = to;
+      }
+      glm::vec3 n0 = glm::cross(d_pos[tris[t].y] - d_pos[tris[t].x],
+				d_pos[tris[t].z] - d_pos[tris[t].x]);
+      glm::vec3 n1 = glm::cross(d_pos[moved.y] - d_pos[moved.x],
+				d_pos[moved.z] - d_pos[moved.x]);
+      flips = glm::dot(n0, n1) <=
+	c_minCos * glm::length(n0) * glm::length(n1);
+    }
+    if ( flips ) continue;
+    for ( size_t i=0; i<adjacent[from].size(); ++i ) {
+      int t = adjacent[from][i];
+      if ( !triAlive[t] ) continue;
+      if ( contains(tris[t], to) ) {
+	triAlive[t] = 0;
+	--live;
+	continue;
+      }
+      for ( int k=0; k<3; ++k ) {
+	if ( tris[t][k] == from ) tris[t][k] = to;
+      }
+      adjacent[to].push_back(t);
+    }
+    std::vector<int>().swap(adjacent[from]);
+    alive[from] = 0;
+    for ( int i=0; i<c_nq; ++i ) {
+      quadric[c_nq * to + i] += quadric[c_nq * from + i];
+    }
+    ++stamp[to];
+    maxError = std::max(maxError, c.d_cost);
+    // drop the removed triangles and requeue the edges of the survivor
+    std::vector<int>& adj = adjacent[to];
+    adj.erase(std::remove_if(adj.begin(), adj.end(), [&](int _t) {
+	  return !triAlive[_t];
+	}), adj.end());
+    std::sort(adj.begin(), adj.end());
+    adj.erase(std::unique(adj.begin(), adj.end()), adj.end());
+    neighbours.clear();
+    for ( size_t i=0; i<adj.size(); ++i ) {
+      for ( int k=0; k<3; ++k ) {
+	if ( tris[adj[i]][k] != to ) neighbours.push_back(tris[adj[i]][k]);
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+		     neighbours.end());
+    for ( size_t i=0; i<neighbours.size(); ++i ) {
+      pushEdge(to, neighbours[i]);
+    }
+  }
+  // the surviving vertices in the order the triangles first use them
+  std::vector<int> remap(nV, -1);
+  _lod.d_ratio = _ratio;
+  _lod.d_vertex.clear();
+  _lod.d_normal.clear();
+  _lod.d_index.clear();
+  for ( int t=0; t<nT; ++t ) {
+    if ( !triAlive[t] ) continue;
+    for ( int k=0; k<3; ++k ) {
+      int v = tris[t][k];
+      if ( remap[v] < 0 ) {
+	remap[v] = static_cast<int>(_lod.d_vertex.size()) / 3;
+	for ( int c=0; c<3; ++c ) {
+	  _lod.d_vertex.push_back(d_pos[v][c]);
+	  _lod.d_normal.push_back(d_normal[v][c]);
+	}
+      }
+      _lod.d_index.push_back(static_cast<GLushort>(remap[v]));
+    }
+  }
+  _lod.d_error = std::sqrt(maxError);
+  _lod.d_ms = std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+  return;
+}
+
+
+void Simplifier::simplifyLevels( const std::vector<float>& _ratios,
+				 std::vector<LodMesh>& _lods,
+				 JobSystem& _jobs ) const {
+  _lods.resize(_ratios.size());
+  _jobs.parallelFor(0, static_cast<int>(_ratios.size()), 1,
+		    [&](int _begin, int _end) {
+		      for ( int l=_begin; l<_end; ++l ) {
+			simplify(_ratios[l], _lods[l]);
+		      }
+		    });
+  return;
+}
+
+} // end namespace
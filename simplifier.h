@@ -0,0 +1,97 @@
+// ==========================================================================
+// $Id: simplifier.h $
+// Quadric error mesh simplification into levels of detail
+// ==========================================================================
+// Garland and Heckbert: every vertex carries the sum of the squared
+// distance quadrics of the planes of its triangles. The edge whose
+// collapse adds the least error is collapsed first, until the level has
+// its share of the triangles. Collapses move a vertex onto its neighbour
+// (half-edge collapse), so the surviving vertices keep their positions
+// and normals. Edges with only one triangle are boundaries, also where
+// a shape duplicates vertices for its normals; they get additional
+// quadrics of planes perpendicular to their triangle, so they hardly
+// move. A collapse which flips a triangle is rejected, one across
+// differing normals costs extra.
+//
+// Every level is simplified from the full mesh, the levels are jobs.
+// ==========================================================================
+#ifndef CSI4130_SIMPLIFIER_H_
+#define CSI4130_SIMPLIFIER_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+// glm types
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "render_shape.h"
+
+namespace CSI4130 {
+
+// One level of detail, indexed as RenderShape but a triangle list
+struct LodMesh {
+  float d_ratio; // requested fraction of the triangles
+  std::vector<GLfloat> d_vertex;
+  std::vector<GLfloat> d_normal;
+  std::vector<GLushort> d_index;
+  double d_error; // root of the largest quadric error of a collapse
+  double d_ms;
+
+  LodMesh() : d_ratio(1.0f), d_error(0.0), d_ms(0.0) {}
+  inline int getNTriangles() const;
+};
+
+
+class Simplifier {
+  std::vector<glm::vec3> d_pos;
+  std::vector<glm::vec3> d_normal;
+  std::vector<glm::ivec3> d_tris;
+  // 10 coefficients of the symmetric 4x4 quadric per vertex
+  std::vector<double> d_quadric;
+
+ public:
+  Simplifier();
+
+  // The triangles of _shape as drawn, strips or a list; returns 0 on
+  // success
+  int setShape( const RenderShape& _shape );
+  // Triangle list _tris into _nVertices positions and normals, 3 floats
+  // each; returns 0 on success
+  int setMesh( const GLfloat* _vertex, const GLfloat* _normal,
+	       int _nVertices, const std::vector<GLuint>& _tris );
+
+  // One level with about _ratio of the triangles
+  void simplify( float _ratio, LodMesh& _lod ) const;
+  // One level per ratio, in parallel
+  void simplifyLevels( const std::vector<float>& _ratios,
+		       std::vector<LodMesh>& _lods,
+		       JobSystem& _jobs = JobSystem::global() ) const;
+
+  inline int getNVertices() const;
+  inline int getNTriangles() const;
+
+ private:
+  void initQuadrics();
+
+  // no copy or assignment
+  Simplifier(const Simplifier& _oSimplifier );
+  Simplifier& operator=( const Simplifier& _oSimplifier );
+};
+
+
+int LodMesh::getNTriangles() const {
+  return static_cast<int>(d_index.size()) / 3;
+}
+
+int Simplifier::getNVertices() const {
+  return static_cast<int>(d_pos.size());
+}
+
+int Simplifier::getNTriangles() const {
+  return static_cast<int>(d_tris.size());
+}
+
+} // end namespace
+#endif
@@ -43,8 +43,8 @@ Sphere::Sphere() : RenderShape() {
 	0.5257311, 0, -0.8506508, 
 	-0.5257311, 0, -0.8506508
 	});
-  // 80 faces
-  d_index.insert(d_index.end(), {
+  // 20 faces as a triangle list
+  std::vector<GLuint> corners({
     1, 0, 4, 
 	0, 1, 6, 
 	2, 3, 5, 
@@ -66,6 +66,8 @@ Sphere::Sphere() : RenderShape() {
 	3, 10, 5, 
 	3, 7, 11
     });
+  // drawn as strips if they are cheaper
+  setTriangles(corners);
 
   d_normal.insert(d_normal.end(), {
 	  1,0,0,
@@ -83,6 +85,6 @@ Sphere::Sphere() : RenderShape() {
   });
 
   // direct specification with all faces unrolled
-  // - not supplied
+  // - derived by getVertexDirect()
 }
 
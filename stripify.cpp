@@ -0,0 +1,181 @@
+// ==========================================================================
+// $Id: stripify.cpp $
+// Triangle lists into triangle strips separated by primitive restarts
+// ==========================================================================
+#include <algorithm>
+#include <cstdint>
+
+#include "stripify.h"
+
+namespace CSI4130 {
+
+namespace {
+
+// edge _a to _b in the winding of triangle d_tri, d_third is its last vertex
+struct DirectedEdge {
+  uint64_t d_key;
+  int d_tri;
+  GLuint d_third;
+
+  bool operator<( const DirectedEdge& _o ) const {
+    return d_key < _o.d_key || (d_key == _o.d_key && d_tri < _o.d_tri);
+  }
+};
+
+inline uint64_t edgeKey( GLuint _a, GLuint _b ) {
+  return static_cast<uint64_t>(_a) << 32 | _b;
+}
+
+
+class StripBuilder {
+  const std::vector<GLuint>& d_corners;
+  std::vector<DirectedEdge> d_edges;
+  std::vector<char> d_used;
+  // triangles taken by the strip being tried
+  std::vector<int> d_trial;
+  int d_trialStamp;
+
+ public:
+  StripBuilder( const std::vector<GLuint>& _corners );
+
+  // Unused triangle with the edge _a to _b in its winding, or -1
+  int find( GLuint _a, GLuint _b, GLuint& _third ) const;
+  // Unused neighbours of _tri
+  int countNeighbours( int _tri ) const;
+  // Strip from triangle _tri starting at its corner _rotation
+  void grow( int _tri, int _rotation, std::vector<GLuint>& _strip,
+	     std::vector<int>& _tris );
+  // The tried strips no longer hold their triangles
+  void endTrials() { ++d_trialStamp; }
+  void use( int _tri ) { d_used[_tri] = 1; }
+  bool isUsed( int _tri ) const { return d_used[_tri] != 0; }
+  GLuint corner( int _tri, int _k ) const { return d_corners[3*_tri + _k]; }
+};
+
+
+StripBuilder::StripBuilder( const std::vector<GLuint>& _corners ) :
+  d_corners(_corners), d_trialStamp(0) {
+  int nTris = static_cast<int>(_corners.size()) / 3;
+  d_edges.reserve(3 * nTris);
+  for ( int t=0; t<nTris; ++t ) {
+    for ( int k=0; k<3; ++k ) {
+      DirectedEdge e = { edgeKey(corner(t, k), corner(t, (k+1)%3)), t,
+			 corner(t, (k+2)%3) };
+      d_edges.push_back(e);
+    }
+  }
+  std::sort(d_edges.begin(), d_edges.end());
+  d_used.assign(nTris, 0);
+  d_trial.assign(nTris, -1);
+}
+
+
+int StripBuilder::find( GLuint _a, GLuint _b, GLuint& _third ) const {
+  DirectedEdge key = { edgeKey(_a, _b), -1, 0 };
+  for ( std::vector<DirectedEdge>::const_iterator it =
+	  std::upper_bound(d_edges.begin(), d_edges.end(), key);
+	it != d_edges.end() && it->d_key == key.d_key; ++it ) {
+    if ( !d_used[it->d_tri] && d_trial[it->d_tri] != d_trialStamp ) {
+      _third = it->d_third;
+      return it->d_tri;
+    }
+  }
+  return -1;
+}
+
+
+int StripBuilder::countNeighbours( int _tri ) const {
+  int count = 0;
+  GLuint third;
+  for ( int k=0; k<3; ++k ) {
+    if ( find(corner(_tri, (k+1)%3), corner(_tri, k), third) >= 0 ) ++count;
+  }
+  return count;
+}
+
+
+void StripBuilder::grow( int _tri, int _rotation, std::vector<GLuint>& _strip,
+			 std::vector<int>& _tris ) {
+  ++d_trialStamp;
+  _strip.clear();
+  _tris.clear();
+  for ( int k=0; k<3; ++k ) {
+    _strip.push_back(corner(_tri, (_rotation + k) % 3));
+  }
+  _tris.push_back(_tri);
+  d_trial[_tri] = d_trialStamp;
+  for ( ;; ) {
+    size_t n = _strip.size();
+    GLuint a = _strip[n-2], b = _strip[n-1], third;
+    // triangle n-2 of a strip is (a, b, c) if even, (b, a, c) if odd
+    int next = n % 2 == 0 ? find(a, b, third) : find(b, a, third);
+    if ( next < 0 ) break;
+    _strip.push_back(third);
+    _tris.push_back(next);
+    d_trial[next] = d_trialStamp;
+  }
+  return;
+}
+
+}
+
+
+int stripify( const std::vector<GLuint>& _corners, GLuint _restart,
+	      std::vector<GLuint>& _strips ) {
+  _strips.clear();
+  int nTris = static_cast<int>(_corners.size()) / 3;
+  StripBuilder builder(_corners);
+  // starts by the number of unused neighbours; entries go stale when the
+  // count drops and are skipped
+  std::vector<int> neighbours(nTris);
+  std::vector<std::vector<int> > bucket(4);
+  for ( int t=nTris-1; t>=0; --t ) {
+    neighbours[t] = builder.countNeighbours(t);
+    bucket[neighbours[t]].push_back(t);
+  }
+  std::vector<GLuint> strip, best;
+  std::vector<int> tris, bestTris;
+  int nStrips = 0;
+  for ( ;; ) {
+    int start = -1;
+    for ( int b=0; b<4 && start<0; ++b ) {
+      while ( !bucket[b].empty() ) {
+	int t = bucket[b].back();
+	bucket[b].pop_back();
+	if ( !builder.isUsed(t) && neighbours[t] == b ) {
+	  start = t;
+	  break;
+	}
+      }
+    }
+    if ( start < 0 ) break;
+    best.clear();
+    for ( int r=0; r<3; ++r ) {
+      builder.grow(start, r, strip, tris);
+      if ( strip.size() > best.size() ) {
+	best.swap(strip);
+	bestTris.swap(tris);
+      }
+    }
+    builder.endTrials();
+    if ( nStrips++ > 0 ) _strips.push_back(_restart);
+    _strips.insert(_strips.end(), best.begin(), best.end());
+    for ( size_t i=0; i<bestTris.size(); ++i ) {
+      builder.use(bestTris[i]);
+    }
+    // the neighbours of the strip lost one
+    for ( size_t i=0; i<bestTris.size(); ++i ) {
+      for ( int k=0; k<3; ++k ) {
+	GLuint third;
+	int t = builder.find(builder.corner(bestTris[i], (k+1)%3),
+			     builder.corner(bestTris[i], k), third);
+	if ( t < 0 ) continue;
+	neighbours[t] = builder.countNeighbours(t);
+	bucket[neighbours[t]].push_back(t);
+      }
+    }
+  }
+  return nStrips;
+}
+
+} // end namespace
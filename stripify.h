@@ -0,0 +1,29 @@
+// ==========================================================================
+// $Id: stripify.h $
+// Triangle lists into triangle strips separated by primitive restarts
+// ==========================================================================
+// A strip of n triangles needs n+2 indices instead of 3n, plus one
+// restart index before every strip but the first. Strips are grown
+// greedily: a strip starts at the unused triangle with the fewest unused
+// neighbours, in the rotation which gives the longest strip, and is
+// extended across the edge of its last two vertices as long as the
+// triangle there is unused and wound the same way. Triangles keep their
+// winding, so face culling is not affected.
+// ==========================================================================
+#ifndef CSI4130_STRIPIFY_H_
+#define CSI4130_STRIPIFY_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+
+namespace CSI4130 {
+
+// Strips of the triangle list _corners (3 vertices per triangle)
+// separated by _restart into _strips; returns the number of strips
+int stripify( const std::vector<GLuint>& _corners, GLuint _restart,
+	      std::vector<GLuint>& _strips );
+
+} // end namespace
+#endif
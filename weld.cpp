@@ -0,0 +1,95 @@
+// ==========================================================================
+// $Id: weld.cpp $
+// Vertex welding of unrolled triangle soups into indexed meshes
+// ==========================================================================
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+#include "weld.h"
+
+namespace CSI4130 {
+
+namespace {
+// cells stay representable for tiny and zero epsilons
+const float c_minCell = 1.0e-6f;
+
+inline uint64_t cellKey( int64_t _x, int64_t _y, int64_t _z ) {
+  return static_cast<uint64_t>(_x) * 73856093u ^
+    static_cast<uint64_t>(_y) * 19349663u ^
+    static_cast<uint64_t>(_z) * 83492791u;
+}
+
+inline bool near( const GLfloat* _a, const GLfloat* _b, float _eps ) {
+  return std::fabs(_a[0] - _b[0]) <= _eps &&
+    std::fabs(_a[1] - _b[1]) <= _eps && std::fabs(_a[2] - _b[2]) <= _eps;
+}
+}
+
+
+int weldVertices( const std::vector<GLfloat>& _vertex,
+		  const std::vector<GLfloat>& _normal, float _eps,
+		  std::vector<GLfloat>& _outVertex,
+		  std::vector<GLfloat>& _outNormal,
+		  std::vector<GLuint>& _corners, int _maxVertices ) {
+  int nCorners = static_cast<int>(_vertex.size()) / 3;
+  bool normals = _normal.size() >= _vertex.size();
+  _eps = std::max(_eps, 0.0f);
+  float cell = std::max(_eps, c_minCell);
+  _outVertex.clear();
+  _outNormal.clear();
+  _corners.resize(nCorners);
+  // first vertex per cell, the others chained through next
+  std::unordered_map<uint64_t, int> first;
+  first.reserve(nCorners);
+  std::vector<int> next;
+  int nVertices = 0;
+  for ( int c=0; c<nCorners; ++c ) {
+    const GLfloat* p = &_vertex[3*c];
+    const GLfloat* n = normals ? &_normal[3*c] : 0;
+    int64_t ix = static_cast<int64_t>(std::floor(p[0] / cell));
+    int64_t iy = static_cast<int64_t>(std::floor(p[1] / cell));
+    int64_t iz = static_cast<int64_t>(std::floor(p[2] / cell));
+    int found = -1;
+    // a vertex within _eps is at most one cell away
+    for ( int dz=-1; dz<=1 && found<0; ++dz ) {
+      for ( int dy=-1; dy<=1 && found<0; ++dy ) {
+	for ( int dx=-1; dx<=1 && found<0; ++dx ) {
+	  std::unordered_map<uint64_t, int>::const_iterator it =
+	    first.find(cellKey(ix + dx, iy + dy, iz + dz));
+	  for ( int v=(it==first.end() ? -1 : it->second); v>=0; v=next[v] ) {
+	    if ( near(p, &_outVertex[3*v], _eps) &&
+		 (!n || near(n, &_outNormal[3*v], _eps)) ) {
+	      found = v;
+	      break;
+	    }
+	  }
+	}
+      }
+    }
+    if ( found < 0 ) {
+      if ( nVertices == _maxVertices ) {
+	std::cerr << "Weld: more than " << _maxVertices << " vertices"
+		  << std::endl;
+	return -1;
+      }
+      found = nVertices++;
+      _outVertex.insert(_outVertex.end(), p, p + 3);
+      if ( n ) {
+	_outNormal.insert(_outNormal.end(), n, n + 3);
+      } else {
+	_outNormal.insert(_outNormal.end(), 3, 0.0f);
+      }
+      uint64_t key = cellKey(ix, iy, iz);
+      std::unordered_map<uint64_t, int>::iterator it = first.find(key);
+      next.push_back(it == first.end() ? -1 : it->second);
+      first[key] = found;
+    }
+    _corners[c] = found;
+  }
+  return nVertices;
+}
+
+} // end namespace
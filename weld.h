@@ -0,0 +1,33 @@
+// ==========================================================================
+// $Id: weld.h $
+// Vertex welding of unrolled triangle soups into indexed meshes
+// ==========================================================================
+// A triangle soup lists three corners per triangle with their own
+// position and normal, as glDrawArrays needs them. Welding merges the
+// corners whose position and normal agree within an epsilon in every
+// coordinate into one vertex. The corners are hashed by the grid cell of
+// their position, with cells as wide as the epsilon, so only the
+// neighbouring cells have to be searched.
+// ==========================================================================
+#ifndef CSI4130_WELD_H_
+#define CSI4130_WELD_H_
+
+#include <vector>
+
+// gl types
+#include <GL/glew.h>
+
+namespace CSI4130 {
+
+// Weld the corners of the soup _vertex/_normal (3 floats per corner)
+// within _eps into _outVertex/_outNormal; _corners gets the vertex of
+// every corner. Returns the number of vertices or -1 if there are more
+// than _maxVertices.
+int weldVertices( const std::vector<GLfloat>& _vertex,
+		  const std::vector<GLfloat>& _normal, float _eps,
+		  std::vector<GLfloat>& _outVertex,
+		  std::vector<GLfloat>& _outNormal,
+		  std::vector<GLuint>& _corners, int _maxVertices );
+
+} // end namespace
+#endif